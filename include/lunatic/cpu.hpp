@@ -10,6 +10,8 @@
 #include <lunatic/coprocessor.hpp>
 #include <lunatic/memory.hpp>
 #include <memory>
+#include <string>
+#include <vector>
 
 namespace lunatic {
 
@@ -68,6 +70,134 @@ struct CPU {
       ARM9
     } model = Model::ARM9;
     int block_size = 32;
+
+    /// Trade-off between compilation time and the quality of the generated code.
+    enum class OptimizationLevel {
+      /// Compile the code as translated.
+      None,
+      /// Remove redundant context accesses and flag updates, propagate constants and remove dead code.
+      Basic,
+      /// Run all optimization passes.
+      Full
+    } optimization_level = OptimizationLevel::Full;
+
+    /**
+     * Number of executions after which a block is recompiled with OptimizationLevel::Full.
+     * Until then blocks are compiled with OptimizationLevel::Basic, which is faster for code that only runs a few times.
+     * Zero compiles all blocks with the optimization level right away. Only used with OptimizationLevel::Full.
+     */
+    int tier_up_threshold = 64;
+
+    /**
+     * Recompile hot blocks on a worker thread, while their baseline code keeps running.
+     * The worker only reads guest code that is mapped by Memory::pagetable or the ITCM, it never calls
+     * the virtual read methods of Memory. Blocks with other code are recompiled on the thread that runs the CPU.
+     * The memory that page table entries point to must stay allocated while the CPU runs, even if an entry changes.
+     * Before a recompiled block is installed, all of the guest code it was translated from is checked for changes.
+     */
+    bool background_compilation = false;
+
+    /// Whether basic blocks are compiled to host code or executed by the IR interpreter.
+    enum class ExecutionMode {
+      /// Compile each block before it runs for the first time.
+      JIT,
+      /// Interpret all code. This is slow, but can be used as a reference to test the compiled code against.
+      Interpreter,
+      /// Interpret each block until it has run interpreter_threshold times, then compile it.
+      Adaptive
+    } execution_mode = ExecutionMode::JIT;
+
+    /**
+     * Number of times that a block is interpreted before it is compiled, with ExecutionMode::Adaptive.
+     * Code that only runs a few times (like boot code or code that is modified often) is never compiled.
+     */
+    int interpreter_threshold = 4;
+
+    /**
+     * Keep the optimized IR of each compiled block, so that CPU::SaveCodeCache() can save it to a file.
+     * Blocks from a code cache loaded by CPU::LoadCodeCache() are used in any case.
+     */
+    bool code_cache = false;
+
+    /**
+     * Count how often each block is executed, so that CPU::GetProfile() can report the hot code.
+     * This adds a memory increment to the compiled code of each block.
+     */
+    bool profile_blocks = false;
+
+    /**
+     * Measure the time and the IR size before and after each optimization pass, see Statistics::passes.
+     * This adds to the compilation time of every block, so it is off unless the statistics are needed.
+     */
+    bool pass_statistics = false;
+  };
+
+  struct Statistics {
+    struct Pass {
+      /// Name of the optimization pass.
+      char const* name = "";
+
+      /// Whether the pass belongs to the baseline tier, which compiles blocks before they are hot.
+      bool baseline = false;
+
+      /// Total time spent in the pass (in nanoseconds).
+      u64 time_ns = 0;
+
+      /// Number of opcodes before and after the pass, summed over all runs.
+      u64 opcodes_in = 0;
+      u64 opcodes_out = 0;
+
+      /// Number of opcodes that the pass inserted and operands that it rewrote.
+      u64 opcodes_rewritten = 0;
+
+      /// Number of variables which are written or read before and after the pass, summed over all runs.
+      u64 variables_in = 0;
+      u64 variables_out = 0;
+    };
+
+    /// Number of basic blocks compiled since the CPU was created.
+    u64 compiled_blocks = 0;
+
+    /// Number of baseline blocks which were recompiled with all optimizations, because they became hot.
+    u64 recompiled_blocks = 0;
+
+    /// Number of times that an idle loop was detected and the remaining cycles were skipped.
+    u64 idle_loop_skips = 0;
+
+    /// Number of times that a basic block was executed by the IR interpreter.
+    u64 interpreted_blocks = 0;
+
+    /// Number of basic blocks compiled by CPU::Precompile(). All other blocks were compiled while the code ran.
+    u64 precompiled_blocks = 0;
+
+    /// Number of basic blocks compiled from the IR in the code cache, without translating their guest code again.
+    u64 cached_blocks = 0;
+
+    /**
+     * Number of heap allocations made while blocks were translated, optimized and compiled, on any thread.
+     * Only counted if the library is built with the LUNATIC_COUNT_ALLOCATIONS option, otherwise always zero.
+     */
+    u64 compile_allocations = 0;
+
+    /**
+     * Statistics for each enabled optimization pass, in the order in which the passes run (baseline tier last).
+     * The counters are only updated with Descriptor::pass_statistics enabled.
+     */
+    std::vector<Pass> passes;
+  };
+
+  /// A block of guest code and the number of times that it was executed.
+  struct ProfileEntry {
+    /// Address of the first instruction, with bit 0 set for Thumb code.
+    u32 address;
+    Mode mode;
+    u64 count;
+  };
+
+  /// A range of guest code, from address_lo to address_hi (inclusive).
+  struct CodeRange {
+    u32 address_lo;
+    u32 address_hi;
   };
 
   virtual ~CPU() = default;
@@ -79,6 +209,49 @@ struct CPU {
   virtual void ClearICache() = 0;
   virtual void ClearICacheRange(u32 address_lo, u32 address_hi) = 0;
   virtual auto Run(int cycles) -> int = 0;
+  virtual auto GetStatistics() const -> Statistics = 0;
+
+  /**
+   * Compile the code that is reachable from a list of entry points, before it runs for the first time.
+   * Entry points with bit 0 set are Thumb code. The code is discovered by following direct branches
+   * and the return addresses of BL, but never leaves the given ranges (unless no range is given).
+   * The blocks are compiled for the current CPU mode. Optionally the code is translated and optimized
+   * on multiple threads, which read the guest code like Descriptor::background_compilation does.
+   * Blocks with code which is not mapped by the page table or the ITCM are translated on the calling thread.
+   * Returns the number of blocks which were compiled.
+   */
+  virtual auto Precompile(
+    std::vector<u32> const& entry_points,
+    std::vector<CodeRange> const& ranges,
+    int threads = 1
+  ) -> int = 0;
+
+  /**
+   * Load the IR of blocks which were compiled by an earlier run and saved with SaveCodeCache().
+   * Each block is used only if the guest code that it was translated from is unchanged.
+   * The blocks whose code is in memory already are compiled right away, the others once they are run.
+   * Returns false if the file cannot be read or was saved by a different JIT version or configuration.
+   */
+  virtual bool LoadCodeCache(std::string const& path) = 0;
+
+  /**
+   * Save the code cache to a file, which holds the blocks compiled with Descriptor::code_cache enabled
+   * and the blocks loaded by LoadCodeCache(). Returns false if the file cannot be written.
+   */
+  virtual bool SaveCodeCache(std::string const& path) = 0;
+
+  /**
+   * Get the blocks which were executed since the CPU was created, the most executed blocks first.
+   * Requires Descriptor::profile_blocks. A profile only refers to guest code, so it stays valid for other JIT versions.
+   */
+  virtual auto GetProfile() const -> std::vector<ProfileEntry> = 0;
+
+  /**
+   * Compile the blocks of a profile which was recorded by an earlier run, in the order of the profile.
+   * Unlike Precompile() no other code is discovered. Optionally the blocks are translated and optimized
+   * on multiple threads, like with Precompile(). Returns the number of blocks which were compiled.
+   */
+  virtual auto PrecompileProfile(std::vector<ProfileEntry> const& profile, int threads = 1) -> int = 0;
 
   virtual auto GetGPR(GPR reg) const -> u32 = 0;
   virtual auto GetGPR(GPR reg, Mode mode) const -> u32 = 0;
@@ -92,4 +265,13 @@ struct CPU {
 
 auto CreateCPU(CPU::Descriptor const& descriptor) -> std::unique_ptr<CPU>;
 
+/// Save a profile to a text file, one block per line. Returns false if the file cannot be written.
+bool SaveProfile(std::string const& path, std::vector<CPU::ProfileEntry> const& profile);
+
+/**
+ * Load a profile saved by SaveProfile(). Malformed lines and lines with an unknown CPU mode are skipped.
+ * Returns an empty profile if the file cannot be read.
+ */
+auto LoadProfile(std::string const& path) -> std::vector<CPU::ProfileEntry>;
+
 } // namespace lunatic
@@ -35,6 +35,13 @@ struct Memory {
   virtual void WriteHalf(u32 address, u16 value, Bus bus) = 0;
   virtual void WriteWord(u32 address, u32 value, Bus bus) = 0;
 
+  /**
+   * Check if reading from an address has no side effects and keeps returning the same value while the CPU runs.
+   * Loops which only poll such addresses are skipped, by consuming the remaining cycles of CPU::Run() at once.
+   * This is also asked for memory mapped via the page table or a TCM, which may be written by other devices.
+   */
+  virtual bool IsPureRead(u32 address, Bus bus) { return false; }
+
   template<typename T, Bus bus>
   auto FastRead(u32 address) -> T {
     static_assert(is_one_of_v<T, u8, u16, u32, u64>);
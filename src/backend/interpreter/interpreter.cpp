@@ -0,0 +1,568 @@
+/*
+ * Copyright (C) 2022 fleroviux. All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <algorithm>
+#include <fmt/format.h>
+#include <stdexcept>
+
+#include "common/bit.hpp"
+#include "interpreter.hpp"
+
+namespace lunatic {
+namespace backend {
+
+Interpreter::Interpreter(CPU::Descriptor const& descriptor, State& state)
+    : state(state)
+    , memory(descriptor.memory)
+    , coprocessors(descriptor.coprocessors) {
+}
+
+auto Interpreter::Run(
+  BasicBlock const& basic_block,
+  std::vector<BasicBlock::MicroBlock> const& micro_blocks
+) -> int {
+  int cycles = 0;
+
+  // The host flags are not known to match the CPSR, unless they are loaded from it.
+  LoadHostFlags();
+
+  for (auto const& micro_block : micro_blocks) {
+    auto condition = micro_block.condition;
+
+    cycles += micro_block.length;
+
+    if (condition != Condition::AL) {
+      LoadHostFlags();
+
+      // Skipping the micro block leaves the context as-is, except that the program counter is advanced.
+      if (!EvaluateCondition(condition)) {
+        state.GetGPR(Mode::User, GPR::PC) = micro_block.next_address;
+        continue;
+      }
+    }
+
+    if (vars.size() < micro_block.emitter.Vars().size()) {
+      vars.resize(micro_block.emitter.Vars().size());
+    }
+
+    for (auto op : micro_block.emitter.Code()) {
+      Execute(op);
+    }
+
+    if (!micro_block.side_exit.IsEmpty()) {
+      break;
+    }
+  }
+
+  return cycles;
+}
+
+void Interpreter::LoadHostFlags() {
+  auto& cpsr = state.GetCPSR();
+
+  host_flags.n = cpsr.f.n;
+  host_flags.z = cpsr.f.z;
+  host_flags.c = cpsr.f.c;
+  host_flags.v = cpsr.f.v;
+}
+
+void Interpreter::SetNZ(u32 value) {
+  host_flags.n = bit::get_bit<u32, bool>(value, 31);
+  host_flags.z = value == 0;
+}
+
+bool Interpreter::EvaluateCondition(Condition condition) const {
+  auto [n, z, c, v] = host_flags;
+
+  switch (condition) {
+    case Condition::EQ: return z;
+    case Condition::NE: return !z;
+    case Condition::CS: return c;
+    case Condition::CC: return !c;
+    case Condition::MI: return n;
+    case Condition::PL: return !n;
+    case Condition::VS: return v;
+    case Condition::VC: return !v;
+    case Condition::HI: return c && !z;
+    case Condition::LS: return !c || z;
+    case Condition::GE: return n == v;
+    case Condition::LT: return n != v;
+    case Condition::GT: return !z && n == v;
+    case Condition::LE: return z || n != v;
+    case Condition::AL: return true;
+    default: return false;
+  }
+}
+
+auto Interpreter::GetValue(IRAnyRef const& value) -> u32 {
+  if (value.IsConstant()) {
+    return value.GetConst().value;
+  }
+  return vars[value.GetVar().id];
+}
+
+void Interpreter::SetValue(IRAnyRef const& var, u32 value) {
+  if (var.IsVariable()) {
+    vars[var.GetVar().id] = value;
+  }
+}
+
+void Interpreter::Execute(IROpcode* op) {
+  switch (op->GetClass()) {
+    case IROpcodeClass::NOP: break;
+
+    // Context access
+    case IROpcodeClass::LoadGPR: {
+      auto load = lunatic_cast<IRLoadGPR>(op);
+      SetValue(load->result, state.GetGPR(load->reg.mode, load->reg.reg));
+      break;
+    }
+    case IROpcodeClass::StoreGPR: {
+      auto store = lunatic_cast<IRStoreGPR>(op);
+      state.GetGPR(store->reg.mode, store->reg.reg) = GetValue(store->value);
+      break;
+    }
+    case IROpcodeClass::LoadSPSR: {
+      auto load = lunatic_cast<IRLoadSPSR>(op);
+      SetValue(load->result, state.GetPointerToSPSR(load->mode)->v);
+      break;
+    }
+    case IROpcodeClass::StoreSPSR: {
+      auto store = lunatic_cast<IRStoreSPSR>(op);
+      state.GetPointerToSPSR(store->mode)->v = GetValue(store->value);
+      break;
+    }
+    case IROpcodeClass::LoadCPSR: SetValue(lunatic_cast<IRLoadCPSR>(op)->result, state.GetCPSR().v); break;
+    case IROpcodeClass::StoreCPSR: state.GetCPSR().v = GetValue(lunatic_cast<IRStoreCPSR>(op)->value); break;
+    case IROpcodeClass::ClearCarry: host_flags.c = false; break;
+    case IROpcodeClass::SetCarry: host_flags.c = true; break;
+    case IROpcodeClass::UpdateFlags: ExecuteUpdateFlags(lunatic_cast<IRUpdateFlags>(op)); break;
+    case IROpcodeClass::UpdateSticky: ExecuteUpdateSticky(lunatic_cast<IRUpdateSticky>(op)); break;
+
+    // Barrel shifter
+    case IROpcodeClass::LSL: ExecuteLSL(lunatic_cast<IRLogicalShiftLeft>(op)); break;
+    case IROpcodeClass::LSR: ExecuteLSR(lunatic_cast<IRLogicalShiftRight>(op)); break;
+    case IROpcodeClass::ASR: ExecuteASR(lunatic_cast<IRArithmeticShiftRight>(op)); break;
+    case IROpcodeClass::ROR: ExecuteROR(lunatic_cast<IRRotateRight>(op)); break;
+
+    // ALU
+    case IROpcodeClass::AND: {
+      auto and_ = lunatic_cast<IRBitwiseAND>(op);
+      ExecuteLogical(and_->result, GetValue(and_->lhs) & GetValue(and_->rhs), and_->update_host_flags);
+      break;
+    }
+    case IROpcodeClass::BIC: {
+      auto bic = lunatic_cast<IRBitwiseBIC>(op);
+      ExecuteLogical(bic->result, GetValue(bic->lhs) & ~GetValue(bic->rhs), bic->update_host_flags);
+      break;
+    }
+    case IROpcodeClass::EOR: {
+      auto eor = lunatic_cast<IRBitwiseEOR>(op);
+      ExecuteLogical(eor->result, GetValue(eor->lhs) ^ GetValue(eor->rhs), eor->update_host_flags);
+      break;
+    }
+    case IROpcodeClass::ORR: {
+      auto orr = lunatic_cast<IRBitwiseORR>(op);
+      ExecuteLogical(orr->result, GetValue(orr->lhs) | GetValue(orr->rhs), orr->update_host_flags);
+      break;
+    }
+    case IROpcodeClass::MOV: {
+      auto mov = lunatic_cast<IRMov>(op);
+      ExecuteLogical(mov->result, GetValue(mov->source), mov->update_host_flags);
+      break;
+    }
+    case IROpcodeClass::MVN: {
+      auto mvn = lunatic_cast<IRMvn>(op);
+      ExecuteLogical(mvn->result, ~GetValue(mvn->source), mvn->update_host_flags);
+      break;
+    }
+    case IROpcodeClass::ADD: {
+      auto add = lunatic_cast<IRAdd>(op);
+      auto rhs = GetValue(add->rhs) << add->rhs_shift;
+      ExecuteAdd(add->result, GetValue(add->lhs), rhs, false, add->update_host_flags);
+      break;
+    }
+    case IROpcodeClass::ADC: {
+      auto adc = lunatic_cast<IRAdc>(op);
+      ExecuteAdd(adc->result, GetValue(adc->lhs), GetValue(adc->rhs), host_flags.c, adc->update_host_flags);
+      break;
+    }
+    case IROpcodeClass::SUB: {
+      auto sub = lunatic_cast<IRSub>(op);
+      ExecuteSub(sub->result, GetValue(sub->lhs), GetValue(sub->rhs), true, sub->update_host_flags);
+      break;
+    }
+    case IROpcodeClass::RSB: {
+      auto rsb = lunatic_cast<IRRsb>(op);
+      ExecuteSub(rsb->result, GetValue(rsb->rhs), GetValue(rsb->lhs), true, rsb->update_host_flags);
+      break;
+    }
+    case IROpcodeClass::SBC: {
+      auto sbc = lunatic_cast<IRSbc>(op);
+      ExecuteSub(sbc->result, GetValue(sbc->lhs), GetValue(sbc->rhs), host_flags.c, sbc->update_host_flags);
+      break;
+    }
+    case IROpcodeClass::RSC: {
+      auto rsc = lunatic_cast<IRRsc>(op);
+      ExecuteSub(rsc->result, GetValue(rsc->rhs), GetValue(rsc->lhs), host_flags.c, rsc->update_host_flags);
+      break;
+    }
+    case IROpcodeClass::CLZ: {
+      auto clz = lunatic_cast<IRCountLeadingZeros>(op);
+      auto value = GetValue(clz->operand);
+      u32 result = 0;
+
+      while (result < 32 && !bit::get_bit(value, 31 - result)) {
+        result++;
+      }
+      SetValue(clz->result, result);
+      break;
+    }
+    case IROpcodeClass::QADD: ExecuteQADD(lunatic_cast<IRSaturatingAdd>(op)); break;
+    case IROpcodeClass::QSUB: ExecuteQSUB(lunatic_cast<IRSaturatingSub>(op)); break;
+
+    // Multiply
+    case IROpcodeClass::MUL: ExecuteMUL(lunatic_cast<IRMultiply>(op)); break;
+    case IROpcodeClass::ADD64: ExecuteADD64(lunatic_cast<IRAdd64>(op)); break;
+
+    // Memory
+    case IROpcodeClass::MemoryRead: ExecuteMemoryRead(lunatic_cast<IRMemoryRead>(op)); break;
+    case IROpcodeClass::MemoryWrite: ExecuteMemoryWrite(lunatic_cast<IRMemoryWrite>(op)); break;
+
+    // Flush
+    case IROpcodeClass::Flush: ExecuteFlush(lunatic_cast<IRFlush>(op)); break;
+    case IROpcodeClass::FlushExchange: ExecuteFlushExchange(lunatic_cast<IRFlushExchange>(op)); break;
+
+    // Coprocessor
+    case IROpcodeClass::MRC: {
+      auto mrc = lunatic_cast<IRReadCoprocessorRegister>(op);
+      auto coprocessor = coprocessors[mrc->coprocessor_id];
+      SetValue(mrc->result, coprocessor->Read(mrc->opcode1, mrc->cn, mrc->cm, mrc->opcode2));
+      break;
+    }
+    case IROpcodeClass::MCR: {
+      auto mcr = lunatic_cast<IRWriteCoprocessorRegister>(op);
+      auto coprocessor = coprocessors[mcr->coprocessor_id];
+      coprocessor->Write(mcr->opcode1, mcr->cn, mcr->cm, mcr->opcode2, GetValue(mcr->value));
+      break;
+    }
+
+    default: {
+      throw std::runtime_error(
+        fmt::format("lunatic: unhandled IR opcode: {}", op->ToString())
+      );
+    }
+  }
+}
+
+void Interpreter::ExecuteUpdateFlags(IRUpdateFlags* op) {
+  u32 mask = 0;
+  u32 flags = 0;
+
+  if (op->flag_n) mask |= 0x80000000;
+  if (op->flag_z) mask |= 0x40000000;
+  if (op->flag_c) mask |= 0x20000000;
+  if (op->flag_v) mask |= 0x10000000;
+
+  if (host_flags.n) flags |= 0x80000000;
+  if (host_flags.z) flags |= 0x40000000;
+  if (host_flags.c) flags |= 0x20000000;
+  if (host_flags.v) flags |= 0x10000000;
+
+  SetValue(op->result, (GetValue(op->input) & ~mask) | (flags & mask));
+}
+
+void Interpreter::ExecuteUpdateSticky(IRUpdateSticky* op) {
+  SetValue(op->result, GetValue(op->input) | (u32(host_flags.v) << 27));
+}
+
+void Interpreter::ExecuteLSL(IRLogicalShiftLeft* op) {
+  auto operand = GetValue(op->operand);
+
+  // Register shift amounts use the bottom byte of the register. Shifts by zero bits leave the host flags as-is.
+  auto amount = std::min(GetValue(op->amount) & 0xFF, 33U);
+  auto result = amount >= 32 ? 0 : operand << amount;
+
+  if (op->update_host_flags && amount != 0) {
+    host_flags.c = amount <= 32 && bit::get_bit<u32, bool>(operand, 32 - amount);
+    SetNZ(result);
+  }
+
+  SetValue(op->result, result);
+}
+
+void Interpreter::ExecuteLSR(IRLogicalShiftRight* op) {
+  auto operand = GetValue(op->operand);
+  auto amount = GetValue(op->amount) & 0xFF;
+
+  // LSR #0 equals to LSR #32
+  if (op->amount.IsConstant() && amount == 0) {
+    amount = 32;
+  }
+
+  amount = std::min(amount, 33U);
+
+  auto result = amount >= 32 ? 0 : operand >> amount;
+
+  if (op->update_host_flags && amount != 0) {
+    host_flags.c = amount <= 32 && bit::get_bit<u32, bool>(operand, amount - 1);
+    SetNZ(result);
+  }
+
+  SetValue(op->result, result);
+}
+
+void Interpreter::ExecuteASR(IRArithmeticShiftRight* op) {
+  auto operand = GetValue(op->operand);
+  auto amount = GetValue(op->amount) & 0xFF;
+
+  // ASR #0 equals to ASR #32
+  if (op->amount.IsConstant() && amount == 0) {
+    amount = 32;
+  }
+
+  // ASR #32 and above fill the result with the sign-bit just like ASR #31.
+  auto result = u32(s32(operand) >> std::min(amount, 31U));
+
+  if (op->update_host_flags && amount != 0) {
+    host_flags.c = bit::get_bit<u32, bool>(operand, std::min(amount, 32U) - 1);
+    SetNZ(result);
+  }
+
+  SetValue(op->result, result);
+}
+
+void Interpreter::ExecuteROR(IRRotateRight* op) {
+  auto operand = GetValue(op->operand);
+  auto amount = GetValue(op->amount);
+
+  // ROR #0 equals to RRX #1
+  if (op->amount.IsConstant() && amount == 0) {
+    auto result = (operand >> 1) | (u32(host_flags.c) << 31);
+
+    if (op->update_host_flags) {
+      host_flags.c = bit::get_bit<u32, bool>(operand, 0);
+    }
+
+    SetValue(op->result, result);
+    return;
+  }
+
+  auto result = bit::rotate_right<u32>(operand, amount & 31);
+
+  // Rotates only update the carry flag, to the last bit that was rotated.
+  if (op->update_host_flags && (amount & 0xFF) != 0) {
+    host_flags.c = bit::get_bit<u32, bool>(result, 31);
+  }
+
+  SetValue(op->result, result);
+}
+
+void Interpreter::ExecuteLogical(IRAnyRef const& result, u32 value, bool update_host_flags) {
+  // The carry flag is preserved, since it is set by the barrel shifter.
+  if (update_host_flags) {
+    SetNZ(value);
+  }
+
+  SetValue(result, value);
+}
+
+void Interpreter::ExecuteAdd(IRAnyRef const& result, u32 lhs, u32 rhs, bool carry, bool update_host_flags) {
+  auto value = u64(lhs) + rhs + carry;
+
+  if (update_host_flags) {
+    SetNZ(u32(value));
+    host_flags.c = value >> 32;
+    host_flags.v = bit::get_bit<u32, bool>(~(lhs ^ rhs) & (lhs ^ u32(value)), 31);
+  }
+
+  SetValue(result, u32(value));
+}
+
+void Interpreter::ExecuteSub(IRAnyRef const& result, u32 lhs, u32 rhs, bool carry, bool update_host_flags) {
+  // The carry flag is the inverted borrow, like on the ARM.
+  auto borrow = carry ? 0U : 1U;
+  auto value = lhs - rhs - borrow;
+
+  if (update_host_flags) {
+    SetNZ(value);
+    host_flags.c = u64(lhs) >= u64(rhs) + borrow;
+    host_flags.v = bit::get_bit<u32, bool>((lhs ^ rhs) & (lhs ^ value), 31);
+  }
+
+  SetValue(result, value);
+}
+
+void Interpreter::ExecuteQADD(IRSaturatingAdd* op) {
+  auto lhs = GetValue(op->lhs);
+  auto rhs = GetValue(op->rhs);
+  auto result = lhs + rhs;
+  bool overflow = bit::get_bit<u32, bool>(~(lhs ^ rhs) & (lhs ^ result), 31);
+
+  if (overflow) {
+    result = s32(result) < 0 ? 0x7FFF'FFFF : 0x8000'0000;
+  }
+
+  // The overflow is reported via the V flag, to be picked up by UpdateSticky.
+  host_flags.v = overflow;
+  SetValue(op->result, result);
+}
+
+void Interpreter::ExecuteQSUB(IRSaturatingSub* op) {
+  auto lhs = GetValue(op->lhs);
+  auto rhs = GetValue(op->rhs);
+  auto result = lhs - rhs;
+  bool overflow = bit::get_bit<u32, bool>((lhs ^ rhs) & (lhs ^ result), 31);
+
+  if (overflow) {
+    result = s32(result) < 0 ? 0x7FFF'FFFF : 0x8000'0000;
+  }
+
+  host_flags.v = overflow;
+  SetValue(op->result, result);
+}
+
+void Interpreter::ExecuteMUL(IRMultiply* op) {
+  auto lhs = GetValue(op->lhs);
+  auto rhs = GetValue(op->rhs);
+
+  if (!op->result_hi.IsNull()) {
+    u64 result;
+
+    if (op->lhs.Get().data_type == IRDataType::SInt32) {
+      result = u64(s64(s32(lhs)) * s64(s32(rhs)));
+    } else {
+      result = u64(lhs) * rhs;
+    }
+
+    // Multiplies only update N and Z, the carry is kept (like on ARMv5TE).
+    if (op->update_host_flags) {
+      host_flags.n = bit::get_bit<u64, bool>(result, 63);
+      host_flags.z = result == 0;
+    }
+
+    SetValue(op->result_lo, u32(result));
+    SetValue(op->result_hi, u32(result >> 32));
+  } else {
+    auto result = lhs * rhs;
+
+    if (op->update_host_flags) {
+      SetNZ(result);
+    }
+
+    SetValue(op->result_lo, result);
+  }
+}
+
+void Interpreter::ExecuteADD64(IRAdd64* op) {
+  auto lhs = (u64(GetValue(op->lhs_hi)) << 32) | GetValue(op->lhs_lo);
+  auto rhs = (u64(GetValue(op->rhs_hi)) << 32) | GetValue(op->rhs_lo);
+  auto result = lhs + rhs;
+
+  if (op->update_host_flags) {
+    host_flags.n = bit::get_bit<u64, bool>(result, 63);
+    host_flags.z = result == 0;
+  }
+
+  SetValue(op->result_lo, u32(result));
+  SetValue(op->result_hi, u32(result >> 32));
+}
+
+template<typename OpcodeType>
+auto Interpreter::GetAddress(OpcodeType* op) -> u32 {
+  auto address = GetValue(op->address) + op->offset;
+
+  if (!op->index.IsNull()) {
+    address += GetValue(op->index) << op->index_shift;
+  }
+  return address;
+}
+
+void Interpreter::ExecuteMemoryRead(IRMemoryRead* op) {
+  auto address = GetAddress(op);
+  auto flags = op->flags;
+  u32 result;
+
+  if (flags & Word) {
+    result = memory.FastRead<u32, Memory::Bus::Data>(address);
+  } else if (flags & Half) {
+    result = memory.FastRead<u16, Memory::Bus::Data>(address);
+
+    if (flags & Signed) {
+      result = u32(s16(result));
+    }
+  } else {
+    result = memory.FastRead<u8, Memory::Bus::Data>(address);
+
+    if (flags & Signed) {
+      result = u32(s8(result));
+    }
+  }
+
+  // Aligned accesses are rotated by zero bits.
+  if ((flags & Rotate) && !(flags & Aligned)) {
+    if (flags & Word) {
+      result = bit::rotate_right<u32>(result, (address & 3) * 8);
+    } else if (flags & Half) {
+      result = bit::rotate_right<u32>(result, (address & 1) * 8);
+    }
+  }
+
+  static constexpr auto kHalfSignedARMv4T = Half | Signed | ARMv4T;
+
+  // ARM7TDMI/ARMv4T special case: unaligned LDRSH is effectively LDRSB.
+  if ((flags & kHalfSignedARMv4T) == kHalfSignedARMv4T && !(flags & Aligned) && (address & 1)) {
+    result = u32(s8(result >> 8));
+  }
+
+  SetValue(op->result, result);
+}
+
+void Interpreter::ExecuteMemoryWrite(IRMemoryWrite* op) {
+  auto address = GetAddress(op);
+  auto flags = op->flags;
+  auto value = GetValue(op->source);
+
+  if (flags & Word) {
+    memory.FastWrite<u32, Memory::Bus::Data>(address, value);
+  } else if (flags & Half) {
+    memory.FastWrite<u16, Memory::Bus::Data>(address, u16(value));
+  } else if (flags & Byte) {
+    memory.FastWrite<u8, Memory::Bus::Data>(address, u8(value));
+  }
+}
+
+void Interpreter::ExecuteFlush(IRFlush* op) {
+  auto address = GetValue(op->address_in);
+
+  if (GetValue(op->cpsr_in) & (1 << 5)) {
+    address += sizeof(u16) * 2;
+  } else {
+    address += sizeof(u32) * 2;
+  }
+
+  SetValue(op->address_out, address);
+}
+
+void Interpreter::ExecuteFlushExchange(IRFlushExchange* op) {
+  auto address = GetValue(op->address_in);
+  auto cpsr = GetValue(op->cpsr_in);
+
+  if (address & 1) {
+    cpsr |= 1 << 5;
+    address = (address & ~1) + sizeof(u16) * 2;
+  } else {
+    cpsr &= ~(1 << 5);
+    address = (address & ~3) + sizeof(u32) * 2;
+  }
+
+  SetValue(op->address_out, address);
+  SetValue(op->cpsr_out, cpsr);
+}
+
+} // namespace lunatic::backend
+} // namespace lunatic
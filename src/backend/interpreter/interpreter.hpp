@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2022 fleroviux. All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#pragma once
+
+#include <lunatic/cpu.hpp>
+#include <array>
+#include <vector>
+
+#include "backend/backend.hpp"
+#include "frontend/basic_block.hpp"
+#include "frontend/state.hpp"
+
+using namespace lunatic::frontend;
+
+namespace lunatic {
+namespace backend {
+
+/**
+ * Executes the IR of a basic block directly, without compiling it to host code.
+ * This is used for code that runs too few times to be worth compiling,
+ * and as a reference to test the code generated by the x86-64 backend against.
+ */
+struct Interpreter : Backend {
+  Interpreter(CPU::Descriptor const& descriptor, State& state);
+
+  /// Execute a basic block once and get the number of cycles that it took.
+  auto Run(
+    BasicBlock const& basic_block,
+    std::vector<BasicBlock::MicroBlock> const& micro_blocks
+  ) -> int;
+
+private:
+  /**
+   * NZCV flags as they would be held in AX by the compiled code.
+   * Opcodes with update_host_flags write them and UpdateFlags copies them into the CPSR.
+   */
+  struct HostFlags {
+    bool n = false;
+    bool z = false;
+    bool c = false;
+    bool v = false;
+  };
+
+  void LoadHostFlags();
+  void SetNZ(u32 value);
+
+  bool EvaluateCondition(Condition condition) const;
+
+  auto GetValue(IRAnyRef const& value) -> u32;
+  void SetValue(IRAnyRef const& var, u32 value);
+
+  void Execute(IROpcode* op);
+
+  // Context access
+  void ExecuteUpdateFlags(IRUpdateFlags* op);
+  void ExecuteUpdateSticky(IRUpdateSticky* op);
+
+  // Barrel shifter
+  void ExecuteLSL(IRLogicalShiftLeft* op);
+  void ExecuteLSR(IRLogicalShiftRight* op);
+  void ExecuteASR(IRArithmeticShiftRight* op);
+  void ExecuteROR(IRRotateRight* op);
+
+  // ALU
+  void ExecuteLogical(IRAnyRef const& result, u32 value, bool update_host_flags);
+  void ExecuteAdd(IRAnyRef const& result, u32 lhs, u32 rhs, bool carry, bool update_host_flags);
+  void ExecuteSub(IRAnyRef const& result, u32 lhs, u32 rhs, bool carry, bool update_host_flags);
+  void ExecuteQADD(IRSaturatingAdd* op);
+  void ExecuteQSUB(IRSaturatingSub* op);
+
+  // Multiply
+  void ExecuteMUL(IRMultiply* op);
+  void ExecuteADD64(IRAdd64* op);
+
+  // Memory
+  template<typename OpcodeType>
+  auto GetAddress(OpcodeType* op) -> u32;
+  void ExecuteMemoryRead(IRMemoryRead* op);
+  void ExecuteMemoryWrite(IRMemoryWrite* op);
+
+  // Flush
+  void ExecuteFlush(IRFlush* op);
+  void ExecuteFlushExchange(IRFlushExchange* op);
+
+  State& state;
+  Memory& memory;
+  std::array<Coprocessor*, 16> coprocessors;
+
+  HostFlags host_flags;
+
+  /// Values of the variables of the micro block which is executed, by variable ID.
+  std::vector<u32> vars;
+};
+
+} // namespace lunatic::backend
+} // namespace lunatic
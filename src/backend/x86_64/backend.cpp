@@ -7,13 +7,14 @@
 
 #include <algorithm>
 #include <cstdlib>
-#include <list>
+#include <iterator>
 #include <stdexcept>
 
 #include "backend.hpp"
 #include "common.hpp"
 #include "common/aligned_memory.hpp"
 #include "common/bit.hpp"
+#include "frontend/ir_opt/flag_liveness.hpp"
 #include "vtune.hpp"
 
 /**
@@ -34,12 +35,15 @@ X64Backend::X64Backend(
     , state(state)
     , coprocessors(descriptor.coprocessors)
     , block_cache(block_cache)
-    , irq_line(irq_line) {
+    , irq_line(irq_line)
+    , enable_loop_pinning(descriptor.optimization_level == CPU::Descriptor::OptimizationLevel::Full)
+    , enable_profiling(descriptor.profile_blocks) {
   CreateCodeGenerator();
   EmitCallBlock();
 }
 
 X64Backend::~X64Backend() {
+  delete reg_alloc;
   delete code;
   memory::free(buffer);
 }
@@ -60,6 +64,7 @@ void X64Backend::CreateCodeGenerator() {
   );
 
   code = new Xbyak::CodeGenerator{kCodeBufferSize, buffer};
+  reg_alloc = new X64RegisterAllocator{*code};
 }
 
 void X64Backend::EmitCallBlock() {
@@ -100,49 +105,213 @@ void X64Backend::EmitCallBlock() {
 #endif
 }
 
-void X64Backend::Compile(BasicBlock& basic_block) {
+void X64Backend::Compile(
+  BasicBlock& basic_block,
+  std::vector<BasicBlock::MicroBlock>& micro_blocks
+) {
+  auto target_block = GetBranchTargetBlock(basic_block);
+  u8 deferred_flags = 0;
+
+  /* If the flags from the final flag update are overwritten by the linked block before it reads them,
+   * then they only need to be written to the CPSR on the exits that return to the dispatcher.
+   * A baseline block may return to the dispatcher right away to be recompiled, so the flags must be stored.
+   */
+  if (target_block && !target_block->tier_up) {
+    deferred_flags = DeferFinalFlagUpdate(micro_blocks, kFlagsNZCV & ~target_block->flags_live_in);
+  }
+
+  CompileBasicBlock(basic_block, micro_blocks, deferred_flags);
+}
+
+auto X64Backend::GetBranchTargetBlock(BasicBlock& basic_block) -> BasicBlock* {
+  auto& branch_target = basic_block.branch_target;
+
+  if (!basic_block.enable_fast_dispatch || branch_target.key.value == 0) {
+    return nullptr;
+  }
+
+  if (branch_target.key == basic_block.key) {
+    return &basic_block;
+  }
+  return block_cache.Get(branch_target.key);
+}
+
+void X64Backend::CompileBasicBlock(
+  BasicBlock& basic_block,
+  std::vector<BasicBlock::MicroBlock> const& micro_blocks,
+  u8 deferred_flags
+) {
   try {
     auto label_return_to_dispatch = Xbyak::Label{};
-    auto opcode_size = basic_block.key.Thumb() ? sizeof(u16) : sizeof(u32);
-    auto number_of_micro_blocks = basic_block.micro_blocks.size();
+    auto number_of_micro_blocks = micro_blocks.size();
+
+    // NZCV flags that the x86 flags register holds in the guest format, at the end of the previous micro block.
+    u8 flags_in_eflags = 0;
+
+    // We do not know where the block was entered from, so AX is not known to match the CPSR.
+    auto host_flags = HostFlagState{};
+
+    /* The final micro block jumps to the branch target after its opcodes have been executed,
+     * so it must be skipped via a branch, if its condition is not met.
+     */
+    auto IsIfConverted = [&](size_t i) {
+      auto const& micro_block = micro_blocks[i];
+
+      // Side exits leave the block only if the condition is met.
+      if (micro_block.condition == Condition::AL || !micro_block.side_exit.IsEmpty()) {
+        return false;
+      }
+
+      if (i == number_of_micro_blocks - 1 && basic_block.enable_fast_dispatch && basic_block.branch_target.key.value != 0) {
+        return false;
+      }
+
+      return IsIfConvertible(micro_block);
+    };
+
+    // All side exits are created before the first one is linked.
+    int side_exit_count = 0;
+
+    for (auto const& micro_block : micro_blocks) {
+      if (!micro_block.side_exit.IsEmpty()) {
+        side_exit_count++;
+      }
+    }
+
+    block_cache.AllocateSideExits(basic_block, side_exit_count);
+
+    auto new_side_exit = basic_block.side_exits;
+
+    for (auto const& micro_block : micro_blocks) {
+      if (!micro_block.side_exit.IsEmpty()) {
+        new_side_exit->key = micro_block.side_exit;
+        new_side_exit->owner = &basic_block;
+        new_side_exit++;
+      }
+    }
+
+    auto side_exit = basic_block.side_exits;
+    auto label_side_exit_return = Xbyak::Label{};
+
+    // Number of instructions up to the end of the current micro block.
+    int cycles = 0;
+
+    /* A block that branches to itself keeps its most used guest registers in host registers.
+     * They are loaded once before the loop and written back whenever the block is left.
+     */
+    auto label_loop_header = Xbyak::Label{};
+    auto label_loop_exit = Xbyak::Label{};
+
+    pinned_gprs.clear();
+    pinned_host_regs.clear();
+
+    if (enable_loop_pinning && GetBranchTargetBlock(basic_block) == &basic_block && IsLoopPinnable(micro_blocks)) {
+      PinLoopGPRs(micro_blocks);
+    }
+
+    auto label_tier_up = Xbyak::Label{};
 
     basic_block.function = (BasicBlock::CompiledFn)code->getCurr();
 
+    EmitLoadPinnedGPRs();
+    code->L(label_loop_header);
+
+    // Each iteration of a loop counts as one execution of the block.
+    if (enable_profiling) {
+      code->mov(rdx, uintptr(&basic_block.execution_count));
+      code->add(qword[rdx], 1);
+    }
+
+    // Count the executions of a baseline block and return to the dispatcher once it should be recompiled.
+    if (basic_block.tier_up) {
+      code->mov(rdx, uintptr(&basic_block.tier_up_counter));
+      code->sub(dword[rdx], 1);
+      code->jz(label_tier_up, Xbyak::CodeGenerator::T_NEAR);
+    }
+
     for (size_t i = 0; i < number_of_micro_blocks; i++) {
-      auto const& micro_block = basic_block.micro_blocks[i];
+      auto const& micro_block = micro_blocks[i];
       auto& emitter  = micro_block.emitter;
       auto condition = micro_block.condition;
-      auto reg_alloc = X64RegisterAllocator{emitter, *code};
-      auto context   = CompileContext{*code, reg_alloc, state};
+      auto context   = CompileContext{*code, *reg_alloc, state};
+
+      reg_alloc->Reset(emitter, pinned_host_regs);
 
       auto label_skip = Xbyak::Label{};
       auto label_done = Xbyak::Label{};
 
-      // Skip past the micro block if its condition is not met
-      EmitConditionalBranch(condition, label_skip);
+      /* Short conditional micro blocks are executed unconditionally and only their GPR writes test the condition.
+       * If the condition is not met, all GPRs keep their value and the program counter points past the micro block.
+       */
+      bool if_converted = IsIfConverted(i);
+
+      if (if_converted) {
+        EmitLoadHostFlags(GetConditionFlags(condition), host_flags);
+
+        code->mov(
+          dword[rcx + state.GetOffsetToGPR(Mode::User, GPR::PC)],
+          micro_block.next_address
+        );
+      } else {
+        // Skip past the micro block if its condition is not met
+        EmitConditionalBranch(condition, label_skip, flags_in_eflags, host_flags);
+      }
+
+      // The skip path continues with the state from after the condition check.
+      auto host_flags_skip = host_flags;
+
+      /* If the next micro block tests the flags which this micro block ends on,
+       * then keep the x86 flags intact while the flags are written to the CPSR,
+       * so that the condition can be tested directly.
+       */
+      flags_in_eflags = 0;
+
+      if (condition == Condition::AL && i != number_of_micro_blocks - 1) {
+        auto fused_flags = GetFusableFlags(micro_block);
+        auto next_flags = GetConditionFlags(micro_blocks[i + 1].condition);
+
+        // An if-converted micro block tests its condition on AX after the x86 flags have been overwritten.
+        if (next_flags != 0 && (next_flags & ~fused_flags) == 0 && !IsIfConverted(i + 1)) {
+          flags_in_eflags = fused_flags;
+        }
+      }
+
+      preserve_host_flags = flags_in_eflags != 0;
+      select_condition = if_converted ? condition : Condition::AL;
 
       // Compile each IR opcode inside the micro block
-      for (auto const& op : emitter.Code()) {
+      for (auto op : emitter.Code()) {
         CompileIROp(context, op);
-        reg_alloc.AdvanceLocation();
+        reg_alloc->AdvanceLocation();
+        host_flags.Update(op);
       }
 
+      select_condition = Condition::AL;
+
+      cycles += micro_block.length;
+
       /* Once we reached the end of the basic block,
        * check if we can emit a jump to an already compiled basic block.
        * Also update the cycle counter in that case and return to the dispatcher
        * in the case that we ran out of cycles.
        */
-      if (basic_block.enable_fast_dispatch && i == number_of_micro_blocks - 1) {
+      if (!micro_block.side_exit.IsEmpty()) {
+        EmitSideExit(basic_block, *side_exit++, cycles, label_side_exit_return);
+      } else if (basic_block.enable_fast_dispatch && i == number_of_micro_blocks - 1) {
         auto& branch_target = basic_block.branch_target;
 
-        if (branch_target.key.value != 0) {
-          BasicBlock* target_block;
+        if (!pinned_gprs.empty()) {
+          // The back-edge of the loop only checks whether the loop must be left.
+          code->sub(rbx, basic_block.length);
+          code->jle(label_loop_exit, Xbyak::CodeGenerator::T_NEAR);
 
-          if (branch_target.key == basic_block.key) {
-            target_block = &basic_block;
-          } else {
-            target_block = block_cache.Get(branch_target.key);
-          }
+          code->mov(rdx, uintptr(&irq_line));
+          code->cmp(byte[rdx], 0);
+          code->jnz(label_loop_exit, Xbyak::CodeGenerator::T_NEAR);
+
+          code->jmp(label_loop_header, Xbyak::CodeGenerator::T_NEAR);
+        } else if (branch_target.key.value != 0) {
+          auto target_block = GetBranchTargetBlock(basic_block);
 
           // Return to the dispatcher if we ran out of cycles.
           code->sub(rbx, basic_block.length);
@@ -155,42 +324,47 @@ void X64Backend::Compile(BasicBlock& basic_block) {
 
           if (target_block) {
             // The branch target is already compiled, emit a relative jump to it now.
-            code->jmp((const void*)target_block->function);
+            branch_target.patch_location = code->getCurr<u8*>();
+            code->jmp((const void*)target_block->function, Xbyak::CodeGenerator::T_NEAR);
 
-            target_block->linking_blocks.push_back(&basic_block);
+            AddLink(target_block->first_link, branch_target);
           } else {
             /* The branch target has not been compiled yet.
              * Create a padding of 5 NOPs and memorize its address, so that a relative jump
              * can be patched in once the branch target has been compiled.
+             * We do not know yet which flags that block reads.
              */
+            EmitStoreDeferredFlags(deferred_flags);
             branch_target.patch_location = code->getCurr<u8*>();
             code->nop(5);
 
             /* Memorize that this basic block should link to the branch target,
              * so that we know which blocks to patch once the branch target has been compiled.
              */
-            block_linking_table[branch_target.key].push_back(&basic_block);
+            AddLink(GetPendingLinkList(branch_target.key), branch_target);
           }
         }
       }
 
       /* The program counter is normally updated via IR opcodes.
        * But if we skipped past the code which'd do that, we need to manually
-       * update the program counter.
+       * update the program counter. The translator recorded the program counter
+       * after the micro block, so it is known in advance.
        */
-      if (condition != Condition::AL) {
+      if (condition != Condition::AL && !if_converted) {
         code->jmp(label_done);
 
         code->L(label_skip);
-        code->add(
-          dword[rcx + state.GetOffsetToGPR(Mode::User, GPR::PC)],
-          micro_block.length * opcode_size
-        );
+        code->mov(dword[rcx + state.GetOffsetToGPR(Mode::User, GPR::PC)], micro_block.next_address);
 
         code->L(label_done);
+
+        host_flags.Merge(host_flags_skip);
       }
     }
 
+    EmitStorePinnedGPRs();
+
     if (basic_block.enable_fast_dispatch) {
       // Return to the dispatcher if we ran out of cycles.
       code->sub(rbx, basic_block.length);
@@ -202,20 +376,38 @@ void X64Backend::Compile(BasicBlock& basic_block) {
       code->jnz(label_return_to_dispatch);
 
       // If the next basic block already is compiled then jump to it.
+      EmitStoreDeferredFlags(deferred_flags);
       EmitBasicBlockDispatch(label_return_to_dispatch);
 
       code->L(label_return_to_dispatch);
+      EmitStoreDeferredFlags(deferred_flags);
       code->ret();
+
+      if (!pinned_gprs.empty()) {
+        code->L(label_loop_exit);
+        EmitStorePinnedGPRs();
+        code->jmp(label_return_to_dispatch, Xbyak::CodeGenerator::T_NEAR);
+      }
     } else {
       code->sub(rbx, basic_block.length);
+      EmitStoreDeferredFlags(deferred_flags);
       code->ret();
     }
 
-    Link(basic_block);
+    // The CPSR is up-to-date at the side exits, because they precede the deferred flag update.
+    if (basic_block.side_exit_count != 0) {
+      code->L(label_side_exit_return);
+      code->ret();
+    }
 
-    basic_block.RegisterReleaseCallback([this](BasicBlock const& basic_block) {
-      OnBasicBlockToBeDeleted(basic_block);
-    });
+    // Nothing was executed yet, so the dispatcher will run the recompiled block from the start.
+    if (basic_block.tier_up) {
+      code->L(label_tier_up);
+      EmitStorePinnedGPRs();
+      code->ret();
+    }
+
+    Link(basic_block);
 
 #if LUNATIC_USE_VTUNE
     vtune::ReportBasicBlock(basic_block, code->getCurr());
@@ -224,87 +416,89 @@ void X64Backend::Compile(BasicBlock& basic_block) {
     if (int(error) == Xbyak::ERR_CODE_IS_TOO_BIG) {
       fmt::print("FLUSH\n");
       block_cache.Flush();
+      // The block exits may still wait in the pending link lists from the failed attempt.
+      RemoveLinks(basic_block);
       code->resetSize();
       EmitCallBlock();
-      Compile(basic_block);
+      CompileBasicBlock(basic_block, micro_blocks, deferred_flags);
     } else {
       throw;
     }
   }
 }
 
-void X64Backend::EmitConditionalBranch(Condition condition, Xbyak::Label& label_skip) {
+void X64Backend::EmitConditionalBranch(
+  Condition condition,
+  Xbyak::Label& label_skip,
+  u8 flags_in_eflags,
+  HostFlagState& host_flags
+) {
   if (condition == Condition::AL) {
     return;
   }
 
-  // TODO: Keep decompressed flags in eax?
-  code->mov(eax, dword[rcx + state.GetOffsetToCPSR()]);
-  code->shr(eax, 28);
-  code->mov(edx, 0xC101);
-  code->pdep(eax, eax, edx);
+  auto flags = GetConditionFlags(condition);
+
+  /* The x86 flags still hold the result of the flag-setting opcode that ended the previous micro block.
+   * In that case we can test them directly, otherwise they must be loaded from AX.
+   */
+  if ((flags & ~flags_in_eflags) != 0) {
+    EmitLoadHostFlags(flags, host_flags);
+
+    // OF = value of AL (overflow flag)
+    if (flags & kFlagV) {
+      code->cmp(al, 0x81);
+    }
+
+    // SF, ZF and CF from AH
+    if (flags & (kFlagN | kFlagZ | kFlagC)) {
+      code->sahf();
+    }
+  }
 
   switch (condition) {
     case Condition::EQ:
-      code->sahf();
       code->jnz(label_skip, Xbyak::CodeGenerator::T_NEAR);
       break;
     case Condition::NE:
-      code->sahf();
       code->jz(label_skip, Xbyak::CodeGenerator::T_NEAR);
       break;
     case Condition::CS:
-      code->sahf();
       code->jnc(label_skip, Xbyak::CodeGenerator::T_NEAR);
       break;
     case Condition::CC:
-      code->sahf();
       code->jc(label_skip, Xbyak::CodeGenerator::T_NEAR);
       break;
     case Condition::MI:
-      code->sahf();
       code->jns(label_skip, Xbyak::CodeGenerator::T_NEAR);
       break;
     case Condition::PL:
-      code->sahf();
       code->js(label_skip, Xbyak::CodeGenerator::T_NEAR);
       break;
     case Condition::VS:
-      code->cmp(al, 0x81);
       code->jno(label_skip, Xbyak::CodeGenerator::T_NEAR);
       break;
     case Condition::VC:
-      code->cmp(al, 0x81);
       code->jo(label_skip, Xbyak::CodeGenerator::T_NEAR);
       break;
     case Condition::HI:
-      code->sahf();
       code->cmc();
       code->jna(label_skip, Xbyak::CodeGenerator::T_NEAR);
       break;
     case Condition::LS:
-      code->sahf();
       code->cmc();
       code->ja(label_skip, Xbyak::CodeGenerator::T_NEAR);
       break;
     case Condition::GE:
-      code->cmp(al, 0x81);
-      code->sahf();
       code->jnge(label_skip, Xbyak::CodeGenerator::T_NEAR);
       break;
     case Condition::LT:
-      code->cmp(al, 0x81);
-      code->sahf();
       code->jnl(label_skip, Xbyak::CodeGenerator::T_NEAR);
       break;
     case Condition::GT:
-      code->cmp(al, 0x81);
-      code->sahf();
       code->jng(label_skip, Xbyak::CodeGenerator::T_NEAR);
       break;
     case Condition::LE:
-      code->cmp(al, 0x81);
-      code->sahf();
       code->jnle(label_skip, Xbyak::CodeGenerator::T_NEAR);
       break;
     case Condition::NV:
@@ -316,6 +510,283 @@ void X64Backend::EmitConditionalBranch(Condition condition, Xbyak::Label& label_
   }
 }
 
+void X64Backend::EmitLoadHostFlags(u8 flags, HostFlagState& host_flags) {
+  if ((flags & ~host_flags.synced) == 0) {
+    return;
+  }
+
+  code->mov(eax, dword[rcx + state.GetOffsetToCPSR()]);
+  code->shr(eax, 28);
+  code->mov(edx, 0xC101);
+  code->pdep(eax, eax, edx);
+
+  host_flags.synced = kFlagsNZCV;
+  host_flags.unstored_update = nullptr;
+}
+
+void X64Backend::EmitConditionalMove(
+  Condition condition,
+  Xbyak::Reg32 const& dst,
+  Xbyak::Operand const& src
+) {
+  auto flags = GetConditionFlags(condition);
+
+  // OF = value of AL (overflow flag)
+  if (flags & kFlagV) {
+    code->cmp(al, 0x81);
+  }
+
+  // SF, ZF and CF from AH
+  if (flags & (kFlagN | kFlagZ | kFlagC)) {
+    code->sahf();
+  }
+
+  switch (condition) {
+    case Condition::EQ: code->cmovz(dst, src); break;
+    case Condition::NE: code->cmovnz(dst, src); break;
+    case Condition::CS: code->cmovc(dst, src); break;
+    case Condition::CC: code->cmovnc(dst, src); break;
+    case Condition::MI: code->cmovs(dst, src); break;
+    case Condition::PL: code->cmovns(dst, src); break;
+    case Condition::VS: code->cmovo(dst, src); break;
+    case Condition::VC: code->cmovno(dst, src); break;
+    case Condition::HI:
+      code->cmc();
+      code->cmova(dst, src);
+      break;
+    case Condition::LS:
+      code->cmc();
+      code->cmovna(dst, src);
+      break;
+    case Condition::GE: code->cmovge(dst, src); break;
+    case Condition::LT: code->cmovl(dst, src); break;
+    case Condition::GT: code->cmovg(dst, src); break;
+    case Condition::LE: code->cmovle(dst, src); break;
+    default:
+      fmt::print("Unsupported Condition {}\n", condition);
+      std::abort();
+  }
+}
+
+auto X64Backend::GetConditionFlags(Condition condition) -> u8 {
+  switch (condition) {
+    case Condition::EQ:
+    case Condition::NE:
+      return kFlagZ;
+    case Condition::CS:
+    case Condition::CC:
+      return kFlagC;
+    case Condition::MI:
+    case Condition::PL:
+      return kFlagN;
+    case Condition::VS:
+    case Condition::VC:
+      return kFlagV;
+    case Condition::HI:
+    case Condition::LS:
+      return kFlagC | kFlagZ;
+    case Condition::GE:
+    case Condition::LT:
+      return kFlagN | kFlagV;
+    case Condition::GT:
+    case Condition::LE:
+      return kFlagN | kFlagZ | kFlagV;
+    default:
+      return 0;
+  }
+}
+
+void X64Backend::HostFlagState::Update(IROpcode* op) {
+  auto flags_written = GetHostFlagsWritten(op);
+
+  if (flags_written != 0) {
+    synced &= ~flags_written;
+    unstored_update = nullptr;
+    return;
+  }
+
+  switch (op->GetClass()) {
+    case IROpcodeClass::UpdateFlags: {
+      unstored_update = lunatic_cast<IRUpdateFlags>(op);
+      break;
+    }
+    case IROpcodeClass::StoreCPSR: {
+      auto& value = lunatic_cast<IRStoreCPSR>(op)->value;
+
+      /* If the CPSR value is the result of the latest flag update, then the updated flags match AX.
+       * The other flags are not tracked through the opcodes which produce the value.
+       */
+      synced = 0;
+
+      if (unstored_update != nullptr && value.IsVariable() && value.GetVar().GetDef() == unstored_update) {
+        if (unstored_update->flag_n) synced |= kFlagN;
+        if (unstored_update->flag_z) synced |= kFlagZ;
+        if (unstored_update->flag_c) synced |= kFlagC;
+        if (unstored_update->flag_v) synced |= kFlagV;
+      }
+      break;
+    }
+    default: {
+      break;
+    }
+  }
+}
+
+void X64Backend::HostFlagState::Merge(HostFlagState const& other) {
+  synced &= other.synced;
+
+  if (unstored_update != other.unstored_update) {
+    unstored_update = nullptr;
+  }
+}
+
+bool X64Backend::IsIfConvertible(BasicBlock::MicroBlock const& micro_block) {
+  // Speculatively executing long micro blocks would cost more than a mispredicted branch.
+  static constexpr int kMaxLength = 3;
+
+  if (micro_block.condition == Condition::AL || micro_block.condition == Condition::NV ||
+      micro_block.length > kMaxLength) {
+    return false;
+  }
+
+  for (auto op : micro_block.emitter.Code()) {
+    // The opcodes must neither modify AX, which holds the flags for the condition, nor have other side effects.
+    if (GetHostFlagsWritten(op) != 0) {
+      return false;
+    }
+
+    switch (op->GetClass()) {
+      case IROpcodeClass::LoadGPR: {
+        // The program counter is set to the address after the micro block before the opcodes are executed.
+        if (lunatic_cast<IRLoadGPR>(op)->reg.reg == GPR::PC) {
+          return false;
+        }
+        break;
+      }
+      case IROpcodeClass::StoreGPR:
+      case IROpcodeClass::LSL:
+      case IROpcodeClass::LSR:
+      case IROpcodeClass::ASR:
+      case IROpcodeClass::ROR:
+      case IROpcodeClass::AND:
+      case IROpcodeClass::BIC:
+      case IROpcodeClass::EOR:
+      case IROpcodeClass::SUB:
+      case IROpcodeClass::RSB:
+      case IROpcodeClass::ADD:
+      case IROpcodeClass::ORR:
+      case IROpcodeClass::MOV:
+      case IROpcodeClass::MVN:
+        break;
+      default:
+        return false;
+    }
+  }
+
+  return true;
+}
+
+/// Check if an opcode only moves data and thus compiles to instructions which leave the x86 flags untouched.
+static bool IsDataMove(IROpcode* op) {
+  switch (op->GetClass()) {
+    case IROpcodeClass::LoadGPR:
+    case IROpcodeClass::StoreGPR:
+    case IROpcodeClass::LoadSPSR:
+    case IROpcodeClass::StoreSPSR:
+    case IROpcodeClass::LoadCPSR:
+      return true;
+    case IROpcodeClass::MOV:
+    case IROpcodeClass::MVN:
+      return !((IRMov*)op)->update_host_flags;
+    default:
+      return false;
+  }
+}
+
+auto X64Backend::GetFusableFlags(BasicBlock::MicroBlock const& micro_block) -> u8 {
+  auto& code = micro_block.emitter.Code();
+  auto it = code.rbegin();
+  auto end = code.rend();
+
+  auto SkipDataMoves = [&]() {
+    while (it != end && IsDataMove(*it)) ++it;
+  };
+
+  // Find the final CPSR write. It must store the result of a flag update.
+  SkipDataMoves();
+
+  if (it == end || (*it)->GetClass() != IROpcodeClass::StoreCPSR) {
+    return 0;
+  }
+
+  auto& value = lunatic_cast<IRStoreCPSR>(*it)->value;
+
+  if (!value.IsVariable() || value.GetVar().GetDef() == nullptr) {
+    return 0;
+  }
+
+  ++it;
+  SkipDataMoves();
+
+  if (it == end || *it != value.GetVar().GetDef() || (*it)->GetClass() != IROpcodeClass::UpdateFlags) {
+    return 0;
+  }
+
+  auto update = lunatic_cast<IRUpdateFlags>(*it);
+  u8 flags = 0;
+
+  if (update->flag_n) flags |= kFlagN;
+  if (update->flag_z) flags |= kFlagZ;
+  if (update->flag_c) flags |= kFlagC;
+  if (update->flag_v) flags |= kFlagV;
+
+  // Find the opcode that set the host flags.
+  ++it;
+  SkipDataMoves();
+
+  if (it == end) {
+    return 0;
+  }
+
+  switch ((*it)->GetClass()) {
+    // The logical opcodes set SF and ZF from the result and restore CF from AH, but leave OF undefined.
+    case IROpcodeClass::MOV:
+    case IROpcodeClass::MVN:
+      return ((IRMov*)*it)->update_host_flags ? (flags & (kFlagN | kFlagZ | kFlagC)) : 0;
+    case IROpcodeClass::AND:
+    case IROpcodeClass::BIC:
+    case IROpcodeClass::EOR:
+    case IROpcodeClass::ORR:
+      return ((IRBitwiseAND*)*it)->update_host_flags ? (flags & (kFlagN | kFlagZ | kFlagC)) : 0;
+    case IROpcodeClass::ADD:
+    case IROpcodeClass::SUB:
+    case IROpcodeClass::RSB:
+      return ((IRAdd*)*it)->update_host_flags ? flags : 0;
+    case IROpcodeClass::ADC:
+    case IROpcodeClass::SBC:
+    case IROpcodeClass::RSC:
+      return ((IRAdc*)*it)->update_host_flags ? flags : 0;
+    default:
+      return 0;
+  }
+}
+
+void X64Backend::EmitStoreDeferredFlags(u8 flags) {
+  if (flags == 0) {
+    return;
+  }
+
+  u32 mask = u32(flags) << 28;
+
+  // Convert the host flags in AX back into the NZCV format and merge them into the CPSR.
+  code->mov(edx, 0xC101);
+  code->pext(edx, eax, edx);
+  code->shl(edx, 28);
+  code->and_(edx, mask);
+  code->and_(dword[rcx + state.GetOffsetToCPSR()], ~mask);
+  code->or_(dword[rcx + state.GetOffsetToCPSR()], edx);
+}
+
 void X64Backend::EmitBasicBlockDispatch(Xbyak::Label& label_cache_miss) {
   // Build the block key from R15 and CPSR.
   // See frontend/basic_block.hpp
@@ -349,117 +820,331 @@ void X64Backend::EmitBasicBlockDispatch(Xbyak::Label& label_cache_miss) {
   code->jmp(rdi);
 }
 
-void X64Backend::Link(BasicBlock& basic_block) {
-  auto iterator = block_linking_table.find(basic_block.key);
+void X64Backend::EmitSideExit(
+  BasicBlock& basic_block,
+  BasicBlock::BranchTarget& side_exit,
+  int cycles,
+  Xbyak::Label& label_return
+) {
+  EmitStorePinnedGPRs();
 
-  if (iterator == block_linking_table.end()) {
+  code->sub(rbx, cycles);
+
+  if (!basic_block.enable_fast_dispatch) {
+    code->jmp(label_return, Xbyak::CodeGenerator::T_NEAR);
     return;
   }
 
-  for (auto linking_block : iterator->second) {
-    u8* patch = linking_block->branch_target.patch_location;
-    u32 relative_address = (u32)((s64)basic_block.function - (s64)patch - 5LL);
+  // Return to the dispatcher if we ran out of cycles.
+  code->jle(label_return, Xbyak::CodeGenerator::T_NEAR);
+
+  // Return to the dispatcher if there is an IRQ to handle
+  code->mov(rdx, uintptr(&irq_line));
+  code->cmp(byte[rdx], 0);
+  code->jnz(label_return, Xbyak::CodeGenerator::T_NEAR);
+
+  auto target_block = side_exit.key == basic_block.key ? &basic_block : block_cache.Get(side_exit.key);
+
+  if (target_block) {
+    side_exit.patch_location = code->getCurr<u8*>();
+    code->jmp((const void*)target_block->function, Xbyak::CodeGenerator::T_NEAR);
+
+    AddLink(target_block->first_link, side_exit);
+  } else {
+    // Patched to a relative jump once the branch target has been compiled, see Link().
+    side_exit.patch_location = code->getCurr<u8*>();
+    code->nop(5);
+    code->jmp(label_return, Xbyak::CodeGenerator::T_NEAR);
+
+    AddLink(GetPendingLinkList(side_exit.key), side_exit);
+  }
+}
+
+bool X64Backend::IsLoopPinnable(std::vector<BasicBlock::MicroBlock> const& micro_blocks) {
+  for (auto const& micro_block : micro_blocks) {
+    for (auto op : micro_block.emitter.Code()) {
+      switch (op->GetClass()) {
+        case IROpcodeClass::StoreCPSR: {
+          auto value = lunatic_cast<IRStoreCPSR>(op)->value;
+
+          // Only flag updates are allowed, a mode change would bank the pinned registers.
+          if (!value.IsVariable() || value.GetVar().GetDef() == nullptr) {
+            return false;
+          }
+
+          auto def_class = value.GetVar().GetDef()->GetClass();
+
+          if (def_class != IROpcodeClass::UpdateFlags && def_class != IROpcodeClass::UpdateSticky) {
+            return false;
+          }
+          break;
+        }
+        case IROpcodeClass::StoreSPSR:
+        case IROpcodeClass::Flush:
+        case IROpcodeClass::FlushExchange:
+        case IROpcodeClass::MRC:
+        case IROpcodeClass::MCR: {
+          return false;
+        }
+        default: {
+          break;
+        }
+      }
+    }
+  }
+
+  return true;
+}
+
+void X64Backend::PinLoopGPRs(std::vector<BasicBlock::MicroBlock> const& micro_blocks) {
+  // Callee-saved host registers, so that they survive calls into the memory handlers.
+  static const Xbyak::Reg32 kPinnableHostRegs[] { r12d, r13d, r14d, r15d };
+
+  auto& candidates = pin_candidates;
+
+  candidates.clear();
+
+  auto CountAccess = [&](IRGuestReg reg) {
+    auto id = reg.ID();
 
-    patch[0] = 0xE9;
-    patch[1] = (u8)(relative_address >>  0);
-    patch[2] = (u8)(relative_address >>  8);
-    patch[3] = (u8)(relative_address >> 16);
-    patch[4] = (u8)(relative_address >> 24);
+    // The program counter is written with constants only, there is nothing to gain.
+    if (reg.reg == GPR::PC) {
+      return;
+    }
 
-    basic_block.linking_blocks.push_back(linking_block);
+    for (auto& candidate : candidates) {
+      if (candidate.id == id) {
+        candidate.accesses++;
+        return;
+      }
+    }
+    candidates.push_back({id, reg.reg, reg.mode, 1, false});
+  };
+
+  for (auto const& micro_block : micro_blocks) {
+    for (auto op : micro_block.emitter.Code()) {
+      if (op->GetClass() == IROpcodeClass::LoadGPR) {
+        CountAccess(lunatic_cast<IRLoadGPR>(op)->reg);
+      } else if (op->GetClass() == IROpcodeClass::StoreGPR) {
+        CountAccess(lunatic_cast<IRStoreGPR>(op)->reg);
+      }
+    }
   }
 
-  block_linking_table.erase(iterator);
+  // Pin the most accessed registers, the first accessed one wins a tie.
+  while (pinned_gprs.size() < std::size(kPinnableHostRegs)) {
+    PinCandidate* best = nullptr;
+
+    for (auto& candidate : candidates) {
+      if (!candidate.pinned && (best == nullptr || candidate.accesses > best->accesses)) {
+        best = &candidate;
+      }
+    }
+
+    if (best == nullptr) {
+      break;
+    }
+
+    auto host_reg = kPinnableHostRegs[pinned_gprs.size()];
+
+    best->pinned = true;
+    pinned_gprs.push_back({best->id, best->reg, best->mode, host_reg});
+    pinned_host_regs.push_back(host_reg);
+  }
 }
 
-void X64Backend::OnBasicBlockToBeDeleted(BasicBlock const& basic_block) {
-  // TODO: release the allocated JIT buffer memory.
+auto X64Backend::GetPinnedHostReg(IRGuestReg reg) -> Xbyak::Reg32 const* {
+  auto id = reg.ID();
 
-  auto const& branch_target = basic_block.branch_target;
+  for (auto const& pinned_gpr : pinned_gprs) {
+    if (pinned_gpr.id == id) {
+      return &pinned_gpr.host_reg;
+    }
+  }
+
+  return nullptr;
+}
+
+void X64Backend::EmitLoadPinnedGPRs() {
+  for (auto& pinned_gpr : pinned_gprs) {
+    code->mov(pinned_gpr.host_reg, dword[rcx + state.GetOffsetToGPR(pinned_gpr.mode, pinned_gpr.reg)]);
+  }
+}
 
-  // Do not leave a dangling pointer to the block in the block linking table or the target block.
-  if (!branch_target.key.IsEmpty()) {
-    auto iterator = block_linking_table.find(branch_target.key);
+void X64Backend::EmitStorePinnedGPRs() {
+  for (auto& pinned_gpr : pinned_gprs) {
+    code->mov(dword[rcx + state.GetOffsetToGPR(pinned_gpr.mode, pinned_gpr.reg)], pinned_gpr.host_reg);
+  }
+}
 
-    if (iterator != block_linking_table.end()) {
-      auto& linking_blocks = iterator->second;
+void X64Backend::Link(BasicBlock& basic_block) {
+  auto link = GetPendingLinkList(basic_block.key);
 
-      linking_blocks.erase(std::find(
-        linking_blocks.begin(), linking_blocks.end(), &basic_block));
+  while (link != nullptr) {
+    auto next_link = link->next_link;
+
+    // Other keys may hash to the same list.
+    if (link->key == basic_block.key) {
+      PatchJump(link->patch_location, basic_block);
+
+      RemoveLink(*link);
+      AddLink(basic_block.first_link, *link);
     }
 
-    auto target_block = block_cache.Get(branch_target.key);
+    link = next_link;
+  }
+}
 
-    if (target_block) {
-      auto& linking_blocks = target_block->linking_blocks;
+void X64Backend::Relink(BasicBlock& old_block, BasicBlock& new_block) {
+  auto link = old_block.first_link;
 
-      auto iterator = std::find(
-        linking_blocks.begin(), linking_blocks.end(), &basic_block);
+  while (link != nullptr) {
+    auto next_link = link->next_link;
 
-      if (iterator != linking_blocks.end()) {
-        linking_blocks.erase(iterator);
-      }
+    RemoveLink(*link);
+
+    // The exits of the old block itself are deleted with it.
+    if (link->owner != &old_block) {
+      PatchJump(link->patch_location, new_block);
+      AddLink(new_block.first_link, *link);
     }
+
+    link = next_link;
+  }
+}
+
+void X64Backend::PatchJump(u8* patch, BasicBlock const& target_block) {
+  u32 relative_address = (u32)((s64)target_block.function - (s64)patch - 5LL);
+
+  patch[0] = 0xE9;
+  patch[1] = (u8)(relative_address >>  0);
+  patch[2] = (u8)(relative_address >>  8);
+  patch[3] = (u8)(relative_address >> 16);
+  patch[4] = (u8)(relative_address >> 24);
+}
+
+void X64Backend::OnBasicBlockToBeDeleted(BasicBlock& basic_block) {
+  // TODO: release the allocated JIT buffer memory.
+
+  // Do not leave dangling pointers to the block exits in the pending link lists or the target blocks.
+  RemoveLinks(basic_block);
+
+  // Exits that still link to this block must not unlink themselves from it later.
+  auto link = basic_block.first_link;
+
+  while (link != nullptr) {
+    auto next_link = link->next_link;
+
+    link->prev_link = nullptr;
+    link->next_link = nullptr;
+    link->link_list = nullptr;
+    link = next_link;
+  }
+
+  basic_block.first_link = nullptr;
+}
+
+void X64Backend::AddLink(BasicBlock::BranchTarget*& list, BasicBlock::BranchTarget& exit) {
+  auto head = list;
+
+  exit.prev_link = nullptr;
+  exit.next_link = head;
+  exit.link_list = &list;
+
+  if (head != nullptr) {
+    head->prev_link = &exit;
+  }
+  list = &exit;
+}
+
+void X64Backend::RemoveLink(BasicBlock::BranchTarget& exit) {
+  auto prev = exit.prev_link;
+  auto next = exit.next_link;
+
+  if (exit.link_list == nullptr) {
+    return;
+  }
+
+  if (prev != nullptr) {
+    prev->next_link = next;
+  } else {
+    *exit.link_list = next;
+  }
+
+  if (next != nullptr) {
+    next->prev_link = prev;
+  }
+
+  exit.prev_link = nullptr;
+  exit.next_link = nullptr;
+  exit.link_list = nullptr;
+}
+
+void X64Backend::RemoveLinks(BasicBlock& basic_block) {
+  RemoveLink(basic_block.branch_target);
+
+  for (int i = 0; i < basic_block.side_exit_count; i++) {
+    RemoveLink(basic_block.side_exits[i]);
   }
 }
 
 void X64Backend::CompileIROp(
   CompileContext const& context,
-  std::unique_ptr<IROpcode> const& op
+  IROpcode* op
 ) {
   switch (op->GetClass()) {
     case IROpcodeClass::NOP: break;
 
     // Context access (compile_context.cpp)
-    case IROpcodeClass::LoadGPR: CompileLoadGPR(context, lunatic_cast<IRLoadGPR>(op.get())); break;
-    case IROpcodeClass::StoreGPR: CompileStoreGPR(context, lunatic_cast<IRStoreGPR>(op.get())); break;
-    case IROpcodeClass::LoadSPSR: CompileLoadSPSR(context, lunatic_cast<IRLoadSPSR>(op.get())); break;
-    case IROpcodeClass::StoreSPSR: CompileStoreSPSR(context, lunatic_cast<IRStoreSPSR>(op.get())); break;
-    case IROpcodeClass::LoadCPSR: CompileLoadCPSR(context, lunatic_cast<IRLoadCPSR>(op.get())); break;
-    case IROpcodeClass::StoreCPSR: CompileStoreCPSR(context, lunatic_cast<IRStoreCPSR>(op.get())); break;
-    case IROpcodeClass::ClearCarry: CompileClearCarry(context, lunatic_cast<IRClearCarry>(op.get())); break;
-    case IROpcodeClass::SetCarry:   CompileSetCarry(context, lunatic_cast<IRSetCarry>(op.get())); break;
-    case IROpcodeClass::UpdateFlags: CompileUpdateFlags(context, lunatic_cast<IRUpdateFlags>(op.get())); break;
-    case IROpcodeClass::UpdateSticky: CompileUpdateSticky(context, lunatic_cast<IRUpdateSticky>(op.get())); break;
+    case IROpcodeClass::LoadGPR: CompileLoadGPR(context, lunatic_cast<IRLoadGPR>(op)); break;
+    case IROpcodeClass::StoreGPR: CompileStoreGPR(context, lunatic_cast<IRStoreGPR>(op)); break;
+    case IROpcodeClass::LoadSPSR: CompileLoadSPSR(context, lunatic_cast<IRLoadSPSR>(op)); break;
+    case IROpcodeClass::StoreSPSR: CompileStoreSPSR(context, lunatic_cast<IRStoreSPSR>(op)); break;
+    case IROpcodeClass::LoadCPSR: CompileLoadCPSR(context, lunatic_cast<IRLoadCPSR>(op)); break;
+    case IROpcodeClass::StoreCPSR: CompileStoreCPSR(context, lunatic_cast<IRStoreCPSR>(op)); break;
+    case IROpcodeClass::ClearCarry: CompileClearCarry(context, lunatic_cast<IRClearCarry>(op)); break;
+    case IROpcodeClass::SetCarry:   CompileSetCarry(context, lunatic_cast<IRSetCarry>(op)); break;
+    case IROpcodeClass::UpdateFlags: CompileUpdateFlags(context, lunatic_cast<IRUpdateFlags>(op)); break;
+    case IROpcodeClass::UpdateSticky: CompileUpdateSticky(context, lunatic_cast<IRUpdateSticky>(op)); break;
     
     // Barrel shifter (compile_shift.cpp)
-    case IROpcodeClass::LSL: CompileLSL(context, lunatic_cast<IRLogicalShiftLeft>(op.get())); break;
-    case IROpcodeClass::LSR: CompileLSR(context, lunatic_cast<IRLogicalShiftRight>(op.get())); break;
-    case IROpcodeClass::ASR: CompileASR(context, lunatic_cast<IRArithmeticShiftRight>(op.get())); break;
-    case IROpcodeClass::ROR: CompileROR(context, lunatic_cast<IRRotateRight>(op.get())); break;
+    case IROpcodeClass::LSL: CompileLSL(context, lunatic_cast<IRLogicalShiftLeft>(op)); break;
+    case IROpcodeClass::LSR: CompileLSR(context, lunatic_cast<IRLogicalShiftRight>(op)); break;
+    case IROpcodeClass::ASR: CompileASR(context, lunatic_cast<IRArithmeticShiftRight>(op)); break;
+    case IROpcodeClass::ROR: CompileROR(context, lunatic_cast<IRRotateRight>(op)); break;
     
     // ALU (compile_alu.cpp)
-    case IROpcodeClass::AND: CompileAND(context, lunatic_cast<IRBitwiseAND>(op.get())); break;
-    case IROpcodeClass::BIC: CompileBIC(context, lunatic_cast<IRBitwiseBIC>(op.get())); break;
-    case IROpcodeClass::EOR: CompileEOR(context, lunatic_cast<IRBitwiseEOR>(op.get())); break;
-    case IROpcodeClass::SUB: CompileSUB(context, lunatic_cast<IRSub>(op.get())); break;
-    case IROpcodeClass::RSB: CompileRSB(context, lunatic_cast<IRRsb>(op.get())); break;
-    case IROpcodeClass::ADD: CompileADD(context, lunatic_cast<IRAdd>(op.get())); break;
-    case IROpcodeClass::ADC: CompileADC(context, lunatic_cast<IRAdc>(op.get())); break;
-    case IROpcodeClass::SBC: CompileSBC(context, lunatic_cast<IRSbc>(op.get())); break;
-    case IROpcodeClass::RSC: CompileRSC(context, lunatic_cast<IRRsc>(op.get())); break;
-    case IROpcodeClass::ORR: CompileORR(context, lunatic_cast<IRBitwiseORR>(op.get())); break;
-    case IROpcodeClass::MOV: CompileMOV(context, lunatic_cast<IRMov>(op.get())); break;
-    case IROpcodeClass::MVN: CompileMVN(context, lunatic_cast<IRMvn>(op.get())); break;
-    case IROpcodeClass::CLZ: CompileCLZ(context, lunatic_cast<IRCountLeadingZeros>(op.get())); break;
-    case IROpcodeClass::QADD: CompileQADD(context, lunatic_cast<IRSaturatingAdd>(op.get())); break;
-    case IROpcodeClass::QSUB: CompileQSUB(context, lunatic_cast<IRSaturatingSub>(op.get())); break;
+    case IROpcodeClass::AND: CompileAND(context, lunatic_cast<IRBitwiseAND>(op)); break;
+    case IROpcodeClass::BIC: CompileBIC(context, lunatic_cast<IRBitwiseBIC>(op)); break;
+    case IROpcodeClass::EOR: CompileEOR(context, lunatic_cast<IRBitwiseEOR>(op)); break;
+    case IROpcodeClass::SUB: CompileSUB(context, lunatic_cast<IRSub>(op)); break;
+    case IROpcodeClass::RSB: CompileRSB(context, lunatic_cast<IRRsb>(op)); break;
+    case IROpcodeClass::ADD: CompileADD(context, lunatic_cast<IRAdd>(op)); break;
+    case IROpcodeClass::ADC: CompileADC(context, lunatic_cast<IRAdc>(op)); break;
+    case IROpcodeClass::SBC: CompileSBC(context, lunatic_cast<IRSbc>(op)); break;
+    case IROpcodeClass::RSC: CompileRSC(context, lunatic_cast<IRRsc>(op)); break;
+    case IROpcodeClass::ORR: CompileORR(context, lunatic_cast<IRBitwiseORR>(op)); break;
+    case IROpcodeClass::MOV: CompileMOV(context, lunatic_cast<IRMov>(op)); break;
+    case IROpcodeClass::MVN: CompileMVN(context, lunatic_cast<IRMvn>(op)); break;
+    case IROpcodeClass::CLZ: CompileCLZ(context, lunatic_cast<IRCountLeadingZeros>(op)); break;
+    case IROpcodeClass::QADD: CompileQADD(context, lunatic_cast<IRSaturatingAdd>(op)); break;
+    case IROpcodeClass::QSUB: CompileQSUB(context, lunatic_cast<IRSaturatingSub>(op)); break;
 
     // Multiply (and accumulate) (compile_multiply.cpp)
-    case IROpcodeClass::MUL: CompileMUL(context, lunatic_cast<IRMultiply>(op.get())); break;
-    case IROpcodeClass::ADD64: CompileADD64(context, lunatic_cast<IRAdd64>(op.get())); break;
+    case IROpcodeClass::MUL: CompileMUL(context, lunatic_cast<IRMultiply>(op)); break;
+    case IROpcodeClass::ADD64: CompileADD64(context, lunatic_cast<IRAdd64>(op)); break;
    
     // Memory read/write (compile_memory.cpp)
-    case IROpcodeClass::MemoryRead: CompileMemoryRead(context, lunatic_cast<IRMemoryRead>(op.get())); break;
-    case IROpcodeClass::MemoryWrite: CompileMemoryWrite(context, lunatic_cast<IRMemoryWrite>(op.get())); break;
+    case IROpcodeClass::MemoryRead: CompileMemoryRead(context, lunatic_cast<IRMemoryRead>(op)); break;
+    case IROpcodeClass::MemoryWrite: CompileMemoryWrite(context, lunatic_cast<IRMemoryWrite>(op)); break;
     
     // Pipeline flush (compile_flush.cpp)
-    case IROpcodeClass::Flush: CompileFlush(context, lunatic_cast<IRFlush>(op.get())); break;
-    case IROpcodeClass::FlushExchange: CompileFlushExchange(context, lunatic_cast<IRFlushExchange>(op.get())); break;
+    case IROpcodeClass::Flush: CompileFlush(context, lunatic_cast<IRFlush>(op)); break;
+    case IROpcodeClass::FlushExchange: CompileFlushExchange(context, lunatic_cast<IRFlushExchange>(op)); break;
 
     // Coprocessor access (compile_coprocessor.cpp)
-    case IROpcodeClass::MRC: CompileMRC(context, lunatic_cast<IRReadCoprocessorRegister>(op.get())); break;
-    case IROpcodeClass::MCR: CompileMCR(context, lunatic_cast<IRWriteCoprocessorRegister>(op.get())); break;
+    case IROpcodeClass::MRC: CompileMRC(context, lunatic_cast<IRReadCoprocessorRegister>(op)); break;
+    case IROpcodeClass::MCR: CompileMCR(context, lunatic_cast<IRWriteCoprocessorRegister>(op)); break;
 
     default: {
       throw std::runtime_error(
@@ -471,7 +1156,7 @@ void X64Backend::CompileIROp(
 
 void X64Backend::Push(
   Xbyak::CodeGenerator& code,
-  std::vector<Xbyak::Reg64> const& regs
+  HostRegList const& regs
 ) {
   for (auto reg : regs) {
     code.push(reg);
@@ -480,20 +1165,18 @@ void X64Backend::Push(
 
 void X64Backend::Pop(
   Xbyak::CodeGenerator& code,
-  std::vector<Xbyak::Reg64> const& regs
+  HostRegList const& regs
 ) {
-  auto end = regs.rend();
-
-  for (auto it = regs.rbegin(); it != end; ++it) {
-    code.pop(*it);
+  for (size_t i = regs.size(); i > 0; i--) {
+    code.pop(regs[i - 1]);
   }
 }
 
 auto X64Backend::GetUsedHostRegsFromList(
   X64RegisterAllocator const& reg_alloc,
-  std::vector<Xbyak::Reg64> const& regs
-) -> std::vector<Xbyak::Reg64> {
-  auto regs_used = std::vector<Xbyak::Reg64>{};
+  HostRegList const& regs
+) -> HostRegList {
+  auto regs_used = HostRegList{};
 
   for (auto reg : regs) {
     if (!reg_alloc.IsHostRegFree(reg)) {
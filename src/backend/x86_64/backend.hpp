@@ -8,8 +8,10 @@
 #pragma once
 
 #include <lunatic/cpu.hpp>
+#include <array>
 #include <fmt/format.h>
-#include <unordered_map>
+#include <initializer_list>
+#include <stdexcept>
 #include <vector>
 
 #include "backend/backend.hpp"
@@ -22,6 +24,32 @@ using namespace lunatic::frontend;
 namespace lunatic {
 namespace backend {
 
+/// Fixed-capacity list of host registers, so that saving registers around calls does not allocate.
+struct HostRegList {
+  HostRegList() = default;
+
+  HostRegList(std::initializer_list<Xbyak::Reg64> regs) {
+    for (auto reg : regs) push_back(reg);
+  }
+
+  auto begin() const -> Xbyak::Reg64 const* { return &data[0]; }
+  auto end() const -> Xbyak::Reg64 const* { return &data[length]; }
+  auto size() const -> size_t { return length; }
+
+  auto operator[](size_t i) const -> Xbyak::Reg64 const& { return data[i]; }
+
+  void push_back(Xbyak::Reg64 reg) {
+    if (length == data.size()) {
+      throw std::runtime_error("HostRegList: out of capacity");
+    }
+    data[length++] = reg;
+  }
+
+private:
+  std::array<Xbyak::Reg64, 16> data;
+  size_t length = 0;
+};
+
 struct X64Backend : Backend {
   X64Backend(
     CPU::Descriptor const& descriptor,
@@ -32,14 +60,27 @@ struct X64Backend : Backend {
 
  ~X64Backend();
 
-  void Compile(BasicBlock& basic_block);
+  void Compile(
+    BasicBlock& basic_block,
+    std::vector<BasicBlock::MicroBlock>& micro_blocks
+  );
 
   auto Call(BasicBlock const& basic_block, int max_cycles) -> int {
     return CallBlock(basic_block.function, max_cycles);
   }
 
+  /// Unlink a basic block that is about to be deleted from the blocks linked to it.
+  void OnBasicBlockToBeDeleted(BasicBlock& basic_block);
+
+  /**
+   * Redirect the exits that link to a block to a new block for the same key, which replaces it.
+   * This must only be done if both blocks were compiled from the same guest code.
+   */
+  void Relink(BasicBlock& old_block, BasicBlock& new_block);
+
 private:
   static constexpr size_t kCodeBufferSize = 32 * 1024 * 1024;
+  static constexpr size_t kPendingLinkBuckets = 4096;
 
   struct CompileContext {
     Xbyak::CodeGenerator& code;
@@ -50,32 +91,134 @@ private:
   void CreateCodeGenerator();
   void EmitCallBlock();
 
-  void EmitConditionalBranch(Condition condition, Xbyak::Label& label_skip);
+  void CompileBasicBlock(
+    BasicBlock& basic_block,
+    std::vector<BasicBlock::MicroBlock> const& micro_blocks,
+    u8 deferred_flags
+  );
+
+  /// Get the compiled block that a basic block links to, if any.
+  auto GetBranchTargetBlock(BasicBlock& basic_block) -> BasicBlock*;
+
+  /// What is known at compile time about the guest flags in AX.
+  struct HostFlagState {
+    /// NZCV flags for which AX holds the same value as the CPSR.
+    u8 synced = 0;
+
+    /// The latest flag update, if AX did not change since and its result was not written to the CPSR yet.
+    IRUpdateFlags* unstored_update = nullptr;
+
+    /// Account for the code that was compiled for an opcode.
+    void Update(IROpcode* op);
+
+    /// Join the state with the state of another path that leads to the same code.
+    void Merge(HostFlagState const& other);
+  };
+
+  void EmitConditionalBranch(
+    Condition condition,
+    Xbyak::Label& label_skip,
+    u8 flags_in_eflags,
+    HostFlagState& host_flags
+  );
+
+  /// Decompress the NZCV flags from the CPSR into AX, unless AX already holds them.
+  void EmitLoadHostFlags(u8 flags, HostFlagState& host_flags);
+
+  /**
+   * Emit a CMOVcc from the source to the destination, which moves if the condition is met.
+   * The condition is tested on the flags in AX, so the x86 flags may have been modified since they were loaded.
+   */
+  void EmitConditionalMove(
+    Condition condition,
+    Xbyak::Reg32 const& dst,
+    Xbyak::Operand const& src
+  );
+
+  /// Get the NZCV flags that a condition code tests.
+  static auto GetConditionFlags(Condition condition) -> u8;
+
+  /**
+   * Check if a conditional micro block can be compiled without branching around it.
+   * This is the case for short micro blocks that only compute values and write them to GPRs,
+   * so that all of it can be done speculatively and the GPR writes select between the old and new value.
+   */
+  static bool IsIfConvertible(BasicBlock::MicroBlock const& micro_block);
+
+  /**
+   * Get the NZCV flags that the x86 flags register holds in the guest format at the end of a micro block.
+   * This is the case if the micro block ends on a flag-setting opcode, whose flags are written to the CPSR
+   * and only data moves follow, so that compiled code does not modify the x86 flags in between.
+   */
+  static auto GetFusableFlags(BasicBlock::MicroBlock const& micro_block) -> u8;
   void EmitBasicBlockDispatch(Xbyak::Label& label_cache_miss);
 
+  /// Write NZCV flags that were deferred from the final flag update from AX to the CPSR.
+  void EmitStoreDeferredFlags(u8 flags);
+
+  /**
+   * Leave the basic block through a side exit, after the side exit micro block was executed.
+   * The program counter already has been written by the micro block.
+   */
+  void EmitSideExit(
+    BasicBlock& basic_block,
+    BasicBlock::BranchTarget& side_exit,
+    int cycles,
+    Xbyak::Label& label_return
+  );
+
+  /**
+   * Check if the guest registers of a block that branches to itself can be kept in host registers across iterations.
+   * This requires that nothing but the compiled code accesses the guest registers or changes the processor mode.
+   */
+  static bool IsLoopPinnable(std::vector<BasicBlock::MicroBlock> const& micro_blocks);
+
+  /// Select the most frequently accessed guest registers of a loop and assign the pinned host registers to them.
+  void PinLoopGPRs(std::vector<BasicBlock::MicroBlock> const& micro_blocks);
+
+  /// Get the host register that a guest register is pinned to, if any.
+  auto GetPinnedHostReg(IRGuestReg reg) -> Xbyak::Reg32 const*;
+
+  /// Load the pinned guest registers from the context into their host registers.
+  void EmitLoadPinnedGPRs();
+
+  /// Write the pinned guest registers back to the context, before the loop is left.
+  void EmitStorePinnedGPRs();
+
   void Link(BasicBlock& basic_block);
 
-  void OnBasicBlockToBeDeleted(BasicBlock const& basic_block);
+  /// Write a relative jump to a compiled block over the five bytes at the patch location.
+  static void PatchJump(u8* patch, BasicBlock const& target_block);
+
+  auto GetPendingLinkList(BasicBlock::Key key) -> BasicBlock::BranchTarget*& {
+    return pending_links[(key.value ^ (key.value >> 12)) & (kPendingLinkBuckets - 1)];
+  }
+
+  static void AddLink(BasicBlock::BranchTarget*& list, BasicBlock::BranchTarget& exit);
+  static void RemoveLink(BasicBlock::BranchTarget& exit);
+
+  /// Remove all exits of a block from the link lists that they are in.
+  static void RemoveLinks(BasicBlock& basic_block);
 
   void CompileIROp(
     CompileContext const& context,
-    std::unique_ptr<IROpcode> const& op
+    IROpcode* op
   );
 
   void Push(
     Xbyak::CodeGenerator& code,
-    std::vector<Xbyak::Reg64> const& regs
+    HostRegList const& regs
   );
 
   void Pop(
     Xbyak::CodeGenerator& code,
-    std::vector<Xbyak::Reg64> const& regs
+    HostRegList const& regs
   );
 
   auto GetUsedHostRegsFromList(
     X64RegisterAllocator const& reg_alloc,
-    std::vector<Xbyak::Reg64> const& regs
-  ) -> std::vector<Xbyak::Reg64>;
+    HostRegList const& regs
+  ) -> HostRegList;
 
   void CompileLoadGPR(CompileContext const& context, IRLoadGPR* op);
   void CompileStoreGPR(CompileContext const& context, IRStoreGPR* op);
@@ -108,6 +251,10 @@ private:
   void CompileQSUB(CompileContext const& context, IRSaturatingSub* op);
   void CompileMUL(CompileContext const& context, IRMultiply* op);
   void CompileADD64(CompileContext const& context, IRAdd64* op);
+  /// Get a host register which holds the address that is accessed by a memory opcode.
+  template<typename OpcodeType>
+  auto GetAddressHostReg(CompileContext const& context, OpcodeType* op) -> Xbyak::Reg32;
+
   void CompileMemoryRead(CompileContext const& context, IRMemoryRead* op);
   void CompileMemoryWrite(CompileContext const& context, IRMemoryWrite* op);
   void CompileFlush(CompileContext const& context, IRFlush* op);
@@ -120,12 +267,51 @@ private:
   std::array<Coprocessor*, 16> coprocessors;
   BasicBlockCache& block_cache;
   bool const& irq_line;
+
+  /// Whether UpdateFlags opcodes must not modify the x86 flags (see CompileBasicBlock()).
+  bool preserve_host_flags = false;
+
+  /// Condition of the if-converted micro block that is being compiled, which StoreGPR opcodes must test.
+  Condition select_condition = Condition::AL;
+
+  /// Whether the guest registers of blocks that branch to themselves may be pinned to host registers.
+  bool enable_loop_pinning;
+
+  /// Whether each block counts its executions in BasicBlock::execution_count (see CPU::Descriptor::profile_blocks).
+  bool enable_profiling;
+
+  /// A guest register which is kept in a host register while a loop is executed.
+  struct PinnedGPR {
+    int id;
+    GPR reg;
+    Mode mode;
+    Xbyak::Reg32 host_reg;
+  };
+
+  /// Guest registers of the loop that is being compiled, which are kept in host registers.
+  std::vector<PinnedGPR> pinned_gprs;
+  std::vector<Xbyak::Reg32> pinned_host_regs;
+
+  /// A guest register that the loop accesses, which may be pinned to a host register.
+  struct PinCandidate {
+    int id;
+    GPR reg;
+    Mode mode;
+    int accesses;
+    bool pinned;
+  };
+
+  /// Guest registers of the loop that is being compiled, kept across compilations so that its capacity is reused.
+  std::vector<PinCandidate> pin_candidates;
+
   int (*CallBlock)(BasicBlock::CompiledFn, int);
 
   u8* buffer;
   Xbyak::CodeGenerator* code;
+  X64RegisterAllocator* reg_alloc;
 
-  std::unordered_map<BasicBlock::Key, std::vector<BasicBlock*>> block_linking_table;
+  /// Block exits waiting for their branch target to be compiled, hashed by the branch target key.
+  std::array<BasicBlock::BranchTarget*, kPendingLinkBuckets> pending_links{};
 };
 
 } // namespace lunatic::backend
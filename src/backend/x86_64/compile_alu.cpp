@@ -21,7 +21,7 @@ void X64Backend::CompileAND(CompileContext const& context, IRBitwiseAND* op) {
     if (op->result.IsNull()) {
       code.test(lhs_reg, imm);
     } else {
-      auto& result_var = op->result.Unwrap();
+      auto& result_var = op->result.GetVar();
 
       reg_alloc.ReleaseVarAndReuseHostReg(lhs_var, result_var);
 
@@ -39,7 +39,7 @@ void X64Backend::CompileAND(CompileContext const& context, IRBitwiseAND* op) {
     if (op->result.IsNull()) {
       code.test(lhs_reg, rhs_reg);
     } else {
-      auto& result_var = op->result.Unwrap(); 
+      auto& result_var = op->result.GetVar(); 
 
       reg_alloc.ReleaseVarAndReuseHostReg(lhs_var, result_var);
       reg_alloc.ReleaseVarAndReuseHostReg(rhs_var, result_var);
@@ -67,7 +67,7 @@ void X64Backend::CompileAND(CompileContext const& context, IRBitwiseAND* op) {
 void X64Backend::CompileBIC(CompileContext const& context, IRBitwiseBIC* op) {
   DESTRUCTURE_CONTEXT;
 
-  auto& result_var = op->result.Unwrap();
+  auto& result_var = op->result.GetVar();
   auto& lhs_var = op->lhs.Get();
   auto  lhs_reg = reg_alloc.GetVariableHostReg(op->lhs.Get());
 
@@ -119,7 +119,7 @@ void X64Backend::CompileEOR(CompileContext const& context, IRBitwiseEOR* op) {
       code.xor_(lhs_reg, imm);
       code.pop(lhs_reg.cvt64());
     } else {
-      auto& result_var = op->result.Unwrap();
+      auto& result_var = op->result.GetVar();
 
       reg_alloc.ReleaseVarAndReuseHostReg(lhs_var, result_var);
 
@@ -140,7 +140,7 @@ void X64Backend::CompileEOR(CompileContext const& context, IRBitwiseEOR* op) {
       code.xor_(lhs_reg, rhs_reg);
       code.pop(lhs_reg.cvt64());
     } else {
-      auto& result_var = op->result.Unwrap();
+      auto& result_var = op->result.GetVar();
 
       reg_alloc.ReleaseVarAndReuseHostReg(lhs_var, result_var);
       reg_alloc.ReleaseVarAndReuseHostReg(rhs_var, result_var);
@@ -178,7 +178,7 @@ void X64Backend::CompileSUB(CompileContext const& context, IRSub* op) {
       code.cmp(lhs_reg, imm);
       code.cmc();
     } else {
-      auto& result_var = op->result.Unwrap();
+      auto& result_var = op->result.GetVar();
 
       reg_alloc.ReleaseVarAndReuseHostReg(lhs_var, result_var);
 
@@ -197,7 +197,7 @@ void X64Backend::CompileSUB(CompileContext const& context, IRSub* op) {
       code.cmp(lhs_reg, rhs_reg);
       code.cmc();
     } else {
-      auto& result_var = op->result.Unwrap();
+      auto& result_var = op->result.GetVar();
 
       reg_alloc.ReleaseVarAndReuseHostReg(lhs_var, result_var);
 
@@ -220,7 +220,7 @@ void X64Backend::CompileSUB(CompileContext const& context, IRSub* op) {
 void X64Backend::CompileRSB(CompileContext const& context, IRRsb* op) {
   DESTRUCTURE_CONTEXT;
 
-  auto& result_var = op->result.Unwrap();
+  auto& result_var = op->result.GetVar();
   auto lhs_reg = reg_alloc.GetVariableHostReg(op->lhs.Get());
 
   if (op->rhs.IsConstant()) {
@@ -261,6 +261,21 @@ void X64Backend::CompileADD(CompileContext const& context, IRAdd* op) {
     return;
   }
 
+  // Shifted operands are only folded into ADDs that do not update the host flags.
+  if (op->rhs_shift != 0) {
+    auto& rhs_var = op->rhs.GetVar();
+    auto  rhs_reg = reg_alloc.GetVariableHostReg(rhs_var);
+    auto& result_var = op->result.GetVar();
+
+    reg_alloc.ReleaseVarAndReuseHostReg(lhs_var, result_var);
+    reg_alloc.ReleaseVarAndReuseHostReg(rhs_var, result_var);
+
+    auto result_reg = reg_alloc.GetVariableHostReg(result_var);
+
+    code.lea(result_reg, dword[lhs_reg.cvt64() + rhs_reg.cvt64() * (1 << op->rhs_shift)]);
+    return;
+  }
+
   if (op->rhs.IsConstant()) {
     auto imm = op->rhs.GetConst().value;
 
@@ -269,7 +284,7 @@ void X64Backend::CompileADD(CompileContext const& context, IRAdd* op) {
       code.mov(eax, lhs_reg);
       code.add(eax, imm);
     } else {
-      auto& result_var = op->result.Unwrap();
+      auto& result_var = op->result.GetVar();
 
       reg_alloc.ReleaseVarAndReuseHostReg(lhs_var, result_var);
 
@@ -289,7 +304,7 @@ void X64Backend::CompileADD(CompileContext const& context, IRAdd* op) {
       code.mov(eax, lhs_reg);
       code.add(eax, rhs_reg);
     } else {
-      auto& result_var = op->result.Unwrap();
+      auto& result_var = op->result.GetVar();
 
       reg_alloc.ReleaseVarAndReuseHostReg(lhs_var, result_var);
       reg_alloc.ReleaseVarAndReuseHostReg(rhs_var, result_var);
@@ -316,7 +331,7 @@ void X64Backend::CompileADD(CompileContext const& context, IRAdd* op) {
 void X64Backend::CompileADC(CompileContext const& context, IRAdc* op) {
   DESTRUCTURE_CONTEXT;
 
-  auto& result_var = op->result.Unwrap();
+  auto& result_var = op->result.GetVar();
   auto& lhs_var = op->lhs.Get();
   auto  lhs_reg = reg_alloc.GetVariableHostReg(lhs_var);
 
@@ -361,7 +376,7 @@ void X64Backend::CompileADC(CompileContext const& context, IRAdc* op) {
 void X64Backend::CompileSBC(CompileContext const& context, IRSbc* op) {
   DESTRUCTURE_CONTEXT;
 
-  auto& result_var = op->result.Unwrap();
+  auto& result_var = op->result.GetVar();
   auto& lhs_var = op->lhs.Get();
   auto  lhs_reg = reg_alloc.GetVariableHostReg(lhs_var);
 
@@ -403,7 +418,7 @@ void X64Backend::CompileSBC(CompileContext const& context, IRSbc* op) {
 void X64Backend::CompileRSC(CompileContext const& context, IRRsc* op) {
   DESTRUCTURE_CONTEXT;
 
-  auto& result_var = op->result.Unwrap();
+  auto& result_var = op->result.GetVar();
   auto lhs_reg = reg_alloc.GetVariableHostReg(op->lhs.Get());
 
   code.sahf();
@@ -440,7 +455,7 @@ void X64Backend::CompileRSC(CompileContext const& context, IRRsc* op) {
 void X64Backend::CompileORR(CompileContext const& context, IRBitwiseORR* op) {
   DESTRUCTURE_CONTEXT;
 
-  auto& result_var = op->result.Unwrap();
+  auto& result_var = op->result.GetVar();
   auto& lhs_var = op->lhs.Get();
   auto  lhs_reg = reg_alloc.GetVariableHostReg(lhs_var);
 
@@ -14,14 +14,55 @@ void X64Backend::CompileLoadGPR(CompileContext const& context, IRLoadGPR* op) {
 
   auto address  = rcx + state.GetOffsetToGPR(op->reg.mode, op->reg.reg);
   auto host_reg = reg_alloc.GetVariableHostReg(op->result.Get());
+  auto pinned_reg = GetPinnedHostReg(op->reg);
 
-  code.mov(host_reg, dword[address]);
+  if (pinned_reg != nullptr) {
+    code.mov(host_reg, *pinned_reg);
+  } else {
+    code.mov(host_reg, dword[address]);
+  }
 }
 
 void X64Backend::CompileStoreGPR(CompileContext const& context, IRStoreGPR* op) {
   DESTRUCTURE_CONTEXT;
 
   auto address = rcx + state.GetOffsetToGPR(op->reg.mode, op->reg.reg);
+  auto pinned_reg = GetPinnedHostReg(op->reg);
+
+  // Inside of a loop the guest register lives in a host register instead of the context.
+  if (pinned_reg != nullptr) {
+    if (select_condition != Condition::AL) {
+      if (op->value.IsConstant()) {
+        auto value_reg = reg_alloc.GetTemporaryHostReg();
+
+        code.mov(value_reg, op->value.GetConst().value);
+        EmitConditionalMove(select_condition, *pinned_reg, value_reg);
+      } else {
+        EmitConditionalMove(select_condition, *pinned_reg, reg_alloc.GetVariableHostReg(op->value.GetVar()));
+      }
+    } else if (op->value.IsConstant()) {
+      code.mov(*pinned_reg, op->value.GetConst().value);
+    } else {
+      code.mov(*pinned_reg, reg_alloc.GetVariableHostReg(op->value.GetVar()));
+    }
+    return;
+  }
+
+  // In an if-converted micro block the GPR keeps its old value, unless the condition is met.
+  if (select_condition != Condition::AL) {
+    auto value_reg = reg_alloc.GetTemporaryHostReg();
+    auto inverse_condition = static_cast<Condition>(static_cast<int>(select_condition) ^ 1);
+
+    if (op->value.IsConstant()) {
+      code.mov(value_reg, op->value.GetConst().value);
+    } else {
+      code.mov(value_reg, reg_alloc.GetVariableHostReg(op->value.GetVar()));
+    }
+
+    EmitConditionalMove(inverse_condition, value_reg, dword[address]);
+    code.mov(dword[address], value_reg);
+    return;
+  }
 
   if (op->value.IsConstant()) {
     code.mov(dword[address], op->value.GetConst().value);
@@ -37,6 +37,38 @@ void X64Backend::CompileUpdateFlags(CompileContext const& context, IRUpdateFlags
   auto pext_mask_reg = reg_alloc.GetTemporaryHostReg();
   auto flags_reg = reg_alloc.GetTemporaryHostReg();
 
+  if (preserve_host_flags) {
+    auto old_flags_reg = reg_alloc.GetTemporaryHostReg();
+    u32 host_mask = 0;
+
+    if (op->flag_n) host_mask |= 0x8000;
+    if (op->flag_z) host_mask |= 0x4000;
+    if (op->flag_c) host_mask |= 0x0100;
+    if (op->flag_v) host_mask |= 0x0001;
+
+    // Same as below, but only with instructions that leave the x86 flags untouched.
+    // Extract the flags to be updated from AX and deposit them into their guest bits.
+    code.mov(pext_mask_reg, host_mask);
+    code.pext(flags_reg, eax, pext_mask_reg);
+    code.mov(pext_mask_reg, mask);
+    code.pdep(flags_reg, flags_reg, pext_mask_reg);
+
+    // Extract the old value of those bits.
+    code.pext(old_flags_reg, input_reg, pext_mask_reg);
+    code.pdep(old_flags_reg, old_flags_reg, pext_mask_reg);
+
+    if (result_reg != input_reg) {
+      code.mov(result_reg, input_reg);
+    }
+
+    // Subtract the old bits (a - b = ~(~a + b)), then add the new bits.
+    code.not_(result_reg);
+    code.lea(result_reg, dword[result_reg.cvt64() + old_flags_reg.cvt64()]);
+    code.not_(result_reg);
+    code.lea(result_reg, dword[result_reg.cvt64() + flags_reg.cvt64()]);
+    return;
+  }
+
   // Convert NZCV bits from AX register into the guest format.
   // Clear the bits which are not to be updated.
   code.mov(pext_mask_reg, 0xC101);
@@ -9,19 +9,58 @@
 
 namespace lunatic::backend {
 
-void X64Backend::CompileMemoryRead(CompileContext const& context, IRMemoryRead* op) {
+template<typename OpcodeType>
+auto X64Backend::GetAddressHostReg(CompileContext const& context, OpcodeType* op) -> Xbyak::Reg32 {
   DESTRUCTURE_CONTEXT;
 
-  Xbyak::Reg32 address_reg;
   auto& address = op->address;
+  auto& index = op->index;
+  auto offset = op->offset;
 
-  if (address.IsVariable()) {
-    address_reg = reg_alloc.GetVariableHostReg(address.GetVar());
-  } else {
-    address_reg = reg_alloc.GetTemporaryHostReg();
+  if (index.IsNull() && offset == 0) {
+    if (address.IsVariable()) {
+      return reg_alloc.GetVariableHostReg(address.GetVar());
+    }
+
+    auto address_reg = reg_alloc.GetTemporaryHostReg();
     code.mov(address_reg, address.GetConst().value);
+    return address_reg;
+  }
+
+  // Compute the folded address (base + (index << shift) + offset) with a single LEA.
+  auto address_reg = reg_alloc.GetTemporaryHostReg();
+  auto scale = 1 << op->index_shift;
+
+  if (address.IsConstant()) {
+    offset += address.GetConst().value;
+
+    if (index.IsNull()) {
+      code.mov(address_reg, offset);
+    } else {
+      auto index_reg = reg_alloc.GetVariableHostReg(index.GetVar()).cvt64();
+
+      code.lea(address_reg, dword[index_reg * scale + s32(offset)]);
+    }
+  } else {
+    auto base_reg = reg_alloc.GetVariableHostReg(address.GetVar()).cvt64();
+
+    if (index.IsNull()) {
+      code.lea(address_reg, dword[base_reg + s32(offset)]);
+    } else {
+      auto index_reg = reg_alloc.GetVariableHostReg(index.GetVar()).cvt64();
+
+      code.lea(address_reg, dword[base_reg + index_reg * scale + s32(offset)]);
+    }
   }
 
+  return address_reg;
+}
+
+void X64Backend::CompileMemoryRead(CompileContext const& context, IRMemoryRead* op) {
+  DESTRUCTURE_CONTEXT;
+
+  auto address_reg = GetAddressHostReg(context, op);
+
   auto result_reg = reg_alloc.GetVariableHostReg(op->result.Get());
   auto flags = op->flags;
 
@@ -189,10 +228,14 @@ void X64Backend::CompileMemoryRead(CompileContext const& context, IRMemoryRead*
   code.mov(kRegArg1.cvt32(), address_reg);
 
   if (flags & Word) {
-    code.and_(kRegArg1.cvt32(), ~3);
+    if (!(flags & Aligned)) {
+      code.and_(kRegArg1.cvt32(), ~3);
+    }
     code.mov(rax, uintptr(&ReadWord));
   } else if (flags & Half) {
-    code.and_(kRegArg1.cvt32(), ~1);
+    if (!(flags & Aligned)) {
+      code.and_(kRegArg1.cvt32(), ~1);
+    }
     code.mov(rax, uintptr(&ReadHalf));
   } else if (flags & Byte) {
     code.mov(rax, uintptr(&ReadByte));
@@ -226,7 +269,8 @@ void X64Backend::CompileMemoryRead(CompileContext const& context, IRMemoryRead*
 
   code.L(label_final);
 
-  if (flags & Rotate) {
+  // Aligned accesses are rotated by zero bits.
+  if ((flags & Rotate) && !(flags & Aligned)) {
     if (flags & Word) {
       code.mov(ecx, address_reg);
       code.and_(cl, 3);
@@ -245,7 +289,7 @@ void X64Backend::CompileMemoryRead(CompileContext const& context, IRMemoryRead*
   /* ARM7TDMI/ARMv4T special case: unaligned LDRSH is effectively LDRSB.
    * TODO: this can probably be optimized by checking for misalignment early.
    */
-  if ((flags & kHalfSignedARMv4T) == kHalfSignedARMv4T) {
+  if ((flags & kHalfSignedARMv4T) == kHalfSignedARMv4T && !(flags & Aligned)) {
     auto label_aligned = Xbyak::Label{};
 
     code.bt(address_reg, 0);
@@ -271,15 +315,7 @@ void X64Backend::CompileMemoryWrite(CompileContext const& context, IRMemoryWrite
     code.mov(source_reg, source.GetConst().value);
   }
 
-  Xbyak::Reg32 address_reg;
-  auto& address = op->address;
-
-  if (address.IsVariable()) {
-    address_reg = reg_alloc.GetVariableHostReg(address.GetVar());
-  } else {
-    address_reg = reg_alloc.GetTemporaryHostReg();
-    code.mov(address_reg, address.GetConst().value);
-  }
+  auto address_reg = GetAddressHostReg(context, op);
 
   auto scratch_reg = reg_alloc.GetTemporaryHostReg();
   auto flags = op->flags;
@@ -437,10 +473,14 @@ void X64Backend::CompileMemoryWrite(CompileContext const& context, IRMemoryWrite
   }
 
   if (flags & Word) {
-    code.and_(kRegArg1.cvt32(), ~3);
+    if (!(flags & Aligned)) {
+      code.and_(kRegArg1.cvt32(), ~3);
+    }
     code.mov(rax, uintptr(&WriteWord));
   } else if (flags & Half) {
-    code.and_(kRegArg1.cvt32(), ~1);
+    if (!(flags & Aligned)) {
+      code.and_(kRegArg1.cvt32(), ~1);
+    }
     code.mov(rax, uintptr(&WriteHalf));
   } else if (flags & Byte) {
     code.mov(rax, uintptr(&WriteByte));
@@ -18,9 +18,9 @@ void X64Backend::CompileMUL(CompileContext const& context, IRMultiply* op) {
   auto  lhs_reg = reg_alloc.GetVariableHostReg(op->lhs.Get());
   auto  rhs_reg = reg_alloc.GetVariableHostReg(op->rhs.Get());
 
-  if (op->result_hi.HasValue()) {
+  if (!op->result_hi.IsNull()) {
     auto result_lo_reg = reg_alloc.GetVariableHostReg(result_lo_var);
-    auto result_hi_reg = reg_alloc.GetVariableHostReg(op->result_hi.Unwrap());
+    auto result_hi_reg = reg_alloc.GetVariableHostReg(op->result_hi.GetVar());
     auto rhs_ext_reg = reg_alloc.GetTemporaryHostReg().cvt64();
 
     if (op->lhs.Get().data_type == IRDataType::SInt32) {
@@ -35,6 +35,8 @@ void X64Backend::CompileMUL(CompileContext const& context, IRMultiply* op) {
 
     if (op->update_host_flags) {
       code.test(result_hi_reg.cvt64(), result_hi_reg.cvt64());
+      // load flags but preserve carry
+      code.bt(ax, 8);
       code.lahf();
     }
 
@@ -57,6 +59,7 @@ void X64Backend::CompileMUL(CompileContext const& context, IRMultiply* op) {
 
     if (op->update_host_flags) {
       code.test(result_lo_reg, result_lo_reg);
+      code.bt(ax, 8);
       code.lahf();
     }
   }
@@ -100,6 +103,8 @@ void X64Backend::CompileADD64(CompileContext const& context, IRAdd64* op) {
     code.or_(result_lo_reg.cvt64(), rhs_lo_reg);
 
     code.add(result_hi_reg.cvt64(), result_lo_reg.cvt64());
+    // UMLALS and SMLALS only update N and Z
+    code.bt(ax, 8);
     code.lahf();
   
     code.mov(result_lo_reg, result_hi_reg);
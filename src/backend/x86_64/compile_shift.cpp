@@ -21,6 +21,25 @@ void X64Backend::CompileLSL(CompileContext const& context, IRLogicalShiftLeft* o
 
   auto result_reg = reg_alloc.GetVariableHostReg(result_var);
 
+  // Without the carry-out the shift can be done on the 32-bit register directly.
+  if (amount.IsConstant() && !op->update_host_flags) {
+    auto amount_value = amount.GetConst().value;
+
+    if (amount_value >= 32) {
+      code.xor_(result_reg, result_reg);
+    } else if (amount_value >= 1 && amount_value <= 3 && result_reg != operand_reg) {
+      code.lea(result_reg, dword[operand_reg.cvt64() * (1 << amount_value)]);
+    } else {
+      if (result_reg != operand_reg) {
+        code.mov(result_reg, operand_reg);
+      }
+      if (amount_value != 0) {
+        code.shl(result_reg, u8(amount_value));
+      }
+    }
+    return;
+  }
+
   if (result_reg != operand_reg) {
     code.mov(result_reg, operand_reg);
   }
@@ -65,6 +84,21 @@ void X64Backend::CompileLSR(CompileContext const& context, IRLogicalShiftRight*
   reg_alloc.ReleaseVarAndReuseHostReg(operand_var, result_var);
 
   auto result_reg = reg_alloc.GetVariableHostReg(result_var);
+
+  if (amount.IsConstant() && !op->update_host_flags) {
+    auto amount_value = amount.GetConst().value;
+
+    // LSR #0 equals to LSR #32
+    if (amount_value == 0 || amount_value >= 32) {
+      code.xor_(result_reg, result_reg);
+    } else {
+      if (result_reg != operand_reg) {
+        code.mov(result_reg, operand_reg);
+      }
+      code.shr(result_reg, u8(amount_value));
+    }
+    return;
+  }
   
   if (result_reg != operand_reg) {
     code.mov(result_reg, operand_reg);
@@ -113,6 +147,21 @@ void X64Backend::CompileASR(CompileContext const& context, IRArithmeticShiftRigh
 
   auto result_reg = reg_alloc.GetVariableHostReg(result_var);
 
+  if (amount.IsConstant() && !op->update_host_flags) {
+    auto amount_value = amount.GetConst().value;
+
+    // ASR #0 equals to ASR #32, which fills the result with the sign-bit just like ASR #31.
+    if (amount_value == 0 || amount_value > 31) {
+      amount_value = 31;
+    }
+
+    if (result_reg != operand_reg) {
+      code.mov(result_reg, operand_reg);
+    }
+    code.sar(result_reg, u8(amount_value));
+    return;
+  }
+
   // Mirror sign-bit in the upper 32-bit of the full 64-bit register.
   code.movsxd(result_reg.cvt64(), operand_reg);
 
@@ -165,6 +214,12 @@ void X64Backend::CompileROR(CompileContext const& context, IRRotateRight* op) {
   auto result_reg = reg_alloc.GetVariableHostReg(result_var);
   auto label_done = Xbyak::Label{};
 
+  // RORX neither needs the operand to be copied first nor touches the host flags.
+  if (amount.IsConstant() && amount.GetConst().value != 0 && !op->update_host_flags) {
+    code.rorx(result_reg, operand_reg, u8(amount.GetConst().value & 31));
+    return;
+  }
+
   if (result_reg != operand_reg) {
     code.mov(result_reg, operand_reg);
   }
@@ -5,6 +5,7 @@
  * found in the LICENSE file.
  */
 
+#include <algorithm>
 #include <iterator>
 
 #include "register_allocator.hpp"
@@ -15,16 +16,21 @@ using namespace Xbyak::util;
 namespace lunatic {
 namespace backend {
 
-X64RegisterAllocator::X64RegisterAllocator(
+X64RegisterAllocator::X64RegisterAllocator(Xbyak::CodeGenerator& code) : code(code) {
+}
+
+void X64RegisterAllocator::Reset(
   IREmitter const& emitter,
-  Xbyak::CodeGenerator& code
-) : emitter(emitter), code(code) {
+  std::vector<Xbyak::Reg32> const& reserved_host_regs
+) {
+  this->emitter = &emitter;
+
   // Static allocation:
   //   - rax: host flags via lahf (overflow flag in al)
   //   - rbx: number of cycles left
   //   - rcx: pointer to guest state (lunatic::frontend::State)
   //   - rbp: pointer to stack frame / spill area.
-  free_host_regs = {
+  free_host_regs.assign({
     edx,
     esi,
     edi,
@@ -36,12 +42,21 @@ X64RegisterAllocator::X64RegisterAllocator(
     r13d,
     r14d,
     r15d
-  };
+  });
+
+  for (auto reg : reserved_host_regs) {
+    free_host_regs.erase(std::find(free_host_regs.begin(), free_host_regs.end(), reg));
+  }
 
+  // assign() only allocates when the program has more variables than any program before.
   auto number_of_vars = emitter.Vars().size();
-  var_id_to_host_reg.resize(number_of_vars);
-  var_id_to_point_of_last_use.resize(number_of_vars);
-  var_id_to_spill_slot.resize(number_of_vars);
+  var_id_to_host_reg.assign(number_of_vars, {});
+  var_id_to_point_of_last_use.assign(number_of_vars, 0);
+  var_id_to_spill_slot.assign(number_of_vars, {});
+
+  free_spill_bitmap.reset();
+  temp_host_regs.clear();
+  location = 0;
 
   EvaluateVariableLifetimes();
 
@@ -115,26 +130,24 @@ bool X64RegisterAllocator::IsHostRegFree(Xbyak::Reg64 reg) const {
 }
 
 void X64RegisterAllocator::EvaluateVariableLifetimes() {
-  for (auto const& var : emitter.Vars()) {
-    int point_of_last_use = -1;
-    int location = 0;
+  int location = 0;
 
-    for (auto const& op : emitter.Code()) {
-      if (op->Writes(*var) || op->Reads(*var)) {
-        point_of_last_use = location;
-      }
+  for (auto op : emitter->Code()) {
+    auto operands = op->GetOperands();
+    auto operand_count = op->GetOperandCount();
 
-      location++;
+    for (int i = 0; i < operand_count; i++) {
+      if (operands[i].IsVariable()) {
+        var_id_to_point_of_last_use[operands[i].GetVar().id] = location;
+      }
     }
 
-    if (point_of_last_use != -1) {
-      var_id_to_point_of_last_use[var->id] = point_of_last_use;
-    }
+    location++;
   }
 }
 
 void X64RegisterAllocator::ReleaseDeadVariables() {
-  for (auto const& var : emitter.Vars()) {
+  for (auto const& var : emitter->Vars()) {
     auto point_of_last_use = var_id_to_point_of_last_use[var->id];
 
     if (location > point_of_last_use) {
@@ -161,11 +174,11 @@ auto X64RegisterAllocator::FindFreeHostReg() -> Xbyak::Reg32 {
     return reg;
   }
 
-  auto const& current_op = *current_op_iter;
+  auto current_op = *current_op_iter;
 
   // Find a variable to be spilled and deallocate it.
   // TODO: think of a smart way to pick which variable/register to spill.
-  for (auto const& var : emitter.Vars()) {
+  for (auto const& var : emitter->Vars()) {
     if (var_id_to_host_reg[var->id].HasValue()) {
       // Make sure the variable that we spill is not currently used.
       if (current_op->Reads(*var) || current_op->Writes(*var)) {
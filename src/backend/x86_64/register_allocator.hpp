@@ -27,9 +27,18 @@ struct X64RegisterAllocator {
 
   static constexpr int kSpillAreaSize = 32;
 
-  X64RegisterAllocator(
+  X64RegisterAllocator(Xbyak::CodeGenerator& code);
+
+  /**
+   * Prepare allocating host registers for a new IR program.
+   * The internal storage is reused across programs.
+   *
+   * @param  emitter  The IR program
+   * @param  reserved_host_regs  Host registers which must not be allocated
+   */
+  void Reset(
     IREmitter const& emitter,
-    Xbyak::CodeGenerator& code
+    std::vector<Xbyak::Reg32> const& reserved_host_regs = {}
   );
 
   /**
@@ -89,7 +98,7 @@ private:
    */
   auto FindFreeHostReg() -> Xbyak::Reg32;
 
-  IREmitter const& emitter;
+  IREmitter const* emitter = nullptr;
   Xbyak::CodeGenerator& code;
 
   /// Host register that are free and can be allocated.
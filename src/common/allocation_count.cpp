@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2022 fleroviux. All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include "allocation_count.hpp"
+
+#ifdef LUNATIC_COUNT_ALLOCATIONS
+
+#include <cstdlib>
+#include <new>
+
+namespace lunatic {
+
+static thread_local u64 allocation_count = 0;
+
+auto GetAllocationCount() -> u64 {
+  return allocation_count;
+}
+
+} // namespace lunatic
+
+static auto Allocate(std::size_t size) -> void* {
+  lunatic::allocation_count++;
+  return std::malloc(size == 0 ? 1 : size);
+}
+
+static auto AllocateAligned(std::size_t size, std::align_val_t alignment) -> void* {
+  auto align = static_cast<std::size_t>(alignment);
+
+  lunatic::allocation_count++;
+
+#ifdef _WIN32
+  return _aligned_malloc(size == 0 ? 1 : size, align);
+#else
+  // The size must be a multiple of the alignment.
+  return std::aligned_alloc(align, (size + align - 1) & ~(align - 1));
+#endif
+}
+
+static void FreeAligned(void* ptr) {
+#ifdef _WIN32
+  _aligned_free(ptr);
+#else
+  std::free(ptr);
+#endif
+}
+
+void* operator new(std::size_t size) {
+  if (auto ptr = Allocate(size)) {
+    return ptr;
+  }
+  throw std::bad_alloc{};
+}
+
+void* operator new[](std::size_t size) {
+  return operator new(size);
+}
+
+void* operator new(std::size_t size, std::nothrow_t const&) noexcept {
+  return Allocate(size);
+}
+
+void* operator new[](std::size_t size, std::nothrow_t const&) noexcept {
+  return Allocate(size);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment) {
+  if (auto ptr = AllocateAligned(size, alignment)) {
+    return ptr;
+  }
+  throw std::bad_alloc{};
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment) {
+  return operator new(size, alignment);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment, std::nothrow_t const&) noexcept {
+  return AllocateAligned(size, alignment);
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment, std::nothrow_t const&) noexcept {
+  return AllocateAligned(size, alignment);
+}
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::nothrow_t const&) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, std::nothrow_t const&) noexcept { std::free(ptr); }
+
+void operator delete(void* ptr, std::align_val_t) noexcept { FreeAligned(ptr); }
+void operator delete[](void* ptr, std::align_val_t) noexcept { FreeAligned(ptr); }
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept { FreeAligned(ptr); }
+void operator delete[](void* ptr, std::size_t, std::align_val_t) noexcept { FreeAligned(ptr); }
+void operator delete(void* ptr, std::align_val_t, std::nothrow_t const&) noexcept { FreeAligned(ptr); }
+void operator delete[](void* ptr, std::align_val_t, std::nothrow_t const&) noexcept { FreeAligned(ptr); }
+
+#else
+
+namespace lunatic {
+
+auto GetAllocationCount() -> u64 {
+  return 0;
+}
+
+} // namespace lunatic
+
+#endif
@@ -0,0 +1,34 @@
+/*
+ * Copyright (C) 2022 fleroviux. All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#pragma once
+
+#include <lunatic/integer.hpp>
+
+namespace lunatic {
+
+/**
+ * Get the number of heap allocations which the calling thread made so far.
+ * Allocations are only counted if the library is built with LUNATIC_COUNT_ALLOCATIONS,
+ * which replaces the global operator new. Otherwise this always returns zero.
+ */
+auto GetAllocationCount() -> u64;
+
+/// Adds the number of heap allocations which the calling thread makes during the lifetime of the scope to a counter.
+struct AllocationCountScope {
+  explicit AllocationCountScope(u64& counter) : counter(counter), count_start(GetAllocationCount()) {}
+
+ ~AllocationCountScope() {
+    counter += GetAllocationCount() - count_start;
+  }
+
+private:
+  u64& counter;
+  u64 count_start;
+};
+
+} // namespace lunatic
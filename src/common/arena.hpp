@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2022 fleroviux. All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <lunatic/integer.hpp>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace lunatic {
+
+/// Bump allocator for short-lived objects, like the IR of a single compilation.
+/// Objects are carved out of large chunks and are never released individually.
+/// Instead Reset() rewinds the arena, keeping its chunks around for reuse.
+struct Arena {
+  static constexpr size_t kChunkSize = 64 * 1024;
+
+  Arena() = default;
+  Arena(Arena const&) = delete;
+  Arena& operator=(Arena const&) = delete;
+
+ ~Arena() {
+    Chunk* chunk = head;
+
+    while (chunk != nullptr) {
+      Chunk* next_chunk = chunk->next;
+      std::free(chunk);
+      chunk = next_chunk;
+    }
+  }
+
+  auto Allocate(size_t size, size_t alignment = alignof(std::max_align_t)) -> void* {
+    uintptr address = (cursor + alignment - 1) & ~(uintptr)(alignment - 1);
+
+    if (current == nullptr || address + size > limit) {
+      NextChunk(size + alignment);
+      address = (cursor + alignment - 1) & ~(uintptr)(alignment - 1);
+    }
+
+    cursor = address + size;
+    return reinterpret_cast<void*>(address);
+  }
+
+  template<typename T, typename... Args>
+  auto New(Args&&... args) -> T* {
+    // Objects are never destructed, so they must not own any resources.
+    static_assert(std::is_trivially_destructible_v<T>,
+      "Arena: type must be trivially destructible");
+
+    return new (Allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+  }
+
+  /// Release all objects at once, but keep the chunks for future allocations.
+  void Reset() {
+    current = nullptr;
+    cursor = 0;
+    limit = 0;
+  }
+
+private:
+  struct Chunk {
+    Chunk* next;
+    size_t size;
+  };
+
+  void NextChunk(size_t min_size) {
+    Chunk* next_chunk = current ? current->next : head;
+
+    // Skip cached chunks that are too small to hold the allocation.
+    while (next_chunk != nullptr && next_chunk->size < min_size) {
+      next_chunk = next_chunk->next;
+    }
+
+    if (next_chunk == nullptr) {
+      auto size = std::max(kChunkSize, min_size);
+
+      next_chunk = (Chunk*)std::malloc(sizeof(Chunk) + size);
+
+      if (next_chunk == nullptr) {
+        throw std::bad_alloc{};
+      }
+
+      next_chunk->size = size;
+      next_chunk->next = nullptr;
+
+      if (tail == nullptr) {
+        head = next_chunk;
+      } else {
+        tail->next = next_chunk;
+      }
+      tail = next_chunk;
+    }
+
+    current = next_chunk;
+    cursor = reinterpret_cast<uintptr>(next_chunk + 1);
+    limit = cursor + next_chunk->size;
+  }
+
+  Chunk* head = nullptr;
+  Chunk* tail = nullptr;
+  Chunk* current = nullptr;
+  uintptr cursor = 0;
+  uintptr limit = 0;
+};
+
+} // namespace lunatic
@@ -7,7 +7,6 @@
 
 #pragma once
 
-#include <fmt/format.h>
 #include <lunatic/integer.hpp>
 
 #ifdef _WIN32
@@ -173,54 +172,4 @@ private:
   List full_pools;
 };
 
-extern PoolAllocator<u16, 4096, 126> g_pool_alloc;
-
-struct PoolObject {
-  auto operator new(size_t size) -> void* {
-#ifndef NDEBUG
-    if (size > decltype(g_pool_alloc)::max_size) {
-      throw std::runtime_error(
-        fmt::format("PoolObject: requested size ({}) is larger than the supported maximum ({})",
-          size, decltype(g_pool_alloc)::max_size));
-    }
-#endif
-    return g_pool_alloc.Allocate();
-  }
-
-  void operator delete(void* object) {
-    g_pool_alloc.Release(object);
-  }
-};
-
-// Wrapper around our g_pool_alloc that implements the 'Allocator' named requirements:
-// https://en.cppreference.com/w/cpp/named_req/Allocator
-template<typename T>
-struct StdPoolAlloc {
-  static_assert(sizeof(T) <= decltype(g_pool_alloc)::max_size,
-    "StdPoolAlloc: type exceeds maxmimum supported allocation size");
-
-  using value_type = T;
-
-  StdPoolAlloc() = default;
-
-  template <typename T2>
-  StdPoolAlloc(const StdPoolAlloc<T2>&) {}
-
-  bool operator==(const StdPoolAlloc<T>&) const noexcept {
-    return true;
-  }
-
-  bool operator!=(const StdPoolAlloc<T>&) const noexcept {
-    return false;
-  }
-
-  auto allocate(std::size_t n) -> T* {
-    return (T*)g_pool_alloc.Allocate();
-  }
-
-  void deallocate(T* p, size_t n) {
-    g_pool_alloc.Release(p);
-  }
-};
-
 } // namespace lunatic
@@ -7,11 +7,9 @@
 
 #pragma once
 
-#include <functional>
 #include <lunatic/integer.hpp>
 #include <vector>
 
-#include "common/pool_allocator.hpp"
 #include "decode/definition/common.hpp"
 #include "ir/emitter.hpp"
 #include "state.hpp"
@@ -19,7 +17,9 @@
 namespace lunatic {
 namespace frontend {
 
-struct BasicBlock : PoolObject {
+/// Runtime record of a compiled basic block.
+/// Data that only is needed during translation (like the IR) is kept elsewhere.
+struct BasicBlock {
   using CompiledFn = uintptr;
 
   union Key {
@@ -70,11 +70,12 @@ struct BasicBlock : PoolObject {
     u64 value = 0;
   } key;
 
-  BasicBlock() = default;
-  explicit BasicBlock(Key key) : key(key) {}
+  BasicBlock() {
+    branch_target.owner = this;
+  }
 
- ~BasicBlock() {
-    for (auto& callback : release_callbacks) callback(*this);
+  explicit BasicBlock(Key key) : key(key) {
+    branch_target.owner = this;
   }
 
   bool operator==(BasicBlock const& other) const {
@@ -85,36 +86,83 @@ struct BasicBlock : PoolObject {
     return key != other.key;
   }
 
-  void RegisterReleaseCallback(std::function<void(BasicBlock const&)> const& callback) {
-    release_callbacks.push_back(callback);
-  }
-
-  int length = 0;
-
+  /// A run of opcodes that share a condition.
+  /// Micro blocks only live until the basic block has been compiled.
   struct MicroBlock {
     Condition condition;
     IREmitter emitter;
     int length = 0;
-  };
 
-  std::vector<MicroBlock> micro_blocks;
+    /**
+     * Value of the program counter after the micro block, which is where the code continues if its condition is not met.
+     * The micro blocks are not necessarily contiguous, because the translator follows unconditional branches.
+     */
+    u32 next_address = 0;
+
+    /// If not empty, the basic block is left towards this block after the (conditional) micro block was executed.
+    Key side_exit{};
+  };
 
   // Pointer to the compiled code.
   CompiledFn function = (CompiledFn)0;
 
+  /// An exit of the block, which can be linked to the block it leads to by a direct jump.
   struct BranchTarget {
     Key key{};
     u8* patch_location = nullptr;
+
+    /// The block that this exit belongs to.
+    BasicBlock* owner = nullptr;
+
+    /// Links of this exit inside the list of exits that are linked to (or waiting for) the same block.
+    BranchTarget* prev_link = nullptr;
+    BranchTarget* next_link = nullptr;
+    BranchTarget** link_list = nullptr;
   } branch_target;
 
-  std::vector<BasicBlock*> linking_blocks;
+  /// Intrusive list of the exits (of any block) that link to this block.
+  BranchTarget* first_link = nullptr;
+
+  /// Maximum number of side exits of a block. The translator ends the block at any further forward branch.
+  static constexpr int kMaxSideExits = 4;
+
+  /// Exits for the side exit micro blocks, in order. Allocated by BasicBlockCache::AllocateSideExits().
+  BranchTarget* side_exits = nullptr;
+  u8 side_exit_count = 0;
+
+  /// A memory read of an idle loop, from a constant address or from a GPR that the loop does not write.
+  struct IdleLoopRead {
+    u32 offset;
+    GPR base_reg : 8;
+    Mode base_mode : 8;
+    bool has_base;
+    u8 size;
+  };
+
+  /// Maximum number of memory reads of an idle loop. Loops which read more are not detected.
+  static constexpr int kMaxIdleLoopReads = 2;
+
+  /// Memory reads of the idle loop, which must not have side effects for the loop to be skipped.
+  IdleLoopRead idle_loop_reads[kMaxIdleLoopReads];
+  u8 idle_loop_read_count = 0;
 
   u32 hash = 0;
+  int length = 0;
   bool enable_fast_dispatch = true;
   bool uses_exception_base = false;
 
-private:
-  std::vector<std::function<void(BasicBlock const&)>> release_callbacks;
+  /// The block branches to itself and reaches the same state again, unless the values it reads from memory change.
+  bool idle_loop = false;
+
+  /// The block was compiled by the baseline tier and returns to the dispatcher once tier_up_counter reaches zero.
+  bool tier_up = false;
+  u32 tier_up_counter = 0;
+
+  /// Number of times that the compiled code was executed, if CPU::Descriptor::profile_blocks is enabled.
+  u64 execution_count = 0;
+
+  /// NZCV flags that the block may read before overwriting them (see GetFlagsLiveIn()).
+  u8 flags_live_in = 15;
 };
 
 } // namespace lunatic::frontend
@@ -7,22 +7,43 @@
 
 #pragma once
 
+#include <memory>
+#include <new>
+#include <stdexcept>
+
+#include "common/pool_allocator.hpp"
 #include "basic_block.hpp"
 
 namespace lunatic {
 namespace frontend {
 
 struct BasicBlockCache {
+  /// Notified right before a basic block is deleted.
+  struct Client {
+    virtual ~Client() = default;
+
+    virtual void OnBasicBlockToBeDeleted(BasicBlock& basic_block) = 0;
+  };
+
+  BasicBlockCache(Client& client) : client(client) {}
+
  ~BasicBlockCache() {
     /* Make sure that the cache does not consist of stale points,
-     * once the basic blocks are deleted and X64Backend::OnBasicBlockToBeDeleted() will be called.
+     * once the basic blocks are deleted and Client::OnBasicBlockToBeDeleted() will be called.
      */
     Flush();
   }
 
   void Flush() {
     for (int i = 0; i < 0x40000; i++) {
-      data[i] = {};
+      // Unlink the table first, so that no stale blocks are found while releasing the blocks.
+      auto table = std::move(data[i]);
+
+      if (table != nullptr) {
+        for (auto block : table->data) {
+          if (block != nullptr) Delete(block);
+        }
+      }
     }
   }
 
@@ -44,12 +65,57 @@ struct BasicBlockCache {
     }
   }
 
+  /// Allocate a basic block. The cache owns the block once it has been passed to Set().
+  auto New(BasicBlock::Key key) -> BasicBlock* {
+    return new (block_pool.Allocate()) BasicBlock{key};
+  }
+
+  void Delete(BasicBlock* block) {
+    client.OnBasicBlockToBeDeleted(*block);
+
+    if (block->side_exits != nullptr) {
+      side_exit_pool.Release(block->side_exits);
+    }
+
+    block->~BasicBlock();
+    block_pool.Release(block);
+  }
+
+  /// Allocate the side exits of a block, which are released together with the block.
+  void AllocateSideExits(BasicBlock& block, int count) {
+    if (count > BasicBlock::kMaxSideExits) {
+      throw std::runtime_error("lunatic: too many side exits in a basic block");
+    }
+
+    if (count != 0 && block.side_exits == nullptr) {
+      block.side_exits = (BasicBlock::BranchTarget*)side_exit_pool.Allocate();
+    }
+
+    for (int i = 0; i < count; i++) {
+      new (&block.side_exits[i]) BasicBlock::BranchTarget{};
+    }
+
+    block.side_exit_count = count;
+  }
+
   auto Get(BasicBlock::Key key) const -> BasicBlock* {
     auto& table = data[key.value >> 19];
     if (table == nullptr) {
       return nullptr;
     }
-    return table->data[key.value & 0x7FFFF].get();
+    return table->data[key.value & 0x7FFFF];
+  }
+
+  /// Call a function with each basic block in the cache.
+  template<typename Function>
+  void ForEach(Function&& callback) const {
+    for (auto const& table : data) {
+      if (table != nullptr) {
+        for (auto block : table->data) {
+          if (block != nullptr) callback(*block);
+        }
+      }
+    }
   }
 
   void Set(BasicBlock::Key key, BasicBlock* block) {
@@ -61,27 +127,59 @@ struct BasicBlockCache {
       data[hash0] = std::make_unique<Table>();
     }
 
-    auto current_block = std::move(table->data[hash1]);
+    auto current_block = table->data[hash1];
+
+    table->data[hash1] = nullptr;
 
     // Temporary fix: remove any linked blocks from the cache as well.
-    if (current_block && current_block.get() != block) {
-      for (auto linking_block : current_block->linking_blocks) {
-        if (linking_block != current_block.get()) {
-          Set(linking_block->key, nullptr);
+    if (current_block && current_block != block) {
+      auto link = current_block->first_link;
+
+      while (link != nullptr) {
+        auto owner = link->owner;
+
+        /* Deleting the linking block unlinks all of its exits from the list.
+         * Those may include the next exit in the list, so start over in that case.
+         */
+        if (owner != current_block && Get(owner->key) == owner) {
+          Set(owner->key, nullptr);
+          link = current_block->first_link;
+        } else {
+          link = link->next_link;
         }
       }
     }
 
-    table->data[hash1] = std::unique_ptr<BasicBlock>{block};
+    table->data[hash1] = block;
+
+    if (current_block && current_block != block) {
+      Delete(current_block);
+    }
   }
 
   struct Table {
     // int use_count = 0;
-    std::unique_ptr<BasicBlock> data[0x80000];
+    BasicBlock* data[0x80000] {};
   };
 
   // TODO: better manage the lifetimes of the tables.
   std::unique_ptr<Table> data[0x40000];
+
+private:
+  // The object size plus the 16-bit object ID keep the pool objects 8-byte aligned.
+  static constexpr size_t kBlockObjectSize = 142;
+  static constexpr size_t kSideExitObjectSize = sizeof(BasicBlock::BranchTarget) * BasicBlock::kMaxSideExits + 6;
+
+  static_assert(sizeof(BasicBlock) <= kBlockObjectSize, "BasicBlockCache: BasicBlock exceeds the pool object size");
+  static_assert((kSideExitObjectSize + sizeof(u16)) % 8 == 0, "BasicBlockCache: side exits are not 8-byte aligned");
+
+  Client& client;
+
+  /// Basic blocks are allocated per CPU instance, so that CPUs can run on separate threads.
+  PoolAllocator<u16, 4096, kBlockObjectSize> block_pool;
+
+  /// The side exits of all blocks that have any, in arrays of BasicBlock::kMaxSideExits.
+  PoolAllocator<u16, 1024, kSideExitObjectSize> side_exit_pool;
 };
 
 } // namespace lunatic::frontend
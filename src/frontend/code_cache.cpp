@@ -0,0 +1,664 @@
+/*
+ * Copyright (C) 2022 fleroviux. All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <type_traits>
+
+#include "code_cache.hpp"
+
+namespace lunatic {
+namespace frontend {
+
+namespace {
+
+constexpr u32 kMagic = 0x434E554C; // 'LUNC'
+
+enum class OperandType : u8 {
+  Null,
+  Variable,
+  Constant
+};
+
+struct Writer {
+  std::vector<u8>& data;
+
+  template<typename T>
+  void Write(T value) {
+    auto bytes = reinterpret_cast<u8 const*>(&value);
+
+    data.insert(data.end(), bytes, bytes + sizeof(T));
+  }
+
+  void Write(IRAnyRef const& operand) {
+    if (operand.IsVariable()) {
+      Write(OperandType::Variable);
+      Write<u32>(operand.GetVar().id);
+    } else if (operand.IsConstant()) {
+      Write(OperandType::Constant);
+      Write<u32>(operand.GetConst().value);
+    } else {
+      Write(OperandType::Null);
+    }
+  }
+
+  void Write(IRGuestReg const& reg) {
+    Write<u8>(u8(reg.reg));
+    Write<u8>(u8(reg.mode));
+  }
+};
+
+/// Reads data written by Writer and throws if the data ends early or is invalid.
+struct Reader {
+  u8 const* data;
+  size_t size;
+  size_t position = 0;
+
+  template<typename T>
+  auto Read() -> T {
+    if constexpr (std::is_same_v<T, bool>) {
+      auto value = Read<u8>();
+
+      if (value > 1) {
+        throw std::runtime_error("lunatic: code cache data has a bad boolean");
+      }
+      return value != 0;
+    } else {
+      if (size - position < sizeof(T)) {
+        throw std::runtime_error("lunatic: code cache data is truncated");
+      }
+
+      T value;
+      std::memcpy(&value, data + position, sizeof(T));
+      position += sizeof(T);
+      return value;
+    }
+  }
+
+  auto ReadOperand(std::vector<IRVariable const*> const& vars) -> IRAnyRef {
+    switch (Read<OperandType>()) {
+      case OperandType::Null: {
+        return {};
+      }
+      case OperandType::Variable: {
+        auto id = Read<u32>();
+
+        if (id >= vars.size()) {
+          throw std::runtime_error("lunatic: code cache data references an unknown variable");
+        }
+        return *vars[id];
+      }
+      case OperandType::Constant: {
+        return IRConstant{Read<u32>()};
+      }
+    }
+
+    throw std::runtime_error("lunatic: code cache data has a bad operand");
+  }
+
+  // The enums index into tables of the state and the backends, so values which are out of range are rejected.
+
+  auto ReadGuestReg() -> IRGuestReg {
+    auto reg = Read<u8>();
+
+    if (reg > u8(GPR::PC)) {
+      throw std::runtime_error("lunatic: code cache data has a bad register");
+    }
+    return IRGuestReg{GPR(reg), ReadMode()};
+  }
+
+  auto ReadMode() -> Mode {
+    auto mode = Mode(Read<u8>());
+
+    switch (mode) {
+      case Mode::User:
+      case Mode::FIQ:
+      case Mode::IRQ:
+      case Mode::Supervisor:
+      case Mode::Abort:
+      case Mode::Undefined:
+      case Mode::System:
+        return mode;
+    }
+
+    throw std::runtime_error("lunatic: code cache data has a bad CPU mode");
+  }
+
+  auto ReadCondition() -> Condition {
+    auto condition = Read<u8>();
+
+    if (condition > u8(Condition::NV)) {
+      throw std::runtime_error("lunatic: code cache data has a bad condition");
+    }
+    return Condition(condition);
+  }
+
+  auto ReadDataType() -> IRDataType {
+    auto data_type = Read<u8>();
+
+    if (data_type > u8(IRDataType::SInt32)) {
+      throw std::runtime_error("lunatic: code cache data has a bad data type");
+    }
+    return IRDataType(data_type);
+  }
+
+  /// Read a shift amount that is a scale factor of an x86 address (1, 2, 4 or 8).
+  auto ReadScaleShift() -> s32 {
+    auto shift = Read<s32>();
+
+    if (shift < 0 || shift > 3) {
+      throw std::runtime_error("lunatic: code cache data has a bad shift amount");
+    }
+    return shift;
+  }
+};
+
+template<typename T>
+void WriteHostFlags(Writer& writer, IROpcode* op) {
+  writer.Write<bool>(lunatic_cast<T>(op)->update_host_flags);
+}
+
+template<typename T>
+void WriteMemoryAccess(Writer& writer, IROpcode* op) {
+  auto access = lunatic_cast<T>(op);
+
+  writer.Write<u32>(access->flags);
+  writer.Write<s32>(access->index_shift);
+  writer.Write<u32>(access->offset);
+}
+
+template<typename T>
+void WriteCoprocessorAccess(Writer& writer, IROpcode* op) {
+  auto access = lunatic_cast<T>(op);
+
+  writer.Write<u8>(access->coprocessor_id);
+  writer.Write<u8>(access->opcode1);
+  writer.Write<u8>(access->cn);
+  writer.Write<u8>(access->cm);
+  writer.Write<u8>(access->opcode2);
+}
+
+void WriteOpcode(Writer& writer, IROpcode* op) {
+  auto operands = op->GetOperands();
+  auto operand_count = op->GetOperandCount();
+
+  writer.Write<u8>(u8(op->GetClass()));
+
+  for (int i = 0; i < operand_count; i++) {
+    writer.Write(operands[i]);
+  }
+
+  // The operands were written generically, only the remaining attributes depend on the opcode.
+  switch (op->GetClass()) {
+    case IROpcodeClass::LoadGPR: writer.Write(lunatic_cast<IRLoadGPR>(op)->reg); break;
+    case IROpcodeClass::StoreGPR: writer.Write(lunatic_cast<IRStoreGPR>(op)->reg); break;
+    case IROpcodeClass::LoadSPSR: writer.Write<u8>(u8(lunatic_cast<IRLoadSPSR>(op)->mode)); break;
+    case IROpcodeClass::StoreSPSR: writer.Write<u8>(u8(lunatic_cast<IRStoreSPSR>(op)->mode)); break;
+    case IROpcodeClass::UpdateFlags: {
+      auto update = lunatic_cast<IRUpdateFlags>(op);
+
+      writer.Write<bool>(update->flag_n);
+      writer.Write<bool>(update->flag_z);
+      writer.Write<bool>(update->flag_c);
+      writer.Write<bool>(update->flag_v);
+      break;
+    }
+    case IROpcodeClass::LSL: WriteHostFlags<IRLogicalShiftLeft>(writer, op); break;
+    case IROpcodeClass::LSR: WriteHostFlags<IRLogicalShiftRight>(writer, op); break;
+    case IROpcodeClass::ASR: WriteHostFlags<IRArithmeticShiftRight>(writer, op); break;
+    case IROpcodeClass::ROR: WriteHostFlags<IRRotateRight>(writer, op); break;
+    case IROpcodeClass::AND: WriteHostFlags<IRBitwiseAND>(writer, op); break;
+    case IROpcodeClass::BIC: WriteHostFlags<IRBitwiseBIC>(writer, op); break;
+    case IROpcodeClass::EOR: WriteHostFlags<IRBitwiseEOR>(writer, op); break;
+    case IROpcodeClass::SUB: WriteHostFlags<IRSub>(writer, op); break;
+    case IROpcodeClass::RSB: WriteHostFlags<IRRsb>(writer, op); break;
+    case IROpcodeClass::ADD: {
+      WriteHostFlags<IRAdd>(writer, op);
+      writer.Write<s32>(lunatic_cast<IRAdd>(op)->rhs_shift);
+      break;
+    }
+    case IROpcodeClass::ADC: WriteHostFlags<IRAdc>(writer, op); break;
+    case IROpcodeClass::SBC: WriteHostFlags<IRSbc>(writer, op); break;
+    case IROpcodeClass::RSC: WriteHostFlags<IRRsc>(writer, op); break;
+    case IROpcodeClass::ORR: WriteHostFlags<IRBitwiseORR>(writer, op); break;
+    case IROpcodeClass::MOV: WriteHostFlags<IRMov>(writer, op); break;
+    case IROpcodeClass::MVN: WriteHostFlags<IRMvn>(writer, op); break;
+    case IROpcodeClass::MUL: WriteHostFlags<IRMultiply>(writer, op); break;
+    case IROpcodeClass::ADD64: WriteHostFlags<IRAdd64>(writer, op); break;
+    case IROpcodeClass::MemoryRead: WriteMemoryAccess<IRMemoryRead>(writer, op); break;
+    case IROpcodeClass::MemoryWrite: WriteMemoryAccess<IRMemoryWrite>(writer, op); break;
+    case IROpcodeClass::MRC: WriteCoprocessorAccess<IRReadCoprocessorRegister>(writer, op); break;
+    case IROpcodeClass::MCR: WriteCoprocessorAccess<IRWriteCoprocessorRegister>(writer, op); break;
+    default: break;
+  }
+}
+
+template<typename T>
+void ReadShifter(Reader& reader, IREmitter& emitter, IRAnyRef const* operands) {
+  emitter.Insert<T>(emitter.Code().end(), operands[0].GetVar(), operands[1].GetVar(), operands[2], reader.Read<bool>());
+}
+
+template<typename T>
+auto ReadBinaryOp(Reader& reader, IREmitter& emitter, IRAnyRef const* operands) -> IREmitter::InstructionList::iterator {
+  auto result = Optional<IRVariable const&>{};
+
+  if (!operands[0].IsNull()) {
+    result = operands[0].GetVar();
+  }
+
+  return emitter.Insert<T>(emitter.Code().end(), result, operands[1].GetVar(), operands[2], reader.Read<bool>());
+}
+
+template<typename T, typename ValueType>
+void ReadMemoryAccess(Reader& reader, IREmitter& emitter, ValueType const& value, IRAnyRef const* operands) {
+  auto flags = reader.Read<u32>();
+  auto index_shift = reader.ReadScaleShift();
+  auto offset = reader.Read<u32>();
+  auto size = flags & (IRMemoryFlags::Byte | IRMemoryFlags::Half | IRMemoryFlags::Word);
+
+  if ((flags & ~0x7FU) != 0 || (size != IRMemoryFlags::Byte && size != IRMemoryFlags::Half && size != IRMemoryFlags::Word)) {
+    throw std::runtime_error("lunatic: code cache data has bad memory access flags");
+  }
+
+  emitter.Insert<T>(emitter.Code().end(), IRMemoryFlags(flags), value, operands[1], operands[2], index_shift, offset);
+}
+
+template<typename T, typename ValueType>
+void ReadCoprocessorAccess(Reader& reader, IREmitter& emitter, ValueType const& value) {
+  auto coprocessor_id = reader.Read<u8>();
+  auto opcode1 = reader.Read<u8>();
+  auto cn = reader.Read<u8>();
+  auto cm = reader.Read<u8>();
+  auto opcode2 = reader.Read<u8>();
+
+  if (coprocessor_id > 15 || opcode1 > 7 || cn > 15 || cm > 15 || opcode2 > 7) {
+    throw std::runtime_error("lunatic: code cache data has a bad coprocessor access");
+  }
+
+  emitter.Insert<T>(emitter.Code().end(), value, coprocessor_id, opcode1, cn, cm, opcode2);
+}
+
+/**
+ * Read an opcode written by WriteOpcode(). GetVar() throws if an operand which must be a variable is not one.
+ * The backends expect each variable to be written once, before it is read. defined keeps track of that.
+ */
+void ReadOpcode(
+  Reader& reader,
+  IREmitter& emitter,
+  std::vector<IRVariable const*> const& vars,
+  std::vector<bool>& defined
+) {
+  auto klass = reader.Read<u8>();
+
+  if (klass > u8(IROpcodeClass::MCR)) {
+    throw std::runtime_error("lunatic: code cache data has an unknown opcode");
+  }
+
+  IRAnyRef operands[6];
+  auto const& info = kIROpcodeInfo[klass];
+
+  for (int i = 0; i < info.operand_count; i++) {
+    operands[i] = reader.ReadOperand(vars);
+
+    if (operands[i].IsVariable() && !(info.write_mask & (1 << i)) && !defined[operands[i].GetVar().id]) {
+      throw std::runtime_error("lunatic: code cache data reads a variable before it is written");
+    }
+  }
+
+  for (int i = 0; i < info.operand_count; i++) {
+    if (operands[i].IsVariable() && (info.write_mask & (1 << i))) {
+      auto id = operands[i].GetVar().id;
+
+      if (defined[id]) {
+        throw std::runtime_error("lunatic: code cache data writes a variable twice");
+      }
+      defined[id] = true;
+    }
+  }
+
+  auto end = emitter.Code().end();
+
+  switch (IROpcodeClass(klass)) {
+    case IROpcodeClass::NOP: emitter.Insert<IRNoOp>(end); break;
+    case IROpcodeClass::LoadGPR: emitter.Insert<IRLoadGPR>(end, reader.ReadGuestReg(), operands[0].GetVar()); break;
+    case IROpcodeClass::StoreGPR: emitter.Insert<IRStoreGPR>(end, reader.ReadGuestReg(), operands[0]); break;
+    case IROpcodeClass::LoadSPSR: emitter.Insert<IRLoadSPSR>(end, operands[0].GetVar(), reader.ReadMode()); break;
+    case IROpcodeClass::StoreSPSR: emitter.Insert<IRStoreSPSR>(end, operands[0], reader.ReadMode()); break;
+    case IROpcodeClass::LoadCPSR: emitter.Insert<IRLoadCPSR>(end, operands[0].GetVar()); break;
+    case IROpcodeClass::StoreCPSR: emitter.Insert<IRStoreCPSR>(end, operands[0]); break;
+    case IROpcodeClass::ClearCarry: emitter.Insert<IRClearCarry>(end); break;
+    case IROpcodeClass::SetCarry: emitter.Insert<IRSetCarry>(end); break;
+    case IROpcodeClass::UpdateFlags: {
+      auto flag_n = reader.Read<bool>();
+      auto flag_z = reader.Read<bool>();
+      auto flag_c = reader.Read<bool>();
+      auto flag_v = reader.Read<bool>();
+
+      emitter.Insert<IRUpdateFlags>(end, operands[0].GetVar(), operands[1].GetVar(), flag_n, flag_z, flag_c, flag_v);
+      break;
+    }
+    case IROpcodeClass::UpdateSticky: emitter.Insert<IRUpdateSticky>(end, operands[0].GetVar(), operands[1].GetVar()); break;
+    case IROpcodeClass::LSL: ReadShifter<IRLogicalShiftLeft>(reader, emitter, operands); break;
+    case IROpcodeClass::LSR: ReadShifter<IRLogicalShiftRight>(reader, emitter, operands); break;
+    case IROpcodeClass::ASR: ReadShifter<IRArithmeticShiftRight>(reader, emitter, operands); break;
+    case IROpcodeClass::ROR: ReadShifter<IRRotateRight>(reader, emitter, operands); break;
+    case IROpcodeClass::AND: ReadBinaryOp<IRBitwiseAND>(reader, emitter, operands); break;
+    case IROpcodeClass::BIC: ReadBinaryOp<IRBitwiseBIC>(reader, emitter, operands); break;
+    case IROpcodeClass::EOR: ReadBinaryOp<IRBitwiseEOR>(reader, emitter, operands); break;
+    case IROpcodeClass::SUB: ReadBinaryOp<IRSub>(reader, emitter, operands); break;
+    case IROpcodeClass::RSB: ReadBinaryOp<IRRsb>(reader, emitter, operands); break;
+    case IROpcodeClass::ADD: {
+      auto op = lunatic_cast<IRAdd>(*ReadBinaryOp<IRAdd>(reader, emitter, operands));
+
+      op->rhs_shift = reader.ReadScaleShift();
+      break;
+    }
+    case IROpcodeClass::ADC: ReadBinaryOp<IRAdc>(reader, emitter, operands); break;
+    case IROpcodeClass::SBC: ReadBinaryOp<IRSbc>(reader, emitter, operands); break;
+    case IROpcodeClass::RSC: ReadBinaryOp<IRRsc>(reader, emitter, operands); break;
+    case IROpcodeClass::ORR: ReadBinaryOp<IRBitwiseORR>(reader, emitter, operands); break;
+    case IROpcodeClass::MOV: emitter.Insert<IRMov>(end, operands[0].GetVar(), operands[1], reader.Read<bool>()); break;
+    case IROpcodeClass::MVN: emitter.Insert<IRMvn>(end, operands[0].GetVar(), operands[1], reader.Read<bool>()); break;
+    case IROpcodeClass::MUL: {
+      auto result_hi = Optional<IRVariable const&>{};
+
+      if (!operands[0].IsNull()) {
+        result_hi = operands[0].GetVar();
+      }
+
+      emitter.Insert<IRMultiply>(end,
+        result_hi, operands[1].GetVar(), operands[2].GetVar(), operands[3].GetVar(), reader.Read<bool>());
+      break;
+    }
+    case IROpcodeClass::ADD64: {
+      emitter.Insert<IRAdd64>(end,
+        operands[0].GetVar(), operands[1].GetVar(),
+        operands[2].GetVar(), operands[3].GetVar(),
+        operands[4].GetVar(), operands[5].GetVar(), reader.Read<bool>());
+      break;
+    }
+    case IROpcodeClass::MemoryRead: ReadMemoryAccess<IRMemoryRead>(reader, emitter, operands[0].GetVar(), operands); break;
+    case IROpcodeClass::MemoryWrite: ReadMemoryAccess<IRMemoryWrite>(reader, emitter, operands[0], operands); break;
+    case IROpcodeClass::Flush: {
+      emitter.Insert<IRFlush>(end, operands[0].GetVar(), operands[1].GetVar(), operands[2].GetVar());
+      break;
+    }
+    case IROpcodeClass::FlushExchange: {
+      emitter.Insert<IRFlushExchange>(end,
+        operands[0].GetVar(), operands[1].GetVar(), operands[2].GetVar(), operands[3].GetVar());
+      break;
+    }
+    case IROpcodeClass::CLZ: emitter.Insert<IRCountLeadingZeros>(end, operands[0].GetVar(), operands[1].GetVar()); break;
+    case IROpcodeClass::QADD: {
+      emitter.Insert<IRSaturatingAdd>(end, operands[0].GetVar(), operands[1].GetVar(), operands[2].GetVar());
+      break;
+    }
+    case IROpcodeClass::QSUB: {
+      emitter.Insert<IRSaturatingSub>(end, operands[0].GetVar(), operands[1].GetVar(), operands[2].GetVar());
+      break;
+    }
+    case IROpcodeClass::MRC: ReadCoprocessorAccess<IRReadCoprocessorRegister>(reader, emitter, operands[0].GetVar()); break;
+    case IROpcodeClass::MCR: ReadCoprocessorAccess<IRWriteCoprocessorRegister>(reader, emitter, operands[0]); break;
+  }
+}
+
+} // namespace
+
+CodeCache::CodeCache(CPU::Descriptor const& descriptor)
+    : memory(descriptor.memory)
+    , model(u32(descriptor.model))
+    , block_size(u32(descriptor.block_size))
+    , optimization_level(u32(descriptor.optimization_level)) {
+}
+
+void CodeCache::Add(
+  BasicBlock const& basic_block,
+  std::vector<BasicBlock::MicroBlock> const& micro_blocks,
+  std::vector<CodeSpan> const& code_spans,
+  u32 code_hash,
+  u32 exception_base,
+  bool baseline
+) {
+  auto& entry = entries[basic_block.key];
+  auto writer = Writer{entry.data};
+
+  entry.code_spans = code_spans;
+  entry.code_hash = code_hash;
+  entry.exception_base = exception_base;
+  entry.length = basic_block.length;
+  entry.branch_target = basic_block.branch_target.key;
+  entry.enable_fast_dispatch = basic_block.enable_fast_dispatch;
+  entry.uses_exception_base = basic_block.uses_exception_base;
+  entry.baseline = baseline;
+  entry.data.clear();
+
+  writer.Write<u32>(u32(micro_blocks.size()));
+
+  for (auto const& micro_block : micro_blocks) {
+    auto const& emitter = micro_block.emitter;
+
+    writer.Write<u8>(u8(micro_block.condition));
+    writer.Write<s32>(micro_block.length);
+    writer.Write<u32>(micro_block.next_address);
+    writer.Write<u64>(micro_block.side_exit.value);
+
+    // Variable IDs are the index of the variable, so recreating the variables in order restores the IDs.
+    writer.Write<u32>(u32(emitter.Vars().size()));
+    for (auto var : emitter.Vars()) {
+      writer.Write<u8>(u8(var->data_type));
+    }
+
+    writer.Write<u32>(u32(emitter.Code().size()));
+    for (auto op : emitter.Code()) {
+      WriteOpcode(writer, op);
+    }
+  }
+}
+
+auto CodeCache::Get(BasicBlock::Key block_key, u32 exception_base) -> Entry const* {
+  auto match = entries.find(block_key);
+
+  if (match == entries.end()) {
+    return nullptr;
+  }
+
+  auto const& entry = match->second;
+
+  if (entry.uses_exception_base && entry.exception_base != exception_base) {
+    return nullptr;
+  }
+
+  if (GetCodeHash(memory, entry.code_spans, block_key.Thumb()) != entry.code_hash) {
+    return nullptr;
+  }
+
+  return &entry;
+}
+
+void CodeCache::Read(
+  Entry const& entry,
+  BasicBlock& basic_block,
+  std::vector<BasicBlock::MicroBlock>& micro_blocks,
+  Arena& arena
+) {
+  auto reader = Reader{entry.data.data(), entry.data.size()};
+  auto vars = std::vector<IRVariable const*>{};
+  auto defined = std::vector<bool>{};
+
+  basic_block.length = entry.length;
+  basic_block.branch_target.key = entry.branch_target;
+  basic_block.enable_fast_dispatch = entry.enable_fast_dispatch;
+  basic_block.uses_exception_base = entry.uses_exception_base;
+
+  auto micro_block_count = reader.Read<u32>();
+  int side_exit_count = 0;
+
+  for (u32 i = 0; i < micro_block_count; i++) {
+    auto& micro_block = micro_blocks.emplace_back(BasicBlock::MicroBlock{reader.ReadCondition(), IREmitter{arena}});
+    auto& emitter = micro_block.emitter;
+
+    micro_block.length = reader.Read<s32>();
+    micro_block.next_address = reader.Read<u32>();
+    micro_block.side_exit = BasicBlock::Key{reader.Read<u64>()};
+
+    if (micro_block.length < 0) {
+      throw std::runtime_error("lunatic: code cache data has a bad micro block length");
+    }
+
+    if (!micro_block.side_exit.IsEmpty() && ++side_exit_count > BasicBlock::kMaxSideExits) {
+      throw std::runtime_error("lunatic: code cache data has too many side exits");
+    }
+
+    auto var_count = reader.Read<u32>();
+
+    vars.clear();
+    for (u32 j = 0; j < var_count; j++) {
+      vars.push_back(&emitter.CreateVar(reader.ReadDataType()));
+    }
+
+    defined.assign(var_count, false);
+
+    auto opcode_count = reader.Read<u32>();
+
+    for (u32 j = 0; j < opcode_count; j++) {
+      ReadOpcode(reader, emitter, vars, defined);
+    }
+  }
+}
+
+auto CodeCache::Keys() const -> std::vector<BasicBlock::Key> {
+  auto keys = std::vector<BasicBlock::Key>{};
+
+  for (auto const& [key, entry] : entries) {
+    keys.push_back(key);
+  }
+  return keys;
+}
+
+bool CodeCache::Load(std::string const& path) {
+  auto file = std::ifstream{path, std::ios::binary};
+
+  if (!file.good()) {
+    return false;
+  }
+
+  auto data = std::vector<u8>{std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{}};
+  auto reader = Reader{data.data(), data.size()};
+  auto loaded_entries = std::unordered_map<BasicBlock::Key, Entry>{};
+  auto arena = Arena{};
+  auto micro_blocks = std::vector<BasicBlock::MicroBlock>{};
+
+  try {
+    if (reader.Read<u32>() != kMagic ||
+        reader.Read<u32>() != kVersion ||
+        reader.Read<u32>() != u32(IROpcodeClass::MCR) + 1 ||
+        reader.Read<u32>() != model ||
+        reader.Read<u32>() != block_size ||
+        reader.Read<u32>() != optimization_level) {
+      return false;
+    }
+
+    auto entry_count = reader.Read<u32>();
+
+    for (u32 i = 0; i < entry_count; i++) {
+      auto key = BasicBlock::Key{reader.Read<u64>()};
+      auto& entry = loaded_entries[key];
+      auto code_span_count = reader.Read<u32>();
+      u32 opcode_size = key.Thumb() ? sizeof(u16) : sizeof(u32);
+      u32 code_size = 0;
+
+      // Each translated instruction adds at most four bytes of code. Bad sizes would make GetCodeHash() loop for long.
+      for (u32 j = 0; j < code_span_count; j++) {
+        auto address = reader.Read<u32>();
+        auto size = reader.Read<u32>();
+
+        code_size += size;
+
+        if (size == 0 || size % opcode_size != 0 || (address & (opcode_size - 1)) != 0 ||
+            size > block_size * sizeof(u32) || code_size > block_size * sizeof(u32)) {
+          return false;
+        }
+
+        entry.code_spans.push_back({address, size});
+      }
+
+      entry.code_hash = reader.Read<u32>();
+      entry.exception_base = reader.Read<u32>();
+      entry.length = reader.Read<s32>();
+
+      if (entry.length < 0 || u32(entry.length) > block_size) {
+        return false;
+      }
+
+      entry.branch_target = BasicBlock::Key{reader.Read<u64>()};
+      entry.enable_fast_dispatch = reader.Read<bool>();
+      entry.uses_exception_base = reader.Read<bool>();
+      entry.baseline = reader.Read<bool>();
+
+      auto size = reader.Read<u32>();
+
+      if (data.size() - reader.position < size) {
+        return false;
+      }
+
+      entry.data.assign(data.begin() + reader.position, data.begin() + reader.position + size);
+      reader.position += size;
+
+      // Make sure that the IR can be recreated, before it is compiled.
+      auto basic_block = BasicBlock{key};
+      Read(entry, basic_block, micro_blocks, arena);
+      micro_blocks.clear();
+      arena.Reset();
+    }
+  } catch (std::runtime_error const&) {
+    return false;
+  }
+
+  entries.merge(loaded_entries);
+  return true;
+}
+
+bool CodeCache::Save(std::string const& path) const {
+  auto data = std::vector<u8>{};
+  auto writer = Writer{data};
+
+  writer.Write<u32>(kMagic);
+  writer.Write<u32>(kVersion);
+  writer.Write<u32>(u32(IROpcodeClass::MCR) + 1);
+  writer.Write<u32>(model);
+  writer.Write<u32>(block_size);
+  writer.Write<u32>(optimization_level);
+  writer.Write<u32>(u32(entries.size()));
+
+  for (auto const& [key, entry] : entries) {
+    writer.Write<u64>(key.value);
+    writer.Write<u32>(u32(entry.code_spans.size()));
+    for (auto const& span : entry.code_spans) {
+      writer.Write<u32>(span.address);
+      writer.Write<u32>(span.size);
+    }
+    writer.Write<u32>(entry.code_hash);
+    writer.Write<u32>(entry.exception_base);
+    writer.Write<s32>(entry.length);
+    writer.Write<u64>(entry.branch_target.value);
+    writer.Write<bool>(entry.enable_fast_dispatch);
+    writer.Write<bool>(entry.uses_exception_base);
+    writer.Write<bool>(entry.baseline);
+    writer.Write<u32>(u32(entry.data.size()));
+    data.insert(data.end(), entry.data.begin(), entry.data.end());
+  }
+
+  auto file = std::ofstream{path, std::ios::binary | std::ios::trunc};
+
+  file.write((char const*)data.data(), data.size());
+  return file.good();
+}
+
+} // namespace lunatic::frontend
+} // namespace lunatic
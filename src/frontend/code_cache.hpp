@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2022 fleroviux. All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#pragma once
+
+#include <lunatic/cpu.hpp>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "common/arena.hpp"
+#include "basic_block.hpp"
+#include "code_span.hpp"
+
+namespace lunatic {
+namespace frontend {
+
+/**
+ * Keeps the optimized IR of compiled basic blocks, so that it can be saved to a file and loaded by a later run.
+ * A block from the cache is compiled without translating and optimizing its guest code again,
+ * but only if the guest code that it was translated from did not change.
+ */
+struct CodeCache {
+  CodeCache(CPU::Descriptor const& descriptor);
+
+  struct Entry {
+    /// The guest code that the block was translated from, which includes the code at the targets of B and BL.
+    std::vector<CodeSpan> code_spans;
+
+    /// Hash of the guest code in code_spans, see GetCodeHash().
+    u32 code_hash = 0;
+
+    /// The exception base that the block was translated with (only relevant if uses_exception_base is set).
+    u32 exception_base = 0;
+
+    int length = 0;
+    BasicBlock::Key branch_target{};
+    bool enable_fast_dispatch = true;
+    bool uses_exception_base = false;
+
+    /// The IR was optimized by the baseline tier, the block should be recompiled once it is hot.
+    bool baseline = false;
+
+    /// The serialized micro blocks.
+    std::vector<u8> data;
+  };
+
+  /// Add or replace the entry for a block, after it has been translated (see Translator::GetCodeSpans()) and optimized.
+  void Add(
+    BasicBlock const& basic_block,
+    std::vector<BasicBlock::MicroBlock> const& micro_blocks,
+    std::vector<CodeSpan> const& code_spans,
+    u32 code_hash,
+    u32 exception_base,
+    bool baseline
+  );
+
+  /// Get the entry for a block, unless its guest code or the exception base that it depends on changed.
+  auto Get(BasicBlock::Key block_key, u32 exception_base) -> Entry const*;
+
+  /// Recreate the translated block and its IR from an entry. The IR is allocated from the arena.
+  static void Read(
+    Entry const& entry,
+    BasicBlock& basic_block,
+    std::vector<BasicBlock::MicroBlock>& micro_blocks,
+    Arena& arena
+  );
+
+  auto Keys() const -> std::vector<BasicBlock::Key>;
+
+  /**
+   * Load the entries saved by an earlier run. Entries that exist already are kept.
+   * Returns false if the file cannot be read, is damaged or was saved with a different JIT version or configuration.
+   */
+  bool Load(std::string const& path);
+
+  /// Save all entries, including those that were loaded and not used by this run. Returns false on failure.
+  bool Save(std::string const& path) const;
+
+private:
+  /**
+   * Must be incremented whenever the translator, the optimization passes or the IR change,
+   * so that IR saved by an older version of the JIT is never compiled.
+   */
+  static constexpr u32 kVersion = 2;
+
+  Memory& memory;
+
+  /// Settings that the translation depends on. A file saved with different settings is not loaded.
+  u32 model;
+  u32 block_size;
+  u32 optimization_level;
+
+  std::unordered_map<BasicBlock::Key, Entry> entries;
+};
+
+} // namespace lunatic::frontend
+} // namespace lunatic
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2022 fleroviux. All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#pragma once
+
+#include <lunatic/memory.hpp>
+#include <vector>
+
+namespace lunatic {
+namespace frontend {
+
+/// A contiguous range of guest code that a block was translated from.
+struct CodeSpan {
+  u32 address;
+  /// Size in bytes.
+  u32 size;
+};
+
+/// FNV-1a hash of guest code, which is computed from the instructions in the order that they were read.
+struct CodeHash {
+  void Add(u32 opcode, u32 opcode_size) {
+    for (u32 i = 0; i < opcode_size; i++) {
+      value = (value ^ ((opcode >> (i * 8)) & 0xFF)) * 0x01000193;
+    }
+  }
+
+  u32 value = 0x811C9DC5;
+};
+
+/// Hash the guest code in a list of spans again, to check if it changed since it was translated.
+inline auto GetCodeHash(Memory& memory, std::vector<CodeSpan> const& spans, bool thumb) -> u32 {
+  auto hash = CodeHash{};
+
+  for (auto const& span : spans) {
+    if (thumb) {
+      for (u32 offset = 0; offset < span.size; offset += sizeof(u16)) {
+        hash.Add(memory.FastRead<u16, Memory::Bus::Code>(span.address + offset), sizeof(u16));
+      }
+    } else {
+      for (u32 offset = 0; offset < span.size; offset += sizeof(u32)) {
+        hash.Add(memory.FastRead<u32, Memory::Bus::Code>(span.address + offset), sizeof(u32));
+      }
+    }
+  }
+
+  return hash.value;
+}
+
+} // namespace lunatic::frontend
+} // namespace lunatic
@@ -31,6 +31,11 @@ enum class Condition {
   NV = 15
 };
 
+/// Get the condition that passes exactly when the given condition (other than AL and NV) fails.
+inline auto InvertCondition(Condition condition) -> Condition {
+  return Condition(int(condition) ^ 1);
+}
+
 enum class Shift {
   LSL = 0,
   LSR = 1,
@@ -5,6 +5,7 @@
  * found in the LICENSE file.
  */
 
+#include <new>
 #include <stdexcept>
 
 #include "emitter.hpp"
@@ -22,7 +23,7 @@ auto IREmitter::ToString() const -> std::string {
 
   source += "\r\n";
 
-  for (auto const& op : code) {
+  for (auto op : code) {
     source += fmt::format("{:03} {}\r\n", location++, op->ToString());
   }
 
@@ -34,12 +35,112 @@ auto IREmitter::CreateVar(
   char const* label
 ) -> IRVariable const& {
   auto id = u32(variables.size());
-  auto var = new IRVariable{id, data_type, label};
+  auto var = new (arena->Allocate(sizeof(IRVariable), alignof(IRVariable))) IRVariable{id, data_type, label};
 
-  variables.push_back(std::unique_ptr<IRVariable>(var));
+  variables.push_back(var);
   return *var;
 }
 
+void IREmitter::Repoint(
+  IRVariable const& var_old,
+  IRVariable const& var_new
+) {
+  auto use = var_old.first_use;
+
+  while (use != nullptr) {
+    auto next_use = use->next;
+
+    use->op->GetOperands()[use->slot] = var_new;
+    RemoveUse(var_old, use);
+    AddUse(var_new, use);
+    rewrite_count++;
+    use = next_use;
+  }
+}
+
+void IREmitter::PropagateConstant(
+  IRVariable const& var,
+  IRConstant const& constant
+) {
+  auto use = var.first_use;
+
+  while (use != nullptr) {
+    auto next_use = use->next;
+
+    if (use->op->GetInfo().const_mask & (1 << use->slot)) {
+      use->op->GetOperands()[use->slot] = constant;
+      RemoveUse(var, use);
+      rewrite_count++;
+    }
+    use = next_use;
+  }
+}
+
+void IREmitter::Link(IROpcode* op) {
+  auto operands = op->GetOperands();
+  auto operand_count = op->GetOperandCount();
+
+  for (int i = 0; i < operand_count; i++) {
+    if (!operands[i].IsVariable()) {
+      continue;
+    }
+
+    auto& var = operands[i].GetVar();
+
+    if (op->IsOperandWritten(i)) {
+      var.def = op;
+    } else {
+      AddUse(var, arena->New<IRUse>(IRUse{op, i, nullptr, nullptr}));
+    }
+  }
+}
+
+void IREmitter::Unlink(IROpcode* op) {
+  auto operands = op->GetOperands();
+  auto operand_count = op->GetOperandCount();
+
+  for (int i = 0; i < operand_count; i++) {
+    if (!operands[i].IsVariable()) {
+      continue;
+    }
+
+    auto& var = operands[i].GetVar();
+
+    if (op->IsOperandWritten(i)) {
+      if (var.def == op) {
+        var.def = nullptr;
+      }
+    } else {
+      for (auto use = var.first_use; use != nullptr; use = use->next) {
+        if (use->op == op && use->slot == i) {
+          RemoveUse(var, use);
+          break;
+        }
+      }
+    }
+  }
+}
+
+void IREmitter::AddUse(IRVariable const& var, IRUse* use) {
+  use->prev = nullptr;
+  use->next = var.first_use;
+  if (var.first_use != nullptr) {
+    var.first_use->prev = use;
+  }
+  var.first_use = use;
+}
+
+void IREmitter::RemoveUse(IRVariable const& var, IRUse* use) {
+  if (use->prev != nullptr) {
+    use->prev->next = use->next;
+  } else {
+    var.first_use = use->next;
+  }
+  if (use->next != nullptr) {
+    use->next->prev = use->prev;
+  }
+}
+
 void IREmitter::LoadGPR(IRGuestReg reg, IRVariable const& result) {
   Push<IRLoadGPR>(reg, result);
 }
@@ -7,23 +7,21 @@
 
 #pragma once
 
-#include <list>
-#include <memory>
-#include <vector>
-
+#include "common/arena.hpp"
 #include "common/optional.hpp"
-#include "common/pool_allocator.hpp"
+#include "instruction_list.hpp"
 #include "opcode.hpp"
+#include "variable_list.hpp"
 
 namespace lunatic {
 namespace frontend {
 
 struct IREmitter {
-  using OpcodePtr = std::unique_ptr<IROpcode>;
-  using InstructionList = std::list<OpcodePtr, StdPoolAlloc<OpcodePtr>>;
-  using VariableList = std::vector<std::unique_ptr<IRVariable>>;
+  using InstructionList = IRInstructionList;
+  using VariableList = IRVariableList;
 
-  IREmitter() = default;
+  /// Opcodes are allocated from the arena, which must outlive the emitter.
+  IREmitter(Arena& arena) : arena(&arena) {}
   IREmitter(const IREmitter&) = delete;
   IREmitter& operator=(const IREmitter&) = delete;
 
@@ -34,6 +32,8 @@ struct IREmitter {
   IREmitter& operator=(IREmitter&& emitter) {
     std::swap(code, emitter.code);
     std::swap(variables, emitter.variables);
+    std::swap(arena, emitter.arena);
+    std::swap(rewrite_count, emitter.rewrite_count);
     return *this;
   }
 
@@ -42,6 +42,54 @@ struct IREmitter {
   auto Vars() const -> VariableList const& { return variables; }
   auto ToString() const -> std::string;
 
+  /// Number of opcodes that were inserted and operands that were rewritten, for the optimizer statistics.
+  auto RewriteCount() const -> u64 { return rewrite_count; }
+
+  /// Create an opcode and insert it before the given position.
+  template<typename T, typename... Args>
+  auto Insert(InstructionList::iterator pos, Args&&... args) -> InstructionList::iterator {
+    auto op = New<T>(std::forward<Args>(args)...);
+    Link(op);
+    rewrite_count++;
+    return code.insert(pos, op);
+  }
+
+  /// Create an opcode and replace the opcode at the given position with it.
+  template<typename T, typename... Args>
+  auto Replace(InstructionList::iterator pos, Args&&... args) -> InstructionList::iterator {
+    return Insert<T>(Erase(pos), std::forward<Args>(args)...);
+  }
+
+  /// Remove the opcode at the given position and return an iterator to its successor.
+  auto Erase(InstructionList::iterator pos) -> InstructionList::iterator {
+    Unlink(*pos);
+    return code.erase(pos);
+  }
+
+  /**
+   * Replace all reads of a variable with reads of another variable.
+   * The opcode writing var_old is expected to be removed by the caller.
+   *
+   * @param  var_old  the variable to be replaced
+   * @param  var_new  the replacement variable
+   */
+  void Repoint(
+    IRVariable const& var_old,
+    IRVariable const& var_new
+  );
+
+  /**
+   * Replace reads of a variable with a constant,
+   * where the reading opcodes can accept a constant.
+   *
+   * @param  var       the variable to be replaced
+   * @param  constant  the replacement constant
+   */
+  void PropagateConstant(
+    IRVariable const& var,
+    IRConstant const& constant
+  );
+
   auto CreateVar(
     IRDataType data_type,
     char const* label = nullptr
@@ -267,13 +315,29 @@ struct IREmitter {
   );
 
 private:
+  template<typename T, typename... Args>
+  auto New(Args&&... args) -> T* {
+    return arena->New<T>(std::forward<Args>(args)...);
+  }
+
   template<typename T, typename... Args>
   void Push(Args&&... args) {
-    code.push_back(std::make_unique<T>(args...));
+    Insert<T>(code.end(), std::forward<Args>(args)...);
   }
 
+  /// Add the operands of an opcode to the def-use chains of their variables.
+  void Link(IROpcode* op);
+
+  /// Remove the operands of an opcode from the def-use chains of their variables.
+  void Unlink(IROpcode* op);
+
+  static void AddUse(IRVariable const& var, IRUse* use);
+  static void RemoveUse(IRVariable const& var, IRUse* use);
+
+  Arena* arena;
   InstructionList code;
   VariableList variables;
+  u64 rewrite_count = 0;
 };
 
 } // namespace lunatic::frontend
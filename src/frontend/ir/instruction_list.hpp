@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2022 fleroviux. All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#pragma once
+
+#include <iterator>
+#include <utility>
+
+#include "opcode.hpp"
+
+namespace lunatic {
+namespace frontend {
+
+/// Intrusive doubly-linked list of IR opcodes.
+/// The list does not own its opcodes, they are allocated from the compilation arena.
+struct IRInstructionList {
+  struct iterator {
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = IROpcode*;
+    using difference_type = std::ptrdiff_t;
+    using pointer = IROpcode**;
+    using reference = IROpcode*;
+
+    iterator() = default;
+    iterator(IROpcode* op, IRInstructionList const* list) : op(op), list(list) {}
+
+    auto operator*() const -> IROpcode* { return op; }
+
+    auto operator++() -> iterator& {
+      op = op->next;
+      return *this;
+    }
+
+    auto operator++(int) -> iterator {
+      auto old = *this;
+      op = op->next;
+      return old;
+    }
+
+    auto operator--() -> iterator& {
+      op = op ? op->prev : list->tail;
+      return *this;
+    }
+
+    auto operator--(int) -> iterator {
+      auto old = *this;
+      --(*this);
+      return old;
+    }
+
+    bool operator==(iterator const& other) const { return op == other.op; }
+    bool operator!=(iterator const& other) const { return op != other.op; }
+
+  private:
+    friend struct IRInstructionList;
+
+    IROpcode* op = nullptr;
+    IRInstructionList const* list = nullptr;
+  };
+
+  using const_iterator = iterator;
+  using reverse_iterator = std::reverse_iterator<iterator>;
+
+  IRInstructionList() = default;
+  IRInstructionList(IRInstructionList const&) = delete;
+  IRInstructionList& operator=(IRInstructionList const&) = delete;
+
+  IRInstructionList(IRInstructionList&& other) {
+    operator=(std::move(other));
+  }
+
+  IRInstructionList& operator=(IRInstructionList&& other) {
+    std::swap(head, other.head);
+    std::swap(tail, other.tail);
+    std::swap(length, other.length);
+    return *this;
+  }
+
+  auto begin() const -> iterator { return {head, this}; }
+  auto end() const -> iterator { return {nullptr, this}; }
+  auto rbegin() const -> reverse_iterator { return reverse_iterator{end()}; }
+  auto rend() const -> reverse_iterator { return reverse_iterator{begin()}; }
+
+  auto front() const -> IROpcode* { return head; }
+  auto back() const -> IROpcode* { return tail; }
+  auto size() const -> size_t { return length; }
+  bool empty() const { return length == 0; }
+
+  /// Insert an opcode before the given position and return an iterator to it.
+  auto insert(iterator pos, IROpcode* op) -> iterator {
+    auto next = pos.op;
+    auto prev = next ? next->prev : tail;
+
+    op->prev = prev;
+    op->next = next;
+
+    if (prev) prev->next = op; else head = op;
+    if (next) next->prev = op; else tail = op;
+
+    length++;
+    return {op, this};
+  }
+
+  void push_back(IROpcode* op) {
+    insert(end(), op);
+  }
+
+  /// Unlink the opcode at the given position and return an iterator to its successor.
+  auto erase(iterator pos) -> iterator {
+    auto op = pos.op;
+    auto next = op->next;
+
+    if (op->prev) op->prev->next = next; else head = next;
+    if (next) next->prev = op->prev; else tail = op->prev;
+
+    op->prev = nullptr;
+    op->next = nullptr;
+
+    length--;
+    return {next, this};
+  }
+
+  void clear() {
+    head = nullptr;
+    tail = nullptr;
+    length = 0;
+  }
+
+private:
+  IROpcode* head = nullptr;
+  IROpcode* tail = nullptr;
+  size_t length = 0;
+};
+
+} // namespace lunatic::frontend
+} // namespace lunatic
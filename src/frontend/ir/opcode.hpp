@@ -7,10 +7,10 @@
 
 #pragma once
 
+#include <cstddef>
 #include <fmt/format.h>
 #include <stdexcept>
 
-#include "common/pool_allocator.hpp"
 #include "register.hpp"
 #include "value.hpp"
 
@@ -58,49 +58,165 @@ enum class IROpcodeClass {
   MCR
 };
 
-// TODO: Reads(), Writes() and ToString() should be const,
-// but due to the nature of this Optional<T> implementation this is not possible at the moment.
+/// Describes the operand slots of an opcode class.
+/// Each opcode stores its operands (results first, then inputs) as IRAnyRef slots
+/// directly after the IROpcode header. This lets passes and the register allocator
+/// iterate the operands of any opcode without knowing its concrete type.
+struct IROpcodeInfo {
+  /// Number of operand slots
+  u8 operand_count;
 
-struct IROpcode : PoolObject {
-  virtual ~IROpcode() = default;
+  /// Bitmask of the slots which are written by the opcode
+  u8 write_mask;
 
-  virtual auto GetClass() const -> IROpcodeClass = 0;
-  virtual auto Reads (IRVariable const& var) -> bool = 0;
-  virtual auto Writes(IRVariable const& var) -> bool = 0;
-  virtual void Repoint(
-    IRVariable const& var_old,
-    IRVariable const& var_new
-  ) = 0;
-  virtual void PropagateConstant(
-    IRVariable const& var,
-    IRConstant const& constant
-  ) {}
-  virtual auto ToString() -> std::string = 0;
+  /// Bitmask of the slots which may be replaced by a constant
+  u8 const_mask;
 };
 
-template<IROpcodeClass _klass>
-struct IROpcodeBase : IROpcode {
-  static constexpr IROpcodeClass klass = _klass;
-
-  auto GetClass() const -> IROpcodeClass override { return _klass; }
+constexpr IROpcodeInfo kIROpcodeInfo[] = {
+  { 0, 0b000000, 0b000 }, // NOP
+  { 1, 0b000001, 0b000 }, // LoadGPR       (result)
+  { 1, 0b000000, 0b001 }, // StoreGPR      (value)
+  { 1, 0b000001, 0b000 }, // LoadSPSR      (result)
+  { 1, 0b000000, 0b001 }, // StoreSPSR     (value)
+  { 1, 0b000001, 0b000 }, // LoadCPSR      (result)
+  { 1, 0b000000, 0b001 }, // StoreCPSR     (value)
+  { 0, 0b000000, 0b000 }, // ClearCarry
+  { 0, 0b000000, 0b000 }, // SetCarry
+  { 2, 0b000001, 0b000 }, // UpdateFlags   (result, input)
+  { 2, 0b000001, 0b000 }, // UpdateSticky  (result, input)
+  // TODO: propagating constants into the shift amount is unsafe, because shifter behaviour
+  // is different for shift-by-register vs shift-by-immediate instructions.
+  { 3, 0b000001, 0b000 }, // LSL           (result, operand, amount)
+  { 3, 0b000001, 0b000 }, // LSR           (result, operand, amount)
+  { 3, 0b000001, 0b000 }, // ASR           (result, operand, amount)
+  { 3, 0b000001, 0b000 }, // ROR           (result, operand, amount)
+  { 3, 0b000001, 0b100 }, // AND           (result, lhs, rhs)
+  { 3, 0b000001, 0b100 }, // BIC           (result, lhs, rhs)
+  { 3, 0b000001, 0b100 }, // EOR           (result, lhs, rhs)
+  { 3, 0b000001, 0b100 }, // SUB           (result, lhs, rhs)
+  { 3, 0b000001, 0b100 }, // RSB           (result, lhs, rhs)
+  { 3, 0b000001, 0b100 }, // ADD           (result, lhs, rhs)
+  { 3, 0b000001, 0b100 }, // ADC           (result, lhs, rhs)
+  { 3, 0b000001, 0b100 }, // SBC           (result, lhs, rhs)
+  { 3, 0b000001, 0b100 }, // RSC           (result, lhs, rhs)
+  { 3, 0b000001, 0b100 }, // ORR           (result, lhs, rhs)
+  { 2, 0b000001, 0b010 }, // MOV           (result, source)
+  { 2, 0b000001, 0b010 }, // MVN           (result, source)
+  { 4, 0b000011, 0b000 }, // MUL           (result_hi, result_lo, lhs, rhs)
+  { 6, 0b000011, 0b000 }, // ADD64         (result_hi, result_lo, lhs_hi, lhs_lo, rhs_hi, rhs_lo)
+  { 3, 0b000001, 0b010 }, // MemoryRead    (result, address, index)
+  { 3, 0b000000, 0b011 }, // MemoryWrite   (source, address, index)
+  { 3, 0b000001, 0b000 }, // Flush         (address_out, address_in, cpsr_in)
+  { 4, 0b000011, 0b000 }, // FlushExchange (address_out, cpsr_out, address_in, cpsr_in)
+  { 2, 0b000001, 0b000 }, // CLZ           (result, operand)
+  { 3, 0b000001, 0b000 }, // QADD          (result, lhs, rhs)
+  { 3, 0b000001, 0b000 }, // QSUB          (result, lhs, rhs)
+  { 1, 0b000001, 0b000 }, // MRC           (result)
+  { 1, 0b000000, 0b001 }  // MCR           (value)
 };
 
-struct IRNoOp final : IROpcodeBase<IROpcodeClass::NOP> {
-  auto Reads(IRVariable const& var) -> bool override {
+static_assert(sizeof(kIROpcodeInfo) / sizeof(IROpcodeInfo) == size_t(IROpcodeClass::MCR) + 1);
+
+struct IROpcode {
+  IROpcode(IROpcode const& other) = delete;
+
+  auto GetClass() const -> IROpcodeClass { return klass; }
+
+  auto GetInfo() const -> IROpcodeInfo const& {
+    return kIROpcodeInfo[size_t(klass)];
+  }
+
+  auto GetOperandCount() const -> int {
+    return GetInfo().operand_count;
+  }
+
+  auto IsOperandWritten(int index) const -> bool {
+    return GetInfo().write_mask & (1 << index);
+  }
+
+  // The operand slots are the first data members of every opcode struct.
+  auto GetOperands() -> IRAnyRef* {
+    return reinterpret_cast<IRAnyRef*>(this + 1);
+  }
+
+  auto GetOperands() const -> IRAnyRef const* {
+    return reinterpret_cast<IRAnyRef const*>(this + 1);
+  }
+
+  auto Reads(IRVariable const& var) const -> bool {
+    auto operands = GetOperands();
+    auto operand_count = GetOperandCount();
+
+    for (int i = 0; i < operand_count; i++) {
+      if (!IsOperandWritten(i) && operands[i].IsVariable() && &operands[i].GetVar() == &var) {
+        return true;
+      }
+    }
     return false;
   }
 
-  auto Writes(IRVariable const& var) -> bool override {
+  auto Writes(IRVariable const& var) const -> bool {
+    auto operands = GetOperands();
+    auto operand_count = GetOperandCount();
+
+    for (int i = 0; i < operand_count; i++) {
+      if (IsOperandWritten(i) && operands[i].IsVariable() && &operands[i].GetVar() == &var) {
+        return true;
+      }
+    }
     return false;
   }
 
   void Repoint(
     IRVariable const& var_old,
     IRVariable const& var_new
-  ) override {
+  ) {
+    auto operands = GetOperands();
+    auto operand_count = GetOperandCount();
+
+    for (int i = 0; i < operand_count; i++) {
+      operands[i].Repoint(var_old, var_new);
+    }
+  }
+
+  void PropagateConstant(
+    IRVariable const& var,
+    IRConstant const& constant
+  ) {
+    auto operands = GetOperands();
+    auto operand_count = GetOperandCount();
+    auto const_mask = GetInfo().const_mask;
+
+    for (int i = 0; i < operand_count; i++) {
+      if (const_mask & (1 << i)) {
+        operands[i].PropagateConstant(var, constant);
+      }
+    }
   }
 
-  auto ToString() -> std::string override {
+  auto ToString() const -> std::string;
+
+  /// Links of the intrusive instruction list
+  IROpcode* prev = nullptr;
+  IROpcode* next = nullptr;
+
+protected:
+  IROpcode(IROpcodeClass klass) : klass(klass) {}
+
+private:
+  IROpcodeClass klass;
+};
+
+template<IROpcodeClass _klass>
+struct IROpcodeBase : IROpcode {
+  static constexpr IROpcodeClass klass = _klass;
+
+  IROpcodeBase() : IROpcode(_klass) {}
+};
+
+struct IRNoOp final : IROpcodeBase<IROpcodeClass::NOP> {
+  auto ToString() const -> std::string {
     return "nop";
   }
 };
@@ -109,27 +225,12 @@ struct IRLoadGPR final : IROpcodeBase<IROpcodeClass::LoadGPR> {
   IRLoadGPR(
     IRGuestReg reg,
     IRVariable const& result
-  )   : reg(reg), result(result) {}
+  )   : result(result), reg(reg) {}
 
-  IRGuestReg reg;
   IRVarRef result;
+  IRGuestReg reg;
 
-  auto Reads(IRVariable const& var) -> bool override {
-    return false;
-  }
-
-  auto Writes(IRVariable const& var) -> bool override {
-    return &var == &result.Get();
-  }
-
-  void Repoint(
-    IRVariable const& var_old,
-    IRVariable const& var_new
-  ) override {
-    result.Repoint(var_old, var_new);
-  }
-
-  auto ToString() -> std::string override {
+  auto ToString() const -> std::string {
     return fmt::format(
       "ldgpr {}, {}",
       std::to_string(reg),
@@ -142,37 +243,12 @@ struct IRStoreGPR final : IROpcodeBase<IROpcodeClass::StoreGPR> {
   IRStoreGPR(
     IRGuestReg reg,
     IRAnyRef value
-  )   : reg(reg), value(value) {}
+  )   : value(value), reg(reg) {}
 
-  IRGuestReg reg;
   IRAnyRef value;
+  IRGuestReg reg;
 
-  auto Reads(IRVariable const& var) -> bool override {
-    if (value.IsVariable()) {
-      return &var == &value.GetVar();
-    }
-    return false;
-  }
-
-  auto Writes(IRVariable const& var) -> bool override {
-    return false;
-  }
-
-  void Repoint(
-    IRVariable const& var_old,
-    IRVariable const& var_new
-  ) override {
-    value.Repoint(var_old, var_new);
-  }
-
-  void PropagateConstant(
-    IRVariable const& var,
-    IRConstant const& constant
-  ) override {
-    value.PropagateConstant(var, constant);
-  }
-
-  auto ToString() -> std::string override {
+  auto ToString() const -> std::string {
     return fmt::format(
       "stgpr {}, {}",
       std::to_string(reg),
@@ -190,22 +266,7 @@ struct IRLoadSPSR final : IROpcodeBase<IROpcodeClass::LoadSPSR> {
   IRVarRef result;
   Mode mode;
 
-  auto Reads(IRVariable const& var) -> bool override {
-    return false;
-  }
-
-  auto Writes(IRVariable const& var) -> bool override {
-    return &var == &result.Get();
-  }
-
-  void Repoint(
-    IRVariable const& var_old,
-    IRVariable const& var_new
-  ) override {
-    result.Repoint(var_old, var_new);
-  }
-
-  auto ToString() -> std::string override {
+  auto ToString() const -> std::string {
     return fmt::format(
       "ldspsr.{} {}",
       std::to_string(mode),
@@ -223,29 +284,7 @@ struct IRStoreSPSR final : IROpcodeBase<IROpcodeClass::StoreSPSR> {
   IRAnyRef value;
   Mode mode;
 
-  auto Reads(IRVariable const& var) -> bool override {
-    return value.IsVariable() && (&var == &value.GetVar());
-  }
-
-  auto Writes(IRVariable const& var) -> bool override {
-    return false;
-  }
-
-  void Repoint(
-    IRVariable const& var_old,
-    IRVariable const& var_new
-  ) override {
-    value.Repoint(var_old, var_new);
-  }
-
-  void PropagateConstant(
-    IRVariable const& var,
-    IRConstant const& constant
-  ) override {
-    value.PropagateConstant(var, constant);  
-  }
-
-  auto ToString() -> std::string override {
+  auto ToString() const -> std::string {
     return fmt::format(
       "stspsr.{} {}",
       std::to_string(mode),
@@ -260,22 +299,7 @@ struct IRLoadCPSR final : IROpcodeBase<IROpcodeClass::LoadCPSR> {
 
   IRVarRef result;
 
-  auto Reads(IRVariable const& var) -> bool override {
-    return false;
-  }
-
-  auto Writes(IRVariable const& var) -> bool override {
-    return &var == &result.Get();
-  }
-
-  void Repoint(
-    IRVariable const& var_old,
-    IRVariable const& var_new
-  ) override {
-    result.Repoint(var_old, var_new);
-  }
-
-  auto ToString() -> std::string override {
+  auto ToString() const -> std::string {
     return fmt::format("ldcpsr {}", std::to_string(result));
   }
 };
@@ -285,73 +309,19 @@ struct IRStoreCPSR final : IROpcodeBase<IROpcodeClass::StoreCPSR> {
 
   IRAnyRef value;
 
-  auto Reads(IRVariable const& var) -> bool override {
-    return value.IsVariable() && &var == &value.GetVar();
-  }
-
-  auto Writes(IRVariable const& var) -> bool override {
-    return false;
-  }
-
-  void Repoint(
-    IRVariable const& var_old,
-    IRVariable const& var_new
-  ) override {
-    value.Repoint(var_old, var_new);
-  }
-
-  void PropagateConstant(
-    IRVariable const& var,
-    IRConstant const& constant
-  ) override {
-    value.PropagateConstant(var, constant);  
-  }
-
-  auto ToString() -> std::string override {
+  auto ToString() const -> std::string {
     return fmt::format("stcpsr {}", std::to_string(value));
   }
 };
 
 struct IRClearCarry final : IROpcodeBase<IROpcodeClass::ClearCarry> {
-  auto Reads(IRVariable const& var) -> bool override {
-    return false;
-  }
-
-  auto Writes(IRVariable const& var) -> bool override {
-    return false;
-  }
-
-  void Repoint(
-    IRVariable const& var_old,
-    IRVariable const& var_new
-  ) override {
-    (void)var_old;
-    (void)var_new;
-  }
-
-  auto ToString() -> std::string override {
+  auto ToString() const -> std::string {
     return "clearcarry";
   }
 };
 
 struct IRSetCarry final : IROpcodeBase<IROpcodeClass::SetCarry> {
-  auto Reads(IRVariable const& var) -> bool override {
-    return false;
-  }
-
-  auto Writes(IRVariable const& var) -> bool override {
-    return false;
-  }
-
-  void Repoint(
-    IRVariable const& var_old,
-    IRVariable const& var_new
-  ) override {
-    (void)var_old;
-    (void)var_new;
-  }
-
-  auto ToString() -> std::string override {
+  auto ToString() const -> std::string {
     return "setcarry";
   }
 };
@@ -379,23 +349,7 @@ struct IRUpdateFlags final : IROpcodeBase<IROpcodeClass::UpdateFlags> {
   bool flag_c;
   bool flag_v;
 
-  auto Reads(IRVariable const& var) -> bool override {
-    return &input.Get() == &var;
-  }
-
-  auto Writes(IRVariable const& var) -> bool override {
-    return &result.Get() == &var;
-  }
-
-  void Repoint(
-    IRVariable const& var_old,
-    IRVariable const& var_new
-  ) override {
-    result.Repoint(var_old, var_new);
-    input.Repoint(var_old, var_new);
-  }
-
-  auto ToString() -> std::string override {
+  auto ToString() const -> std::string {
     return fmt::format(
       "update.{}{}{}{} {}, {}",
       flag_n ? 'n' : '-',
@@ -417,23 +371,7 @@ struct IRUpdateSticky final : IROpcodeBase<IROpcodeClass::UpdateSticky> {
   IRVarRef result;
   IRVarRef input;
 
-  auto Reads(IRVariable const& var) -> bool override {
-    return &input.Get() == &var;
-  }
-
-  auto Writes(IRVariable const& var) -> bool override {
-    return &result.Get() == &var;
-  }
-
-  void Repoint(
-    IRVariable const& var_old,
-    IRVariable const& var_new
-  ) override {
-    result.Repoint(var_old, var_new);
-    input.Repoint(var_old, var_new);
-  }
-
-  auto ToString() -> std::string override {
+  auto ToString() const -> std::string {
     return fmt::format(
       "update.q {}, {}",
       std::to_string(result),
@@ -460,38 +398,12 @@ struct IRShifterBase : IROpcodeBase<_klass> {
   IRAnyRef amount;
   bool update_host_flags;
 
-  auto Reads(IRVariable const& var) -> bool override {
-    return &var == &operand.Get() ||
-          (amount.IsVariable() && &var == &amount.GetVar());
-  }
-
-  auto Writes(IRVariable const& var) -> bool override {
-    return &var == &result.Get();
-  }
-
-  void Repoint(
-    IRVariable const& var_old,
-    IRVariable const& var_new
-  ) override {
-    result.Repoint(var_old, var_new);
-    operand.Repoint(var_old, var_new);
-    amount.Repoint(var_old, var_new);
-  }
-
-  void PropagateConstant(
-    IRVariable const& var,
-    IRConstant const& constant
-  ) override {
-    // TODO: this is unsafe, because shifter behaviour is different for
-    // shift-by-register vs shift-by-immediate instructions.
-    //amount.PropagateConstant(var, constant);
-  }
 };
 
 struct IRLogicalShiftLeft final : IRShifterBase<IROpcodeClass::LSL> {
   using IRShifterBase::IRShifterBase;
 
-  auto ToString() -> std::string override {
+  auto ToString() const -> std::string {
     return fmt::format(
       "lsl{} {}, {}, {}",
       update_host_flags ? "s" : "",
@@ -505,7 +417,7 @@ struct IRLogicalShiftLeft final : IRShifterBase<IROpcodeClass::LSL> {
 struct IRLogicalShiftRight final : IRShifterBase<IROpcodeClass::LSR> {
   using IRShifterBase::IRShifterBase;
 
-  auto ToString() -> std::string override {
+  auto ToString() const -> std::string {
     return fmt::format(
       "lsr{} {}, {}, {}",
       update_host_flags ? "s" : "",
@@ -519,7 +431,7 @@ struct IRLogicalShiftRight final : IRShifterBase<IROpcodeClass::LSR> {
 struct IRArithmeticShiftRight final : IRShifterBase<IROpcodeClass::ASR> {
   using IRShifterBase::IRShifterBase;
 
-  auto ToString() -> std::string override {
+  auto ToString() const -> std::string {
     return fmt::format(
       "asr{} {}, {}, {}",
       update_host_flags ? "s": "",
@@ -533,7 +445,7 @@ struct IRArithmeticShiftRight final : IRShifterBase<IROpcodeClass::ASR> {
 struct IRRotateRight final : IRShifterBase<IROpcodeClass::ROR> {
   using IRShifterBase::IRShifterBase;
 
-  auto ToString() -> std::string override {
+  auto ToString() const -> std::string {
     return fmt::format(
       "ror{} {}, {}, {}",
       update_host_flags ? "s" : "",
@@ -551,51 +463,26 @@ struct IRBinaryOpBase : IROpcodeBase<_klass> {
     IRVariable const& lhs,
     IRAnyRef rhs,
     bool update_host_flags
-  )   : result(result)
-      , lhs(lhs)
+  )   : lhs(lhs)
       , rhs(rhs)
       , update_host_flags(update_host_flags) {
+    if (result.HasValue()) {
+      this->result = result.Unwrap();
+    }
   }
 
-  Optional<IRVariable const&> result;
+  /// May be null, if only the host flags are of interest.
+  IRAnyRef result;
   IRVarRef lhs;
   IRAnyRef rhs;
   bool update_host_flags;
 
-  auto Reads(IRVariable const& var) -> bool override {
-    return &lhs.Get() == &var || 
-          (rhs.IsVariable() && (&rhs.GetVar() == &var));
-  }
-
-  auto Writes(IRVariable const& var) -> bool override {
-    return result.HasValue() && (&result.Unwrap() == &var);
-  }
-
-  void Repoint(
-    IRVariable const& var_old,
-    IRVariable const& var_new
-  ) override {
-    // TODO: make this reusable?
-    if (result.HasValue() && (&result.Unwrap() == &var_old)) {
-      result = var_new;
-    }
-
-    lhs.Repoint(var_old, var_new);
-    rhs.Repoint(var_old, var_new);
-  }
-
-  void PropagateConstant(
-    IRVariable const& var,
-    IRConstant const& constant
-  ) override {
-    rhs.PropagateConstant(var, constant);  
-  }
 };
 
 struct IRBitwiseAND final : IRBinaryOpBase<IROpcodeClass::AND> {
   using IRBinaryOpBase::IRBinaryOpBase;
 
-  auto ToString() -> std::string override {
+  auto ToString() const -> std::string {
     return fmt::format(
       "and{} {}, {}, {}",
       update_host_flags ? "s" : "",
@@ -609,7 +496,7 @@ struct IRBitwiseAND final : IRBinaryOpBase<IROpcodeClass::AND> {
 struct IRBitwiseBIC final : IRBinaryOpBase<IROpcodeClass::BIC> {
   using IRBinaryOpBase::IRBinaryOpBase;
 
-  auto ToString() -> std::string override {
+  auto ToString() const -> std::string {
     return fmt::format(
       "bic{} {}, {}, {}",
       update_host_flags ? "s" : "",
@@ -623,7 +510,7 @@ struct IRBitwiseBIC final : IRBinaryOpBase<IROpcodeClass::BIC> {
 struct IRBitwiseEOR final : IRBinaryOpBase<IROpcodeClass::EOR> {
   using IRBinaryOpBase::IRBinaryOpBase;
 
-  auto ToString() -> std::string override {
+  auto ToString() const -> std::string {
     return fmt::format(
       "eor{} {}, {}, {}",
       update_host_flags ? "s" : "",
@@ -637,7 +524,7 @@ struct IRBitwiseEOR final : IRBinaryOpBase<IROpcodeClass::EOR> {
 struct IRSub final : IRBinaryOpBase<IROpcodeClass::SUB> {
   using IRBinaryOpBase::IRBinaryOpBase;
 
-  auto ToString() -> std::string override {
+  auto ToString() const -> std::string {
     return fmt::format(
       "sub{} {}, {}, {}",
       update_host_flags ? "s" : "",
@@ -651,7 +538,7 @@ struct IRSub final : IRBinaryOpBase<IROpcodeClass::SUB> {
 struct IRRsb final : IRBinaryOpBase<IROpcodeClass::RSB> {
   using IRBinaryOpBase::IRBinaryOpBase;
 
-  auto ToString() -> std::string override {
+  auto ToString() const -> std::string {
     return fmt::format(
       "rsb{} {}, {}, {}",
       update_host_flags ? "s" : "",
@@ -665,13 +552,17 @@ struct IRRsb final : IRBinaryOpBase<IROpcodeClass::RSB> {
 struct IRAdd final : IRBinaryOpBase<IROpcodeClass::ADD> {
   using IRBinaryOpBase::IRBinaryOpBase;
 
-  auto ToString() -> std::string override {
+  /// Left shift (0 - 3) applied to rhs before the addition. Only used when the host flags are not updated.
+  int rhs_shift = 0;
+
+  auto ToString() const -> std::string {
     return fmt::format(
-      "add{} {}, {}, {}",
+      "add{} {}, {}, {}{}",
       update_host_flags ? "s" : "",
       std::to_string(result),
       std::to_string(lhs),
-      std::to_string(rhs)
+      std::to_string(rhs),
+      rhs_shift != 0 ? fmt::format(" << {}", rhs_shift) : ""
     );
   }
 };
@@ -679,7 +570,7 @@ struct IRAdd final : IRBinaryOpBase<IROpcodeClass::ADD> {
 struct IRAdc final : IRBinaryOpBase<IROpcodeClass::ADC> {
   using IRBinaryOpBase::IRBinaryOpBase;
 
-  auto ToString() -> std::string override {
+  auto ToString() const -> std::string {
     return fmt::format(
       "adc{} {}, {}, {}",
       update_host_flags ? "s" : "",
@@ -693,7 +584,7 @@ struct IRAdc final : IRBinaryOpBase<IROpcodeClass::ADC> {
 struct IRSbc final : IRBinaryOpBase<IROpcodeClass::SBC> {
   using IRBinaryOpBase::IRBinaryOpBase;
 
-  auto ToString() -> std::string override {
+  auto ToString() const -> std::string {
     return fmt::format(
       "sbc{} {}, {}, {}",
       update_host_flags ? "s" : "",
@@ -707,7 +598,7 @@ struct IRSbc final : IRBinaryOpBase<IROpcodeClass::SBC> {
 struct IRRsc final : IRBinaryOpBase<IROpcodeClass::RSC> {
   using IRBinaryOpBase::IRBinaryOpBase;
 
-  auto ToString() -> std::string override {
+  auto ToString() const -> std::string {
     return fmt::format(
       "rsc{} {}, {}, {}",
       update_host_flags ? "s" : "",
@@ -721,7 +612,7 @@ struct IRRsc final : IRBinaryOpBase<IROpcodeClass::RSC> {
 struct IRBitwiseORR final : IRBinaryOpBase<IROpcodeClass::ORR> {
   using IRBinaryOpBase::IRBinaryOpBase;
 
-  auto ToString() -> std::string override {
+  auto ToString() const -> std::string {
     return fmt::format(
       "orr{} {}, {}, {}",
       update_host_flags ? "s" : "",
@@ -746,30 +637,7 @@ struct IRMov final : IROpcodeBase<IROpcodeClass::MOV> {
   IRAnyRef source;
   bool update_host_flags;
 
-  auto Reads(IRVariable const& var) -> bool override {
-    return source.IsVariable() && (&source.GetVar() == &var);
-  }
-
-  auto Writes(IRVariable const& var) -> bool override {
-    return &result.Get() == &var;
-  }
-
-  void Repoint(
-    IRVariable const& var_old,
-    IRVariable const& var_new
-  ) override {
-    result.Repoint(var_old, var_new);
-    source.Repoint(var_old, var_new);
-  }
-
-  void PropagateConstant(
-    IRVariable const& var,
-    IRConstant const& constant
-  ) override {
-    source.PropagateConstant(var, constant);  
-  }
-
-  auto ToString() -> std::string override {
+  auto ToString() const -> std::string {
     return fmt::format(
       "mov{} {}, {}",
       update_host_flags ? "s" : "",
@@ -793,30 +661,7 @@ struct IRMvn final : IROpcodeBase<IROpcodeClass::MVN> {
   IRAnyRef source;
   bool update_host_flags;
 
-  auto Reads(IRVariable const& var) -> bool override {
-    return source.IsVariable() && (&source.GetVar() == &var);
-  }
-
-  auto Writes(IRVariable const& var) -> bool override {
-    return &result.Get() == &var;
-  }
-
-  void Repoint(
-    IRVariable const& var_old,
-    IRVariable const& var_new
-  ) override {
-    result.Repoint(var_old, var_new);
-    source.Repoint(var_old, var_new);
-  }
-
-  void PropagateConstant(
-    IRVariable const& var,
-    IRConstant const& constant
-  ) override {
-    source.PropagateConstant(var, constant);
-  }
-
-  auto ToString() -> std::string override {
+  auto ToString() const -> std::string {
     return fmt::format(
       "mvn{} {}, {}",
       update_host_flags ? "s" : "",
@@ -833,48 +678,29 @@ struct IRMultiply final : IROpcodeBase<IROpcodeClass::MUL> {
     IRVariable const& lhs,
     IRVariable const& rhs,
     bool update_host_flags
-  )   : result_hi(result_hi)
-      , result_lo(result_lo)
+  )   : result_lo(result_lo)
       , lhs(lhs)
       , rhs(rhs)
       , update_host_flags(update_host_flags) {
+    if (result_hi.HasValue()) {
+      this->result_hi = result_hi.Unwrap();
+    }
   }
 
-  Optional<IRVariable const&> result_hi;
+  /// Is null for 32-bit multiplies.
+  IRAnyRef result_hi;
   IRVarRef result_lo;
   IRVarRef lhs;
   IRVarRef rhs;
   bool update_host_flags;
 
-  auto Reads(IRVariable const& var) -> bool override {
-    return &var == &lhs.Get() || &var == &rhs.Get();
-  }
-
-  auto Writes(IRVariable const& var) -> bool override {
-    return &var == &result_lo.Get() || 
-          (result_hi.HasValue() && (&result_hi.Unwrap() == &var));
-  }
-
-  void Repoint(
-    IRVariable const& var_old,
-    IRVariable const& var_new
-  ) override {
-    if (result_hi.HasValue() && (&result_hi.Unwrap() == &var_old)) {
-      result_hi = var_new;
-    }
-
-    result_lo.Repoint(var_old, var_new);
-    lhs.Repoint(var_old, var_new);
-    rhs.Repoint(var_old, var_new);
-  }
-
-  auto ToString() -> std::string override {
+  auto ToString() const -> std::string {
     std::string result_str;
 
-    if (result_hi.HasValue()) {
+    if (!result_hi.IsNull()) {
       result_str = fmt::format(
         "({}, {})",
-        std::to_string(result_hi.Unwrap()),
+        std::to_string(result_hi),
         std::to_string(result_lo)
       );
     } else {
@@ -917,30 +743,7 @@ struct IRAdd64 final : IROpcodeBase<IROpcodeClass::ADD64> {
   IRVarRef rhs_lo;
   bool update_host_flags;
 
-  auto Reads(IRVariable const& var) -> bool override {
-    return &var == &lhs_hi.Get() ||
-           &var == &lhs_lo.Get() ||
-           &var == &rhs_hi.Get() ||
-           &var == &rhs_lo.Get();
-  }
-
-  auto Writes(IRVariable const& var) -> bool override {
-    return &var == &result_hi.Get() || &var == &result_lo.Get();
-  }
-
-  void Repoint(
-    IRVariable const& var_old,
-    IRVariable const& var_new
-  ) override {
-    result_hi.Repoint(var_old, var_new);
-    result_lo.Repoint(var_old, var_new);
-    lhs_hi.Repoint(var_old, var_new);
-    lhs_lo.Repoint(var_old, var_new);
-    rhs_hi.Repoint(var_old, var_new);
-    rhs_lo.Repoint(var_old, var_new);
-  }
-
-  auto ToString() -> std::string override {
+  auto ToString() const -> std::string {
     return fmt::format(
       "add{} ({}, {}), ({}, {}), ({}, {})",
       update_host_flags ? "s": "",
@@ -960,62 +763,72 @@ enum IRMemoryFlags {
   Word = 4,
   Rotate = 8,
   Signed = 16,
-  ARMv4T = 32
+  ARMv4T = 32,
+
+  /// The address is known to be aligned to the access size.
+  Aligned = 64
 };
 
 constexpr auto operator|(IRMemoryFlags lhs, IRMemoryFlags rhs) -> IRMemoryFlags {
   return static_cast<IRMemoryFlags>(int(lhs) | rhs);
 }
 
+inline auto FormatAddress(
+  IRAnyRef const& address,
+  IRAnyRef const& index,
+  int index_shift,
+  u32 offset
+) -> std::string {
+  auto result = std::to_string(address);
+
+  if (!index.IsNull()) {
+    result += fmt::format(" + {} << {}", std::to_string(index), index_shift);
+  }
+
+  if (offset != 0) {
+    result += fmt::format(" + 0x{:08X}", offset);
+  }
+  return result;
+}
+
 struct IRMemoryRead final : IROpcodeBase<IROpcodeClass::MemoryRead> {
   IRMemoryRead(
     IRMemoryFlags flags,
     IRVariable const& result,
-    IRAnyRef address
-  )   : flags(flags)
-      , result(result)
-      , address(address) {
+    IRAnyRef address,
+    IRAnyRef index = {},
+    int index_shift = 0,
+    u32 offset = 0
+  )   : result(result)
+      , address(address)
+      , index(index)
+      , flags(flags)
+      , index_shift(index_shift)
+      , offset(offset) {
   }
 
-  IRMemoryFlags flags;
   IRVarRef result;
   IRAnyRef address;
 
-  auto Reads(IRVariable const& var) -> bool override {
-    return address.IsVariable() && (&address.GetVar() == &var);
-  }
-
-  auto Writes(IRVariable const& var) -> bool override {
-    return &result.Get() == &var;
-  }
-
-  void Repoint(
-    IRVariable const& var_old,
-    IRVariable const& var_new
-  ) override {
-    result.Repoint(var_old, var_new);
-    address.Repoint(var_old, var_new);
-  }
-
-  void PropagateConstant(
-    IRVariable const& var,
-    IRConstant const& constant
-  ) override {
-    address.PropagateConstant(var, constant);
-  }
+  /// The accessed address is: address + (index << index_shift) + offset
+  IRAnyRef index;
+  IRMemoryFlags flags;
+  int index_shift;
+  u32 offset;
 
-  auto ToString() -> std::string override {
+  auto ToString() const -> std::string {
     auto size = "b";
 
     if (flags & IRMemoryFlags::Half) size = "h";
     if (flags & IRMemoryFlags::Word) size = "w";
 
     return fmt::format(
-      "ldr.{}{} {}, [{}]",
+      "ldr.{}{}{} {}, [{}]",
       size,
       (flags & IRMemoryFlags::Rotate) ? "r" : "",
+      (flags & IRMemoryFlags::Aligned) ? "a" : "",
       std::to_string(result),
-      std::to_string(address)
+      FormatAddress(address, index, index_shift, offset)
     );
   }
 };
@@ -1024,52 +837,39 @@ struct IRMemoryWrite final : IROpcodeBase<IROpcodeClass::MemoryWrite> {
   IRMemoryWrite(
     IRMemoryFlags flags,
     IRAnyRef source,
-    IRAnyRef address
-  )   : flags(flags)
-      , source(source)
-      , address(address) {
+    IRAnyRef address,
+    IRAnyRef index = {},
+    int index_shift = 0,
+    u32 offset = 0
+  )   : source(source)
+      , address(address)
+      , index(index)
+      , flags(flags)
+      , index_shift(index_shift)
+      , offset(offset) {
   }
 
-  IRMemoryFlags flags;
   IRAnyRef source;
   IRAnyRef address;
 
-  auto Reads(IRVariable const& var) -> bool override {
-    return (address.IsVariable() && (&address.GetVar() == &var)) ||
-           (source.IsVariable()  && (&source.GetVar()  == &var));
-  }
-
-  auto Writes(IRVariable const& var) -> bool override {
-    return false;
-  }
-
-  void Repoint(
-    IRVariable const& var_old,
-    IRVariable const& var_new
-  ) override {
-    source.Repoint(var_old, var_new);
-    address.Repoint(var_old, var_new);
-  }
-
-  void PropagateConstant(
-    IRVariable const& var,
-    IRConstant const& constant
-  ) override {
-    source.PropagateConstant(var, constant);
-    address.PropagateConstant(var, constant);
-  }
+  /// The accessed address is: address + (index << index_shift) + offset
+  IRAnyRef index;
+  IRMemoryFlags flags;
+  int index_shift;
+  u32 offset;
 
-  auto ToString() -> std::string override {
+  auto ToString() const -> std::string {
     auto size = "b";
 
     if (flags & IRMemoryFlags::Half) size = "h";
     if (flags & IRMemoryFlags::Word) size = "w";
 
     return fmt::format(
-      "str.{} {}, [{}]",
+      "str.{}{} {}, [{}]",
       size,
+      (flags & IRMemoryFlags::Aligned) ? "a" : "",
       std::to_string(source),
-      std::to_string(address)
+      FormatAddress(address, index, index_shift, offset)
     );
   }
 };
@@ -1088,24 +888,7 @@ struct IRFlush final : IROpcodeBase<IROpcodeClass::Flush> {
   IRVarRef address_in;
   IRVarRef cpsr_in;
 
-  auto Reads(IRVariable const& var) -> bool override {
-    return &var == &address_in.Get() || &var == &cpsr_in.Get();
-  }
-
-  auto Writes(IRVariable const& var) -> bool override {
-    return &var == &address_out.Get();
-  }
-
-  void Repoint(
-    IRVariable const& var_old,
-    IRVariable const& var_new
-  ) override {
-    address_out.Repoint(var_old, var_new);
-    address_in.Repoint(var_old, var_new);
-    cpsr_in.Repoint(var_old, var_new);
-  }
-
-  auto ToString() -> std::string override {
+  auto ToString() const -> std::string {
     return fmt::format(
       "flush {}, {}, {}",
       std::to_string(address_out),
@@ -1132,25 +915,7 @@ struct IRFlushExchange final : IROpcodeBase<IROpcodeClass::FlushExchange> {
   IRVarRef address_in;
   IRVarRef cpsr_in;
 
-  auto Reads(IRVariable const& var) -> bool override {
-    return &var == &address_in.Get() || &var == &cpsr_in.Get();
-  }
-
-  auto Writes(IRVariable const& var) -> bool override {
-    return &var == &address_out.Get() || &var == &cpsr_out.Get();
-  }
-
-  void Repoint(
-    IRVariable const& var_old,
-    IRVariable const& var_new
-  ) override {
-    address_out.Repoint(var_old, var_new);
-    cpsr_out.Repoint(var_old, var_new);
-    address_in.Repoint(var_old, var_new);
-    cpsr_in.Repoint(var_old, var_new);
-  }
-
-  auto ToString() -> std::string override {
+  auto ToString() const -> std::string {
     return fmt::format(
       "flushxchg {}, {}, {}, {}",
       std::to_string(address_out),
@@ -1170,23 +935,7 @@ struct IRCountLeadingZeros final : IROpcodeBase<IROpcodeClass::CLZ> {
   IRVarRef result;
   IRVarRef operand;
 
-  auto Reads(IRVariable const& var) -> bool override {
-    return &var == &operand.Get();
-  }
-
-  auto Writes(IRVariable const& var) -> bool override {
-    return &var == &result.Get();
-  }
-
-  void Repoint(
-    IRVariable const& var_old,
-    IRVariable const& var_new
-  ) override {
-    result.Repoint(var_old, var_new);
-    operand.Repoint(var_old, var_new);
-  }
-
-  auto ToString() -> std::string override {
+  auto ToString() const -> std::string {
     return fmt::format(
       "clz {}, {}",
       std::to_string(result),
@@ -1206,24 +955,7 @@ struct IRSaturatingAdd final : IROpcodeBase<IROpcodeClass::QADD> {
   IRVarRef lhs;
   IRVarRef rhs;
 
-  auto Reads(IRVariable const& var) -> bool override {
-    return &var == &lhs.Get() || &var == &rhs.Get();
-  }
-
-  auto Writes(IRVariable const& var) -> bool override {
-    return &var == &result.Get();
-  }
-
-  void Repoint(
-    IRVariable const& var_old,
-    IRVariable const& var_new
-  ) override {
-    result.Repoint(var_old, var_new);
-    lhs.Repoint(var_old, var_new);
-    rhs.Repoint(var_old, var_new);
-  }
-
-  auto ToString() -> std::string override {
+  auto ToString() const -> std::string {
     return fmt::format(
       "qadd {}, {}, {}",
       std::to_string(result),
@@ -1244,24 +976,7 @@ struct IRSaturatingSub final : IROpcodeBase<IROpcodeClass::QSUB> {
   IRVarRef lhs;
   IRVarRef rhs;
 
-  auto Reads(IRVariable const& var) -> bool override {
-    return &var == &lhs.Get() || &var == &rhs.Get();
-  }
-
-  auto Writes(IRVariable const& var) -> bool override {
-    return &var == &result.Get();
-  }
-
-  void Repoint(
-    IRVariable const& var_old,
-    IRVariable const& var_new
-  ) override {
-    result.Repoint(var_old, var_new);
-    lhs.Repoint(var_old, var_new);
-    rhs.Repoint(var_old, var_new);
-  }
-
-  auto ToString() -> std::string override {
+  auto ToString() const -> std::string {
     return fmt::format(
       "qsub {}, {}, {}",
       std::to_string(result),
@@ -1294,22 +1009,7 @@ struct IRReadCoprocessorRegister final : IROpcodeBase<IROpcodeClass::MRC> {
   uint cm;
   uint opcode2;
 
-  auto Reads(IRVariable const& var) -> bool override {
-    return false;
-  }
-
-  auto Writes(IRVariable const& var) -> bool override {
-    return &var == &result.Get();
-  }
-
-  void Repoint(
-    IRVariable const& var_old,
-    IRVariable const& var_new
-  ) override {
-    result.Repoint(var_old, var_new);
-  }
-
-  auto ToString() -> std::string override {
+  auto ToString() const -> std::string {
     return fmt::format(
       "mrc {}, cp{}, #{}, {}, {}, #{}",
       std::to_string(result),
@@ -1345,29 +1045,7 @@ struct IRWriteCoprocessorRegister final : IROpcodeBase<IROpcodeClass::MCR> {
   uint cm;
   uint opcode2;
 
-  auto Reads(IRVariable const& var) -> bool override {
-    return value.IsVariable() && (&value.GetVar() == &var);
-  }
-
-  auto Writes(IRVariable const& var) -> bool override {
-    return false;
-  }
-
-  void Repoint(
-    IRVariable const& var_old,
-    IRVariable const& var_new
-  ) override {
-    value.Repoint(var_old, var_new);
-  }
-
-  void PropagateConstant(
-    IRVariable const& var,
-    IRConstant const& constant
-  ) override {
-    value.PropagateConstant(var, constant); 
-  }
-
-  auto ToString() -> std::string override {
+  auto ToString() const -> std::string {
     return fmt::format(
       "mcr {}, cp{}, #{}, {}, {}, #{}",
       std::to_string(value),
@@ -1380,6 +1058,241 @@ struct IRWriteCoprocessorRegister final : IROpcodeBase<IROpcodeClass::MCR> {
   }
 };
 
+/* GetOperands() finds the operand slots of an opcode right after the IROpcode header.
+ * Check that every opcode class stores exactly the slots that kIROpcodeInfo describes there, in that order.
+ */
+// The opcode classes are not standard-layout, offsetof() is supported for them but warned about.
+#if defined(__GNUC__)
+  #pragma GCC diagnostic push
+  #pragma GCC diagnostic ignored "-Winvalid-offsetof"
+#endif
+
+#define LUNATIC_IR_OPERAND_COUNT(T, count) \
+  static_assert(kIROpcodeInfo[size_t(T::klass)].operand_count == (count), #T ": wrong number of operand slots")
+
+#define LUNATIC_IR_OPERAND_SLOT(T, index, member) \
+  static_assert( \
+    sizeof(T::member) == sizeof(IRAnyRef) && offsetof(T, member) == sizeof(IROpcode) + (index) * sizeof(IRAnyRef), \
+    #T "::" #member " is not stored in operand slot " #index \
+  )
+
+LUNATIC_IR_OPERAND_COUNT(IRNoOp, 0);
+
+LUNATIC_IR_OPERAND_COUNT(IRLoadGPR, 1);
+LUNATIC_IR_OPERAND_SLOT(IRLoadGPR, 0, result);
+
+LUNATIC_IR_OPERAND_COUNT(IRStoreGPR, 1);
+LUNATIC_IR_OPERAND_SLOT(IRStoreGPR, 0, value);
+
+LUNATIC_IR_OPERAND_COUNT(IRLoadSPSR, 1);
+LUNATIC_IR_OPERAND_SLOT(IRLoadSPSR, 0, result);
+
+LUNATIC_IR_OPERAND_COUNT(IRStoreSPSR, 1);
+LUNATIC_IR_OPERAND_SLOT(IRStoreSPSR, 0, value);
+
+LUNATIC_IR_OPERAND_COUNT(IRLoadCPSR, 1);
+LUNATIC_IR_OPERAND_SLOT(IRLoadCPSR, 0, result);
+
+LUNATIC_IR_OPERAND_COUNT(IRStoreCPSR, 1);
+LUNATIC_IR_OPERAND_SLOT(IRStoreCPSR, 0, value);
+
+LUNATIC_IR_OPERAND_COUNT(IRClearCarry, 0);
+
+LUNATIC_IR_OPERAND_COUNT(IRSetCarry, 0);
+
+LUNATIC_IR_OPERAND_COUNT(IRUpdateFlags, 2);
+LUNATIC_IR_OPERAND_SLOT(IRUpdateFlags, 0, result);
+LUNATIC_IR_OPERAND_SLOT(IRUpdateFlags, 1, input);
+
+LUNATIC_IR_OPERAND_COUNT(IRUpdateSticky, 2);
+LUNATIC_IR_OPERAND_SLOT(IRUpdateSticky, 0, result);
+LUNATIC_IR_OPERAND_SLOT(IRUpdateSticky, 1, input);
+
+LUNATIC_IR_OPERAND_COUNT(IRLogicalShiftLeft, 3);
+LUNATIC_IR_OPERAND_SLOT(IRLogicalShiftLeft, 0, result);
+LUNATIC_IR_OPERAND_SLOT(IRLogicalShiftLeft, 1, operand);
+LUNATIC_IR_OPERAND_SLOT(IRLogicalShiftLeft, 2, amount);
+
+LUNATIC_IR_OPERAND_COUNT(IRLogicalShiftRight, 3);
+LUNATIC_IR_OPERAND_SLOT(IRLogicalShiftRight, 0, result);
+LUNATIC_IR_OPERAND_SLOT(IRLogicalShiftRight, 1, operand);
+LUNATIC_IR_OPERAND_SLOT(IRLogicalShiftRight, 2, amount);
+
+LUNATIC_IR_OPERAND_COUNT(IRArithmeticShiftRight, 3);
+LUNATIC_IR_OPERAND_SLOT(IRArithmeticShiftRight, 0, result);
+LUNATIC_IR_OPERAND_SLOT(IRArithmeticShiftRight, 1, operand);
+LUNATIC_IR_OPERAND_SLOT(IRArithmeticShiftRight, 2, amount);
+
+LUNATIC_IR_OPERAND_COUNT(IRRotateRight, 3);
+LUNATIC_IR_OPERAND_SLOT(IRRotateRight, 0, result);
+LUNATIC_IR_OPERAND_SLOT(IRRotateRight, 1, operand);
+LUNATIC_IR_OPERAND_SLOT(IRRotateRight, 2, amount);
+
+LUNATIC_IR_OPERAND_COUNT(IRBitwiseAND, 3);
+LUNATIC_IR_OPERAND_SLOT(IRBitwiseAND, 0, result);
+LUNATIC_IR_OPERAND_SLOT(IRBitwiseAND, 1, lhs);
+LUNATIC_IR_OPERAND_SLOT(IRBitwiseAND, 2, rhs);
+
+LUNATIC_IR_OPERAND_COUNT(IRBitwiseBIC, 3);
+LUNATIC_IR_OPERAND_SLOT(IRBitwiseBIC, 0, result);
+LUNATIC_IR_OPERAND_SLOT(IRBitwiseBIC, 1, lhs);
+LUNATIC_IR_OPERAND_SLOT(IRBitwiseBIC, 2, rhs);
+
+LUNATIC_IR_OPERAND_COUNT(IRBitwiseEOR, 3);
+LUNATIC_IR_OPERAND_SLOT(IRBitwiseEOR, 0, result);
+LUNATIC_IR_OPERAND_SLOT(IRBitwiseEOR, 1, lhs);
+LUNATIC_IR_OPERAND_SLOT(IRBitwiseEOR, 2, rhs);
+
+LUNATIC_IR_OPERAND_COUNT(IRSub, 3);
+LUNATIC_IR_OPERAND_SLOT(IRSub, 0, result);
+LUNATIC_IR_OPERAND_SLOT(IRSub, 1, lhs);
+LUNATIC_IR_OPERAND_SLOT(IRSub, 2, rhs);
+
+LUNATIC_IR_OPERAND_COUNT(IRRsb, 3);
+LUNATIC_IR_OPERAND_SLOT(IRRsb, 0, result);
+LUNATIC_IR_OPERAND_SLOT(IRRsb, 1, lhs);
+LUNATIC_IR_OPERAND_SLOT(IRRsb, 2, rhs);
+
+LUNATIC_IR_OPERAND_COUNT(IRAdd, 3);
+LUNATIC_IR_OPERAND_SLOT(IRAdd, 0, result);
+LUNATIC_IR_OPERAND_SLOT(IRAdd, 1, lhs);
+LUNATIC_IR_OPERAND_SLOT(IRAdd, 2, rhs);
+
+LUNATIC_IR_OPERAND_COUNT(IRAdc, 3);
+LUNATIC_IR_OPERAND_SLOT(IRAdc, 0, result);
+LUNATIC_IR_OPERAND_SLOT(IRAdc, 1, lhs);
+LUNATIC_IR_OPERAND_SLOT(IRAdc, 2, rhs);
+
+LUNATIC_IR_OPERAND_COUNT(IRSbc, 3);
+LUNATIC_IR_OPERAND_SLOT(IRSbc, 0, result);
+LUNATIC_IR_OPERAND_SLOT(IRSbc, 1, lhs);
+LUNATIC_IR_OPERAND_SLOT(IRSbc, 2, rhs);
+
+LUNATIC_IR_OPERAND_COUNT(IRRsc, 3);
+LUNATIC_IR_OPERAND_SLOT(IRRsc, 0, result);
+LUNATIC_IR_OPERAND_SLOT(IRRsc, 1, lhs);
+LUNATIC_IR_OPERAND_SLOT(IRRsc, 2, rhs);
+
+LUNATIC_IR_OPERAND_COUNT(IRBitwiseORR, 3);
+LUNATIC_IR_OPERAND_SLOT(IRBitwiseORR, 0, result);
+LUNATIC_IR_OPERAND_SLOT(IRBitwiseORR, 1, lhs);
+LUNATIC_IR_OPERAND_SLOT(IRBitwiseORR, 2, rhs);
+
+LUNATIC_IR_OPERAND_COUNT(IRMov, 2);
+LUNATIC_IR_OPERAND_SLOT(IRMov, 0, result);
+LUNATIC_IR_OPERAND_SLOT(IRMov, 1, source);
+
+LUNATIC_IR_OPERAND_COUNT(IRMvn, 2);
+LUNATIC_IR_OPERAND_SLOT(IRMvn, 0, result);
+LUNATIC_IR_OPERAND_SLOT(IRMvn, 1, source);
+
+LUNATIC_IR_OPERAND_COUNT(IRMultiply, 4);
+LUNATIC_IR_OPERAND_SLOT(IRMultiply, 0, result_hi);
+LUNATIC_IR_OPERAND_SLOT(IRMultiply, 1, result_lo);
+LUNATIC_IR_OPERAND_SLOT(IRMultiply, 2, lhs);
+LUNATIC_IR_OPERAND_SLOT(IRMultiply, 3, rhs);
+
+LUNATIC_IR_OPERAND_COUNT(IRAdd64, 6);
+LUNATIC_IR_OPERAND_SLOT(IRAdd64, 0, result_hi);
+LUNATIC_IR_OPERAND_SLOT(IRAdd64, 1, result_lo);
+LUNATIC_IR_OPERAND_SLOT(IRAdd64, 2, lhs_hi);
+LUNATIC_IR_OPERAND_SLOT(IRAdd64, 3, lhs_lo);
+LUNATIC_IR_OPERAND_SLOT(IRAdd64, 4, rhs_hi);
+LUNATIC_IR_OPERAND_SLOT(IRAdd64, 5, rhs_lo);
+
+LUNATIC_IR_OPERAND_COUNT(IRMemoryRead, 3);
+LUNATIC_IR_OPERAND_SLOT(IRMemoryRead, 0, result);
+LUNATIC_IR_OPERAND_SLOT(IRMemoryRead, 1, address);
+LUNATIC_IR_OPERAND_SLOT(IRMemoryRead, 2, index);
+
+LUNATIC_IR_OPERAND_COUNT(IRMemoryWrite, 3);
+LUNATIC_IR_OPERAND_SLOT(IRMemoryWrite, 0, source);
+LUNATIC_IR_OPERAND_SLOT(IRMemoryWrite, 1, address);
+LUNATIC_IR_OPERAND_SLOT(IRMemoryWrite, 2, index);
+
+LUNATIC_IR_OPERAND_COUNT(IRFlush, 3);
+LUNATIC_IR_OPERAND_SLOT(IRFlush, 0, address_out);
+LUNATIC_IR_OPERAND_SLOT(IRFlush, 1, address_in);
+LUNATIC_IR_OPERAND_SLOT(IRFlush, 2, cpsr_in);
+
+LUNATIC_IR_OPERAND_COUNT(IRFlushExchange, 4);
+LUNATIC_IR_OPERAND_SLOT(IRFlushExchange, 0, address_out);
+LUNATIC_IR_OPERAND_SLOT(IRFlushExchange, 1, cpsr_out);
+LUNATIC_IR_OPERAND_SLOT(IRFlushExchange, 2, address_in);
+LUNATIC_IR_OPERAND_SLOT(IRFlushExchange, 3, cpsr_in);
+
+LUNATIC_IR_OPERAND_COUNT(IRCountLeadingZeros, 2);
+LUNATIC_IR_OPERAND_SLOT(IRCountLeadingZeros, 0, result);
+LUNATIC_IR_OPERAND_SLOT(IRCountLeadingZeros, 1, operand);
+
+LUNATIC_IR_OPERAND_COUNT(IRSaturatingAdd, 3);
+LUNATIC_IR_OPERAND_SLOT(IRSaturatingAdd, 0, result);
+LUNATIC_IR_OPERAND_SLOT(IRSaturatingAdd, 1, lhs);
+LUNATIC_IR_OPERAND_SLOT(IRSaturatingAdd, 2, rhs);
+
+LUNATIC_IR_OPERAND_COUNT(IRSaturatingSub, 3);
+LUNATIC_IR_OPERAND_SLOT(IRSaturatingSub, 0, result);
+LUNATIC_IR_OPERAND_SLOT(IRSaturatingSub, 1, lhs);
+LUNATIC_IR_OPERAND_SLOT(IRSaturatingSub, 2, rhs);
+
+LUNATIC_IR_OPERAND_COUNT(IRReadCoprocessorRegister, 1);
+LUNATIC_IR_OPERAND_SLOT(IRReadCoprocessorRegister, 0, result);
+
+LUNATIC_IR_OPERAND_COUNT(IRWriteCoprocessorRegister, 1);
+LUNATIC_IR_OPERAND_SLOT(IRWriteCoprocessorRegister, 0, value);
+
+#undef LUNATIC_IR_OPERAND_COUNT
+#undef LUNATIC_IR_OPERAND_SLOT
+
+#if defined(__GNUC__)
+  #pragma GCC diagnostic pop
+#endif
+
+inline auto IROpcode::ToString() const -> std::string {
+  switch (klass) {
+    case IROpcodeClass::NOP: return static_cast<IRNoOp const*>(this)->ToString();
+    case IROpcodeClass::LoadGPR: return static_cast<IRLoadGPR const*>(this)->ToString();
+    case IROpcodeClass::StoreGPR: return static_cast<IRStoreGPR const*>(this)->ToString();
+    case IROpcodeClass::LoadSPSR: return static_cast<IRLoadSPSR const*>(this)->ToString();
+    case IROpcodeClass::StoreSPSR: return static_cast<IRStoreSPSR const*>(this)->ToString();
+    case IROpcodeClass::LoadCPSR: return static_cast<IRLoadCPSR const*>(this)->ToString();
+    case IROpcodeClass::StoreCPSR: return static_cast<IRStoreCPSR const*>(this)->ToString();
+    case IROpcodeClass::ClearCarry: return static_cast<IRClearCarry const*>(this)->ToString();
+    case IROpcodeClass::SetCarry: return static_cast<IRSetCarry const*>(this)->ToString();
+    case IROpcodeClass::UpdateFlags: return static_cast<IRUpdateFlags const*>(this)->ToString();
+    case IROpcodeClass::UpdateSticky: return static_cast<IRUpdateSticky const*>(this)->ToString();
+    case IROpcodeClass::LSL: return static_cast<IRLogicalShiftLeft const*>(this)->ToString();
+    case IROpcodeClass::LSR: return static_cast<IRLogicalShiftRight const*>(this)->ToString();
+    case IROpcodeClass::ASR: return static_cast<IRArithmeticShiftRight const*>(this)->ToString();
+    case IROpcodeClass::ROR: return static_cast<IRRotateRight const*>(this)->ToString();
+    case IROpcodeClass::AND: return static_cast<IRBitwiseAND const*>(this)->ToString();
+    case IROpcodeClass::BIC: return static_cast<IRBitwiseBIC const*>(this)->ToString();
+    case IROpcodeClass::EOR: return static_cast<IRBitwiseEOR const*>(this)->ToString();
+    case IROpcodeClass::SUB: return static_cast<IRSub const*>(this)->ToString();
+    case IROpcodeClass::RSB: return static_cast<IRRsb const*>(this)->ToString();
+    case IROpcodeClass::ADD: return static_cast<IRAdd const*>(this)->ToString();
+    case IROpcodeClass::ADC: return static_cast<IRAdc const*>(this)->ToString();
+    case IROpcodeClass::SBC: return static_cast<IRSbc const*>(this)->ToString();
+    case IROpcodeClass::RSC: return static_cast<IRRsc const*>(this)->ToString();
+    case IROpcodeClass::ORR: return static_cast<IRBitwiseORR const*>(this)->ToString();
+    case IROpcodeClass::MOV: return static_cast<IRMov const*>(this)->ToString();
+    case IROpcodeClass::MVN: return static_cast<IRMvn const*>(this)->ToString();
+    case IROpcodeClass::MUL: return static_cast<IRMultiply const*>(this)->ToString();
+    case IROpcodeClass::ADD64: return static_cast<IRAdd64 const*>(this)->ToString();
+    case IROpcodeClass::MemoryRead: return static_cast<IRMemoryRead const*>(this)->ToString();
+    case IROpcodeClass::MemoryWrite: return static_cast<IRMemoryWrite const*>(this)->ToString();
+    case IROpcodeClass::Flush: return static_cast<IRFlush const*>(this)->ToString();
+    case IROpcodeClass::FlushExchange: return static_cast<IRFlushExchange const*>(this)->ToString();
+    case IROpcodeClass::CLZ: return static_cast<IRCountLeadingZeros const*>(this)->ToString();
+    case IROpcodeClass::QADD: return static_cast<IRSaturatingAdd const*>(this)->ToString();
+    case IROpcodeClass::QSUB: return static_cast<IRSaturatingSub const*>(this)->ToString();
+    case IROpcodeClass::MRC: return static_cast<IRReadCoprocessorRegister const*>(this)->ToString();
+    case IROpcodeClass::MCR: return static_cast<IRWriteCoprocessorRegister const*>(this)->ToString();
+  }
+
+  return "???";
+}
+
 } // namespace lunatic::frontend
 } // namespace lunatic
 
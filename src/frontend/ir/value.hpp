@@ -12,18 +12,27 @@
 #include <stdexcept>
 
 #include "common/optional.hpp"
-#include "common/pool_allocator.hpp"
 
 namespace lunatic {
 namespace frontend {
 
+struct IROpcode;
+
 enum class IRDataType {
   UInt32,
   SInt32
 };
 
+/// An operand slot of an opcode, that reads a variable.
+struct IRUse {
+  IROpcode* op;
+  int slot;
+  IRUse* prev;
+  IRUse* next;
+};
+
 /// Represents an immutable variable
-struct IRVariable : PoolObject {
+struct IRVariable {
   IRVariable(IRVariable const& other) = delete;
 
   /// ID that is unique inside the IREmitter instance.
@@ -35,14 +44,30 @@ struct IRVariable : PoolObject {
   /// An optional label to hint at the variable usage
   char const* const label;
 
+  /// The opcode that writes the variable (if any).
+  /// The def-use chains are maintained by the IREmitter.
+  auto GetDef() const -> IROpcode* { return def; }
+
+  /// The first opcode operand that reads the variable (if any).
+  auto GetFirstUse() const -> IRUse* { return first_use; }
+
+  bool IsUnused() const { return first_use == nullptr; }
+
 private:
   friend struct IREmitter;
+  friend struct IRVariableList;
 
   IRVariable(
     u32 id,
     IRDataType data_type,
     char const* label
   ) : id(id), data_type(data_type), label(label) {}
+
+  mutable IROpcode* def = nullptr;
+  mutable IRUse* first_use = nullptr;
+
+  /// The next variable created by the same emitter.
+  IRVariable* next = nullptr;
 };
 
 /// Represents an immediate (constant) value
@@ -126,26 +151,17 @@ private:
 };
 
 /// Represents an IR argument that always is a variable.
-struct IRVarRef {
-  IRVarRef(IRVariable const& var) : p_var(&var) {}
+/// Shares its layout with IRAnyRef, so that it can be used as an operand slot.
+struct IRVarRef : IRAnyRef {
+  IRVarRef(IRVariable const& var) : IRAnyRef(var) {}
 
   auto Get() const -> IRVariable const& {
-    return *p_var;
-  }
-
-  void Repoint(
-    IRVariable const& var_old,
-    IRVariable const& var_new
-  ) {
-    if (&var_old == p_var) {
-      p_var = &var_new;
-    }
+    return GetVar();
   }
-
-private:
-  IRVariable const* p_var;
 };
 
+static_assert(sizeof(IRVarRef) == sizeof(IRAnyRef));
+
 } // namespace lunatic::frontend 
 } // namespace lunatic
 
@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2022 fleroviux. All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#pragma once
+
+#include <iterator>
+#include <utility>
+
+#include "value.hpp"
+
+namespace lunatic {
+namespace frontend {
+
+/// Intrusive singly-linked list of IR variables, in order of creation.
+/// The list does not own its variables, they are allocated from the compilation arena.
+struct IRVariableList {
+  struct iterator {
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = IRVariable*;
+    using difference_type = std::ptrdiff_t;
+    using pointer = IRVariable**;
+    using reference = IRVariable*;
+
+    iterator() = default;
+    iterator(IRVariable* var) : var(var) {}
+
+    auto operator*() const -> IRVariable* { return var; }
+
+    auto operator++() -> iterator& {
+      var = var->next;
+      return *this;
+    }
+
+    auto operator++(int) -> iterator {
+      auto old = *this;
+      var = var->next;
+      return old;
+    }
+
+    bool operator==(iterator const& other) const { return var == other.var; }
+    bool operator!=(iterator const& other) const { return var != other.var; }
+
+  private:
+    IRVariable* var = nullptr;
+  };
+
+  using const_iterator = iterator;
+
+  IRVariableList() = default;
+  IRVariableList(IRVariableList const&) = delete;
+  IRVariableList& operator=(IRVariableList const&) = delete;
+
+  IRVariableList(IRVariableList&& other) {
+    operator=(std::move(other));
+  }
+
+  IRVariableList& operator=(IRVariableList&& other) {
+    std::swap(head, other.head);
+    std::swap(tail, other.tail);
+    std::swap(length, other.length);
+    return *this;
+  }
+
+  auto begin() const -> iterator { return {head}; }
+  auto end() const -> iterator { return {nullptr}; }
+
+  auto size() const -> size_t { return length; }
+  bool empty() const { return length == 0; }
+
+  void push_back(IRVariable* var) {
+    var->next = nullptr;
+
+    if (tail) tail->next = var; else head = var;
+    tail = var;
+
+    length++;
+  }
+
+  void clear() {
+    head = nullptr;
+    tail = nullptr;
+    length = 0;
+  }
+
+private:
+  IRVariable* head = nullptr;
+  IRVariable* tail = nullptr;
+  size_t length = 0;
+};
+
+} // namespace lunatic::frontend
+} // namespace lunatic
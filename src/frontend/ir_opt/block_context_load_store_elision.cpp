@@ -0,0 +1,207 @@
+/*
+ * Copyright (C) 2022 fleroviux. All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <algorithm>
+#include <iterator>
+
+#include "frontend/ir_opt/block_context_load_store_elision.hpp"
+
+namespace lunatic {
+namespace frontend {
+
+static constexpr int kPCID = static_cast<int>(GPR::PC);
+
+static bool IsSameConstant(IRAnyRef const& a, IRAnyRef const& b) {
+  return a.IsConstant() && b.IsConstant() && a.GetConst().value == b.GetConst().value;
+}
+
+void IRBlockContextLoadStoreElisionPass::Run(
+  BasicBlock const& basic_block,
+  MicroBlockList& micro_blocks
+) {
+  // Forward pass: replace GPR and CPSR reads with constants known from earlier micro blocks
+  ForwardConstants(basic_block, micro_blocks);
+
+  // Backward pass: remove GPR and CPSR stores that are overwritten in later micro blocks
+  RemoveStores(micro_blocks);
+}
+
+void IRBlockContextLoadStoreElisionPass::ForwardConstants(
+  BasicBlock const& basic_block,
+  MicroBlockList& micro_blocks
+) {
+  IRAnyRef current_gpr_value[512] {};
+  IRAnyRef current_cpsr_value;
+  IRAnyRef skip_gpr_value[512];
+  IRAnyRef skip_cpsr_value;
+
+  // The block is entered with the program counter that its key was built from.
+  current_gpr_value[kPCID] = IRConstant{basic_block.key.Address()};
+
+  for (auto& micro_block : micro_blocks) {
+    auto& emitter = micro_block.emitter;
+    auto& code = emitter.Code();
+    auto it = code.begin();
+    auto end = code.end();
+    bool conditional = micro_block.condition != Condition::AL;
+
+    // Skipping the micro block leaves the context as-is, except that the program counter is advanced.
+    if (conditional) {
+      std::copy(std::begin(current_gpr_value), std::end(current_gpr_value), skip_gpr_value);
+      skip_cpsr_value = current_cpsr_value;
+      skip_gpr_value[kPCID] = IRConstant{micro_block.next_address};
+    }
+
+    auto Forward = [&](IRVariable const& dst, IRConstant const& src) {
+      emitter.PropagateConstant(dst, src);
+      if (!dst.IsUnused()) {
+        emitter.Insert<IRMov>(it, dst, src, false);
+      }
+    };
+
+    while (it != end) {
+      switch ((*it)->GetClass()) {
+        case IROpcodeClass::StoreGPR: {
+          auto op = lunatic_cast<IRStoreGPR>(*it);
+
+          current_gpr_value[op->reg.ID()] = op->value.IsConstant() ? op->value : IRAnyRef{};
+          break;
+        }
+        case IROpcodeClass::LoadGPR: {
+          auto  op = lunatic_cast<IRLoadGPR>(*it);
+          auto  value = current_gpr_value[op->reg.ID()];
+          auto& var_dst = op->result.Get();
+
+          if (value.IsConstant()) {
+            it = emitter.Erase(it);
+
+            Forward(var_dst, value.GetConst());
+            continue;
+          }
+          break;
+        }
+        case IROpcodeClass::StoreCPSR: {
+          auto op = lunatic_cast<IRStoreCPSR>(*it);
+
+          current_cpsr_value = op->value.IsConstant() ? op->value : IRAnyRef{};
+          break;
+        }
+        case IROpcodeClass::LoadCPSR: {
+          auto  op = lunatic_cast<IRLoadCPSR>(*it);
+          auto& var_dst = op->result.Get();
+
+          if (current_cpsr_value.IsConstant()) {
+            it = emitter.Erase(it);
+
+            Forward(var_dst, current_cpsr_value.GetConst());
+            continue;
+          }
+          break;
+        }
+        default: {
+          break;
+        }
+      }
+
+      ++it;
+    }
+
+    // The block is left through the side exit if the micro block was executed.
+    if (!micro_block.side_exit.IsEmpty()) {
+      std::copy(std::begin(skip_gpr_value), std::end(skip_gpr_value), current_gpr_value);
+      current_cpsr_value = skip_cpsr_value;
+    } else if (conditional) {
+      // Only keep the constants that are known regardless of whether the micro block was skipped.
+      for (int i = 0; i < 512; i++) {
+        if (!IsSameConstant(current_gpr_value[i], skip_gpr_value[i])) {
+          current_gpr_value[i] = {};
+        }
+      }
+
+      if (!IsSameConstant(current_cpsr_value, skip_cpsr_value)) {
+        current_cpsr_value = {};
+      }
+    }
+  }
+}
+
+void IRBlockContextLoadStoreElisionPass::RemoveStores(MicroBlockList& micro_blocks) {
+  // The context must be up-to-date once the basic block has been left.
+  bool gpr_overwritten[512] {false};
+  bool cpsr_overwritten = false;
+  bool skip_gpr_overwritten[512];
+
+  for (auto micro_block = micro_blocks.rbegin(); micro_block != micro_blocks.rend(); ++micro_block) {
+    auto& emitter = micro_block->emitter;
+    auto& code = emitter.Code();
+    auto it = code.rbegin();
+    auto end = code.rend();
+    bool conditional = micro_block->condition != Condition::AL;
+
+    // The skip edge of a conditional micro block writes the program counter.
+    if (conditional) {
+      std::copy(std::begin(gpr_overwritten), std::end(gpr_overwritten), skip_gpr_overwritten);
+      skip_gpr_overwritten[kPCID] = true;
+    }
+
+    // The context must be up-to-date when the block is left through the side exit.
+    if (!micro_block->side_exit.IsEmpty()) {
+      std::fill(std::begin(gpr_overwritten), std::end(gpr_overwritten), false);
+      cpsr_overwritten = false;
+    }
+
+    while (it != end) {
+      switch ((*it)->GetClass()) {
+        case IROpcodeClass::StoreGPR: {
+          auto gpr_id = lunatic_cast<IRStoreGPR>(*it)->reg.ID();
+
+          if (gpr_overwritten[gpr_id]) {
+            it = std::reverse_iterator{emitter.Erase(std::next(it).base())};
+            end = code.rend();
+            continue;
+          }
+          gpr_overwritten[gpr_id] = true;
+          break;
+        }
+        case IROpcodeClass::LoadGPR: {
+          gpr_overwritten[lunatic_cast<IRLoadGPR>(*it)->reg.ID()] = false;
+          break;
+        }
+        case IROpcodeClass::StoreCPSR: {
+          if (cpsr_overwritten) {
+            it = std::reverse_iterator{emitter.Erase(std::next(it).base())};
+            end = code.rend();
+            continue;
+          }
+          cpsr_overwritten = true;
+          break;
+        }
+        case IROpcodeClass::LoadCPSR: {
+          cpsr_overwritten = false;
+          break;
+        }
+        default: {
+          break;
+        }
+      }
+
+      ++it;
+    }
+
+    if (conditional) {
+      for (int i = 0; i < 512; i++) {
+        gpr_overwritten[i] = gpr_overwritten[i] && skip_gpr_overwritten[i];
+      }
+
+      // The condition check reads the CPSR.
+      cpsr_overwritten = false;
+    }
+  }
+}
+
+} // namespace lunatic::frontend
+} // namespace lunatic
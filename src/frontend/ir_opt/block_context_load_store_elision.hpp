@@ -0,0 +1,37 @@
+/*
+ * Copyright (C) 2022 fleroviux. All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#pragma once
+
+#include "frontend/ir_opt/pass.hpp"
+
+namespace lunatic {
+namespace frontend {
+
+/**
+ * Removes GPR and CPSR loads and stores across the micro blocks of a basic block.
+ * Only constants are forwarded between micro blocks, since IR variables are local to a micro block.
+ * The skip edge of a conditional micro block is treated as a store of the program counter,
+ * and the condition check as a read of the CPSR.
+ */
+struct IRBlockContextLoadStoreElisionPass final : IRBasicBlockPass {
+  void Run(
+    BasicBlock const& basic_block,
+    MicroBlockList& micro_blocks
+  ) override;
+
+private:
+  void ForwardConstants(
+    BasicBlock const& basic_block,
+    MicroBlockList& micro_blocks
+  );
+
+  void RemoveStores(MicroBlockList& micro_blocks);
+};
+
+} // namespace lunatic::frontend
+} // namespace lunatic
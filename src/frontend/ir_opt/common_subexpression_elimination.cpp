@@ -0,0 +1,217 @@
+/*
+ * Copyright (C) 2022 fleroviux. All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include "frontend/ir_opt/common_subexpression_elimination.hpp"
+
+namespace lunatic {
+namespace frontend {
+
+void IRCommonSubexpressionEliminationPass::Run(IREmitter& emitter) {
+  auto& code = emitter.Code();
+  size_t opcode_count = 0;
+  size_t capacity = 16;
+
+  for (auto op : code) {
+    if (IsPure(op)) opcode_count++;
+  }
+
+  if (opcode_count < 2) {
+    return;
+  }
+
+  // Keep the load factor at or below 50%.
+  while (capacity < opcode_count * 2) {
+    capacity *= 2;
+  }
+
+  auto mask = capacity - 1;
+
+  table.assign(capacity, nullptr);
+
+  auto it = code.begin();
+
+  while (it != code.end()) {
+    auto op = *it;
+
+    if (!IsPure(op)) {
+      ++it;
+      continue;
+    }
+
+    auto slot = GetHash(op) & mask;
+    bool redundant = false;
+
+    while (table[slot] != nullptr) {
+      if (IsSameValue(table[slot], op)) {
+        redundant = true;
+        break;
+      }
+      slot = (slot + 1) & mask;
+    }
+
+    if (!redundant) {
+      table[slot] = op;
+      ++it;
+      continue;
+    }
+
+    // Read the value(s) from the earlier opcode instead.
+    auto operands_old = op->GetOperands();
+    auto operands_new = table[slot]->GetOperands();
+
+    for (int i = 0; i < op->GetOperandCount(); i++) {
+      if (op->IsOperandWritten(i) && operands_old[i].IsVariable()) {
+        Repoint(emitter, operands_old[i].GetVar(), operands_new[i].GetVar());
+      }
+    }
+
+    it = emitter.Erase(it);
+  }
+}
+
+bool IRCommonSubexpressionEliminationPass::IsPure(IROpcode* op) {
+  // Opcodes which update the host flags or read the carry from them are not pure.
+  switch (op->GetClass()) {
+    case IROpcodeClass::LSL:
+    case IROpcodeClass::LSR:
+    case IROpcodeClass::ASR:
+      return !((IRLogicalShiftLeft*)op)->update_host_flags;
+    case IROpcodeClass::ROR: {
+      auto ror = lunatic_cast<IRRotateRight>(op);
+
+      // ROR #0 is RRX, which shifts in the carry.
+      bool rrx = ror->amount.IsConstant() && ror->amount.GetConst().value == 0;
+
+      return !ror->update_host_flags && !rrx;
+    }
+    case IROpcodeClass::AND:
+    case IROpcodeClass::BIC:
+    case IROpcodeClass::EOR:
+    case IROpcodeClass::SUB:
+    case IROpcodeClass::RSB:
+    case IROpcodeClass::ORR: {
+      auto binary_op = (IRBitwiseAND*)op;
+
+      return !binary_op->update_host_flags && binary_op->result.IsVariable();
+    }
+    case IROpcodeClass::ADD: {
+      auto add_op = lunatic_cast<IRAdd>(op);
+
+      // The operands of a shifted ADD do not commute.
+      return !add_op->update_host_flags && add_op->result.IsVariable() && add_op->rhs_shift == 0;
+    }
+    case IROpcodeClass::MVN:
+      return !lunatic_cast<IRMvn>(op)->update_host_flags;
+    case IROpcodeClass::MUL:
+      return !lunatic_cast<IRMultiply>(op)->update_host_flags;
+    case IROpcodeClass::CLZ:
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool IRCommonSubexpressionEliminationPass::IsCommutative(IROpcode const* op) {
+  switch (op->GetClass()) {
+    case IROpcodeClass::AND:
+    case IROpcodeClass::EOR:
+    case IROpcodeClass::ADD:
+    case IROpcodeClass::ORR:
+    case IROpcodeClass::MUL:
+      return true;
+    default:
+      return false;
+  }
+}
+
+static auto GetOperandHash(IRAnyRef const& operand) -> u64 {
+  if (operand.IsVariable()) {
+    return (operand.GetVar().id + 1) * 0x9E3779B97F4A7C15ULL;
+  }
+
+  if (operand.IsConstant()) {
+    return (operand.GetConst().value ^ 0xFFFFFFFF00000000ULL) * 0xC2B2AE3D27D4EB4FULL;
+  }
+
+  return 0;
+}
+
+static bool IsSameOperand(IRAnyRef const& a, IRAnyRef const& b) {
+  if (a.IsVariable()) {
+    return b.IsVariable() && &a.GetVar() == &b.GetVar();
+  }
+
+  if (a.IsConstant()) {
+    return b.IsConstant() && a.GetConst().value == b.GetConst().value;
+  }
+
+  return b.IsNull();
+}
+
+auto IRCommonSubexpressionEliminationPass::GetHash(IROpcode const* op) -> u64 {
+  auto operands = op->GetOperands();
+  auto commutative = IsCommutative(op);
+  u64 hash = static_cast<u64>(op->GetClass());
+
+  for (int i = 0; i < op->GetOperandCount(); i++) {
+    if (op->IsOperandWritten(i)) {
+      continue;
+    }
+
+    // The inputs of commutative opcodes are combined in an order-independent way.
+    if (commutative) {
+      hash += GetOperandHash(operands[i]);
+    } else {
+      hash = (hash * 0x100000001B3ULL) ^ GetOperandHash(operands[i]);
+    }
+  }
+
+  return hash ^ (hash >> 29);
+}
+
+bool IRCommonSubexpressionEliminationPass::IsSameValue(IROpcode const* op_a, IROpcode const* op_b) {
+  if (op_a->GetClass() != op_b->GetClass()) {
+    return false;
+  }
+
+  auto operands_a = op_a->GetOperands();
+  auto operands_b = op_b->GetOperands();
+  auto operand_count = op_a->GetOperandCount();
+
+  // The results must have the same shape, so that one result can stand in for the other.
+  for (int i = 0; i < operand_count; i++) {
+    if (op_a->IsOperandWritten(i)) {
+      auto& result_a = operands_a[i];
+      auto& result_b = operands_b[i];
+
+      if (result_a.IsVariable() != result_b.IsVariable() ||
+          (result_a.IsVariable() && result_a.GetVar().data_type != result_b.GetVar().data_type)) {
+        return false;
+      }
+    }
+  }
+
+  bool same = true;
+
+  for (int i = 0; i < operand_count; i++) {
+    if (!op_a->IsOperandWritten(i) && !IsSameOperand(operands_a[i], operands_b[i])) {
+      same = false;
+      break;
+    }
+  }
+
+  // All pure commutative opcodes have two inputs in their last two operand slots.
+  if (!same && IsCommutative(op_a)) {
+    same = IsSameOperand(operands_a[operand_count - 2], operands_b[operand_count - 1]) &&
+           IsSameOperand(operands_a[operand_count - 1], operands_b[operand_count - 2]);
+  }
+
+  return same;
+}
+
+} // namespace lunatic::frontend
+} // namespace lunatic
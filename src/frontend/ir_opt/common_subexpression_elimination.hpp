@@ -0,0 +1,32 @@
+/*
+ * Copyright (C) 2022 fleroviux. All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#pragma once
+
+#include <vector>
+
+#include "frontend/ir_opt/pass.hpp"
+
+namespace lunatic {
+namespace frontend {
+
+/// Hash-based value numbering: removes pure opcodes that compute the same value as an earlier opcode.
+struct IRCommonSubexpressionEliminationPass final : IRPass {
+  void Run(IREmitter& emitter) override;
+
+private:
+  static bool IsPure(IROpcode* op);
+  static bool IsCommutative(IROpcode const* op);
+  static auto GetHash(IROpcode const* op) -> u64;
+  static bool IsSameValue(IROpcode const* op_a, IROpcode const* op_b);
+
+  /// Open-addressing hash table of the opcodes that computed a value. Kept to avoid allocations.
+  std::vector<IROpcode*> table;
+};
+
+} // namespace lunatic::frontend
+} // namespace lunatic
@@ -16,49 +16,45 @@ void IRConstantPropagationPass::Run(IREmitter& emitter) {
   var_to_const.clear();
   var_to_const.resize(emitter.Vars().size());
 
-  for (auto& op : emitter.Code()) {
-    switch (op->GetClass()) {
-      case IROpcodeClass::MOV: DoMOV(op); break;
-      case IROpcodeClass::LSL: DoLSL(op); break;
-      case IROpcodeClass::LSR: DoLSR(op); break;
-      case IROpcodeClass::ASR: DoASR(op); break;
-      case IROpcodeClass::ROR: DoROR(op); break;
-      case IROpcodeClass::ADD: DoBinaryOp<IRAdd>(op); break;
-      case IROpcodeClass::SUB: DoBinaryOp<IRSub>(op); break;
-      case IROpcodeClass::AND: DoBinaryOp<IRBitwiseAND>(op); break;
-      case IROpcodeClass::BIC: DoBinaryOp<IRBitwiseBIC>(op); break;
-      case IROpcodeClass::EOR: DoBinaryOp<IRBitwiseEOR>(op); break;
-      case IROpcodeClass::ORR: DoBinaryOp<IRBitwiseORR>(op); break;
-      case IROpcodeClass::MUL: DoMUL(op); break;
+  auto& code = emitter.Code();
+
+  for (auto it = code.begin(); it != code.end(); ++it) {
+    switch ((*it)->GetClass()) {
+      case IROpcodeClass::MOV: DoMOV(it); break;
+      case IROpcodeClass::LSL: DoLSL(it); break;
+      case IROpcodeClass::LSR: DoLSR(it); break;
+      case IROpcodeClass::ASR: DoASR(it); break;
+      case IROpcodeClass::ROR: DoROR(it); break;
+      case IROpcodeClass::ADD: DoBinaryOp<IRAdd>(it); break;
+      case IROpcodeClass::SUB: DoBinaryOp<IRSub>(it); break;
+      case IROpcodeClass::AND: DoBinaryOp<IRBitwiseAND>(it); break;
+      case IROpcodeClass::BIC: DoBinaryOp<IRBitwiseBIC>(it); break;
+      case IROpcodeClass::EOR: DoBinaryOp<IRBitwiseEOR>(it); break;
+      case IROpcodeClass::ORR: DoBinaryOp<IRBitwiseORR>(it); break;
+      case IROpcodeClass::MUL: DoMUL(it); break;
     }
   }
 }
 
 void IRConstantPropagationPass::Propagate(IRVariable const& var, IRConstant const& constant) {
   var_to_const[var.id] = constant;
-
-  // TODO: start at the opcode where the variable is first written.
-  for (auto& op : emitter->Code()) {
-    if (op->Reads(var)) {
-      op->PropagateConstant(var, constant);
-    }
-  }
+  emitter->PropagateConstant(var, constant);
 };
 
 auto IRConstantPropagationPass::GetKnownConstant(IRVarRef const& var) -> Optional<IRConstant>& {
   return var_to_const[var.Get().id];
 };
 
-void IRConstantPropagationPass::DoMOV(std::unique_ptr<IROpcode>& op) {
-  auto mov_op = lunatic_cast<IRMov>(op.get());
+void IRConstantPropagationPass::DoMOV(InstructionList::iterator& it) {
+  auto mov_op = lunatic_cast<IRMov>(*it);
 
   if (mov_op->source.IsConstant()) {
     Propagate(mov_op->result.Get(), mov_op->source.GetConst());
   }
 }
 
-void IRConstantPropagationPass::DoLSL(std::unique_ptr<IROpcode>& op) {
-  auto lsl_op = lunatic_cast<IRLogicalShiftLeft>(op.get());
+void IRConstantPropagationPass::DoLSL(InstructionList::iterator& it) {
+  auto lsl_op = lunatic_cast<IRLogicalShiftLeft>(*it);
 
   auto& result = lsl_op->result.Get();
   auto& operand = GetKnownConstant(lsl_op->operand);
@@ -71,13 +67,13 @@ void IRConstantPropagationPass::DoLSL(std::unique_ptr<IROpcode>& op) {
     Propagate(result, constant);
 
     if (!lsl_op->update_host_flags) {
-      op = MOV(result, constant);
+      it = emitter->Replace<IRMov>(it, result, constant, false);
     }
   }
 }
 
-void IRConstantPropagationPass::DoLSR(std::unique_ptr<IROpcode>& op) {
-  auto lsr_op = lunatic_cast<IRLogicalShiftRight>(op.get());
+void IRConstantPropagationPass::DoLSR(InstructionList::iterator& it) {
+  auto lsr_op = lunatic_cast<IRLogicalShiftRight>(*it);
 
   auto& result = lsr_op->result.Get();
   auto& operand = GetKnownConstant(lsr_op->operand);
@@ -90,13 +86,13 @@ void IRConstantPropagationPass::DoLSR(std::unique_ptr<IROpcode>& op) {
     Propagate(result, constant);
 
     if (!lsr_op->update_host_flags) {
-      op = MOV(result, constant);
+      it = emitter->Replace<IRMov>(it, result, constant, false);
     }
   }
 }
 
-void IRConstantPropagationPass::DoASR(std::unique_ptr<IROpcode>& op) {
-  auto asr_op = lunatic_cast<IRArithmeticShiftRight>(op.get());
+void IRConstantPropagationPass::DoASR(InstructionList::iterator& it) {
+  auto asr_op = lunatic_cast<IRArithmeticShiftRight>(*it);
 
   auto& result = asr_op->result.Get();
   auto& operand = GetKnownConstant(asr_op->operand);
@@ -115,13 +111,13 @@ void IRConstantPropagationPass::DoASR(std::unique_ptr<IROpcode>& op) {
     Propagate(result, constant);
 
     if (!asr_op->update_host_flags) {
-      op = MOV(result, constant);
+      it = emitter->Replace<IRMov>(it, result, constant, false);
     }
   }
 }
 
-void IRConstantPropagationPass::DoROR(std::unique_ptr<IROpcode>& op) {
-  auto ror_op = lunatic_cast<IRRotateRight>(op.get());
+void IRConstantPropagationPass::DoROR(InstructionList::iterator& it) {
+  auto ror_op = lunatic_cast<IRRotateRight>(*it);
 
   auto& result = ror_op->result.Get();
   auto& operand = GetKnownConstant(ror_op->operand);
@@ -140,16 +136,16 @@ void IRConstantPropagationPass::DoROR(std::unique_ptr<IROpcode>& op) {
     Propagate(ror_op->result.Get(), constant);
 
     if (!ror_op->update_host_flags) {
-      op = MOV(result, constant);
+      it = emitter->Replace<IRMov>(it, result, constant, false);
     }
   }
 }
 
 template<typename OpcodeType>
-void IRConstantPropagationPass::DoBinaryOp(std::unique_ptr<IROpcode>& op) {
+void IRConstantPropagationPass::DoBinaryOp(InstructionList::iterator& it) {
   constexpr IROpcodeClass klass = OpcodeType::klass;
 
-  auto bin_op = lunatic_cast<OpcodeType>(op.get());
+  auto bin_op = lunatic_cast<OpcodeType>(*it);
   auto& result = bin_op->result;
   auto& lhs = GetKnownConstant(bin_op->lhs);
   auto& rhs = bin_op->rhs;
@@ -169,56 +165,56 @@ void IRConstantPropagationPass::DoBinaryOp(std::unique_ptr<IROpcode>& op) {
       case IROpcodeClass::ORR: constant = lhs_value |  rhs_value; break;
     }
 
-    if (result.HasValue()) {
-      Propagate(result.Unwrap(), constant);
+    if (!result.IsNull()) {
+      Propagate(result.GetVar(), constant);
     }
 
     bool update_host_flags = bin_op->update_host_flags;
 
     // Attempt to replace opcode with a MOV (removes dependencies on operand variables)
-    if (result.HasValue()) {
+    if (!result.IsNull()) {
       if (klass == IROpcodeClass::ADD || klass == IROpcodeClass::SUB) {
         if (!update_host_flags) {
-          op = MOV(result.Unwrap(), constant, false);
+          it = emitter->Replace<IRMov>(it, result.GetVar(), constant, false);
         }
       } else {
         // AND, BIC, EOR, ORR
-        op = MOV(result.Unwrap(), constant, update_host_flags);
+        it = emitter->Replace<IRMov>(it, result.GetVar(), constant, update_host_flags);
       }
     } else if (!update_host_flags) {
-      op = NOP();
+      it = emitter->Replace<IRNoOp>(it);
     }
   }
 }
 
-void IRConstantPropagationPass::DoMUL(std::unique_ptr<IROpcode>& op) {
-  const auto mul_op = (IRMultiply*)op.get();
+void IRConstantPropagationPass::DoMUL(InstructionList::iterator& it) {
+  const auto mul_op = lunatic_cast<IRMultiply>(*it);
 
   auto& lhs = GetKnownConstant(mul_op->lhs.Get());
   auto& rhs = GetKnownConstant(mul_op->rhs.Get());
 
   if (lhs.HasValue() && rhs.HasValue()) {
-    if (mul_op->result_hi.HasValue()) {
+    if (!mul_op->result_hi.IsNull()) {
       if (mul_op->lhs.Get().data_type == IRDataType::SInt32) {
         s64 result = (s64)(s32)lhs.Unwrap().value * (s64)(s32)rhs.Unwrap().value;
         IRConstant constant_lo = (u32)result;
         IRConstant constant_hi = (u32)(result >> 32);
 
         Propagate(mul_op->result_lo.Get(), constant_lo);
-        Propagate(mul_op->result_hi.Unwrap(), constant_hi);
+        Propagate(mul_op->result_hi.GetVar(), constant_hi);
       } else {
         u64 result = (u64)lhs.Unwrap().value * (u64)rhs.Unwrap().value;
         IRConstant constant_lo = (u32)result;
         IRConstant constant_hi = (u32)(result >> 32);
 
         Propagate(mul_op->result_lo.Get(), constant_lo);
-        Propagate(mul_op->result_hi.Unwrap(), constant_hi);
+        Propagate(mul_op->result_hi.GetVar(), constant_hi);
       }
     } else {
       IRConstant constant = lhs.Unwrap().value * rhs.Unwrap().value;
 
       Propagate(mul_op->result_lo.Get(), constant);
-      op = MOV(mul_op->result_lo.Get(), constant, mul_op->update_host_flags);
+      it = emitter->Replace<IRMov>(it, mul_op->result_lo.Get(), constant, mul_op->update_host_flags);
     }
   }
 }
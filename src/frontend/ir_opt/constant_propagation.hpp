@@ -21,23 +21,15 @@ private:
   void Propagate(IRVariable const& var, IRConstant const& constant);
   auto GetKnownConstant(IRVarRef const& var) -> Optional<IRConstant>&;
 
-  void DoMOV(std::unique_ptr<IROpcode>& op);
-  void DoLSL(std::unique_ptr<IROpcode>& op);
-  void DoLSR(std::unique_ptr<IROpcode>& op);
-  void DoASR(std::unique_ptr<IROpcode>& op);
-  void DoROR(std::unique_ptr<IROpcode>& op);
-  void DoMUL(std::unique_ptr<IROpcode>& op);
+  void DoMOV(InstructionList::iterator& it);
+  void DoLSL(InstructionList::iterator& it);
+  void DoLSR(InstructionList::iterator& it);
+  void DoASR(InstructionList::iterator& it);
+  void DoROR(InstructionList::iterator& it);
+  void DoMUL(InstructionList::iterator& it);
 
   template<typename OpcodeType>
-  void DoBinaryOp(std::unique_ptr<IROpcode>& op);
-
-  static auto MOV(IRVariable const& result, IRConstant const& constant, bool update_host_flags = false) {
-    return std::make_unique<IRMov>(result, constant, update_host_flags);
-  };
-
-  static auto NOP() {
-    return std::make_unique<IRNoOp>();
-  };
+  void DoBinaryOp(InstructionList::iterator& it);
 
   IREmitter* emitter;
   std::vector<Optional<IRConstant>> var_to_const{};
@@ -25,32 +25,40 @@ void IRContextLoadStoreElisionPass::RemoveLoads(IREmitter& emitter) {
   IRAnyRef current_gpr_value[512] {};
   IRAnyRef current_cpsr_value;
 
-  auto Move = [&](IRVariable const& dst, IRAnyRef src) {
-    code.insert(it, std::make_unique<IRMov>(dst, src, false));
+  // Replace reads of the loaded variable with the known value.
+  // If that is not possible, keep the value in the variable using a MOV.
+  auto Forward = [&](IRVariable const& dst, IRAnyRef src) {
+    if (src.IsConstant()) {
+      emitter.PropagateConstant(dst, src.GetConst());
+      if (dst.IsUnused()) {
+        return;
+      }
+    } else if (Repoint(emitter, dst, src.GetVar())) {
+      return;
+    }
+
+    emitter.Insert<IRMov>(it, dst, src, false);
   };
 
   while (it != end) {
-    switch (it->get()->GetClass()) {
+    switch ((*it)->GetClass()) {
       case IROpcodeClass::StoreGPR: {
-        auto op = lunatic_cast<IRStoreGPR>(it->get());
+        auto op = lunatic_cast<IRStoreGPR>(*it);
         auto gpr_id = op->reg.ID();
 
         current_gpr_value[gpr_id] = op->value;
         break;
       }
       case IROpcodeClass::LoadGPR: {
-        auto  op = lunatic_cast<IRLoadGPR>(it->get());
+        auto  op = lunatic_cast<IRLoadGPR>(*it);
         auto  gpr_id  = op->reg.ID();
         auto  var_src = current_gpr_value[gpr_id];
         auto& var_dst = op->result.Get();
 
         if (!var_src.IsNull()) {
-          it = code.erase(it);
+          it = emitter.Erase(it);
 
-          // TODO: if var_src is constant attempt updating IRAnyRefs.
-          if (var_src.IsConstant() || !Repoint(var_dst, var_src.GetVar(), it, end)) {
-            Move(var_dst, var_src);
-          }
+          Forward(var_dst, var_src);
           continue;
         } else {
           current_gpr_value[gpr_id] = var_dst;
@@ -58,21 +66,18 @@ void IRContextLoadStoreElisionPass::RemoveLoads(IREmitter& emitter) {
         break;
       }
       case IROpcodeClass::StoreCPSR: {
-        current_cpsr_value = lunatic_cast<IRStoreCPSR>(it->get())->value;
+        current_cpsr_value = lunatic_cast<IRStoreCPSR>(*it)->value;
         break;
       }
       case IROpcodeClass::LoadCPSR: {
-        auto  op = lunatic_cast<IRLoadCPSR>(it->get());
+        auto  op = lunatic_cast<IRLoadCPSR>(*it);
         auto  var_src = current_cpsr_value;
         auto& var_dst = op->result.Get();
 
         if (!var_src.IsNull()) {
-          it = code.erase(it);
+          it = emitter.Erase(it);
 
-          // TODO: if var_src is constant attempt updating IRAnyRefs.
-          if (var_src.IsConstant() || !Repoint(var_dst, var_src.GetVar(), it, end)) {
-            Move(var_dst, var_src);
-          }
+          Forward(var_dst, var_src);
           continue;
         } else {
           current_cpsr_value = var_dst;
@@ -96,13 +101,13 @@ void IRContextLoadStoreElisionPass::RemoveStores(IREmitter& emitter) {
   bool cpsr_already_stored = false;
 
   while (it != end) {
-    switch (it->get()->GetClass()) {
+    switch ((*it)->GetClass()) {
       case IROpcodeClass::StoreGPR: {
-        auto op = lunatic_cast<IRStoreGPR>(it->get());
+        auto op = lunatic_cast<IRStoreGPR>(*it);
         auto gpr_id = op->reg.ID();
 
         if (gpr_already_stored[gpr_id]) {
-          it = std::reverse_iterator{code.erase(std::next(it).base())};
+          it = std::reverse_iterator{emitter.Erase(std::next(it).base())};
           end = code.rend();
           continue;
         } else {
@@ -112,7 +117,7 @@ void IRContextLoadStoreElisionPass::RemoveStores(IREmitter& emitter) {
       }
       case IROpcodeClass::StoreCPSR: {
         if (cpsr_already_stored) {
-          it = std::reverse_iterator{code.erase(std::next(it).base())};
+          it = std::reverse_iterator{emitter.Erase(std::next(it).base())};
           end = code.rend();
           continue;
         } else {
@@ -11,31 +11,35 @@ namespace lunatic {
 namespace frontend {
 
 void IRDeadCodeElisionPass::Run(IREmitter& emitter) {
-	auto& code = emitter.Code();
   this->emitter = &emitter;
-  it = code.begin();
-  end = code.end();
 
+  auto& code = emitter.Code();
+  auto it = code.rbegin();
+  auto end = code.rend();
+
+  // Walk the code backwards, so that removing an opcode
+  // may make the opcodes producing its inputs dead too.
   while (it != end) {
     bool dead = false;
 
-    switch (it->get()->GetClass()) {
-      case IROpcodeClass::MOV: dead = CheckMOV(lunatic_cast<IRMov>(it->get())); break;
-      case IROpcodeClass::LSL: dead = CheckShifterOp(lunatic_cast<IRLogicalShiftLeft>(it->get())); break;
-      case IROpcodeClass::LSR: dead = CheckShifterOp(lunatic_cast<IRLogicalShiftRight>(it->get())); break;
-      case IROpcodeClass::ASR: dead = CheckShifterOp(lunatic_cast<IRArithmeticShiftRight>(it->get())); break;
-      case IROpcodeClass::ROR: dead = CheckShifterOp(lunatic_cast<IRRotateRight>(it->get())); break;
-      case IROpcodeClass::ADD: dead = CheckBinaryOp(lunatic_cast<IRAdd>(it->get())); break;
-      case IROpcodeClass::SUB: dead = CheckBinaryOp(lunatic_cast<IRSub>(it->get())); break;
-      case IROpcodeClass::AND: dead = CheckBinaryOp(lunatic_cast<IRBitwiseAND>(it->get())); break;
-      case IROpcodeClass::BIC: dead = CheckBinaryOp(lunatic_cast<IRBitwiseBIC>(it->get())); break;
-      case IROpcodeClass::EOR: dead = CheckBinaryOp(lunatic_cast<IRBitwiseEOR>(it->get())); break;
-      case IROpcodeClass::ORR: dead = CheckBinaryOp(lunatic_cast<IRBitwiseORR>(it->get())); break;
-      case IROpcodeClass::MUL: dead = CheckMUL(lunatic_cast<IRMultiply>(it->get())); break;
+    switch ((*it)->GetClass()) {
+      case IROpcodeClass::MOV: dead = CheckMOV(lunatic_cast<IRMov>(*it)); break;
+      case IROpcodeClass::LSL: dead = CheckShifterOp(lunatic_cast<IRLogicalShiftLeft>(*it)); break;
+      case IROpcodeClass::LSR: dead = CheckShifterOp(lunatic_cast<IRLogicalShiftRight>(*it)); break;
+      case IROpcodeClass::ASR: dead = CheckShifterOp(lunatic_cast<IRArithmeticShiftRight>(*it)); break;
+      case IROpcodeClass::ROR: dead = CheckShifterOp(lunatic_cast<IRRotateRight>(*it)); break;
+      case IROpcodeClass::ADD: dead = CheckBinaryOp(lunatic_cast<IRAdd>(*it)); break;
+      case IROpcodeClass::SUB: dead = CheckBinaryOp(lunatic_cast<IRSub>(*it)); break;
+      case IROpcodeClass::AND: dead = CheckBinaryOp(lunatic_cast<IRBitwiseAND>(*it)); break;
+      case IROpcodeClass::BIC: dead = CheckBinaryOp(lunatic_cast<IRBitwiseBIC>(*it)); break;
+      case IROpcodeClass::EOR: dead = CheckBinaryOp(lunatic_cast<IRBitwiseEOR>(*it)); break;
+      case IROpcodeClass::ORR: dead = CheckBinaryOp(lunatic_cast<IRBitwiseORR>(*it)); break;
+      case IROpcodeClass::MUL: dead = CheckMUL(lunatic_cast<IRMultiply>(*it)); break;
     }
 
     if (dead) {
-      it = code.erase(it);
+      it = std::reverse_iterator{emitter.Erase(std::next(it).base())};
+      end = code.rend();
     } else {
       ++it;
     }
@@ -50,7 +54,7 @@ bool IRDeadCodeElisionPass::CheckMOV(IRMov* op) {
   // MOV var_a, var_b: var_a is a redundant variable.
   if (op->source.IsVariable() &&
       !op->update_host_flags &&
-    Repoint(op->result.Get(), op->source.GetVar(), it, end)
+    Repoint(*emitter, op->result.Get(), op->source.GetVar())
   ) {
     return true;
   }
@@ -68,7 +72,7 @@ bool IRDeadCodeElisionPass::CheckShifterOp(OpcodeType* op) {
   if constexpr(OpcodeType::klass == IROpcodeClass::LSL) {
     if (op->amount.IsConstant() &&
         op->amount.GetConst().value == 0 &&
-        Repoint(op->result.Get(), op->operand.Get(), it, end)
+        Repoint(*emitter, op->result.Get(), op->operand.Get())
     ) {
       return true;
     }
@@ -79,17 +83,17 @@ bool IRDeadCodeElisionPass::CheckShifterOp(OpcodeType* op) {
 
 template<class OpcodeType>
 bool IRDeadCodeElisionPass::CheckBinaryOp(OpcodeType* op) {
-  if ((!op->result.HasValue() ||IsValueUnused(op->result.Unwrap())) && !op->update_host_flags) {
+  if ((op->result.IsNull() || IsValueUnused(op->result.GetVar())) && !op->update_host_flags) {
     return true;
   }
 
   // ADD #0 is a no-operation
   if constexpr(OpcodeType::klass == IROpcodeClass::ADD) {
-    if (op->result.HasValue() &&
+    if (op->result.IsVariable() &&
         op->rhs.IsConstant() &&
         op->rhs.GetConst().value == 0 &&
         !op->update_host_flags &&
-        Repoint(op->result.Unwrap(), op->lhs.Get(), it, end)
+        Repoint(*emitter, op->result.GetVar(), op->lhs.Get())
     ) {
       return true;
     }
@@ -100,7 +104,7 @@ bool IRDeadCodeElisionPass::CheckBinaryOp(OpcodeType* op) {
 
 bool IRDeadCodeElisionPass::CheckMUL(IRMultiply* op) {
   if (IsValueUnused(op->result_lo.Get()) &&
-      (!op->result_hi.HasValue() || IsValueUnused(op->result_hi.Unwrap())) &&
+      (op->result_hi.IsNull() || IsValueUnused(op->result_hi.GetVar())) &&
       !op->update_host_flags
   ) {
     return true;
@@ -110,17 +114,7 @@ bool IRDeadCodeElisionPass::CheckMUL(IRMultiply* op) {
 }
 
 bool IRDeadCodeElisionPass::IsValueUnused(IRVariable const& var) {
-  auto local_it = it;
-
-  ++local_it;
-
-  while (local_it != end) {
-    if (local_it->get()->Reads(var))
-      return false;
-    ++local_it;
-  }
-
-  return true;
+  return var.IsUnused();
 }
 
 } // namespace lunatic::frontend
@@ -29,8 +29,6 @@ private:
   bool IsValueUnused(IRVariable const& var);
 
   IREmitter* emitter;
-  IREmitter::InstructionList::iterator it;
-  IREmitter::InstructionList::iterator end;
 };
 
 } // namespace lunatic::frontend
@@ -33,11 +33,21 @@ void IRDeadFlagElisionPass::RemoveRedundantUpdateFlagsOpcodes(IREmitter& emitter
   Optional<IRVariable const&> current_cpsr_in{};
 
   while (it != end) {
-    switch (it->get()->GetClass()) {
+    switch ((*it)->GetClass()) {
       case IROpcodeClass::UpdateFlags: {
-        auto op = lunatic_cast<IRUpdateFlags>(it->get());
+        auto op = lunatic_cast<IRUpdateFlags>(*it);
 
         if (current_cpsr_in.HasValue() && op->Writes(current_cpsr_in.Unwrap())) {
+          /* The CPSR value may be read by other opcodes than the next NZCV update,
+           * for example by a forwarded MRS. Those need all flags to be updated.
+           */
+          if (op->result.Get().GetFirstUse()->next != nullptr) {
+            unused_n = false;
+            unused_z = false;
+            unused_c = false;
+            unused_v = false;
+          }
+
           if (unused_n) op->flag_n = false;
           if (unused_z) op->flag_z = false;
           if (unused_c) op->flag_c = false;
@@ -45,10 +55,9 @@ void IRDeadFlagElisionPass::RemoveRedundantUpdateFlagsOpcodes(IREmitter& emitter
 
           // Elide update.nzcv opcodes that now don't update any flag.
           if (!op->flag_n && !op->flag_z && !op->flag_c && !op->flag_v) {
-            // TODO: do not use begin()?
-            if (Repoint(op->result.Get(), op->input.Get(), code.begin(), code.end())) {
+            if (Repoint(emitter, op->result.Get(), op->input.Get())) {
               current_cpsr_in = op->input.Get();
-              it = std::reverse_iterator{code.erase(std::next(it).base())};
+              it = std::reverse_iterator{emitter.Erase(std::next(it).base())};
               end = code.rend();
               continue;
             }
@@ -64,8 +73,26 @@ void IRDeadFlagElisionPass::RemoveRedundantUpdateFlagsOpcodes(IREmitter& emitter
 
         break;
       }
+      case IROpcodeClass::UpdateSticky: {
+        auto op = lunatic_cast<IRUpdateSticky>(*it);
+
+        // update.q only sets the Q flag, so the NZCV flags of its input reach the next NZCV update.
+        bool passes_flags = current_cpsr_in.HasValue() &&
+          op->Writes(current_cpsr_in.Unwrap()) &&
+          op->result.Get().GetFirstUse()->next == nullptr;
+
+        if (!passes_flags) {
+          unused_n = false;
+          unused_z = false;
+          unused_c = false;
+          unused_v = false;
+        }
+
+        current_cpsr_in = op->input.Get();
+        break;
+      }
       default: {
-        if (current_cpsr_in.HasValue() && it->get()->Reads(current_cpsr_in.Unwrap())) {
+        if (current_cpsr_in.HasValue() && (*it)->Reads(current_cpsr_in.Unwrap())) {
           /* We are reading the CPSR value between two NZCV updates.
            * This means that the first NZCV update must update all flags,
            * otherwise this opcode will read the wrong CPSR value.
@@ -95,11 +122,11 @@ void IRDeadFlagElisionPass::DisableRedundantFlagCalculations(IREmitter& emitter)
   bool used_v = false;
 
   while (it != end) {
-    auto op_class = it->get()->GetClass();
+    auto op_class = (*it)->GetClass();
 
     switch (op_class) {
       case IROpcodeClass::UpdateFlags: {
-        auto op = lunatic_cast<IRUpdateFlags>(it->get());
+        auto op = lunatic_cast<IRUpdateFlags>(*it);
 
         if (op->flag_n) used_n = true;
         if (op->flag_z) used_z = true;
@@ -114,7 +141,9 @@ void IRDeadFlagElisionPass::DisableRedundantFlagCalculations(IREmitter& emitter)
       case IROpcodeClass::ClearCarry:
       case IROpcodeClass::SetCarry: {
         if (!used_c) {
-          *it = std::make_unique<IRNoOp>();
+          it = std::reverse_iterator{emitter.Erase(std::next(it).base())};
+          end = code.rend();
+          continue;
         }
         used_c = false;
         break;
@@ -123,7 +152,7 @@ void IRDeadFlagElisionPass::DisableRedundantFlagCalculations(IREmitter& emitter)
       case IROpcodeClass::LSR:
       case IROpcodeClass::ASR:
       case IROpcodeClass::ROR: {
-        auto op = (IRLogicalShiftLeft*)it->get();
+        auto op = (IRLogicalShiftLeft*)(*it);
 
         if (!used_c) {
           op->update_host_flags = false;
@@ -141,7 +170,7 @@ void IRDeadFlagElisionPass::DisableRedundantFlagCalculations(IREmitter& emitter)
       case IROpcodeClass::BIC:
       case IROpcodeClass::EOR:
       case IROpcodeClass::ORR: {
-        auto op = (IRBitwiseAND*)it->get();
+        auto op = (IRBitwiseAND*)(*it);
 
         if (!used_n && !used_z) {
           op->update_host_flags = false;
@@ -154,7 +183,7 @@ void IRDeadFlagElisionPass::DisableRedundantFlagCalculations(IREmitter& emitter)
       case IROpcodeClass::ADD:
       case IROpcodeClass::SUB:
       case IROpcodeClass::RSB: {
-        auto op = (IRAdd*)it->get();
+        auto op = (IRAdd*)(*it);
 
         if (!used_n && !used_z && !used_c && !used_v) {
           op->update_host_flags = false;
@@ -169,7 +198,7 @@ void IRDeadFlagElisionPass::DisableRedundantFlagCalculations(IREmitter& emitter)
       case IROpcodeClass::ADC:
       case IROpcodeClass::SBC:
       case IROpcodeClass::RSC: {
-        auto op = (IRAdc*)it->get();
+        auto op = (IRAdc*)(*it);
 
         if (!used_n && !used_z && !used_c && !used_v) {
           op->update_host_flags = false;
@@ -184,7 +213,7 @@ void IRDeadFlagElisionPass::DisableRedundantFlagCalculations(IREmitter& emitter)
       }
       case IROpcodeClass::MOV:
       case IROpcodeClass::MVN: {
-        auto op = (IRMov*)it->get();
+        auto op = (IRMov*)(*it);
 
         if (!used_n && !used_z) {
           op->update_host_flags = false;
@@ -195,7 +224,7 @@ void IRDeadFlagElisionPass::DisableRedundantFlagCalculations(IREmitter& emitter)
         break;
       }
       case IROpcodeClass::MUL: {
-        auto op = lunatic_cast<IRMultiply>(it->get());
+        auto op = lunatic_cast<IRMultiply>(*it);
 
         if (!used_n && !used_z) {
           op->update_host_flags = false;
@@ -206,7 +235,7 @@ void IRDeadFlagElisionPass::DisableRedundantFlagCalculations(IREmitter& emitter)
         break;
       }
       case IROpcodeClass::ADD64: {
-        auto op = lunatic_cast<IRAdd64>(it->get());
+        auto op = lunatic_cast<IRAdd64>(*it);
 
         if (!used_n && !used_z) {
           op->update_host_flags = false;
@@ -0,0 +1,169 @@
+/*
+ * Copyright (C) 2022 fleroviux. All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include "frontend/ir_opt/flag_liveness.hpp"
+
+namespace lunatic {
+namespace frontend {
+
+static auto GetUpdatedFlags(IRUpdateFlags const* op) -> u8 {
+  u8 flags = 0;
+
+  if (op->flag_n) flags |= kFlagN;
+  if (op->flag_z) flags |= kFlagZ;
+  if (op->flag_c) flags |= kFlagC;
+  if (op->flag_v) flags |= kFlagV;
+  return flags;
+}
+
+/// Opcodes that only move the CPSR between the context and the flag updates.
+static bool IsCPSRTransfer(IROpcodeClass klass) {
+  switch (klass) {
+    case IROpcodeClass::LoadCPSR:
+    case IROpcodeClass::StoreCPSR:
+    case IROpcodeClass::UpdateFlags:
+    case IROpcodeClass::UpdateSticky:
+      return true;
+    default:
+      return false;
+  }
+}
+
+/// Check if an opcode consumes a CPSR value in some other way than writing it back to the context.
+static bool ObservesCPSR(IROpcode const* op) {
+  if (IsCPSRTransfer(op->GetClass())) {
+    return false;
+  }
+
+  auto operands = op->GetOperands();
+  auto operand_count = op->GetOperandCount();
+
+  for (int i = 0; i < operand_count; i++) {
+    if (op->IsOperandWritten(i) || !operands[i].IsVariable()) {
+      continue;
+    }
+
+    auto def = operands[i].GetVar().GetDef();
+
+    if (def != nullptr && IsCPSRTransfer(def->GetClass())) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/// Check if an opcode calls out to a handler, which may inspect the CPU state.
+static bool IsHelperCall(IROpcode const* op) {
+  switch (op->GetClass()) {
+    case IROpcodeClass::MRC:
+    case IROpcodeClass::MCR:
+      return true;
+    default:
+      return false;
+  }
+}
+
+auto GetHostFlagsWritten(IROpcode* op) -> u8 {
+  // Opcodes that only update N, Z and C load them into AH and leave V (in AL) as-is.
+  static constexpr u8 kFlagsNZC = kFlagN | kFlagZ | kFlagC;
+
+  switch (op->GetClass()) {
+    case IROpcodeClass::LSL:
+    case IROpcodeClass::LSR:
+    case IROpcodeClass::ASR:
+    case IROpcodeClass::ROR:
+      return ((IRLogicalShiftLeft*)op)->update_host_flags ? kFlagsNZC : 0;
+    case IROpcodeClass::AND:
+    case IROpcodeClass::BIC:
+    case IROpcodeClass::EOR:
+    case IROpcodeClass::ORR:
+      return ((IRBitwiseAND*)op)->update_host_flags ? kFlagsNZC : 0;
+    case IROpcodeClass::ADD:
+    case IROpcodeClass::SUB:
+    case IROpcodeClass::RSB:
+      return ((IRAdd*)op)->update_host_flags ? kFlagsNZCV : 0;
+    case IROpcodeClass::ADC:
+    case IROpcodeClass::SBC:
+    case IROpcodeClass::RSC:
+      return ((IRAdc*)op)->update_host_flags ? kFlagsNZCV : 0;
+    case IROpcodeClass::MOV:
+    case IROpcodeClass::MVN:
+      return ((IRMov*)op)->update_host_flags ? kFlagsNZC : 0;
+    // Multiplies only update N and Z, the carry is kept.
+    case IROpcodeClass::MUL:
+      return lunatic_cast<IRMultiply>(op)->update_host_flags ? (kFlagN | kFlagZ) : 0;
+    case IROpcodeClass::ADD64:
+      return lunatic_cast<IRAdd64>(op)->update_host_flags ? (kFlagN | kFlagZ) : 0;
+    case IROpcodeClass::ClearCarry:
+    case IROpcodeClass::SetCarry:
+      return kFlagC;
+    case IROpcodeClass::QADD:
+    case IROpcodeClass::QSUB:
+      return kFlagV;
+    default:
+      return 0;
+  }
+}
+
+auto GetFlagsLiveIn(std::vector<BasicBlock::MicroBlock> const& micro_blocks) -> u8 {
+  u8 flags_written = 0;
+
+  for (auto const& micro_block : micro_blocks) {
+    // The condition check reads the flags. Also flag updates inside the micro block are not guaranteed to happen.
+    if (micro_block.condition != Condition::AL) {
+      break;
+    }
+
+    for (auto op : micro_block.emitter.Code()) {
+      if (op->GetClass() == IROpcodeClass::UpdateFlags) {
+        flags_written |= GetUpdatedFlags(lunatic_cast<IRUpdateFlags>(op));
+      } else if (ObservesCPSR(op)) {
+        return kFlagsNZCV & ~flags_written;
+      }
+    }
+  }
+
+  // All flags are observable once the basic block has been left.
+  return kFlagsNZCV & ~flags_written;
+}
+
+auto DeferFinalFlagUpdate(std::vector<BasicBlock::MicroBlock>& micro_blocks, u8 flags) -> u8 {
+  for (auto micro_block = micro_blocks.rbegin(); micro_block != micro_blocks.rend(); ++micro_block) {
+    auto& code = micro_block->emitter.Code();
+
+    for (auto it = code.rbegin(); it != code.rend(); ++it) {
+      auto op = *it;
+
+      if (op->GetClass() == IROpcodeClass::UpdateFlags) {
+        auto update = lunatic_cast<IRUpdateFlags>(op);
+        auto deferred = GetUpdatedFlags(update) & flags;
+
+        if (deferred & kFlagN) update->flag_n = false;
+        if (deferred & kFlagZ) update->flag_z = false;
+        if (deferred & kFlagC) update->flag_c = false;
+        if (deferred & kFlagV) update->flag_v = false;
+        return deferred;
+      }
+
+      // The flags must still be in AX and must not have been read from the CPSR after the final update.
+      if (op->GetClass() == IROpcodeClass::LoadCPSR || ObservesCPSR(op) || IsHelperCall(op) || GetHostFlagsWritten(op) != 0) {
+        return 0;
+      }
+    }
+
+    // The condition check of a later micro block reloads AX from the CPSR and side exits need the CPSR in the context.
+    if (micro_block->condition != Condition::AL || !micro_block->side_exit.IsEmpty()) {
+      return 0;
+    }
+  }
+
+  return 0;
+}
+
+} // namespace lunatic::frontend
+} // namespace lunatic
@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2022 fleroviux. All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#pragma once
+
+#include <lunatic/integer.hpp>
+#include <vector>
+
+#include "frontend/basic_block.hpp"
+
+namespace lunatic {
+namespace frontend {
+
+/// Masks of the guest NZCV flags (CPSR bits 28 - 31, shifted down by 28).
+enum : u8 {
+  kFlagV = 1,
+  kFlagC = 2,
+  kFlagZ = 4,
+  kFlagN = 8,
+  kFlagsNZCV = 15
+};
+
+/**
+ * Get the NZCV flags which an opcode writes to the host flags.
+ * Opcodes with update_host_flags set keep their NZCV result in the host flags,
+ * until it is written to the CPSR by an UpdateFlags opcode.
+ *
+ * @param  op  the opcode
+ * @returns the mask of NZCV flags that the opcode writes to the host flags
+ */
+auto GetHostFlagsWritten(IROpcode* op) -> u8;
+
+/**
+ * Determine which NZCV flags in the guest CPSR a basic block may read before it overwrites them.
+ * A conditional micro block reads all flags, because it reloads the host flags from the CPSR.
+ *
+ * @param  micro_blocks  the (optimized) micro blocks of the basic block
+ * @returns the mask of NZCV flags which are live when entering the basic block
+ */
+auto GetFlagsLiveIn(std::vector<BasicBlock::MicroBlock> const& micro_blocks) -> u8;
+
+/**
+ * Stop the final NZCV update of a basic block from updating the given flags.
+ * This is only done if the host flags (in AX) still hold the flags at the end of the basic block,
+ * so that the caller can write the flags back to the CPSR at the exits where they are observable.
+ *
+ * @param  micro_blocks  the (optimized) micro blocks of the basic block
+ * @param  flags         mask of the NZCV flags which should not be updated
+ * @returns the mask of NZCV flags which no longer are updated
+ */
+auto DeferFinalFlagUpdate(std::vector<BasicBlock::MicroBlock>& micro_blocks, u8 flags) -> u8;
+
+} // namespace lunatic::frontend
+} // namespace lunatic
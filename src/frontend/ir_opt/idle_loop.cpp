@@ -0,0 +1,188 @@
+/*
+ * Copyright (C) 2022 fleroviux. All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include "frontend/ir_opt/idle_loop.hpp"
+
+namespace lunatic {
+namespace frontend {
+
+/// Check if a CPSR value is only used as the input of flag updates, which keep the bits they do not update.
+static bool IsOnlyUpdated(IRVariable const& cpsr_in) {
+  for (auto use = cpsr_in.GetFirstUse(); use != nullptr; use = use->next) {
+    auto klass = use->op->GetClass();
+
+    if (klass != IROpcodeClass::UpdateFlags && klass != IROpcodeClass::UpdateSticky) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/// Opcodes which neither have side effects nor carry state from one iteration into the next.
+static bool IsIdempotent(IROpcode* op) {
+  switch (op->GetClass()) {
+    case IROpcodeClass::NOP:
+    case IROpcodeClass::LoadGPR:
+    case IROpcodeClass::StoreGPR:
+    case IROpcodeClass::LoadCPSR:
+    case IROpcodeClass::StoreCPSR:
+    case IROpcodeClass::ClearCarry:
+    case IROpcodeClass::SetCarry:
+    case IROpcodeClass::UpdateFlags:
+    case IROpcodeClass::UpdateSticky:
+    case IROpcodeClass::LSL:
+    case IROpcodeClass::LSR:
+    case IROpcodeClass::ASR:
+    case IROpcodeClass::AND:
+    case IROpcodeClass::BIC:
+    case IROpcodeClass::EOR:
+    case IROpcodeClass::SUB:
+    case IROpcodeClass::RSB:
+    case IROpcodeClass::ADD:
+    case IROpcodeClass::ORR:
+    case IROpcodeClass::MOV:
+    case IROpcodeClass::MVN:
+    case IROpcodeClass::MUL:
+    case IROpcodeClass::ADD64:
+    case IROpcodeClass::MemoryRead:
+    case IROpcodeClass::CLZ:
+    case IROpcodeClass::QADD:
+    case IROpcodeClass::QSUB:
+      return true;
+    case IROpcodeClass::ROR: {
+      // ROR #0 is RRX, which shifts in the carry of the previous iteration.
+      auto amount = lunatic_cast<IRRotateRight>(op)->amount;
+      return !amount.IsConstant() || amount.GetConst().value != 0;
+    }
+    default:
+      // ADC, SBC and RSC may compute a new carry from the carry of the previous iteration.
+      return false;
+  }
+}
+
+bool DetectIdleLoop(BasicBlock& basic_block, std::vector<BasicBlock::MicroBlock> const& micro_blocks) {
+  bool gpr_stored[512] {false};
+  bool gpr_written[512] {false};
+  bool cpsr_stored = false;
+  bool cpsr_written = false;
+
+  basic_block.idle_loop_read_count = 0;
+
+  if (basic_block.branch_target.key != basic_block.key) {
+    return false;
+  }
+
+  for (auto const& micro_block : micro_blocks) {
+    for (auto op : micro_block.emitter.Code()) {
+      if (!IsIdempotent(op)) {
+        return false;
+      }
+
+      if (op->GetClass() == IROpcodeClass::StoreGPR) {
+        gpr_stored[lunatic_cast<IRStoreGPR>(op)->reg.ID()] = true;
+      } else if (op->GetClass() == IROpcodeClass::StoreCPSR) {
+        cpsr_stored = true;
+      }
+    }
+  }
+
+  /* Reading a value from the context that the block writes, before the block has written it,
+   * carries state from one iteration into the next (think of a loop counter).
+   * Writes inside of conditional micro blocks may be skipped, so they do not count as written.
+   */
+  for (auto const& micro_block : micro_blocks) {
+    bool conditional = micro_block.condition != Condition::AL;
+
+    // The condition check reads the flags.
+    if (conditional && cpsr_stored && !cpsr_written) {
+      return false;
+    }
+
+    for (auto op : micro_block.emitter.Code()) {
+      switch (op->GetClass()) {
+        case IROpcodeClass::LoadGPR: {
+          auto id = lunatic_cast<IRLoadGPR>(op)->reg.ID();
+
+          if (gpr_stored[id] && !gpr_written[id]) {
+            return false;
+          }
+          break;
+        }
+        case IROpcodeClass::StoreGPR: {
+          if (!conditional) {
+            gpr_written[lunatic_cast<IRStoreGPR>(op)->reg.ID()] = true;
+          }
+          break;
+        }
+        case IROpcodeClass::LoadCPSR: {
+          auto& cpsr_in = lunatic_cast<IRLoadCPSR>(op)->result.Get();
+
+          if (cpsr_stored && !cpsr_written && !IsOnlyUpdated(cpsr_in)) {
+            return false;
+          }
+          break;
+        }
+        case IROpcodeClass::StoreCPSR: {
+          if (!conditional) {
+            cpsr_written = true;
+          }
+          break;
+        }
+        case IROpcodeClass::MemoryRead: {
+          auto read = lunatic_cast<IRMemoryRead>(op);
+          auto idle_read = BasicBlock::IdleLoopRead{read->offset, GPR::R0, Mode::User, false, 1};
+
+          if (read->flags & IRMemoryFlags::Half) idle_read.size = 2;
+          if (read->flags & IRMemoryFlags::Word) idle_read.size = 4;
+
+          if (read->index.IsConstant()) {
+            idle_read.offset += read->index.GetConst().value << read->index_shift;
+          } else if (!read->index.IsNull()) {
+            return false;
+          }
+
+          // The address must be known when the loop is checked, so it can only be based on a GPR which the loop does not write.
+          if (read->address.IsConstant()) {
+            idle_read.offset += read->address.GetConst().value;
+          } else {
+            auto def = read->address.GetVar().GetDef();
+
+            if (def == nullptr || def->GetClass() != IROpcodeClass::LoadGPR) {
+              return false;
+            }
+
+            auto load = lunatic_cast<IRLoadGPR>(def);
+
+            if (gpr_stored[load->reg.ID()]) {
+              return false;
+            }
+
+            idle_read.has_base = true;
+            idle_read.base_reg = load->reg.reg;
+            idle_read.base_mode = load->reg.mode;
+          }
+
+          if (basic_block.idle_loop_read_count == BasicBlock::kMaxIdleLoopReads) {
+            return false;
+          }
+
+          basic_block.idle_loop_reads[basic_block.idle_loop_read_count++] = idle_read;
+          break;
+        }
+        default: {
+          break;
+        }
+      }
+    }
+  }
+
+  return true;
+}
+
+} // namespace lunatic::frontend
+} // namespace lunatic
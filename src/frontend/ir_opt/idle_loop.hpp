@@ -0,0 +1,30 @@
+/*
+ * Copyright (C) 2022 fleroviux. All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#pragma once
+
+#include <vector>
+
+#include "frontend/basic_block.hpp"
+
+namespace lunatic {
+namespace frontend {
+
+/**
+ * Check if a basic block is an idle loop, which only polls memory until the value that it reads changes.
+ * Such a block branches to itself and every value which it writes to the context only depends on
+ * values that the block does not write and on memory reads, so that each iteration ends in the same state.
+ * The memory reads of an idle loop are recorded in the basic block.
+ *
+ * @param  basic_block   the basic block
+ * @param  micro_blocks  the (optimized) micro blocks of the basic block
+ * @returns whether the basic block is an idle loop
+ */
+bool DetectIdleLoop(BasicBlock& basic_block, std::vector<BasicBlock::MicroBlock> const& micro_blocks);
+
+} // namespace lunatic::frontend
+} // namespace lunatic
@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2022 fleroviux. All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <type_traits>
+
+#include "frontend/ir_opt/memory_address_folding.hpp"
+
+namespace lunatic {
+namespace frontend {
+
+void IRMemoryAddressFoldingPass::Run(IREmitter& emitter) {
+  this->emitter = &emitter;
+
+  auto& code = emitter.Code();
+
+  for (auto it = code.begin(); it != code.end(); ++it) {
+    switch ((*it)->GetClass()) {
+      case IROpcodeClass::MemoryRead:  Fold<IRMemoryRead>(it); break;
+      case IROpcodeClass::MemoryWrite: Fold<IRMemoryWrite>(it); break;
+    }
+  }
+}
+
+template<typename OpcodeType>
+void IRMemoryAddressFoldingPass::Fold(InstructionList::iterator& it) {
+  auto op = lunatic_cast<OpcodeType>(*it);
+
+  if (!op->address.IsVariable() || !op->index.IsNull() || op->offset != 0) {
+    return;
+  }
+
+  auto& address = op->address.GetVar();
+  auto  def = address.GetDef();
+
+  /* Only fold if the memory access is the only user of the address.
+   * Otherwise (e.g. with base register writeback) the address is computed anyway.
+   */
+  auto use = address.GetFirstUse();
+
+  if (def == nullptr || use->next != nullptr) {
+    return;
+  }
+
+  IRAnyRef base;
+  IRAnyRef index;
+  int index_shift = 0;
+  u32 offset = 0;
+
+  switch (def->GetClass()) {
+    case IROpcodeClass::ADD: {
+      auto add_op = lunatic_cast<IRAdd>(def);
+
+      if (add_op->update_host_flags) {
+        return;
+      }
+
+      base = add_op->lhs;
+
+      if (add_op->rhs.IsConstant()) {
+        offset = add_op->rhs.GetConst().value;
+      } else {
+        auto& rhs = add_op->rhs.GetVar();
+        auto  rhs_def = rhs.GetDef();
+
+        index = rhs;
+        index_shift = add_op->rhs_shift;
+
+        // Fold the shifted register offset of LDR/STR, if it maps to an x86 scale factor.
+        if (index_shift == 0 && rhs_def != nullptr && rhs_def->GetClass() == IROpcodeClass::LSL) {
+          auto lsl_op = lunatic_cast<IRLogicalShiftLeft>(rhs_def);
+
+          if (!lsl_op->update_host_flags && lsl_op->amount.IsConstant() && lsl_op->amount.GetConst().value <= 3) {
+            index = lsl_op->operand;
+            index_shift = (int)lsl_op->amount.GetConst().value;
+          }
+        }
+      }
+      break;
+    }
+    case IROpcodeClass::SUB: {
+      auto sub_op = lunatic_cast<IRSub>(def);
+
+      if (sub_op->update_host_flags || !sub_op->rhs.IsConstant()) {
+        return;
+      }
+
+      base = sub_op->lhs;
+      offset = -sub_op->rhs.GetConst().value;
+      break;
+    }
+    default: {
+      return;
+    }
+  }
+
+  auto flags = op->flags;
+
+  if constexpr (std::is_same_v<OpcodeType, IRMemoryRead>) {
+    auto& result = op->result.Get();
+
+    it = emitter->Replace<IRMemoryRead>(it, flags, result, base, index, index_shift, offset);
+  } else {
+    auto source = op->source;
+
+    it = emitter->Replace<IRMemoryWrite>(it, flags, source, base, index, index_shift, offset);
+  }
+}
+
+} // namespace lunatic::frontend
+} // namespace lunatic
@@ -0,0 +1,31 @@
+/*
+ * Copyright (C) 2022 fleroviux. All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#pragma once
+
+#include "frontend/ir_opt/pass.hpp"
+
+namespace lunatic {
+namespace frontend {
+
+/**
+ * Fold address arithmetic (base + offset and base + index << shift)
+ * into the addressing of memory reads and writes, so that the backend can use a single address computation.
+ * The arithmetic opcodes are left to dead code elision.
+ */
+struct IRMemoryAddressFoldingPass final : IRPass {
+  void Run(IREmitter& emitter) override;
+
+private:
+  template<typename OpcodeType>
+  void Fold(InstructionList::iterator& it);
+
+  IREmitter* emitter;
+};
+
+} // namespace lunatic::frontend
+} // namespace lunatic
@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2022 fleroviux. All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <algorithm>
+
+#include "frontend/ir_opt/memory_alignment.hpp"
+
+namespace lunatic {
+namespace frontend {
+
+/// Limits how far the analysis follows the opcodes that produce a value.
+static constexpr int kMaxDepth = 8;
+
+/// Get the lowest bits that are known to be zero in a value, given all bits that are known to be zero.
+static auto GetTrailingZeroBits(u32 known_zero) -> u32 {
+  return known_zero & ~(known_zero + 1);
+}
+
+void IRMemoryAlignmentPass::Run(IREmitter& emitter) {
+  for (auto op : emitter.Code()) {
+    switch (op->GetClass()) {
+      case IROpcodeClass::MemoryRead:  TagAligned(lunatic_cast<IRMemoryRead>(op)); break;
+      case IROpcodeClass::MemoryWrite: TagAligned(lunatic_cast<IRMemoryWrite>(op)); break;
+    }
+  }
+}
+
+template<typename OpcodeType>
+void IRMemoryAlignmentPass::TagAligned(OpcodeType* op) {
+  u32 alignment_mask;
+
+  if (op->flags & IRMemoryFlags::Word) {
+    alignment_mask = 3;
+  } else if (op->flags & IRMemoryFlags::Half) {
+    alignment_mask = 1;
+  } else {
+    return;
+  }
+
+  auto known_zero = GetTrailingZeroBits(GetKnownZeroBits(op->address)) & GetTrailingZeroBits(~op->offset);
+
+  if (!op->index.IsNull()) {
+    auto shift = op->index_shift;
+
+    known_zero &= GetTrailingZeroBits((GetKnownZeroBits(op->index) << shift) | ((1U << shift) - 1));
+  }
+
+  if ((known_zero & alignment_mask) == alignment_mask) {
+    op->flags = op->flags | IRMemoryFlags::Aligned;
+  }
+}
+
+auto IRMemoryAlignmentPass::GetKnownZeroBits(IRAnyRef const& value, int depth) -> u32 {
+  if (value.IsConstant()) {
+    return ~value.GetConst().value;
+  }
+
+  if (!value.IsVariable() || depth == kMaxDepth) {
+    return 0;
+  }
+
+  auto def = value.GetVar().GetDef();
+
+  if (def == nullptr) {
+    return 0;
+  }
+
+  depth++;
+
+  auto GetShiftAmount = [](IRAnyRef const& amount) -> int {
+    return amount.IsConstant() ? (int)std::min(amount.GetConst().value, 32U) : -1;
+  };
+
+  switch (def->GetClass()) {
+    case IROpcodeClass::MOV: {
+      return GetKnownZeroBits(lunatic_cast<IRMov>(def)->source, depth);
+    }
+    case IROpcodeClass::AND: {
+      auto op = lunatic_cast<IRBitwiseAND>(def);
+
+      return GetKnownZeroBits(op->lhs, depth) | GetKnownZeroBits(op->rhs, depth);
+    }
+    case IROpcodeClass::BIC: {
+      auto op = lunatic_cast<IRBitwiseBIC>(def);
+      auto known_zero = GetKnownZeroBits(op->lhs, depth);
+
+      if (op->rhs.IsConstant()) {
+        known_zero |= op->rhs.GetConst().value;
+      }
+      return known_zero;
+    }
+    case IROpcodeClass::ORR:
+    case IROpcodeClass::EOR: {
+      auto op = (IRBitwiseORR*)def;
+
+      return GetKnownZeroBits(op->lhs, depth) & GetKnownZeroBits(op->rhs, depth);
+    }
+    case IROpcodeClass::ADD: {
+      auto op = lunatic_cast<IRAdd>(def);
+      auto shift = op->rhs_shift;
+      auto rhs_known_zero = (GetKnownZeroBits(op->rhs, depth) << shift) | ((1U << shift) - 1);
+
+      // Carries only propagate upwards, so the sum is zero in the low bits that are zero in both operands.
+      return GetTrailingZeroBits(GetKnownZeroBits(op->lhs, depth)) & GetTrailingZeroBits(rhs_known_zero);
+    }
+    case IROpcodeClass::SUB:
+    case IROpcodeClass::RSB: {
+      auto op = (IRSub*)def;
+
+      return GetTrailingZeroBits(GetKnownZeroBits(op->lhs, depth)) & GetTrailingZeroBits(GetKnownZeroBits(op->rhs, depth));
+    }
+    case IROpcodeClass::LSL: {
+      auto op = lunatic_cast<IRLogicalShiftLeft>(def);
+      auto amount = GetShiftAmount(op->amount);
+
+      if (amount < 0) return 0;
+      if (amount == 32) return 0xFFFFFFFF;
+      return (GetKnownZeroBits(op->operand, depth) << amount) | ((1U << amount) - 1);
+    }
+    case IROpcodeClass::LSR: {
+      auto op = lunatic_cast<IRLogicalShiftRight>(def);
+      auto amount = GetShiftAmount(op->amount);
+
+      // LSR #0 equals to LSR #32
+      if (amount < 0) return 0;
+      if (amount == 0 || amount == 32) return 0xFFFFFFFF;
+      return (GetKnownZeroBits(op->operand, depth) >> amount) | ~(0xFFFFFFFF >> amount);
+    }
+    case IROpcodeClass::ASR: {
+      auto op = lunatic_cast<IRArithmeticShiftRight>(def);
+      auto amount = GetShiftAmount(op->amount);
+
+      // ASR #0 equals to ASR #32. The upper bits are known to be zero if the sign-bit is.
+      if (amount < 0) return 0;
+      if (amount == 0 || amount == 32) amount = 31;
+      return (u32)((s32)GetKnownZeroBits(op->operand, depth) >> amount);
+    }
+    case IROpcodeClass::MemoryRead: {
+      auto flags = lunatic_cast<IRMemoryRead>(def)->flags;
+
+      // Zero-extended loads. A rotated halfword may have its bits anywhere.
+      if ((flags & IRMemoryFlags::Signed) == 0) {
+        if (flags & IRMemoryFlags::Byte) return 0xFFFFFF00;
+        if ((flags & IRMemoryFlags::Half) && (flags & IRMemoryFlags::Rotate) == 0) return 0xFFFF0000;
+      }
+      return 0;
+    }
+    default: {
+      return 0;
+    }
+  }
+}
+
+} // namespace lunatic::frontend
+} // namespace lunatic
@@ -0,0 +1,32 @@
+/*
+ * Copyright (C) 2022 fleroviux. All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#pragma once
+
+#include "frontend/ir_opt/pass.hpp"
+
+namespace lunatic {
+namespace frontend {
+
+/**
+ * Tag halfword and word memory accesses as aligned, if the low bits of their address are known to be zero.
+ * The bits are derived from constants and the opcodes that produce the address (known-bits analysis),
+ * so that the backend can skip the alignment masking and the fixups for misaligned accesses.
+ */
+struct IRMemoryAlignmentPass final : IRPass {
+  void Run(IREmitter& emitter) override;
+
+private:
+  template<typename OpcodeType>
+  static void TagAligned(OpcodeType* op);
+
+  /// Get a mask of the bits that are known to be zero in a value.
+  static auto GetKnownZeroBits(IRAnyRef const& value, int depth = 0) -> u32;
+};
+
+} // namespace lunatic::frontend
+} // namespace lunatic
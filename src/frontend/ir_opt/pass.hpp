@@ -7,6 +7,9 @@
 
 #pragma once
 
+#include <vector>
+
+#include "frontend/basic_block.hpp"
 #include "frontend/ir/emitter.hpp"
 
 namespace lunatic {
@@ -21,21 +24,32 @@ protected:
   using InstructionList = IREmitter::InstructionList;
 
   bool Repoint(
+    IREmitter& emitter,
     IRVariable const& var_old,
-    IRVariable const& var_new,
-    InstructionList::const_iterator begin,
-    InstructionList::const_iterator end
+    IRVariable const& var_new
   ) {
     if (var_old.data_type != var_new.data_type) {
       return false;
     }
-    
-    for (auto it = begin; it != end; ++it) {
-      (*it)->Repoint(var_old, var_new); 
-    }
 
+    emitter.Repoint(var_old, var_new);
     return true;
-  }  
+  }
+};
+
+/// A pass that works across all micro blocks of a basic block.
+struct IRBasicBlockPass {
+  using MicroBlockList = std::vector<BasicBlock::MicroBlock>;
+
+  virtual ~IRBasicBlockPass() = default;
+
+  virtual void Run(
+    BasicBlock const& basic_block,
+    MicroBlockList& micro_blocks
+  ) = 0;
+
+protected:
+  using InstructionList = IREmitter::InstructionList;
 };
 
 } // namespace lunatic::frontend
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2022 fleroviux. All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include "frontend/ir_opt/shifted_operand_folding.hpp"
+
+namespace lunatic {
+namespace frontend {
+
+void IRShiftedOperandFoldingPass::Run(IREmitter& emitter) {
+  auto& code = emitter.Code();
+
+  for (auto it = code.begin(); it != code.end(); ++it) {
+    if ((*it)->GetClass() != IROpcodeClass::ADD) {
+      continue;
+    }
+
+    auto op = lunatic_cast<IRAdd>(*it);
+
+    if (op->update_host_flags || !op->result.IsVariable() || op->rhs_shift != 0) {
+      continue;
+    }
+
+    IRAnyRef lhs = op->lhs;
+    IRAnyRef rhs = op->rhs;
+    auto lsl_op = GetFoldableShift(rhs);
+
+    // ADD is commutative, so the shift may also be found on the left-hand side.
+    if (lsl_op == nullptr) {
+      lsl_op = GetFoldableShift(lhs);
+
+      if (lsl_op == nullptr || !rhs.IsVariable()) {
+        continue;
+      }
+      lhs = rhs;
+    }
+
+    auto& result = op->result.GetVar();
+    auto& operand = lsl_op->operand.Get();
+    auto  shift = (int)lsl_op->amount.GetConst().value;
+
+    it = emitter.Replace<IRAdd>(it, result, lhs.GetVar(), operand, false);
+
+    lunatic_cast<IRAdd>(*it)->rhs_shift = shift;
+  }
+}
+
+auto IRShiftedOperandFoldingPass::GetFoldableShift(IRAnyRef const& operand) -> IRLogicalShiftLeft* {
+  if (!operand.IsVariable()) {
+    return nullptr;
+  }
+
+  auto& var = operand.GetVar();
+  auto  def = var.GetDef();
+
+  // Only fold if the ADD is the only user of the shifted value. Otherwise the shift is computed anyway.
+  if (def == nullptr || def->GetClass() != IROpcodeClass::LSL || var.GetFirstUse()->next != nullptr) {
+    return nullptr;
+  }
+
+  auto lsl_op = lunatic_cast<IRLogicalShiftLeft>(def);
+  auto& amount = lsl_op->amount;
+
+  // Only shifts which map to an x86 scale factor can be folded.
+  if (lsl_op->update_host_flags || !amount.IsConstant() || amount.GetConst().value < 1 || amount.GetConst().value > 3) {
+    return nullptr;
+  }
+
+  return lsl_op;
+}
+
+} // namespace lunatic::frontend
+} // namespace lunatic
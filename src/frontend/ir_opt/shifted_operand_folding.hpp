@@ -0,0 +1,28 @@
+/*
+ * Copyright (C) 2022 fleroviux. All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#pragma once
+
+#include "frontend/ir_opt/pass.hpp"
+
+namespace lunatic {
+namespace frontend {
+
+/**
+ * Fold small constant left shifts (LSL #1 - #3) of an operand into the ADD reading it,
+ * so that the backend can compute both with a single LEA.
+ * The shift opcodes are left to dead code elision.
+ */
+struct IRShiftedOperandFoldingPass final : IRPass {
+  void Run(IREmitter& emitter) override;
+
+private:
+  static auto GetFoldableShift(IRAnyRef const& operand) -> IRLogicalShiftLeft*;
+};
+
+} // namespace lunatic::frontend
+} // namespace lunatic
@@ -13,6 +13,13 @@ namespace frontend {
 auto Translator::Handle(ARMBranchRelative const& opcode) -> Status {
   auto branch_address = code_address + opcode_size * 2 + opcode.offset;
 
+  // A folded branch emits no code, instead the code up to its target only runs if it is not taken (see Translate()).
+  if (IsFoldedBranch(code_address)) {
+    skip_end = branch_address;
+    skip_condition = InvertCondition(opcode.condition);
+    return Status::Continue;
+  }
+
   if (opcode.link) {
     // Note: thumb BL consists of two 16-bit opcodes.
     u32 link_address = code_address + sizeof(u32);
@@ -48,7 +55,21 @@ auto Translator::Handle(ARMBranchRelative const& opcode) -> Status {
     code_address = branch_address - opcode_size * 3;
     basic_block->branch_target.key = {};
     return Status::Continue;
-  } else {
+  }
+
+  /* Forward branches are assumed to be not taken (backward branches usually close loops).
+   * Keep translating along the fall-through path and leave the block through a side exit if the branch is taken.
+   */
+  if (enable_side_exits && side_exit_count < BasicBlock::kMaxSideExits && !opcode.exchange && opcode.offset >= 0) {
+    side_exit = BasicBlock::Key{branch_address, mode, thumb_mode};
+    side_exit_count++;
+    if (form_region) {
+      forward_branches.push_back({code_address, branch_address - opcode_size * 2});
+    }
+    return Status::BreakMicroBlock;
+  }
+
+  {
     if (opcode.exchange) {
       thumb_mode = !thumb_mode;
     }
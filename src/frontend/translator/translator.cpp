@@ -5,25 +5,104 @@
  * found in the LICENSE file.
  */
 
+#include <algorithm>
+
 #include "translator.hpp"
 
 namespace lunatic {
 namespace frontend {
 
-Translator::Translator(CPU::Descriptor const& descriptor)
+Translator::Translator(CPU::Descriptor const& descriptor, Arena& arena, bool mapped_code_only)
     : armv5te(descriptor.model == CPU::Descriptor::Model::ARM9)
     , max_block_size(descriptor.block_size)
+    , enable_side_exits(descriptor.optimization_level == CPU::Descriptor::OptimizationLevel::Full)
+    , mapped_code_only(mapped_code_only)
     , exception_base(descriptor.exception_base)
     , memory(descriptor.memory)
-    , coprocessors(descriptor.coprocessors) {
+    , coprocessors(descriptor.coprocessors)
+    , arena(arena) {
 }
 
-void Translator::Translate(BasicBlock& basic_block) {
+void Translator::Translate(
+  BasicBlock& basic_block,
+  std::vector<BasicBlock::MicroBlock>& micro_blocks,
+  bool form_region
+) {
+  this->form_region = form_region && enable_side_exits;
+  trace.clear();
+  forward_branches.clear();
+  folded_branches.clear();
+
+  TranslateBlock(basic_block, micro_blocks);
+
+  if (!this->form_region) {
+    return;
+  }
+
+  this->form_region = false;
+
+  /* A side exit whose target is translated later on the fall-through path skips over code of the block (if-then).
+   * Such branches are folded into the block: the skipped code only runs if the branch is not taken,
+   * so that both paths stay in the block and e.g. a loop containing an if-then compiles to a single block.
+   */
+  for (auto const& branch : forward_branches) {
+    auto position = std::find(trace.begin(), trace.end(), branch.address);
+
+    if (std::find(position, trace.end(), branch.target) != trace.end()) {
+      folded_branches.push_back(branch.address);
+    }
+  }
+
+  if (folded_branches.empty()) {
+    return;
+  }
+
+  auto length = basic_block.length;
+  auto branch_target = basic_block.branch_target.key;
+  auto enable_fast_dispatch = basic_block.enable_fast_dispatch;
+  auto uses_exception_base = basic_block.uses_exception_base;
+  auto first_code_hash = code_hash;
+
+  first_code_spans.swap(code_spans);
+
+  basic_block.length = 0;
+  basic_block.branch_target.key = {};
+  basic_block.enable_fast_dispatch = true;
+  basic_block.uses_exception_base = false;
+
+  TranslateBlock(basic_block, region_micro_blocks);
+
+  // Keep the first translation if the skipped code turned out to be unsuitable.
+  if (region_failed) {
+    basic_block.length = length;
+    basic_block.branch_target.key = branch_target;
+    basic_block.enable_fast_dispatch = enable_fast_dispatch;
+    basic_block.uses_exception_base = uses_exception_base;
+    code_spans.swap(first_code_spans);
+    code_hash = first_code_hash;
+  } else {
+    micro_blocks.swap(region_micro_blocks);
+  }
+
+  region_micro_blocks.clear();
+}
+
+void Translator::TranslateBlock(
+  BasicBlock& basic_block,
+  std::vector<BasicBlock::MicroBlock>& micro_blocks
+) {
   mode = basic_block.key.Mode();
   thumb_mode = basic_block.key.Thumb();
   opcode_size = thumb_mode ? sizeof(u16) : sizeof(u32);
   code_address = basic_block.key.Address() - 2 * opcode_size;
   this->basic_block = &basic_block;
+  this->micro_blocks = &micro_blocks;
+  side_exit = {};
+  side_exit_count = 0;
+  skip_end = 0;
+  region_failed = false;
+  code_spans.clear();
+  code_hash = {};
 
   if (thumb_mode) {
     TranslateThumb(basic_block);
@@ -32,37 +111,99 @@ void Translator::Translate(BasicBlock& basic_block) {
   }
 }
 
+void Translator::AddCode(u32 address, u32 opcode, u32 size) {
+  if (!code_spans.empty() && code_spans.back().address + code_spans.back().size == address) {
+    code_spans.back().size += size;
+  } else {
+    code_spans.push_back({address, size});
+  }
+
+  code_hash.Add(opcode, size);
+}
+
+template<typename T>
+auto Translator::ReadCode(u32 address) -> T {
+  if (!mapped_code_only) {
+    return memory.FastRead<T, Memory::Bus::Code>(address);
+  }
+
+  address &= ~(sizeof(T) - 1);
+
+  if (itcm.config.enable_read && address >= itcm.config.base && address <= itcm.config.limit) {
+    return read<T>(itcm.data, (address - itcm.config.base) & itcm.mask);
+  }
+
+  if (memory.pagetable != nullptr) {
+    auto page = (*memory.pagetable)[address >> Memory::kPageShift];
+    if (page != nullptr) {
+      return read<T>(page, address & Memory::kPageMask);
+    }
+  }
+
+  throw std::runtime_error(
+    fmt::format("lunatic: code @ 0x{:08X} is not mapped by the page table or the ITCM", address)
+  );
+}
+
 void Translator::TranslateARM(BasicBlock& basic_block) {
-  auto micro_block = BasicBlock::MicroBlock{};
+  auto micro_block = BasicBlock::MicroBlock{Condition::AL, IREmitter{arena}};
 
   auto add_micro_block = [&]() {
-    basic_block.micro_blocks.push_back(std::move(micro_block));
+    micro_blocks->push_back(std::move(micro_block));
   };
 
   auto break_micro_block = [&](Condition condition) {
-    add_micro_block();
-    micro_block = {condition};
+    // Do not leave behind an empty micro block, e.g. after a side exit that is followed by a different condition.
+    if (micro_block.length == 0) {
+      micro_block.condition = condition;
+      return;
+    }
+
+    add_micro_block();
+    micro_block = {condition, IREmitter{arena}};
+    // A micro block that stays empty leaves the program counter where the previous one did.
+    micro_block.next_address = micro_blocks->back().next_address;
     emitter = &micro_block.emitter;
   };
 
   emitter = &micro_block.emitter;
 
   for (int i = 0; i < max_block_size; i++) {
-    auto instruction = memory.FastRead<u32, Memory::Bus::Code>(code_address);
+    auto instruction = ReadCode<u32>(code_address);
     auto condition = bit::get_field<u32, Condition>(instruction, 28, 4);
 
+    AddCode(code_address, instruction, sizeof(u32));
+
     // ARMv5TE+ treats condition code 'NV' as a separate
     // encoding space for unpredicated instructions.
     if (armv5te && condition == Condition::NV) {
       condition = Condition::AL;
     }
 
+    if (skip_end != 0) {
+      // Code that is skipped by a folded branch can not be conditional itself.
+      if (condition != Condition::AL) {
+        region_failed = true;
+        break;
+      }
+      condition = skip_condition;
+    } else if (IsFoldedBranch(code_address)) {
+      // The folded branch emits no code, it only decides whether the next micro block runs.
+      condition = i == 0 ? Condition::AL : micro_block.condition;
+    }
+
     if (i == 0) {
       micro_block.condition = condition;
     } else if (condition != micro_block.condition) {
       break_micro_block(condition);
     }
 
+    auto address = code_address;
+
+    if (form_region) {
+      trace.push_back(address);
+    }
+
     auto status = decode_arm(instruction, *this);
 
     if (status == Status::Unimplemented) {
@@ -72,10 +213,25 @@ void Translator::TranslateARM(BasicBlock& basic_block) {
       );
     }
 
+    // The skipped code must fall through to the branch target.
+    if (skip_end != 0 && (status == Status::BreakBasicBlock || code_address != address)) {
+      region_failed = true;
+      break;
+    }
+
     basic_block.length++;
     micro_block.length++;
 
-    if (status == Status::BreakMicroBlock && condition != Condition::AL) {
+    // After an unconditional branch code_address points to the instruction before the branch target.
+    micro_block.next_address = code_address + opcode_size * 3;
+
+    if (!side_exit.IsEmpty()) {
+      micro_block.side_exit = side_exit;
+      side_exit = {};
+    }
+
+    // The condition of skipped code is evaluated once by the folded branch, so flag updates do not matter.
+    if (status == Status::BreakMicroBlock && condition != Condition::AL && skip_end == 0) {
       break_micro_block(condition);
     }
 
@@ -84,41 +240,88 @@ void Translator::TranslateARM(BasicBlock& basic_block) {
     }
 
     code_address += sizeof(u32);
+
+    // The skipped code may have updated the flags, so the condition of the next instruction is evaluated again.
+    if (code_address == skip_end) {
+      skip_end = 0;
+      break_micro_block(Condition::AL);
+    }
+
+    // The basic block ends at the next instruction, so that is where it continues.
+    if (i == max_block_size - 1) {
+      basic_block.branch_target.key = BasicBlock::Key{code_address + 2 * opcode_size, mode, thumb_mode};
+    }
+  }
+
+  // The block ended before the target of a folded branch.
+  if (skip_end != 0) {
+    region_failed = true;
   }
 
   add_micro_block();
 }
 
 void Translator::TranslateThumb(BasicBlock& basic_block) {
-  auto micro_block = BasicBlock::MicroBlock{Condition::AL};
+  auto micro_block = BasicBlock::MicroBlock{Condition::AL, IREmitter{arena}};
 
   emitter = &micro_block.emitter;
 
   auto add_micro_block = [&]() {
-    basic_block.micro_blocks.push_back(std::move(micro_block));
+    micro_blocks->push_back(std::move(micro_block));
+  };
+
+  auto break_micro_block = [&](Condition condition) {
+    if (micro_block.length == 0) {
+      micro_block.condition = condition;
+      return;
+    }
+
+    add_micro_block();
+    micro_block = {condition, IREmitter{arena}};
+    micro_block.next_address = micro_blocks->back().next_address;
+    emitter = &micro_block.emitter;
   };
 
   for (int i = 0; i < max_block_size; i++) {
     u32 instruction;
 
     if (code_address & 2) {
-      instruction  = memory.FastRead<u16, Memory::Bus::Code>(code_address + 0);
-      instruction |= memory.FastRead<u16, Memory::Bus::Code>(code_address + 2) << 16;
+      instruction  = ReadCode<u16>(code_address + 0);
+      instruction |= ReadCode<u16>(code_address + 2) << 16;
     } else {
-      instruction = memory.FastRead<u32, Memory::Bus::Code>(code_address);
+      instruction = ReadCode<u32>(code_address);
+    }
+
+    // BL is translated from both of its halves at once, see decode_thumb().
+    AddCode(code_address, instruction, (instruction & 0xE800'F800) == 0xE800'F000 ? sizeof(u32) : sizeof(u16));
+
+    bool conditional_branch = (instruction & 0xF000) == 0xD000 && (instruction & 0xF00) != 0xF00;
+
+    if (skip_end != 0) {
+      // Code that is skipped by a folded branch can not be conditional itself.
+      if (conditional_branch) {
+        region_failed = true;
+        break;
+      }
+      if (micro_block.condition != skip_condition) {
+        break_micro_block(skip_condition);
+      }
+    } else if (micro_block.condition != Condition::AL) {
+      break_micro_block(Condition::AL);
     }
 
     // HACK: detect conditional branches and break the micro block early.
-    if ((instruction & 0xF000) == 0xD000 && (instruction & 0xF00) != 0xF00) {
+    // A folded branch emits no code, it only decides whether the next micro block runs.
+    if (conditional_branch && !IsFoldedBranch(code_address)) {
       auto condition = bit::get_field<u16, Condition>(instruction, 8, 4);
 
-      if (i == 0) {
-        micro_block.condition = condition;
-      } else {
-        add_micro_block();
-        micro_block = {condition};
-        emitter = &micro_block.emitter;
-      }
+      break_micro_block(condition);
+    }
+
+    auto address = code_address;
+
+    if (form_region) {
+      trace.push_back(address);
     }
 
     auto status = decode_thumb(instruction, *this);
@@ -130,19 +333,54 @@ void Translator::TranslateThumb(BasicBlock& basic_block) {
       );
     }
 
+    // The skipped code must fall through to the branch target.
+    if (skip_end != 0 && (status == Status::BreakBasicBlock || code_address != address)) {
+      region_failed = true;
+      break;
+    }
+
     basic_block.length++;
     micro_block.length++;
+    micro_block.next_address = code_address + opcode_size * 3;
+
+    // Continue after the conditional branch with a new unconditional micro block.
+    if (!side_exit.IsEmpty()) {
+      micro_block.side_exit = side_exit;
+      side_exit = {};
+      add_micro_block();
+      micro_block = {Condition::AL, IREmitter{arena}};
+      micro_block.next_address = micro_blocks->back().next_address;
+      emitter = &micro_block.emitter;
+    }
 
     if (status == Status::BreakBasicBlock) {
       break;
     }
 
     code_address += sizeof(u16);
+
+    if (code_address == skip_end) {
+      skip_end = 0;
+    }
+
+    // The basic block ends at the next instruction, so that is where it continues.
+    if (i == max_block_size - 1) {
+      basic_block.branch_target.key = BasicBlock::Key{code_address + 2 * opcode_size, mode, thumb_mode};
+    }
+  }
+
+  // The block ended before the target of a folded branch.
+  if (skip_end != 0) {
+    region_failed = true;
   }
 
   add_micro_block();
 }
 
+bool Translator::IsFoldedBranch(u32 address) const {
+  return std::find(folded_branches.begin(), folded_branches.end(), address) != folded_branches.end();
+}
+
 auto Translator::Undefined(u32 opcode) -> Status {
   return Status::Unimplemented;
 }
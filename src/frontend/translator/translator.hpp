@@ -8,10 +8,12 @@
 #pragma once
 
 #include <lunatic/memory.hpp>
+#include <vector>
 
 #include "frontend/decode/arm.hpp"
 #include "frontend/decode/thumb.hpp"
 #include "frontend/basic_block.hpp"
+#include "frontend/code_span.hpp"
 
 namespace lunatic {
 namespace frontend {
@@ -25,13 +27,49 @@ enum class Status {
 };
 
 struct Translator final : ARMDecodeClient<Status> {
-  Translator(CPU::Descriptor const& descriptor);
+  /**
+   * @param  mapped_code_only  only read guest code that is mapped by the page table or the ITCM (see SetITCM()),
+   *                           and fail the translation (by throwing std::runtime_error) on other code.
+   *                           Memory is not called then, which is needed to translate on a worker thread.
+   */
+  Translator(CPU::Descriptor const& descriptor, Arena& arena, bool mapped_code_only = false);
+
+  auto GetExceptionBase() const -> u32 {
+    return exception_base;
+  }
 
   void SetExceptionBase(u32 new_exception_base) {
     exception_base = new_exception_base;
   }
 
-  void Translate(BasicBlock& basic_block);
+  /// Set the ITCM to read code from, if only mapped code is read. Its configuration may change on another thread.
+  void SetITCM(Memory::TCM const& new_itcm) {
+    itcm = new_itcm;
+  }
+
+  /// Get the guest code that the last translated block was translated from, which may be spread over multiple spans.
+  auto GetCodeSpans() const -> std::vector<CodeSpan> const& {
+    return code_spans;
+  }
+
+  /// Get the hash of the guest code of the last translated block, see GetCodeHash().
+  auto GetCodeHash() const -> u32 {
+    return code_hash.value;
+  }
+
+  /**
+   * Translate a basic block into IR.
+   *
+   * @param  basic_block   the basic block to translate
+   * @param  micro_blocks  receives the micro blocks of the basic block
+   * @param  form_region   fold forward branches that skip over code on the fall-through path into the block,
+   *                       so that both paths of an if-then stay inside of the block. Intended for hot blocks.
+   */
+  void Translate(
+    BasicBlock& basic_block,
+    std::vector<BasicBlock::MicroBlock>& micro_blocks,
+    bool form_region = false
+  );
 
   auto Handle(ARMDataProcessing const& opcode) -> Status override;
   auto Handle(ARMMoveStatusRegister const& opcode) -> Status override;
@@ -55,8 +93,20 @@ struct Translator final : ARMDecodeClient<Status> {
   auto Undefined(u32 opcode) -> Status override;
 
 private:
+  /// A conditional forward branch that was turned into a side exit.
+  struct ForwardBranch {
+    u32 address;
+    u32 target;
+  };
+
+  void TranslateBlock(BasicBlock& basic_block, std::vector<BasicBlock::MicroBlock>& micro_blocks);
   void TranslateARM(BasicBlock& basic_block);
   void TranslateThumb(BasicBlock& basic_block);
+  bool IsFoldedBranch(u32 address) const;
+  void AddCode(u32 address, u32 opcode, u32 size);
+
+  template<typename T>
+  auto ReadCode(u32 address) -> T;
 
   void EmitUpdateNZ();
   void EmitUpdateNZC();
@@ -75,11 +125,45 @@ private:
   Mode mode;
   bool armv5te;
   int  max_block_size;
+  bool enable_side_exits;
+  bool mapped_code_only;
+  Memory::TCM itcm;
   u32  exception_base;
   Memory& memory;
   std::array<Coprocessor*, 16> coprocessors;
+  Arena& arena;
   IREmitter* emitter = nullptr;
   BasicBlock* basic_block = nullptr;
+  std::vector<BasicBlock::MicroBlock>* micro_blocks = nullptr;
+
+  /// Guest code that was translated so far, B and BL continue translating at their target.
+  std::vector<CodeSpan> code_spans;
+  CodeHash code_hash;
+
+  /// Target of a conditional branch that was turned into a side exit of the current micro block.
+  BasicBlock::Key side_exit{};
+  int side_exit_count = 0;
+
+  /// Addresses of all translated instructions and the side exit branches, recorded to find branches that can be folded.
+  bool form_region = false;
+  std::vector<u32> trace;
+  std::vector<ForwardBranch> forward_branches;
+
+  /// Addresses of the forward branches that are folded into the block.
+  std::vector<u32> folded_branches;
+
+  /**
+   * While skip_end is set, the instructions up to skip_end (exclusive) are skipped by a folded branch.
+   * They are translated into a micro block that only runs if skip_condition passes (the branch is not taken).
+   */
+  u32 skip_end = 0;
+  Condition skip_condition = Condition::AL;
+
+  /// The skipped code can not be folded into the block, e.g. because it contains another conditional instruction.
+  bool region_failed = false;
+
+  std::vector<BasicBlock::MicroBlock> region_micro_blocks;
+  std::vector<CodeSpan> first_code_spans;
 };
 
 } // namespace lunatic::frontend
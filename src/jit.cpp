@@ -2,15 +2,36 @@
  * Copyright (C) 2021 fleroviux
  */
 
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <fmt/format.h>
+#include <fstream>
 #include <lunatic/cpu.hpp>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
+#include "common/allocation_count.hpp"
+#include "common/arena.hpp"
+#include "frontend/code_cache.hpp"
+#include "frontend/ir_opt/block_context_load_store_elision.hpp"
+#include "frontend/ir_opt/common_subexpression_elimination.hpp"
 #include "frontend/ir_opt/constant_propagation.hpp"
 #include "frontend/ir_opt/context_load_store_elision.hpp"
 #include "frontend/ir_opt/dead_code_elision.hpp"
 #include "frontend/ir_opt/dead_flag_elision.hpp"
+#include "frontend/ir_opt/memory_address_folding.hpp"
+#include "frontend/ir_opt/memory_alignment.hpp"
+#include "frontend/ir_opt/shifted_operand_folding.hpp"
+#include "frontend/ir_opt/flag_liveness.hpp"
+#include "frontend/ir_opt/idle_loop.hpp"
 #include "frontend/state.hpp"
 #include "frontend/translator/translator.hpp"
+#include "backend/interpreter/interpreter.hpp"
 #include "backend/x86_64/backend.hpp"
 
 using namespace lunatic::frontend;
@@ -18,16 +39,39 @@ using namespace lunatic::backend;
 
 namespace lunatic {
 
-struct JIT final : CPU {
+struct JIT final : CPU, BasicBlockCache::Client {
   JIT(CPU::Descriptor const& descriptor)
-      : exception_base(descriptor.exception_base)
+      : descriptor(descriptor)
+      , exception_base(descriptor.exception_base)
       , memory(descriptor.memory)
-      , translator(descriptor)
-      , backend(descriptor, state, block_cache, irq_line) {
-    passes.push_back(std::make_unique<IRContextLoadStoreElisionPass>());
-    passes.push_back(std::make_unique<IRDeadFlagElisionPass>());
-    passes.push_back(std::make_unique<IRConstantPropagationPass>());
-    passes.push_back(std::make_unique<IRDeadCodeElisionPass>());
+      , translator(descriptor, ir_arena)
+      , block_cache(*this)
+      , backend(descriptor, state, block_cache, irq_line)
+      , interpreter(descriptor, state)
+      , code_cache(descriptor)
+      , execution_mode(descriptor.execution_mode)
+      , interpreter_threshold(descriptor.interpreter_threshold) {
+    CreatePasses(optimized_pipeline, statistics.passes, descriptor.optimization_level, false);
+
+    if (descriptor.optimization_level == OptimizationLevel::Full && descriptor.tier_up_threshold > 0) {
+      tier_up_threshold = descriptor.tier_up_threshold;
+      CreatePasses(baseline_pipeline, statistics.passes, OptimizationLevel::Basic, true);
+
+      if (descriptor.background_compilation) {
+        background_compiler = std::make_unique<BackgroundCompiler>(descriptor);
+        CreatePasses(background_compiler->pipeline, background_compiler->pass_stats, descriptor.optimization_level, false);
+        background_compiler->thread = std::thread{&JIT::RunBackgroundCompiler, this, std::ref(*background_compiler)};
+      }
+    }
+  }
+
+ ~JIT() override {
+    if (background_compiler) {
+      StopBackgroundCompiler(*background_compiler);
+    }
+
+    // Delete the basic blocks while the backend still is alive.
+    block_cache.Flush();
   }
 
   void Reset() override {
@@ -38,6 +82,8 @@ struct JIT final : CPU {
     SetGPR(GPR::PC, exception_base);
     block_cache.Flush();
     exception_causing_basic_blocks.clear();
+    interpreter_counts.clear();
+    generation++;
   }
 
   auto IRQLine() -> bool& override {
@@ -56,15 +102,19 @@ struct JIT final : CPU {
       }
 
       translator.SetExceptionBase(new_exception_base);
+      generation++;
     }
   }
 
   void ClearICache() override {
     block_cache.Flush();
+    interpreter_counts.clear();
+    generation++;
   }
 
   void ClearICacheRange(u32 address_lo, u32 address_hi) override {
     block_cache.Flush(address_lo, address_hi);
+    generation++;
   }
 
   auto Run(int cycles) -> int override {
@@ -81,15 +131,47 @@ struct JIT final : CPU {
         SignalIRQ();
       }
 
+      if (background_compiler) {
+        InstallBackgroundCompilation();
+      }
+
       auto block_key = BasicBlock::Key{state};
       auto basic_block = block_cache.Get(block_key);
       auto hash = GetBasicBlockHash(block_key);
 
-      if (basic_block == nullptr || basic_block->hash != hash) {
-        basic_block = Compile(block_key);
-      }
+      bool outdated = basic_block == nullptr || basic_block->hash != hash;
+
+      if (outdated && ShouldInterpret(block_key, basic_block)) {
+        cycles_to_run -= Interpret(block_key);
+      } else {
+        if (outdated) {
+          basic_block = Compile(block_key, tier_up_threshold != 0);
+        } else if (basic_block->tier_up && basic_block->tier_up_counter == 0) {
+          if (background_compiler) {
+            RequestBackgroundCompilation(*basic_block);
+          } else {
+            basic_block = Compile(block_key, false);
+            statistics.recompiled_blocks++;
+          }
+        }
 
-      cycles_to_run = backend.Call(*basic_block, cycles_to_run);
+        // The block may be deleted while it runs, when the host clears the instruction cache from a memory handler.
+        bool idle_loop = basic_block->idle_loop;
+
+        cycles_to_run = backend.Call(*basic_block, cycles_to_run);
+
+        /* An idle loop that is about to run again would spin until the host changes the memory it polls.
+         * Once the cycles ran out, the loop stops anyway and its overshoot must still be reported.
+         */
+        if (idle_loop && cycles_to_run > 0 && BasicBlock::Key{state} == block_key) {
+          basic_block = block_cache.Get(block_key);
+
+          if (basic_block != nullptr && basic_block->idle_loop && HasPureReads(*basic_block)) {
+            cycles_to_run = 0;
+            statistics.idle_loop_skips++;
+          }
+        }
+      }
 
       if (WaitForIRQ()) {
         int cycles_executed = cycles_available - cycles_to_run;
@@ -101,6 +183,96 @@ struct JIT final : CPU {
     return cycles_available - cycles_to_run;
   }
 
+  auto GetStatistics() const -> Statistics override {
+    return statistics;
+  }
+
+  auto Precompile(
+    std::vector<u32> const& entry_points,
+    std::vector<CodeRange> const& ranges,
+    int threads
+  ) -> int override {
+    auto mode = GetCPSR().f.mode;
+    auto block_keys = std::vector<BasicBlock::Key>{};
+
+    for (auto address : entry_points) {
+      block_keys.push_back(GetKeyForAddress(address, mode));
+    }
+
+    return CompileAheadOfTime(block_keys, ranges, true, threads);
+  }
+
+  auto GetProfile() const -> std::vector<ProfileEntry> override {
+    auto counts = profile_counts;
+    auto profile = std::vector<ProfileEntry>{};
+
+    block_cache.ForEach([&](BasicBlock const& basic_block) {
+      if (basic_block.execution_count != 0) {
+        counts[basic_block.key] += basic_block.execution_count;
+      }
+    });
+
+    for (auto const& [block_key, count] : counts) {
+      auto address = block_key.Address();
+
+      if (block_key.Thumb()) {
+        address = (address - sizeof(u16) * 2) | 1;
+      } else {
+        address -= sizeof(u32) * 2;
+      }
+
+      profile.push_back({address, block_key.Mode(), count});
+    }
+
+    std::sort(profile.begin(), profile.end(), [](ProfileEntry const& a, ProfileEntry const& b) {
+      return a.count > b.count;
+    });
+    return profile;
+  }
+
+  auto PrecompileProfile(std::vector<ProfileEntry> const& profile, int threads) -> int override {
+    auto block_keys = std::vector<BasicBlock::Key>{};
+
+    for (auto const& entry : profile) {
+      block_keys.push_back(GetKeyForAddress(entry.address, entry.mode));
+    }
+
+    return CompileAheadOfTime(block_keys, {}, false, threads);
+  }
+
+  bool LoadCodeCache(std::string const& path) override {
+    if (!code_cache.Load(path)) {
+      return false;
+    }
+
+    // The interpreter never runs compiled blocks.
+    if (execution_mode == ExecutionMode::Interpreter) {
+      return true;
+    }
+
+    // Compile the blocks whose guest code is loaded already, so that they do not have to be compiled once they run.
+    for (auto block_key : code_cache.Keys()) {
+      auto entry = code_cache.Get(block_key, translator.GetExceptionBase());
+      auto current_block = block_cache.Get(block_key);
+
+      if (entry == nullptr || (entry->baseline && tier_up_threshold == 0)) {
+        continue;
+      }
+
+      if (current_block == nullptr || current_block->hash != GetBasicBlockHash(block_key)) {
+        auto allocation_count_scope = AllocationCountScope{statistics.compile_allocations};
+
+        CompileCached(block_key, *entry);
+      }
+    }
+
+    return true;
+  }
+
+  bool SaveCodeCache(std::string const& path) override {
+    return code_cache.Save(path);
+  }
+
   auto GetGPR(GPR reg) const -> u32 override {
     return GetGPR(reg, GetCPSR().f.mode);
   }
@@ -142,37 +314,511 @@ struct JIT final : CPU {
   }
 
 private:
-  auto Compile(BasicBlock::Key block_key) -> BasicBlock* {
-    auto basic_block = new BasicBlock{block_key};
+  using OptimizationLevel = CPU::Descriptor::OptimizationLevel;
+  using ExecutionMode = CPU::Descriptor::ExecutionMode;
+
+  /// Size of the IR before or after running a pass.
+  struct IRMetrics {
+    u64 opcodes = 0;
+    u64 rewrites = 0;
+    u64 variables = 0;
+
+    void Add(IREmitter const& emitter) {
+      opcodes += emitter.Code().size();
+      rewrites += emitter.RewriteCount();
+
+      for (auto var : emitter.Vars()) {
+        if (var->GetDef() != nullptr || !var->IsUnused()) {
+          variables++;
+        }
+      }
+    }
+  };
+
+  /// The optimization passes that a compilation tier runs.
+  struct Pipeline {
+    std::vector<std::unique_ptr<IRBasicBlockPass>> block_passes;
+    std::vector<std::unique_ptr<IRPass>> passes;
+
+    /// Index of the statistics of the first pass.
+    size_t first_pass_stats = 0;
+
+    /// Measure each pass (see Descriptor::pass_statistics).
+    bool collect_statistics = false;
+  };
+
+  /**
+   * Translates and optimizes blocks on a worker thread, the owner thread compiles them to host code.
+   * Used to recompile hot blocks and to precompile code.
+   */
+  struct BackgroundCompiler {
+    explicit BackgroundCompiler(CPU::Descriptor const& descriptor) : translator(descriptor, arena, true) {}
+
+    enum class Status {
+      /// Waiting for a block to recompile.
+      Idle,
+      /// Translating and optimizing a block, which only the worker thread accesses.
+      Busy,
+      /// The IR is ready to be installed by the owner thread.
+      Done,
+      Quit
+    } status = Status::Idle;
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable condition;
+
+    u64 generation = 0;
+    bool failed = false;
+
+    /// Number of heap allocations made by the worker thread, which were not yet added to the statistics.
+    u64 allocations = 0;
+
+    BasicBlock basic_block;
+    Arena arena;
+    Translator translator;
+    std::vector<BasicBlock::MicroBlock> micro_blocks;
+    Pipeline pipeline;
+    std::vector<Statistics::Pass> pass_stats;
+  };
+
+  void CreatePasses(
+    Pipeline& pipeline,
+    std::vector<Statistics::Pass>& pass_stats,
+    OptimizationLevel level,
+    bool baseline
+  ) {
+    pipeline.first_pass_stats = pass_stats.size();
+    pipeline.collect_statistics = descriptor.pass_statistics;
+
+    if (level == OptimizationLevel::None) {
+      return;
+    }
+
+    auto AddBlockPass = [&](std::unique_ptr<IRBasicBlockPass> pass, char const* name) {
+      pipeline.block_passes.push_back(std::move(pass));
+      pass_stats.push_back({name, baseline});
+    };
+
+    auto AddPass = [&](std::unique_ptr<IRPass> pass, char const* name) {
+      pipeline.passes.push_back(std::move(pass));
+      pass_stats.push_back({name, baseline});
+    };
+
+    // Block-wide passes must be created first, their statistics come first.
+    if (level == OptimizationLevel::Full) {
+      AddBlockPass(std::make_unique<IRBlockContextLoadStoreElisionPass>(), "BlockContextLoadStoreElision");
+    }
+
+    AddPass(std::make_unique<IRContextLoadStoreElisionPass>(), "ContextLoadStoreElision");
+    AddPass(std::make_unique<IRDeadFlagElisionPass>(), "DeadFlagElision");
+    AddPass(std::make_unique<IRConstantPropagationPass>(), "ConstantPropagation");
+
+    if (level == OptimizationLevel::Full) {
+      AddPass(std::make_unique<IRCommonSubexpressionEliminationPass>(), "CommonSubexpressionElimination");
+      AddPass(std::make_unique<IRShiftedOperandFoldingPass>(), "ShiftedOperandFolding");
+      AddPass(std::make_unique<IRMemoryAddressFoldingPass>(), "MemoryAddressFolding");
+      AddPass(std::make_unique<IRMemoryAlignmentPass>(), "MemoryAlignment");
+    }
+
+    AddPass(std::make_unique<IRDeadCodeElisionPass>(), "DeadCodeElision");
+  }
+
+  static void UpdatePassStatistics(
+    Statistics::Pass& pass_stats,
+    IRMetrics const& metrics_in,
+    IRMetrics const& metrics_out,
+    std::chrono::steady_clock::duration time
+  ) {
+    pass_stats.time_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(time).count();
+    pass_stats.opcodes_in += metrics_in.opcodes;
+    pass_stats.opcodes_out += metrics_out.opcodes;
+    pass_stats.opcodes_rewritten += metrics_out.rewrites - metrics_in.rewrites;
+    pass_stats.variables_in += metrics_in.variables;
+    pass_stats.variables_out += metrics_out.variables;
+  }
+
+  /**
+   * Compile the basic block at a key and replace the current block for the key, if any.
+   * A baseline block is compiled quickly and will be recompiled once it has been executed often enough.
+   */
+  auto Compile(BasicBlock::Key block_key, bool baseline) -> BasicBlock* {
+    auto allocation_count_scope = AllocationCountScope{statistics.compile_allocations};
+    auto cached_entry = code_cache.Get(block_key, translator.GetExceptionBase());
+
+    // Baseline IR from the code cache is not good enough to replace a hot block.
+    if (cached_entry != nullptr && (baseline || !cached_entry->baseline)) {
+      return CompileCached(block_key, *cached_entry);
+    }
+
+    auto basic_block = block_cache.New(block_key);
+
+    basic_block->hash = GetBasicBlockHash(block_key);
+
+    // Hot blocks keep both paths of forward branches inside the block where possible.
+    translator.Translate(*basic_block, micro_blocks, !baseline);
+    Optimize(*basic_block, micro_blocks, baseline ? baseline_pipeline : optimized_pipeline, statistics.passes);
+    AddToCodeCache(*basic_block, micro_blocks, translator, baseline);
+    Install(basic_block, micro_blocks, baseline);
+
+    // Keep the capacity of the micro block list and the arena chunks for the next compilation.
+    micro_blocks.clear();
+    ir_arena.Reset();
+    return basic_block;
+  }
+
+  /// Compile a block from the IR in the code cache, instead of translating and optimizing its guest code.
+  auto CompileCached(BasicBlock::Key block_key, CodeCache::Entry const& entry) -> BasicBlock* {
+    auto basic_block = block_cache.New(block_key);
 
     basic_block->hash = GetBasicBlockHash(block_key);
 
-    translator.Translate(*basic_block);
-    Optimize(basic_block);
+    CodeCache::Read(entry, *basic_block, micro_blocks, ir_arena);
+    Install(basic_block, micro_blocks, entry.baseline);
+
+    micro_blocks.clear();
+    ir_arena.Reset();
+    statistics.cached_blocks++;
+    return basic_block;
+  }
+
+  /// Add a block to the code cache, with the guest code that a translator (of this or a worker thread) read for it.
+  void AddToCodeCache(
+    BasicBlock const& basic_block,
+    std::vector<BasicBlock::MicroBlock> const& micro_blocks,
+    Translator const& block_translator,
+    bool baseline
+  ) {
+    if (descriptor.code_cache) {
+      code_cache.Add(
+        basic_block,
+        micro_blocks,
+        block_translator.GetCodeSpans(),
+        block_translator.GetCodeHash(),
+        translator.GetExceptionBase(),
+        baseline
+      );
+    }
+  }
+
+  /**
+   * Check if a block that is not compiled (or whose code has changed) should be interpreted instead.
+   * With ExecutionMode::Adaptive, code that changed must become hot again before it is recompiled.
+   */
+  bool ShouldInterpret(BasicBlock::Key block_key, BasicBlock* outdated_block) {
+    switch (execution_mode) {
+      case ExecutionMode::Interpreter: {
+        return true;
+      }
+      case ExecutionMode::Adaptive: {
+        auto& count = interpreter_counts[block_key];
+
+        if (outdated_block != nullptr) {
+          block_cache.Set(block_key, nullptr);
+          count = 0;
+        }
+        return count++ < interpreter_threshold;
+      }
+      default: {
+        return false;
+      }
+    }
+  }
+
+  /// Translate the basic block at a key and execute its unoptimized IR once. Returns the number of cycles taken.
+  auto Interpret(BasicBlock::Key block_key) -> int {
+    auto basic_block = BasicBlock{block_key};
+
+    translator.Translate(basic_block, micro_blocks);
+
+    int cycles = interpreter.Run(basic_block, micro_blocks);
+
+    micro_blocks.clear();
+    ir_arena.Reset();
+    statistics.interpreted_blocks++;
+
+    if (descriptor.profile_blocks) {
+      profile_counts[block_key]++;
+    }
+    return cycles;
+  }
+
+  /// Compile the optimized IR of a basic block to host code and replace the current block for its key.
+  void Install(BasicBlock* basic_block, std::vector<BasicBlock::MicroBlock>& micro_blocks, bool baseline) {
+    auto block_key = basic_block->key;
+
+    basic_block->flags_live_in = GetFlagsLiveIn(micro_blocks);
+
+    /* Idle loops return to the dispatcher after each iteration, so that it can skip them.
+     * The block is about to run, so its reads can be checked with the current state.
+     * If they have side effects now, then the loop is unlikely to ever be skipped.
+     */
+    if (DetectIdleLoop(*basic_block, micro_blocks) && HasPureReads(*basic_block)) {
+      basic_block->idle_loop = true;
+      basic_block->enable_fast_dispatch = false;
+    }
 
     if (basic_block->uses_exception_base) {
       exception_causing_basic_blocks.push_back(basic_block);
+    }
 
-      basic_block->RegisterReleaseCallback([this](BasicBlock const& block) {
-        auto match = std::find(
-          exception_causing_basic_blocks.begin(), exception_causing_basic_blocks.end(), &block);
+    if (baseline) {
+      basic_block->tier_up = true;
+      basic_block->tier_up_counter = tier_up_threshold;
+    }
 
-        if (match != exception_causing_basic_blocks.end()) {
-          exception_causing_basic_blocks.erase(match);
-        }
-      });
+    backend.Compile(*basic_block, micro_blocks);
+
+    // The blocks that link to a baseline block which became hot can link to the recompiled block instead.
+    auto old_block = block_cache.Get(block_key);
+
+    if (!baseline && old_block != nullptr && old_block->tier_up) {
+      backend.Relink(*old_block, *basic_block);
     }
 
-    backend.Compile(*basic_block);
     block_cache.Set(block_key, basic_block);
-    basic_block->micro_blocks.clear();
+    statistics.compiled_blocks++;
+  }
+
+  /// Hand a baseline block that became hot to the worker thread, unless it still is busy with another block.
+  void RequestBackgroundCompilation(BasicBlock& basic_block) {
+    auto& worker = *background_compiler;
+
+    std::lock_guard lock{worker.mutex};
+
+    if (worker.status != BackgroundCompiler::Status::Idle) {
+      basic_block.tier_up_counter = tier_up_threshold;
+      return;
+    }
+
+    // The baseline block keeps running until the recompiled block is installed.
+    basic_block.tier_up_counter = ~0U;
+
+    StartBackgroundCompilation(worker, basic_block.key);
+  }
+
+  /// Hand the block at a key to an idle worker thread. The caller must hold the lock of the worker.
+  void StartBackgroundCompilation(BackgroundCompiler& worker, BasicBlock::Key block_key) {
+    auto& new_block = worker.basic_block;
+
+    new_block.key = block_key;
+    new_block.hash = GetBasicBlockHash(block_key);
+    new_block.length = 0;
+    new_block.branch_target.key = {};
+    new_block.enable_fast_dispatch = true;
+    new_block.uses_exception_base = false;
+
+    worker.translator.SetExceptionBase(translator.GetExceptionBase());
+    worker.translator.SetITCM(memory.itcm);
+    worker.generation = generation;
+    worker.status = BackgroundCompiler::Status::Busy;
+    worker.condition.notify_all();
+  }
+
+  static void StopBackgroundCompiler(BackgroundCompiler& worker) {
+    {
+      std::lock_guard lock{worker.mutex};
+      worker.status = BackgroundCompiler::Status::Quit;
+    }
+    worker.condition.notify_all();
+    worker.thread.join();
+  }
+
+  /// Allocate a block for a translation that was done into another BasicBlock object.
+  auto NewTranslatedBlock(BasicBlock const& translated_block) -> BasicBlock* {
+    auto basic_block = block_cache.New(translated_block.key);
+
+    basic_block->hash = translated_block.hash;
+    basic_block->length = translated_block.length;
+    basic_block->branch_target.key = translated_block.branch_target.key;
+    basic_block->enable_fast_dispatch = translated_block.enable_fast_dispatch;
+    basic_block->uses_exception_base = translated_block.uses_exception_base;
     return basic_block;
   }
 
-  void Optimize(BasicBlock* basic_block) {
-    for (auto &micro_block : basic_block->micro_blocks) {
-      for (auto& pass : passes) {
-        pass->Run(micro_block.emitter);
+  /// Check that the translation of a worker thread succeeded and that the guest code it read did not change since.
+  auto IsUpToDate(BackgroundCompiler& worker) -> bool {
+    auto& new_block = worker.basic_block;
+    auto& spans = worker.translator.GetCodeSpans();
+
+    return !worker.failed &&
+      worker.generation == generation &&
+      GetBasicBlockHash(new_block.key) == new_block.hash &&
+      GetCodeHash(memory, spans, new_block.key.Thumb()) == worker.translator.GetCodeHash();
+  }
+
+  /**
+   * Install the block that the worker thread has recompiled, if it is done.
+   * The block is dropped if the guest code or the translation settings changed in the meantime.
+   * If the worker could not read the code, the block is recompiled on this thread instead.
+   */
+  void InstallBackgroundCompilation() {
+    auto& worker = *background_compiler;
+    auto recompile_key = BasicBlock::Key{};
+
+    {
+      std::lock_guard lock{worker.mutex};
+
+      if (worker.status != BackgroundCompiler::Status::Done) {
+        return;
+      }
+
+      auto& new_block = worker.basic_block;
+      auto key = new_block.key;
+      auto old_block = block_cache.Get(key);
+
+      if (IsUpToDate(worker) && old_block != nullptr && old_block->tier_up && old_block->hash == new_block.hash) {
+        auto allocation_count_scope = AllocationCountScope{statistics.compile_allocations};
+
+        AddToCodeCache(new_block, worker.micro_blocks, worker.translator, false);
+        Install(NewTranslatedBlock(new_block), worker.micro_blocks, false);
+        statistics.recompiled_blocks++;
+      } else if (worker.failed && old_block != nullptr && old_block->tier_up) {
+        recompile_key = key;
+      } else if (old_block != nullptr && old_block->tier_up) {
+        // Try again once the baseline block is hot again.
+        old_block->tier_up_counter = tier_up_threshold;
+      }
+
+      AddPassStatistics(worker);
+
+      worker.micro_blocks.clear();
+      worker.arena.Reset();
+      worker.status = BackgroundCompiler::Status::Idle;
+    }
+
+    // E.g. code outside of the page table, which only this thread may read.
+    if (!recompile_key.IsEmpty()) {
+      Compile(recompile_key, false);
+      statistics.recompiled_blocks++;
+    }
+  }
+
+  void RunBackgroundCompiler(BackgroundCompiler& worker) {
+    std::unique_lock lock{worker.mutex};
+
+    while (true) {
+      worker.condition.wait(lock, [&]() {
+        return worker.status == BackgroundCompiler::Status::Busy || worker.status == BackgroundCompiler::Status::Quit;
+      });
+
+      if (worker.status == BackgroundCompiler::Status::Quit) {
+        return;
+      }
+
+      lock.unlock();
+
+      // Unimplemented opcodes and code which the worker may not read are left to the owner thread.
+      try {
+        auto allocation_count_scope = AllocationCountScope{worker.allocations};
+
+        worker.translator.Translate(worker.basic_block, worker.micro_blocks, true);
+        Optimize(worker.basic_block, worker.micro_blocks, worker.pipeline, worker.pass_stats);
+        worker.failed = false;
+      } catch (std::runtime_error const&) {
+        worker.failed = true;
+      }
+
+      lock.lock();
+
+      if (worker.status == BackgroundCompiler::Status::Busy) {
+        worker.status = BackgroundCompiler::Status::Done;
+        worker.condition.notify_all();
+      }
+    }
+  }
+
+  void OnBasicBlockToBeDeleted(BasicBlock& basic_block) override {
+    if (basic_block.uses_exception_base) {
+      auto match = std::find(
+        exception_causing_basic_blocks.begin(), exception_causing_basic_blocks.end(), &basic_block);
+
+      if (match != exception_causing_basic_blocks.end()) {
+        exception_causing_basic_blocks.erase(match);
+      }
+    }
+
+    // Keep the execution count of blocks that are recompiled or invalidated.
+    if (basic_block.execution_count != 0) {
+      profile_counts[basic_block.key] += basic_block.execution_count;
+    }
+
+    backend.OnBasicBlockToBeDeleted(basic_block);
+  }
+
+  /// Add the pass statistics and allocations of a worker thread to the statistics of the optimized pipeline.
+  void AddPassStatistics(BackgroundCompiler& worker) {
+    for (size_t i = 0; i < worker.pass_stats.size(); i++) {
+      AddPassStatistics(statistics.passes[optimized_pipeline.first_pass_stats + i], worker.pass_stats[i]);
+    }
+
+    statistics.compile_allocations += worker.allocations;
+    worker.allocations = 0;
+  }
+
+  static void AddPassStatistics(Statistics::Pass& pass_stats, Statistics::Pass& pass_stats_delta) {
+    pass_stats.time_ns += pass_stats_delta.time_ns;
+    pass_stats.opcodes_in += pass_stats_delta.opcodes_in;
+    pass_stats.opcodes_out += pass_stats_delta.opcodes_out;
+    pass_stats.opcodes_rewritten += pass_stats_delta.opcodes_rewritten;
+    pass_stats.variables_in += pass_stats_delta.variables_in;
+    pass_stats.variables_out += pass_stats_delta.variables_out;
+    pass_stats_delta = {pass_stats_delta.name, pass_stats_delta.baseline};
+  }
+
+  /// Run the passes of a pipeline. This may run on the worker thread, so it must only access the given objects.
+  static void Optimize(
+    BasicBlock const& basic_block,
+    std::vector<BasicBlock::MicroBlock>& micro_blocks,
+    Pipeline& pipeline,
+    std::vector<Statistics::Pass>& pipeline_stats
+  ) {
+    if (!pipeline.collect_statistics) {
+      for (auto& pass : pipeline.block_passes) {
+        pass->Run(basic_block, micro_blocks);
+      }
+
+      for (auto& micro_block : micro_blocks) {
+        for (auto& pass : pipeline.passes) {
+          pass->Run(micro_block.emitter);
+        }
+      }
+      return;
+    }
+
+    using Clock = std::chrono::steady_clock;
+
+    auto pass_stats = pipeline_stats.data() + pipeline.first_pass_stats;
+
+    // Block-wide passes run first, so that the per-micro block passes can clean up after them.
+    for (auto& pass : pipeline.block_passes) {
+      auto metrics_in = IRMetrics{};
+      auto metrics_out = IRMetrics{};
+
+      for (auto& micro_block : micro_blocks) metrics_in.Add(micro_block.emitter);
+      auto t0 = Clock::now();
+      pass->Run(basic_block, micro_blocks);
+      auto t1 = Clock::now();
+      for (auto& micro_block : micro_blocks) metrics_out.Add(micro_block.emitter);
+
+      UpdatePassStatistics(*pass_stats++, metrics_in, metrics_out, t1 - t0);
+    }
+
+    for (auto &micro_block : micro_blocks) {
+      auto& emitter = micro_block.emitter;
+      auto micro_pass_stats = pass_stats;
+
+      for (auto& pass : pipeline.passes) {
+        auto metrics_in = IRMetrics{};
+        auto metrics_out = IRMetrics{};
+
+        metrics_in.Add(emitter);
+        auto t0 = Clock::now();
+        pass->Run(emitter);
+        auto t1 = Clock::now();
+        metrics_out.Add(emitter);
+
+        UpdatePassStatistics(*micro_pass_stats++, metrics_in, metrics_out, t1 - t0);
       }
     }
   }
@@ -198,6 +844,232 @@ private:
     }
   }
 
+  /**
+   * Compile the blocks at a list of keys ahead of time, in order. With discover set the successors of each block
+   * inside the code ranges are compiled as well. Returns the number of blocks which were compiled.
+   */
+  auto CompileAheadOfTime(
+    std::vector<BasicBlock::Key> const& block_keys,
+    std::vector<CodeRange> const& ranges,
+    bool discover,
+    int threads
+  ) -> int {
+    // The interpreter never runs compiled blocks.
+    if (execution_mode == ExecutionMode::Interpreter) {
+      return 0;
+    }
+
+    auto queue = std::vector<BasicBlock::Key>{};
+    auto visited = std::unordered_set<BasicBlock::Key>{};
+    int compiled_blocks = 0;
+
+    auto Enqueue = [&](BasicBlock::Key key) {
+      if (!key.IsEmpty() && IsInCodeRanges(key, ranges) && visited.insert(key).second) {
+        queue.push_back(key);
+      }
+    };
+
+    // Compile the translated block, unless an up-to-date block exists already. Then continue at its successors.
+    auto Finish = [&](
+      BasicBlock const& translated_block,
+      std::vector<BasicBlock::MicroBlock>& micro_blocks,
+      Translator const& block_translator
+    ) {
+      auto current_block = block_cache.Get(translated_block.key);
+
+      if (current_block == nullptr || current_block->hash != translated_block.hash || current_block->tier_up) {
+        AddToCodeCache(translated_block, micro_blocks, block_translator, false);
+        Install(NewTranslatedBlock(translated_block), micro_blocks, false);
+        compiled_blocks++;
+      }
+
+      if (discover) {
+        ForEachSuccessor(translated_block, micro_blocks, Enqueue);
+      }
+    };
+
+    // Translate, optimize and compile a block on this thread.
+    auto TranslateAndFinish = [&](BasicBlock::Key block_key) {
+      auto allocation_count_scope = AllocationCountScope{statistics.compile_allocations};
+      auto translated_block = BasicBlock{block_key};
+      bool decoded = true;
+
+      translated_block.hash = GetBasicBlockHash(block_key);
+
+      // Data that was mistaken for code may not decode, then the path is not followed any further.
+      try {
+        translator.Translate(translated_block, micro_blocks, true);
+      } catch (std::runtime_error const&) {
+        decoded = false;
+      }
+
+      if (decoded) {
+        Optimize(translated_block, micro_blocks, optimized_pipeline, statistics.passes);
+        Finish(translated_block, micro_blocks, translator);
+      }
+
+      micro_blocks.clear();
+      ir_arena.Reset();
+    };
+
+    for (auto block_key : block_keys) {
+      Enqueue(block_key);
+    }
+
+    if (threads <= 1) {
+      for (size_t i = 0; i < queue.size(); i++) {
+        TranslateAndFinish(queue[i]);
+      }
+    } else {
+      auto workers = std::vector<std::unique_ptr<BackgroundCompiler>>{};
+      size_t next_key = 0;
+
+      for (int i = 0; i < threads; i++) {
+        auto& worker = *workers.emplace_back(std::make_unique<BackgroundCompiler>(descriptor));
+
+        CreatePasses(worker.pipeline, worker.pass_stats, descriptor.optimization_level, false);
+        worker.thread = std::thread{&JIT::RunBackgroundCompiler, this, std::ref(worker)};
+      }
+
+      while (true) {
+        bool busy = false;
+
+        // Hand out blocks to all idle workers first, so that they are translated and optimized in parallel.
+        for (auto& worker : workers) {
+          std::lock_guard lock{worker->mutex};
+
+          if (worker->status == BackgroundCompiler::Status::Idle && next_key < queue.size()) {
+            StartBackgroundCompilation(*worker, queue[next_key++]);
+          }
+        }
+
+        // The backend is not thread-safe, so the blocks are compiled to host code on this thread.
+        for (auto& worker : workers) {
+          std::unique_lock lock{worker->mutex};
+
+          if (worker->status == BackgroundCompiler::Status::Idle) {
+            continue;
+          }
+
+          worker->condition.wait(lock, [&]() {
+            return worker->status == BackgroundCompiler::Status::Done;
+          });
+
+          auto block_key = worker->basic_block.key;
+          bool up_to_date = IsUpToDate(*worker);
+
+          if (up_to_date) {
+            auto allocation_count_scope = AllocationCountScope{statistics.compile_allocations};
+
+            Finish(worker->basic_block, worker->micro_blocks, worker->translator);
+          }
+
+          AddPassStatistics(*worker);
+          worker->micro_blocks.clear();
+          worker->arena.Reset();
+          worker->status = BackgroundCompiler::Status::Idle;
+          busy = true;
+
+          // The worker could not read the code, or it changed in the meantime.
+          if (!up_to_date) {
+            TranslateAndFinish(block_key);
+          }
+        }
+
+        if (!busy) {
+          break;
+        }
+      }
+
+      for (auto& worker : workers) {
+        StopBackgroundCompiler(*worker);
+      }
+    }
+
+    statistics.precompiled_blocks += compiled_blocks;
+    return compiled_blocks;
+  }
+
+  /// Get the key of the block at an address, which is Thumb code if bit 0 is set.
+  static auto GetKeyForAddress(u32 address, Mode mode) -> BasicBlock::Key {
+    if (address & 1) {
+      return BasicBlock::Key{(address & ~1) + 4, mode, true};
+    }
+    return BasicBlock::Key{(address & ~3) + 8, mode, false};
+  }
+
+  static bool IsInCodeRanges(BasicBlock::Key block_key, std::vector<CodeRange> const& ranges) {
+    u32 address = block_key.Address() - (block_key.Thumb() ? 4 : 8);
+
+    if (ranges.empty()) {
+      return true;
+    }
+
+    return std::any_of(ranges.begin(), ranges.end(), [&](CodeRange const& range) {
+      return address >= range.address_lo && address <= range.address_hi;
+    });
+  }
+
+  /// Call a function with the keys of the blocks that a translated block may continue at, as far as they are known.
+  template<typename Function>
+  static void ForEachSuccessor(
+    BasicBlock const& basic_block,
+    std::vector<BasicBlock::MicroBlock> const& micro_blocks,
+    Function&& callback
+  ) {
+    auto mode = basic_block.key.Mode();
+    auto thumb = basic_block.key.Thumb();
+    u32 opcode_size = thumb ? sizeof(u16) : sizeof(u32);
+
+    callback(basic_block.branch_target.key);
+
+    for (auto const& micro_block : micro_blocks) {
+      callback(micro_block.side_exit);
+
+      // Functions that are called via BL (or MOV LR, PC) return to the address in LR.
+      for (auto op : micro_block.emitter.Code()) {
+        if (op->GetClass() == IROpcodeClass::StoreGPR) {
+          auto store = lunatic_cast<IRStoreGPR>(op);
+
+          if (store->reg.reg == GPR::LR && store->value.IsConstant()) {
+            callback(GetKeyForAddress(store->value.GetConst().value, mode));
+          }
+        }
+      }
+    }
+
+    // The code after the block runs, if the final micro block is skipped.
+    if (!micro_blocks.empty() && micro_blocks.back().condition != Condition::AL) {
+      callback(BasicBlock::Key{basic_block.key.Address() + basic_block.length * opcode_size, mode, thumb});
+    }
+  }
+
+  /// Check if the memory reads of an idle loop have no side effects, given the current GPR values.
+  bool HasPureReads(BasicBlock const& basic_block) {
+    for (int i = 0; i < basic_block.idle_loop_read_count; i++) {
+      auto const& read = basic_block.idle_loop_reads[i];
+      auto address = read.offset;
+
+      if (read.has_base) {
+        address += state.GetGPR(read.base_mode, read.base_reg);
+      }
+
+      if (!IsPureRead(address & ~(read.size - 1))) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  /**
+   * The host decides which addresses are pure, also for memory mapped by the page table or a TCM:
+   * it may be written by something else than this CPU (e.g. DMA or another CPU) while the loop waits.
+   */
+  bool IsPureRead(u32 address) {
+    return memory.IsPureRead(address, Memory::Bus::Data);
+  }
+
   auto GetBasicBlockHash(BasicBlock::Key block_key) -> u32 {
     return memory.FastRead<u32, Memory::Bus::Code>(block_key.Address());
   }
@@ -218,16 +1090,37 @@ private:
     return *state.GetPointerToSPSR(mode);
   }
 
+  CPU::Descriptor descriptor;
   bool irq_line = false;
   bool wait_for_irq = false;
   int cycles_to_run = 0;
   u32 exception_base;
   Memory& memory;
   State state;
+  Arena ir_arena;
+  std::vector<BasicBlock::MicroBlock> micro_blocks;
+  Statistics statistics;
   Translator translator;
   BasicBlockCache block_cache;
   X64Backend backend;
-  std::vector<std::unique_ptr<IRPass>> passes;
+  Interpreter interpreter;
+  CodeCache code_cache;
+  ExecutionMode execution_mode;
+
+  /// Execution counts of the blocks which are not in the block cache anymore, and of interpreted blocks.
+  std::unordered_map<BasicBlock::Key, u64> profile_counts;
+
+  /// Number of times that each block was interpreted with ExecutionMode::Adaptive.
+  std::unordered_map<BasicBlock::Key, int> interpreter_counts;
+  int interpreter_threshold;
+  Pipeline optimized_pipeline;
+  Pipeline baseline_pipeline;
+  u32 tier_up_threshold = 0;
+
+  /// Incremented whenever compiled blocks may have become outdated.
+  u64 generation = 0;
+
+  std::unique_ptr<BackgroundCompiler> background_compiler;
   std::vector<BasicBlock*> exception_causing_basic_blocks;
 };
 
@@ -235,4 +1128,48 @@ auto CreateCPU(CPU::Descriptor const& descriptor) -> std::unique_ptr<CPU> {
   return std::make_unique<JIT>(descriptor);
 }
 
+bool SaveProfile(std::string const& path, std::vector<CPU::ProfileEntry> const& profile) {
+  auto file = std::ofstream{path};
+
+  for (auto const& entry : profile) {
+    file << fmt::format("{:08X} {:02X} {}\n", entry.address, uint(entry.mode), entry.count);
+  }
+
+  return file.good();
+}
+
+auto LoadProfile(std::string const& path) -> std::vector<CPU::ProfileEntry> {
+  auto file = std::ifstream{path};
+  auto profile = std::vector<CPU::ProfileEntry>{};
+  auto line = std::string{};
+
+  // A malformed line is skipped, so that the lines after it are still used.
+  while (std::getline(file, line)) {
+    auto stream = std::istringstream{line};
+    auto entry = CPU::ProfileEntry{};
+    uint mode;
+
+    if (!(stream >> std::hex >> entry.address >> mode >> std::dec >> entry.count) || !(stream >> std::ws).eof()) {
+      continue;
+    }
+
+    entry.mode = Mode(mode);
+
+    switch (entry.mode) {
+      case Mode::User:
+      case Mode::FIQ:
+      case Mode::IRQ:
+      case Mode::Supervisor:
+      case Mode::Abort:
+      case Mode::Undefined:
+      case Mode::System: {
+        profile.push_back(entry);
+        break;
+      }
+    }
+  }
+
+  return profile;
+}
+
 } // namespace lunatic
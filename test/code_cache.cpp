@@ -0,0 +1,474 @@
+/*
+ * Copyright (C) 2022 fleroviux. All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Test of the code cache: entries must survive CodeCache::Save() and CodeCache::Load() unchanged,
+ * but must not be used once their guest code changed. Files that were saved with other settings
+ * or that are truncated or damaged must be rejected. Finally a CPU must run the code from a loaded cache
+ * without translating it again.
+ */
+
+#include <lunatic/cpu.hpp>
+#include <cstdio>
+#include <cstring>
+#include <fmt/format.h>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "frontend/code_cache.hpp"
+#include "frontend/translator/translator.hpp"
+
+using namespace lunatic;
+using namespace lunatic::frontend;
+
+static constexpr u32 kCodeBase = 0x02000000;
+static constexpr u32 kRAMSize = 0x10000;
+
+static constexpr char const* kPath = "code_cache_test.bin";
+
+/// RAM which is mapped by the page table.
+struct TestMemory final : Memory {
+  TestMemory() : ram(kRAMSize) {
+    pagetable = std::make_unique<std::array<u8*, 1048576>>();
+
+    for (u32 offset = 0; offset < kRAMSize; offset += 4096) {
+      (*pagetable)[(kCodeBase + offset) >> kPageShift] = &ram[offset];
+    }
+  }
+
+  auto ReadByte(u32 address, Bus bus) -> u8 override {
+    return ram[address & (kRAMSize - 1)];
+  }
+
+  auto ReadHalf(u32 address, Bus bus) -> u16 override {
+    u16 value;
+    std::memcpy(&value, &ram[address & (kRAMSize - 2)], sizeof(u16));
+    return value;
+  }
+
+  auto ReadWord(u32 address, Bus bus) -> u32 override {
+    u32 value;
+    std::memcpy(&value, &ram[address & (kRAMSize - 4)], sizeof(u32));
+    return value;
+  }
+
+  void WriteByte(u32 address, u8 value, Bus bus) override {
+    ram[address & (kRAMSize - 1)] = value;
+  }
+
+  void WriteHalf(u32 address, u16 value, Bus bus) override {
+    std::memcpy(&ram[address & (kRAMSize - 2)], &value, sizeof(u16));
+  }
+
+  void WriteWord(u32 address, u32 value, Bus bus) override {
+    std::memcpy(&ram[address & (kRAMSize - 4)], &value, sizeof(u32));
+  }
+
+  std::vector<u8> ram;
+};
+
+static const u32 kARMProgram[] {
+  0xE3A00000, // mov r0, #0
+  0xE3A0100A, // mov r1, #10
+  0xE0800001, // loop: add r0, r0, r1
+  0xE3100001, // tst r0, #1
+  0x12800C01, // addne r0, r0, #256
+  0xE2511001, // subs r1, r1, #1
+  0x1AFFFFFA, // bne loop
+  0xEAFFFFFE  // b .
+};
+
+static constexpr u32 kARMProgramEnd = kCodeBase + 7 * sizeof(u32);
+
+static constexpr u32 kThumbBase = kCodeBase + 0x100;
+
+static const u16 kThumbProgram[] {
+  0x2000, // movs r0, #0
+  0x2105, // movs r1, #5
+  0x1840, // loop: adds r0, r0, r1
+  0x3901, // subs r1, #1
+  0xD1FC, // bne loop
+  0xE7FE  // b .
+};
+
+static auto GetARMKey(u32 address) -> BasicBlock::Key {
+  return BasicBlock::Key{address + 8, Mode::System, false};
+}
+
+static auto GetThumbKey(u32 address) -> BasicBlock::Key {
+  return BasicBlock::Key{address + 4, Mode::System, true};
+}
+
+/// Load both programs into the memory.
+static void LoadPrograms(TestMemory& memory) {
+  std::memcpy(&memory.ram[0], kARMProgram, sizeof(kARMProgram));
+  std::memcpy(&memory.ram[kThumbBase - kCodeBase], kThumbProgram, sizeof(kThumbProgram));
+}
+
+/// Translate the block at a key and add it to the code cache.
+static void AddBlock(CodeCache& code_cache, Translator& translator, Arena& arena, BasicBlock::Key block_key) {
+  auto basic_block = BasicBlock{block_key};
+  auto micro_blocks = std::vector<BasicBlock::MicroBlock>{};
+
+  translator.Translate(basic_block, micro_blocks, true);
+  code_cache.Add(
+    basic_block,
+    micro_blocks,
+    translator.GetCodeSpans(),
+    translator.GetCodeHash(),
+    translator.GetExceptionBase(),
+    false
+  );
+
+  micro_blocks.clear();
+  arena.Reset();
+}
+
+/// Translate the blocks of both programs and save them. Returns false if the file cannot be written.
+static bool SaveBlocks(CPU::Descriptor const& descriptor, std::vector<BasicBlock::Key> const& block_keys) {
+  auto arena = Arena{};
+  auto translator = Translator{descriptor, arena};
+  auto code_cache = CodeCache{descriptor};
+
+  for (auto block_key : block_keys) {
+    AddBlock(code_cache, translator, arena, block_key);
+  }
+  return code_cache.Save(kPath);
+}
+
+static auto ReadFile() -> std::vector<u8> {
+  auto file = std::ifstream{kPath, std::ios::binary};
+
+  return std::vector<u8>{std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{}};
+}
+
+static void WriteFile(std::vector<u8> const& data) {
+  auto file = std::ofstream{kPath, std::ios::binary | std::ios::trunc};
+
+  file.write((char const*)data.data(), data.size());
+}
+
+static bool Check(bool condition, char const* message) {
+  if (!condition) {
+    fmt::print("{}\n", message);
+  }
+  return condition;
+}
+
+static bool TestRoundTrip() {
+  auto memory = TestMemory{};
+  auto descriptor = CPU::Descriptor{memory};
+  auto arena = Arena{};
+  auto translator = Translator{descriptor, arena};
+  auto code_cache = CodeCache{descriptor};
+  auto block_keys = {GetARMKey(kCodeBase), GetARMKey(kCodeBase + 2 * sizeof(u32)), GetThumbKey(kThumbBase)};
+
+  LoadPrograms(memory);
+
+  for (auto block_key : block_keys) {
+    AddBlock(code_cache, translator, arena, block_key);
+  }
+
+  if (!Check(code_cache.Save(kPath), "round trip: the code cache cannot be saved")) {
+    return false;
+  }
+
+  auto loaded_cache = CodeCache{descriptor};
+
+  if (!Check(loaded_cache.Load(kPath), "round trip: the code cache cannot be loaded")) {
+    return false;
+  }
+
+  if (!Check(loaded_cache.Keys().size() == block_keys.size(), "round trip: the number of entries changed")) {
+    return false;
+  }
+
+  for (auto block_key : block_keys) {
+    auto entry = code_cache.Get(block_key, 0);
+    auto loaded_entry = loaded_cache.Get(block_key, 0);
+
+    if (!Check(entry != nullptr && loaded_entry != nullptr, "round trip: an entry is missing")) {
+      return false;
+    }
+
+    bool equal = loaded_entry->code_spans.size() == entry->code_spans.size() &&
+                 loaded_entry->code_hash == entry->code_hash &&
+                 loaded_entry->length == entry->length &&
+                 loaded_entry->branch_target == entry->branch_target &&
+                 loaded_entry->enable_fast_dispatch == entry->enable_fast_dispatch &&
+                 loaded_entry->baseline == entry->baseline &&
+                 loaded_entry->data == entry->data;
+
+    for (size_t i = 0; equal && i < entry->code_spans.size(); i++) {
+      equal = loaded_entry->code_spans[i].address == entry->code_spans[i].address &&
+              loaded_entry->code_spans[i].size == entry->code_spans[i].size;
+    }
+
+    if (!Check(equal, "round trip: an entry changed")) {
+      return false;
+    }
+
+    // The IR must be recreated with the micro blocks that it was saved with.
+    auto basic_block = BasicBlock{block_key};
+    auto micro_blocks = std::vector<BasicBlock::MicroBlock>{};
+
+    CodeCache::Read(*loaded_entry, basic_block, micro_blocks, arena);
+
+    if (!Check(basic_block.length == entry->length && !micro_blocks.empty(), "round trip: the IR cannot be read")) {
+      return false;
+    }
+
+    micro_blocks.clear();
+    arena.Reset();
+  }
+
+  return true;
+}
+
+static bool TestStaleCode() {
+  auto memory = TestMemory{};
+  auto descriptor = CPU::Descriptor{memory};
+  auto arm_key = GetARMKey(kCodeBase + 2 * sizeof(u32));
+  auto thumb_key = GetThumbKey(kThumbBase);
+
+  LoadPrograms(memory);
+
+  if (!Check(SaveBlocks(descriptor, {arm_key, thumb_key}), "stale code: the code cache cannot be saved")) {
+    return false;
+  }
+
+  auto code_cache = CodeCache{descriptor};
+
+  if (!Check(code_cache.Load(kPath), "stale code: the code cache cannot be loaded")) {
+    return false;
+  }
+
+  // Code outside of the blocks does not matter.
+  memory.WriteWord(kCodeBase, 0xE3A00001, Memory::Bus::Data); // mov r0, #1
+
+  if (!Check(code_cache.Get(arm_key, 0) != nullptr, "stale code: a change outside of the block was detected")) {
+    return false;
+  }
+
+  memory.WriteWord(kCodeBase + 4 * sizeof(u32), 0x12800C02, Memory::Bus::Data); // addne r0, r0, #512
+  memory.WriteHalf(kThumbBase + 3 * sizeof(u16), 0x3902, Memory::Bus::Data); // subs r1, #2
+
+  return Check(code_cache.Get(arm_key, 0) == nullptr, "stale code: a changed ARM block was used") &&
+         Check(code_cache.Get(thumb_key, 0) == nullptr, "stale code: a changed Thumb block was used");
+}
+
+static bool TestSettings() {
+  auto memory = TestMemory{};
+  auto descriptor = CPU::Descriptor{memory};
+
+  LoadPrograms(memory);
+
+  if (!Check(SaveBlocks(descriptor, {GetARMKey(kCodeBase)}), "settings: the code cache cannot be saved")) {
+    return false;
+  }
+
+  auto arm7_descriptor = descriptor;
+  auto block_size_descriptor = descriptor;
+  auto optimization_descriptor = descriptor;
+
+  arm7_descriptor.model = CPU::Descriptor::Model::ARM7;
+  block_size_descriptor.block_size = descriptor.block_size + 1;
+  optimization_descriptor.optimization_level = CPU::Descriptor::OptimizationLevel::Basic;
+
+  for (auto const& other_descriptor : {arm7_descriptor, block_size_descriptor, optimization_descriptor}) {
+    auto code_cache = CodeCache{other_descriptor};
+
+    if (!Check(!code_cache.Load(kPath), "settings: a file saved with other settings was loaded")) {
+      return false;
+    }
+  }
+
+  // The version follows the magic number at the start of the file.
+  auto data = ReadFile();
+  u32 version;
+
+  std::memcpy(&version, &data[sizeof(u32)], sizeof(u32));
+  version++;
+  std::memcpy(&data[sizeof(u32)], &version, sizeof(u32));
+  WriteFile(data);
+
+  auto code_cache = CodeCache{descriptor};
+
+  return Check(!code_cache.Load(kPath), "settings: a file saved by another version was loaded");
+}
+
+static bool TestDamagedFile() {
+  auto memory = TestMemory{};
+  auto descriptor = CPU::Descriptor{memory};
+  auto block_key = GetARMKey(kCodeBase + 2 * sizeof(u32));
+
+  LoadPrograms(memory);
+
+  if (!Check(SaveBlocks(descriptor, {block_key}), "damaged file: the code cache cannot be saved")) {
+    return false;
+  }
+
+  auto data = ReadFile();
+
+  for (size_t size = 0; size < data.size(); size++) {
+    auto code_cache = CodeCache{descriptor};
+
+    WriteFile({data.begin(), data.begin() + size});
+
+    if (!Check(!code_cache.Load(kPath), "damaged file: a truncated file was loaded")) {
+      fmt::print("  the file was truncated to {} of {} bytes\n", size, data.size());
+      return false;
+    }
+  }
+
+  /* The header (seven words) is followed by the entry: its key, the code spans, the code hash, the exception base,
+   * the length, the branch target, three booleans and the size of the IR. The IR starts with the number of micro blocks
+   * and the condition of the first micro block.
+   */
+  auto code_span_count = u32{};
+  std::memcpy(&code_span_count, &data[7 * sizeof(u32) + sizeof(u64)], sizeof(u32));
+
+  auto flags_offset = 7 * sizeof(u32) + sizeof(u64) + sizeof(u32) + code_span_count * 2 * sizeof(u32) +
+                      3 * sizeof(u32) + sizeof(u64);
+  auto condition_offset = flags_offset + 3 + sizeof(u32) + sizeof(u32);
+
+  struct Damage {
+    size_t offset;
+    u8 value;
+    char const* what;
+  };
+
+  Damage damages[] {
+    {0, 0, "a bad magic number"},
+    {7 * sizeof(u32) + sizeof(u64), 0xFF, "too many code spans"},
+    {flags_offset, 2, "a bad boolean"},
+    {condition_offset, 0xFF, "a bad condition"}
+  };
+
+  for (auto const& damage : damages) {
+    auto damaged_data = data;
+    auto code_cache = CodeCache{descriptor};
+
+    damaged_data[damage.offset] = damage.value;
+    WriteFile(damaged_data);
+
+    if (!Check(!code_cache.Load(kPath), "damaged file: a damaged file was loaded")) {
+      fmt::print("  the file had {}\n", damage.what);
+      return false;
+    }
+  }
+
+  // Other damage may go unnoticed, but loading the file must never crash, and a rejected file must not add entries.
+  for (size_t offset = 0; offset < data.size(); offset++) {
+    auto damaged_data = data;
+    auto code_cache = CodeCache{descriptor};
+
+    damaged_data[offset] ^= 0xFF;
+    WriteFile(damaged_data);
+
+    if (!code_cache.Load(kPath) && !Check(code_cache.Keys().empty(), "damaged file: a rejected file added entries")) {
+      fmt::print("  byte {} was damaged\n", offset);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/// Run the ARM program until it reaches the 'b .' at its end. Returns false if it does not get there.
+static bool RunProgram(CPU& cpu) {
+  auto cpsr = StatusRegister{};
+
+  cpsr.f.mode = Mode::System;
+  cpu.SetCPSR(cpsr);
+  cpu.SetGPR(GPR::PC, kCodeBase);
+
+  for (int i = 0; i < 1000; i++) {
+    if (cpu.GetGPR(GPR::PC) == kARMProgramEnd + sizeof(u32) * 2) {
+      return true;
+    }
+    cpu.Run(64);
+  }
+
+  return false;
+}
+
+static bool TestCPU() {
+  auto memory = TestMemory{};
+  auto descriptor = CPU::Descriptor{memory};
+
+  LoadPrograms(memory);
+  descriptor.tier_up_threshold = 0;
+  descriptor.code_cache = true;
+
+  auto cpu = CreateCPU(descriptor);
+
+  if (!Check(RunProgram(*cpu), "CPU: the program did not finish")) {
+    return false;
+  }
+
+  auto expected_r0 = cpu->GetGPR(GPR::R0);
+
+  if (!Check(cpu->SaveCodeCache(kPath), "CPU: the code cache cannot be saved")) {
+    return false;
+  }
+
+  // Blocks from a code cache are used even if the new CPU does not keep a code cache itself.
+  descriptor.code_cache = false;
+  cpu = CreateCPU(descriptor);
+
+  if (!Check(cpu->LoadCodeCache(kPath), "CPU: the code cache cannot be loaded")) {
+    return false;
+  }
+
+  auto cached_blocks = cpu->GetStatistics().cached_blocks;
+
+  if (!Check(cached_blocks != 0, "CPU: no block was compiled from the code cache")) {
+    return false;
+  }
+
+  if (!Check(RunProgram(*cpu) && cpu->GetGPR(GPR::R0) == expected_r0, "CPU: the cached code computed another result")) {
+    return false;
+  }
+
+  auto statistics = cpu->GetStatistics();
+
+  if (!Check(statistics.compiled_blocks == statistics.cached_blocks, "CPU: blocks were translated again")) {
+    return false;
+  }
+
+  // A damaged file is rejected by the CPU as well.
+  auto data = ReadFile();
+
+  data.resize(data.size() / 2);
+  WriteFile(data);
+  cpu = CreateCPU(descriptor);
+
+  return Check(!cpu->LoadCodeCache(kPath), "CPU: a truncated code cache was loaded");
+}
+
+int main() {
+  int failures = 0;
+
+  for (auto test : {TestRoundTrip, TestStaleCode, TestSettings, TestDamagedFile, TestCPU}) {
+    if (!test()) {
+      failures++;
+    }
+  }
+
+  std::remove(kPath);
+
+  if (failures != 0) {
+    fmt::print("{} failures\n", failures);
+    return 1;
+  }
+
+  fmt::print("all code cache tests passed\n");
+  return 0;
+}
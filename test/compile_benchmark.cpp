@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2022 fleroviux. All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Measures how fast the JIT compiles code: a long run of generated ARM code is executed once,
+ * then the instruction cache is cleared, so that every iteration compiles all of its blocks again.
+ * Running straight-line code once takes little time compared to compiling it.
+ * Only the public API that predates the arena-backed IR is used, so that the benchmark can be built
+ * against older revisions of the library, to compare the compile throughput of both.
+ */
+
+#include <lunatic/cpu.hpp>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fmt/format.h>
+#include <vector>
+
+using namespace lunatic;
+
+static constexpr u32 kCodeBase = 0x02000000;
+static constexpr u32 kDataBase = 0x02100000;
+
+struct BenchmarkMemory final : Memory {
+  BenchmarkMemory() {
+    std::memset(ram, 0, sizeof(ram));
+
+    pagetable = std::make_unique<std::array<u8*, 1048576>>();
+
+    for (u32 offset = 0; offset < sizeof(ram); offset += 4096) {
+      (*pagetable)[(kCodeBase + offset) >> kPageShift] = &ram[offset];
+    }
+  }
+
+  auto ReadByte(u32 address, Bus bus) ->  u8 override { return 0; }
+  auto ReadHalf(u32 address, Bus bus) -> u16 override { return 0; }
+  auto ReadWord(u32 address, Bus bus) -> u32 override { return 0; }
+
+  void WriteByte(u32 address,  u8 value, Bus bus) override {}
+  void WriteHalf(u32 address, u16 value, Bus bus) override {}
+  void WriteWord(u32 address, u32 value, Bus bus) override {}
+
+  u8 ram[0x200000];
+};
+
+/// Generates a deterministic mix of ALU, shifter, multiply and load/store instructions.
+struct CodeGenerator {
+  auto Random(u32 range) -> u32 {
+    state = state * 1103515245 + 12345;
+    return (state >> 8) % range;
+  }
+
+  auto Condition() -> u32 {
+    // Mostly unconditional code, like compiled code is.
+    return Random(8) == 0 ? Random(14) : 14;
+  }
+
+  auto Next() -> u32 {
+    auto cond = Condition() << 28;
+    auto rd = Random(8);
+    auto rn = Random(8);
+    auto rm = Random(8);
+
+    switch (Random(6)) {
+      case 0:
+      case 1: {
+        // Data processing with an immediate. Compare instructions (TST, TEQ, CMP, CMN) always update the flags.
+        auto opcode = Random(16);
+        auto set_flags = (opcode >= 8 && opcode <= 11) ? 1 : Random(2);
+        return cond | (1 << 25) | (opcode << 21) | (set_flags << 20) | (rn << 16) | (rd << 12) | Random(16) << 8 | Random(256);
+      }
+      case 2:
+      case 3: {
+        // Data processing with a register shifted by an immediate.
+        auto opcode = Random(16);
+        auto set_flags = (opcode >= 8 && opcode <= 11) ? 1 : Random(2);
+        return cond | (opcode << 21) | (set_flags << 20) | (rn << 16) | (rd << 12) | Random(32) << 7 | Random(4) << 5 | rm;
+      }
+      case 4: {
+        // LDR/STR relative to SP, which points to the data area.
+        return cond | 0x05800000 | Random(2) << 20 | (13 << 16) | (rd << 12) | Random(1024) << 2;
+      }
+      default: {
+        // MUL(S), the destination must differ from the first operand on ARMv4.
+        if (rd == rm) {
+          rm = (rm + 1) % 8;
+        }
+        return cond | Random(2) << 20 | (rd << 16) | (rn << 8) | 0x90 | rm;
+      }
+    }
+  }
+
+  u32 state = 0x12345678;
+};
+
+int main(int argc, char** argv) {
+  static constexpr int kInstructionCount = 65536;
+
+  int iterations = argc > 1 ? std::atoi(argv[1]) : 20;
+
+  static BenchmarkMemory memory;
+
+  auto generator = CodeGenerator{};
+
+  for (int i = 0; i < kInstructionCount; i++) {
+    memory.FastWrite<u32, Memory::Bus::Data>(kCodeBase + i * sizeof(u32), generator.Next());
+  }
+
+  // b .
+  memory.FastWrite<u32, Memory::Bus::Data>(kCodeBase + kInstructionCount * sizeof(u32), 0xEAFFFFFE);
+
+  auto descriptor = CPU::Descriptor{memory};
+  auto jit = CreateCPU(descriptor);
+
+  using Clock = std::chrono::steady_clock;
+
+  auto total_time = Clock::duration{};
+
+  // The first iteration warms up the arena and the block cache, it is not measured.
+  for (int i = 0; i <= iterations; i++) {
+    jit->ClearICache();
+    jit->SetGPR(GPR::SP, kDataBase);
+    jit->SetGPR(GPR::PC, kCodeBase);
+
+    auto t0 = Clock::now();
+    jit->Run(kInstructionCount);
+    auto t1 = Clock::now();
+
+    if (i != 0) {
+      total_time += t1 - t0;
+    }
+  }
+
+  auto seconds = std::chrono::duration<double>(total_time).count();
+  auto blocks = (kInstructionCount + descriptor.block_size - 1) / descriptor.block_size;
+
+  fmt::print("{} iterations of {} instructions ({} blocks): {:.2f} ms per iteration\n",
+    iterations, kInstructionCount, blocks, seconds * 1000.0 / iterations);
+  fmt::print("{:.0f} instructions per second, {:.0f} blocks per second\n",
+    (double)iterations * kInstructionCount / seconds, (double)iterations * blocks / seconds);
+  return 0;
+}
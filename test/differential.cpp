@@ -0,0 +1,509 @@
+/*
+ * Copyright (C) 2022 fleroviux. All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Differential test of the compiled code: generated ARM and Thumb programs run on the IR interpreter, which runs
+ * the IR as it was translated, and on the x86-64 backend with each optimization level and tier-up configuration.
+ * The registers and the data memory must match after each run. The programs consist of loops with
+ * conditional forward branches, so that blocks become hot, get side exits and fold if-then code.
+ */
+
+#include <lunatic/cpu.hpp>
+#include <algorithm>
+#include <cstring>
+#include <fmt/format.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+using namespace lunatic;
+
+static constexpr u32 kCodeBase = 0x02000000;
+static constexpr u32 kDataBase = 0x02020000;
+static constexpr u32 kRAMSize = 0x40000;
+static constexpr u32 kDataSize = kRAMSize - (kDataBase - kCodeBase);
+
+/// RAM which is accessed via the page table, or via the virtual methods (the slow path of the compiled code).
+struct TestMemory final : Memory {
+  TestMemory(bool use_pagetable) : ram(kRAMSize) {
+    if (use_pagetable) {
+      pagetable = std::make_unique<std::array<u8*, 1048576>>();
+
+      for (u32 offset = 0; offset < kRAMSize; offset += 4096) {
+        (*pagetable)[(kCodeBase + offset) >> kPageShift] = &ram[offset];
+      }
+    }
+  }
+
+  auto ReadByte(u32 address, Bus bus) -> u8 override {
+    return ram[address & (kRAMSize - 1)];
+  }
+
+  auto ReadHalf(u32 address, Bus bus) -> u16 override {
+    u16 value;
+    std::memcpy(&value, &ram[address & (kRAMSize - 2)], sizeof(u16));
+    return value;
+  }
+
+  auto ReadWord(u32 address, Bus bus) -> u32 override {
+    u32 value;
+    std::memcpy(&value, &ram[address & (kRAMSize - 4)], sizeof(u32));
+    return value;
+  }
+
+  void WriteByte(u32 address, u8 value, Bus bus) override {
+    ram[address & (kRAMSize - 1)] = value;
+  }
+
+  void WriteHalf(u32 address, u16 value, Bus bus) override {
+    std::memcpy(&ram[address & (kRAMSize - 2)], &value, sizeof(u16));
+  }
+
+  void WriteWord(u32 address, u32 value, Bus bus) override {
+    std::memcpy(&ram[address & (kRAMSize - 4)], &value, sizeof(u32));
+  }
+
+  std::vector<u8> ram;
+};
+
+/// A program of 32-bit ARM or 16-bit Thumb instructions.
+struct Program {
+  auto OpcodeSize() const -> u32 {
+    return thumb ? sizeof(u16) : sizeof(u32);
+  }
+
+  bool thumb;
+  std::vector<u32> code;
+};
+
+struct Random {
+  auto Next(u32 range) -> u32 {
+    state = state * 1103515245 + 12345;
+    return (state >> 8) % range;
+  }
+
+  auto Next32() -> u32 {
+    return Next(0x10000) << 16 | Next(0x10000);
+  }
+
+  u32 state;
+};
+
+/**
+ * Generates ARMv5TE programs from loops, which use R0 - R7 and access the data memory relative to SP.
+ * R8 is the loop counter. Each program ends with 'b .'.
+ */
+struct ProgramGenerator {
+  auto Generate(u32 seed) -> Program {
+    random.state = seed;
+    code.clear();
+
+    auto loop_count = 1 + random.Next(4);
+
+    for (u32 i = 0; i < loop_count; i++) {
+      GenerateLoop();
+    }
+
+    code.push_back(0xEAFFFFFE); // b .
+    return {false, code};
+  }
+
+  void GenerateLoop() {
+    code.push_back(0xE3A08000 | (1 + random.Next(6))); // mov r8, #iterations
+
+    auto loop_start = code.size();
+    auto body_length = 4 + random.Next(48);
+
+    for (u32 i = 0; i < body_length; i++) {
+      if (random.Next(8) == 0) {
+        // Conditional branch over up to three instructions, which stays inside of the loop body.
+        auto skip = std::min(random.Next(4), body_length - i - 1);
+
+        code.push_back(Condition() << 28 | 0x0A000000 | ((skip - 1) & 0xFFFFFF));
+      } else {
+        code.push_back(Instruction());
+      }
+    }
+
+    code.push_back(0xE2588001); // subs r8, r8, #1
+
+    auto offset = s32(loop_start) - s32(code.size()) - 2;
+
+    code.push_back(0x1A000000 | (offset & 0xFFFFFF)); // bne loop_start
+  }
+
+  auto Condition() -> u32 {
+    return random.Next(4) == 0 ? 14 : random.Next(14);
+  }
+
+  auto Register() -> u32 {
+    return random.Next(8);
+  }
+
+  auto Instruction() -> u32 {
+    auto cond = (random.Next(6) == 0 ? random.Next(14) : 14) << 28;
+    auto rd = Register();
+    auto rn = Register();
+    auto rm = Register();
+    auto rs = Register();
+
+    switch (random.Next(12)) {
+      case 0:
+      case 1: {
+        // Data processing with an immediate. Compare instructions (TST, TEQ, CMP, CMN) always update the flags.
+        auto opcode = random.Next(16);
+        auto set_flags = (opcode >= 8 && opcode <= 11) ? 1 : random.Next(2);
+        return cond | 1 << 25 | opcode << 21 | set_flags << 20 | rn << 16 | rd << 12 | random.Next(16) << 8 | random.Next(256);
+      }
+      case 2:
+      case 3: {
+        // Data processing with a register shifted by an immediate. A zero amount encodes LSR #32, ASR #32 and RRX.
+        auto opcode = random.Next(16);
+        auto set_flags = (opcode >= 8 && opcode <= 11) ? 1 : random.Next(2);
+        return cond | opcode << 21 | set_flags << 20 | rn << 16 | rd << 12 | random.Next(32) << 7 | random.Next(4) << 5 | rm;
+      }
+      case 4: {
+        // Data processing with a register shifted by a register.
+        auto opcode = random.Next(16);
+        auto set_flags = (opcode >= 8 && opcode <= 11) ? 1 : random.Next(2);
+        return cond | opcode << 21 | set_flags << 20 | rn << 16 | rd << 12 | rs << 8 | random.Next(4) << 5 | 1 << 4 | rm;
+      }
+      case 5: {
+        // LDR(B)/STR(B) relative to SP, word accesses may be unaligned.
+        auto byte = random.Next(2);
+        return cond | 0x05800000 | byte << 22 | random.Next(2) << 20 | 13 << 16 | rd << 12 | random.Next(4096);
+      }
+      case 6: {
+        // LDRH/STRH relative to SP.
+        auto offset = random.Next(128) * 2;
+        return cond | 0x01C000B0 | random.Next(2) << 20 | 13 << 16 | rd << 12 | (offset >> 4) << 8 | (offset & 15);
+      }
+      case 7: {
+        // MUL(S) and MLA(S), the destination must differ from the first operand on ARMv4.
+        if (rd == rm) {
+          rm = (rm + 1) % 8;
+        }
+        return cond | random.Next(4) << 20 | rd << 16 | rn << 12 | rs << 8 | 0x90 | rm;
+      }
+      case 8: {
+        // UMULL, UMLAL, SMULL and SMLAL, with distinct destination registers.
+        auto rd_hi = rd;
+        auto rd_lo = (rd + 1 + random.Next(7)) % 8;
+        if (rm == rd_hi || rm == rd_lo) {
+          // R8 keeps the loop counter, which is a valid source.
+          rm = 8;
+        }
+        return cond | 0x00800090 | random.Next(8) << 20 | rd_hi << 16 | rd_lo << 12 | rs << 8 | rm;
+      }
+      case 9: {
+        // MRS and MSR of the flags.
+        if (random.Next(2) == 0) {
+          return cond | 0x010F0000 | rd << 12;
+        }
+        return cond | 0x0128F000 | rm;
+      }
+      case 10: {
+        // CLZ
+        return cond | 0x016F0F10 | rd << 12 | rm;
+      }
+      default: {
+        // QADD, QSUB, QDADD and QDSUB
+        return cond | 0x01000050 | random.Next(4) << 21 | rn << 16 | rd << 12 | rm;
+      }
+    }
+  }
+
+  Random random;
+  std::vector<u32> code;
+};
+
+/**
+ * Generates Thumb programs from loops, which use R0 - R6, read R8 - R11 and access the data memory relative to SP.
+ * R7 is the loop counter. Each program ends with 'b .'.
+ */
+struct ThumbProgramGenerator {
+  auto Generate(u32 seed) -> Program {
+    random.state = seed;
+    code.clear();
+
+    auto loop_count = 1 + random.Next(4);
+
+    for (u32 i = 0; i < loop_count; i++) {
+      GenerateLoop();
+    }
+
+    code.push_back(0xE7FE); // b .
+    return {true, code};
+  }
+
+  void GenerateLoop() {
+    code.push_back(0x2700 | (1 + random.Next(6))); // movs r7, #iterations
+
+    auto loop_start = code.size();
+    auto body_length = 4 + random.Next(48);
+
+    for (u32 i = 0; i < body_length; i++) {
+      if (random.Next(8) == 0) {
+        // Conditional branch over up to three instructions, which stays inside of the loop body.
+        auto skip = std::min(random.Next(4), body_length - i - 1);
+
+        code.push_back(0xD000 | Condition() << 8 | ((skip - 1) & 0xFF));
+      } else {
+        code.push_back(Instruction());
+      }
+    }
+
+    code.push_back(0x3F01); // subs r7, #1
+
+    auto offset = s32(loop_start) - s32(code.size()) - 2;
+
+    code.push_back(0xD100 | (offset & 0xFF)); // bne loop_start
+  }
+
+  auto Condition() -> u32 {
+    return random.Next(14);
+  }
+
+  auto Register() -> u32 {
+    return random.Next(7);
+  }
+
+  auto Instruction() -> u32 {
+    auto rd = Register();
+    auto rs = Register();
+    auto rn = Register();
+
+    switch (random.Next(8)) {
+      case 0: {
+        // LSL, LSR and ASR by an immediate. A zero amount encodes LSR #32 and ASR #32.
+        return random.Next(3) << 11 | random.Next(32) << 6 | rs << 3 | rd;
+      }
+      case 1: {
+        // ADD and SUB with a register or a three-bit immediate.
+        return 0x1800 | random.Next(4) << 9 | rn << 6 | rs << 3 | rd;
+      }
+      case 2: {
+        // MOV, CMP, ADD and SUB with an eight-bit immediate.
+        return 0x2000 | random.Next(4) << 11 | rd << 8 | random.Next(256);
+      }
+      case 3:
+      case 4: {
+        // ALU operations, including shifts by a register, ADC, SBC, NEG and MUL.
+        return 0x4000 | random.Next(16) << 6 | rs << 3 | rd;
+      }
+      case 5: {
+        // ADD, CMP and MOV with a high register as the source, the destination stays a low register.
+        auto opcode = random.Next(3);
+        return 0x4440 | opcode << 8 | (random.Next(4) << 3) | rd;
+      }
+      default: {
+        // LDR/STR relative to SP.
+        return 0x9000 | random.Next(2) << 11 | rd << 8 | random.Next(256);
+      }
+    }
+  }
+
+  Random random;
+  std::vector<u32> code;
+};
+
+struct Config {
+  char const* name;
+  std::function<void(CPU::Descriptor&)> setup;
+};
+
+/// A CPU with its own memory, which runs the program from the start.
+struct Machine {
+  Machine(bool use_pagetable, Config const& config) : memory{use_pagetable} {
+    auto descriptor = CPU::Descriptor{memory};
+
+    config.setup(descriptor);
+    cpu = CreateCPU(descriptor);
+  }
+
+  void Load(Program const& program) {
+    auto opcode_size = program.OpcodeSize();
+
+    for (size_t i = 0; i < program.code.size(); i++) {
+      std::memcpy(&memory.ram[i * opcode_size], &program.code[i], opcode_size);
+    }
+    cpu->ClearICache();
+  }
+
+  /// Run the program until it reaches the 'b .' at its end. Returns false if it does not get there.
+  bool Run(Program const& program, u32 seed) {
+    auto random = Random{seed};
+    auto cpsr = StatusRegister{};
+    auto opcode_size = program.OpcodeSize();
+    auto end = kCodeBase + u32(program.code.size() - 1) * opcode_size;
+
+    for (u32 i = 0; i < kDataSize; i += sizeof(u32)) {
+      auto value = random.Next32();
+      std::memcpy(&memory.ram[kDataBase - kCodeBase + i], &value, sizeof(u32));
+    }
+
+    for (int reg = 0; reg < 8; reg++) {
+      cpu->SetGPR(GPR(reg), random.Next32());
+    }
+
+    cpsr.f.mode = Mode::System;
+    cpsr.f.thumb = program.thumb;
+    cpsr.v |= random.Next(32) << 27;
+    cpu->SetCPSR(cpsr);
+    cpu->SetGPR(GPR::R8, 0);
+    cpu->SetGPR(GPR::SP, kDataBase + random.Next(256) * sizeof(u32));
+    cpu->SetGPR(GPR::PC, kCodeBase);
+
+    for (int i = 0; i < 10000; i++) {
+      if (cpu->GetGPR(GPR::PC) == end + opcode_size * 2) {
+        return true;
+      }
+      cpu->Run(64);
+    }
+
+    return false;
+  }
+
+  TestMemory memory;
+  std::unique_ptr<CPU> cpu;
+};
+
+/// Compare the state of a machine to the reference, and print the differences.
+static bool Compare(Machine& reference, Machine& machine) {
+  bool equal = true;
+
+  for (int reg = 0; reg < 16; reg++) {
+    auto expected = reference.cpu->GetGPR(GPR(reg));
+    auto actual = machine.cpu->GetGPR(GPR(reg));
+
+    if (actual != expected) {
+      fmt::print("  r{}: expected 0x{:08X}, got 0x{:08X}\n", reg, expected, actual);
+      equal = false;
+    }
+  }
+
+  auto expected_cpsr = reference.cpu->GetCPSR().v;
+  auto actual_cpsr = machine.cpu->GetCPSR().v;
+
+  if (actual_cpsr != expected_cpsr) {
+    fmt::print("  cpsr: expected 0x{:08X}, got 0x{:08X}\n", expected_cpsr, actual_cpsr);
+    equal = false;
+  }
+
+  for (u32 i = kDataBase - kCodeBase; i < kRAMSize; i++) {
+    if (machine.memory.ram[i] != reference.memory.ram[i]) {
+      fmt::print("  memory differs at 0x{:08X}\n", kCodeBase + i);
+      equal = false;
+      break;
+    }
+  }
+
+  return equal;
+}
+
+static void PrintProgram(Program const& program) {
+  for (size_t i = 0; i < program.code.size(); i++) {
+    auto address = kCodeBase + i * program.OpcodeSize();
+
+    if (program.thumb) {
+      fmt::print("  0x{:08X}: 0x{:04X}\n", address, program.code[i]);
+    } else {
+      fmt::print("  0x{:08X}: 0x{:08X}\n", address, program.code[i]);
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  using ExecutionMode = CPU::Descriptor::ExecutionMode;
+  using OptimizationLevel = CPU::Descriptor::OptimizationLevel;
+
+  int program_count = argc > 1 ? std::stoi(argv[1]) : 64;
+
+  auto reference_config = Config{"Interpreter", [](CPU::Descriptor& descriptor) {
+    descriptor.execution_mode = ExecutionMode::Interpreter;
+    descriptor.optimization_level = OptimizationLevel::None;
+  }};
+
+  Config configs[] {
+    {"None", [](CPU::Descriptor& descriptor) {
+      descriptor.optimization_level = OptimizationLevel::None;
+    }},
+    {"Basic", [](CPU::Descriptor& descriptor) {
+      descriptor.optimization_level = OptimizationLevel::Basic;
+    }},
+    {"Full", [](CPU::Descriptor& descriptor) {
+      descriptor.optimization_level = OptimizationLevel::Full;
+      descriptor.tier_up_threshold = 0;
+    }},
+    {"Full (tier-up)", [](CPU::Descriptor& descriptor) {
+      descriptor.optimization_level = OptimizationLevel::Full;
+      descriptor.tier_up_threshold = 2;
+    }},
+    {"Full (background tier-up)", [](CPU::Descriptor& descriptor) {
+      descriptor.optimization_level = OptimizationLevel::Full;
+      descriptor.tier_up_threshold = 2;
+      descriptor.background_compilation = true;
+    }},
+    {"Full (adaptive)", [](CPU::Descriptor& descriptor) {
+      descriptor.optimization_level = OptimizationLevel::Full;
+      descriptor.execution_mode = ExecutionMode::Adaptive;
+      descriptor.interpreter_threshold = 1;
+      descriptor.tier_up_threshold = 2;
+    }}
+  };
+
+  // RRX reads the carry, so two of them with a flag update in between are not the same expression.
+  auto programs = std::vector<Program>{
+    {false, {0xE1A01060, 0xE0933003, 0xE1A02060, 0xEAFFFFFE}}
+  };
+
+  auto arm_generator = ProgramGenerator{};
+  auto thumb_generator = ThumbProgramGenerator{};
+  int failures = 0;
+
+  for (int i = 0; i < program_count; i++) {
+    programs.push_back(arm_generator.Generate(u32(i)));
+    programs.push_back(thumb_generator.Generate(u32(i)));
+  }
+
+  for (int i = 0; i < int(programs.size()); i++) {
+    auto const& program = programs[i];
+
+    for (bool use_pagetable : {true, false}) {
+      auto reference = Machine{use_pagetable, reference_config};
+
+      reference.Load(program);
+
+      for (auto const& config : configs) {
+        auto machine = Machine{use_pagetable, config};
+
+        machine.Load(program);
+
+        // Running the program again with other input runs the blocks which were compiled (and tiered up) before.
+        for (u32 run = 0; run < 4; run++) {
+          auto seed = u32(i) * 4 + run;
+
+          if (!reference.Run(program, seed) || !machine.Run(program, seed) || !Compare(reference, machine)) {
+            fmt::print("program {} ({}, {}, {}), run {}: mismatch\n",
+              i, program.thumb ? "Thumb" : "ARM", config.name, use_pagetable ? "page table" : "memory handlers", run);
+            PrintProgram(program);
+            failures++;
+            break;
+          }
+        }
+      }
+    }
+  }
+
+  if (failures != 0) {
+    fmt::print("{} failures\n", failures);
+    return 1;
+  }
+
+  fmt::print("{} programs match the interpreter with all configurations\n", programs.size());
+  return 0;
+}
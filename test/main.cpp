@@ -10,6 +10,7 @@
 #include <fstream>
 #include <cstring>
 #include <SDL.h>
+#include <thread>
 #include <unordered_map>
 
 #ifdef _WIN32
@@ -130,6 +131,11 @@ struct Memory final : lunatic::Memory {
   void WriteWord(u32 address, u32 value, Bus bus) override {
   }
 
+  // Only the CPU writes to the mapped memory, so polling it has no effect until the next Run() call.
+  bool IsPureRead(u32 address, Bus bus) override {
+    return (*pagetable)[address >> kPageShift] != nullptr;
+  }
+
   int vblank_counter;
   u8 dtcm[0x4000];
   u8 mainram[0x400000];
@@ -174,6 +180,8 @@ int main(int argc, char** argv) {
   using namespace lunatic;
 
   static constexpr auto kROMPath = "armwrestler.nds";
+  static constexpr auto kCodeCachePath = "armwrestler.lunatic";
+  static constexpr auto kProfilePath = "armwrestler.profile";
 
   size_t size;
   std::ifstream file { kROMPath, std::ios::binary };
@@ -208,16 +216,36 @@ int main(int argc, char** argv) {
   }
 
   // TODO: better initialization, set exception base for example.
-  auto jit = CreateCPU(CPU::Descriptor{
+  auto descriptor = CPU::Descriptor{
     g_memory, {
       nullptr, nullptr, nullptr, nullptr,
       nullptr, nullptr, nullptr, nullptr,
       nullptr, nullptr, nullptr, nullptr,
       nullptr, nullptr, nullptr, &g_cp15
     }
-  });
+  };
+  descriptor.code_cache = true;
+  descriptor.profile_blocks = true;
+  descriptor.pass_statistics = true;
+
+  auto jit = CreateCPU(descriptor);
   jit->SetGPR(GPR::PC, header.arm9.entrypoint);
 
+  if (jit->LoadCodeCache(kCodeCachePath)) {
+    fmt::print("{} blocks loaded from the code cache\n", jit->GetStatistics().cached_blocks);
+  }
+
+  // Compile the hot code of the last run first.
+  auto profiled_blocks = jit->PrecompileProfile(LoadProfile(kProfilePath), (int)std::thread::hardware_concurrency());
+  fmt::print("{} blocks precompiled from the profile\n", profiled_blocks);
+
+  auto precompiled_blocks = jit->Precompile(
+    {header.arm9.entrypoint},
+    {{header.arm9.load_address, header.arm9.load_address + header.arm9.size - 1}},
+    (int)std::thread::hardware_concurrency()
+  );
+  fmt::print("{} blocks precompiled\n", precompiled_blocks);
+
   SDL_Init(SDL_INIT_VIDEO);
 
   auto window = SDL_CreateWindow(
@@ -235,9 +263,11 @@ int main(int argc, char** argv) {
 
   auto tick0 = SDL_GetTicks();
   auto frames = 0;
+  auto stats0 = jit->GetStatistics();
 
   for (;;) {
     jit->Run(279620/3);
+
     render_frame();
     frames++;
 
@@ -245,9 +275,19 @@ int main(int argc, char** argv) {
     auto diff = tick1 - tick0;
 
     if (diff >= 1000) {
+      auto stats1 = jit->GetStatistics();
+      auto compiled_blocks = stats1.compiled_blocks - stats0.compiled_blocks;
+
       fmt::print("{} fps\n", frames * 1000.0/diff);
+
+      // Allocations are only counted if the library was built with LUNATIC_COUNT_ALLOCATIONS.
+      if (compiled_blocks != 0) {
+        fmt::print("{} blocks compiled, {:.2f} allocations per block\n",
+          compiled_blocks, (double)(stats1.compile_allocations - stats0.compile_allocations) / compiled_blocks);
+      }
       tick0 = SDL_GetTicks();
       frames = 0;
+      stats0 = stats1;
     }
 
     SDL_UpdateTexture(texture, nullptr, frame, sizeof(u16) * 256);
@@ -288,6 +328,14 @@ int main(int argc, char** argv) {
   }
 
 done:
+  jit->SaveCodeCache(kCodeCachePath);
+  SaveProfile(kProfilePath, jit->GetProfile());
+
+  for (auto const& pass : jit->GetStatistics().passes) {
+    fmt::print("{}{}: {} -> {} opcodes, {:.2f} ms\n", pass.name, pass.baseline ? " (baseline)" : "",
+      pass.opcodes_in, pass.opcodes_out, pass.time_ns / 1e6);
+  }
+
   SDL_DestroyTexture(texture);
   SDL_DestroyRenderer(renderer);
   SDL_DestroyWindow(window);
@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2022 fleroviux. All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Test of CPU::Precompile(): all code that a program runs must be found from its entry point,
+ * so that no block is compiled while the program runs. The program calls a function in a loop,
+ * so its blocks are only found by following branches, the return address of BL and the fall-through of BNE.
+ */
+
+#include <lunatic/cpu.hpp>
+#include <cstring>
+#include <fmt/format.h>
+#include <vector>
+
+using namespace lunatic;
+
+static constexpr u32 kCodeBase = 0x02000000;
+static constexpr u32 kRAMSize = 0x10000;
+
+/// RAM which is mapped by the page table, so that worker threads can read the code as well.
+struct TestMemory final : Memory {
+  TestMemory() : ram(kRAMSize) {
+    pagetable = std::make_unique<std::array<u8*, 1048576>>();
+
+    for (u32 offset = 0; offset < kRAMSize; offset += 4096) {
+      (*pagetable)[(kCodeBase + offset) >> kPageShift] = &ram[offset];
+    }
+  }
+
+  auto ReadByte(u32 address, Bus bus) -> u8 override {
+    return ram[address & (kRAMSize - 1)];
+  }
+
+  auto ReadHalf(u32 address, Bus bus) -> u16 override {
+    u16 value;
+    std::memcpy(&value, &ram[address & (kRAMSize - 2)], sizeof(u16));
+    return value;
+  }
+
+  auto ReadWord(u32 address, Bus bus) -> u32 override {
+    u32 value;
+    std::memcpy(&value, &ram[address & (kRAMSize - 4)], sizeof(u32));
+    return value;
+  }
+
+  void WriteByte(u32 address, u8 value, Bus bus) override {
+    ram[address & (kRAMSize - 1)] = value;
+  }
+
+  void WriteHalf(u32 address, u16 value, Bus bus) override {
+    std::memcpy(&ram[address & (kRAMSize - 2)], &value, sizeof(u16));
+  }
+
+  void WriteWord(u32 address, u32 value, Bus bus) override {
+    std::memcpy(&ram[address & (kRAMSize - 4)], &value, sizeof(u32));
+  }
+
+  std::vector<u8> ram;
+};
+
+static const u32 kProgram[] {
+  0xE3A00000, // mov r0, #0
+  0xE3A0100A, // mov r1, #10
+  0xEB000002, // loop: bl add
+  0xE2511001, // subs r1, r1, #1
+  0x1AFFFFFC, // bne loop
+  0xEAFFFFFE, // b .
+  0xE0800001, // add: add r0, r0, r1
+  0xE12FFF1E  // bx lr
+};
+
+static constexpr u32 kProgramEnd = kCodeBase + 5 * sizeof(u32);
+
+/// Precompile the program with a number of threads, run it and check that no other block was compiled.
+static bool Test(int threads) {
+  auto memory = TestMemory{};
+  auto descriptor = CPU::Descriptor{memory};
+
+  std::memcpy(memory.ram.data(), kProgram, sizeof(kProgram));
+
+  auto cpu = CreateCPU(descriptor);
+  auto cpsr = StatusRegister{};
+
+  cpsr.f.mode = Mode::System;
+  cpu->SetCPSR(cpsr);
+  cpu->SetGPR(GPR::PC, kCodeBase);
+
+  auto precompiled_blocks = cpu->Precompile({kCodeBase}, {{kCodeBase, kCodeBase + sizeof(kProgram) - 1}}, threads);
+  auto statistics = cpu->GetStatistics();
+
+  if (precompiled_blocks == 0 || statistics.precompiled_blocks != u64(precompiled_blocks)) {
+    fmt::print("{} threads: Precompile() returned {}, but {} blocks were precompiled\n",
+      threads, precompiled_blocks, statistics.precompiled_blocks);
+    return false;
+  }
+
+  for (int i = 0; i < 1000 && cpu->GetGPR(GPR::PC) != kProgramEnd + sizeof(u32) * 2; i++) {
+    cpu->Run(64);
+  }
+
+  statistics = cpu->GetStatistics();
+
+  if (cpu->GetGPR(GPR::R0) != 55) {
+    fmt::print("{} threads: r0 is {}, expected 55\n", threads, cpu->GetGPR(GPR::R0));
+    return false;
+  }
+
+  // Precompiled blocks count as compiled blocks, any other compiled block was missed by Precompile().
+  if (statistics.compiled_blocks != statistics.precompiled_blocks) {
+    fmt::print("{} threads: {} blocks were compiled while the program ran\n",
+      threads, statistics.compiled_blocks - statistics.precompiled_blocks);
+    return false;
+  }
+
+  return true;
+}
+
+int main() {
+  int failures = 0;
+
+  for (int threads : {1, 2}) {
+    if (!Test(threads)) {
+      failures++;
+    }
+  }
+
+  if (failures != 0) {
+    fmt::print("{} failures\n", failures);
+    return 1;
+  }
+
+  fmt::print("all blocks were precompiled\n");
+  return 0;
+}
@@ -0,0 +1,244 @@
+/*
+ * Copyright (C) 2022 fleroviux. All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Test of block profiles: a profile must survive SaveProfile() and LoadProfile() unchanged, including the Thumb bit
+ * of its addresses, and malformed lines must be skipped. A profile recorded by one CPU must let another CPU
+ * precompile all code that the same program runs.
+ */
+
+#include <lunatic/cpu.hpp>
+#include <cstdio>
+#include <cstring>
+#include <fmt/format.h>
+#include <fstream>
+#include <vector>
+
+using namespace lunatic;
+
+static constexpr u32 kCodeBase = 0x02000000;
+static constexpr u32 kRAMSize = 0x10000;
+
+static constexpr char const* kPath = "profile_test.txt";
+
+/// RAM which is mapped by the page table.
+struct TestMemory final : Memory {
+  TestMemory() : ram(kRAMSize) {
+    pagetable = std::make_unique<std::array<u8*, 1048576>>();
+
+    for (u32 offset = 0; offset < kRAMSize; offset += 4096) {
+      (*pagetable)[(kCodeBase + offset) >> kPageShift] = &ram[offset];
+    }
+  }
+
+  auto ReadByte(u32 address, Bus bus) -> u8 override {
+    return ram[address & (kRAMSize - 1)];
+  }
+
+  auto ReadHalf(u32 address, Bus bus) -> u16 override {
+    u16 value;
+    std::memcpy(&value, &ram[address & (kRAMSize - 2)], sizeof(u16));
+    return value;
+  }
+
+  auto ReadWord(u32 address, Bus bus) -> u32 override {
+    u32 value;
+    std::memcpy(&value, &ram[address & (kRAMSize - 4)], sizeof(u32));
+    return value;
+  }
+
+  void WriteByte(u32 address, u8 value, Bus bus) override {
+    ram[address & (kRAMSize - 1)] = value;
+  }
+
+  void WriteHalf(u32 address, u16 value, Bus bus) override {
+    std::memcpy(&ram[address & (kRAMSize - 2)], &value, sizeof(u16));
+  }
+
+  void WriteWord(u32 address, u32 value, Bus bus) override {
+    std::memcpy(&ram[address & (kRAMSize - 4)], &value, sizeof(u32));
+  }
+
+  std::vector<u8> ram;
+};
+
+/// ARM code which switches to a Thumb loop.
+static const u32 kARMCode[] {
+  0xE3A00000, // mov r0, #0
+  0xE28F1005, // add r1, pc, #5
+  0xE12FFF11, // bx r1
+  0xEAFFFFFE  // b .
+};
+
+static constexpr u32 kThumbBase = kCodeBase + sizeof(kARMCode);
+
+static const u16 kThumbCode[] {
+  0x2203, // movs r2, #3
+  0x3002, // loop: adds r0, #2
+  0x3A01, // subs r2, #1
+  0xD1FC, // bne loop
+  0xE7FE  // b .
+};
+
+static constexpr u32 kThumbEnd = kThumbBase + 4 * sizeof(u16);
+
+static bool Check(bool condition, char const* message) {
+  if (!condition) {
+    fmt::print("{}\n", message);
+  }
+  return condition;
+}
+
+static bool Equal(std::vector<CPU::ProfileEntry> const& a, std::vector<CPU::ProfileEntry> const& b) {
+  if (a.size() != b.size()) {
+    return false;
+  }
+
+  for (size_t i = 0; i < a.size(); i++) {
+    if (a[i].address != b[i].address || a[i].mode != b[i].mode || a[i].count != b[i].count) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static bool TestRoundTrip() {
+  auto profile = std::vector<CPU::ProfileEntry>{
+    {0x08000000, Mode::System, 1000000000000},
+    {0x02000101, Mode::IRQ, 77},
+    {0xFFFF0000, Mode::Supervisor, 1},
+    {0x02000002, Mode::User, 0}
+  };
+
+  if (!Check(SaveProfile(kPath, profile), "round trip: the profile cannot be saved")) {
+    return false;
+  }
+
+  return Check(Equal(LoadProfile(kPath), profile), "round trip: the profile changed");
+}
+
+static bool TestMalformedLines() {
+  auto file = std::ofstream{kPath, std::ios::trunc};
+
+  file << "02000000 1F 10\n";
+  file << "garbage\n";
+  file << "02000004 1F\n";
+  file << "02000008 05 10\n";
+  file << "0200000C 1F 10 trailing\n";
+  file << "02000010 1F -\n";
+  file << "\n";
+  file << "02000015 12 3\n";
+  file.close();
+
+  auto expected = std::vector<CPU::ProfileEntry>{
+    {0x02000000, Mode::System, 10},
+    {0x02000015, Mode::IRQ, 3}
+  };
+
+  if (!Check(Equal(LoadProfile(kPath), expected), "malformed lines: the valid lines were not loaded")) {
+    return false;
+  }
+
+  std::remove(kPath);
+
+  return Check(LoadProfile(kPath).empty(), "malformed lines: a missing file did not load an empty profile");
+}
+
+/// Run the program until it reaches the 'b .' at the end of its Thumb code. Returns false if it does not get there.
+static bool RunProgram(CPU& cpu) {
+  auto cpsr = StatusRegister{};
+
+  cpsr.f.mode = Mode::System;
+  cpu.SetCPSR(cpsr);
+  cpu.SetGPR(GPR::PC, kCodeBase);
+
+  for (int i = 0; i < 1000; i++) {
+    if (cpu.GetCPSR().f.thumb && cpu.GetGPR(GPR::PC) == kThumbEnd + sizeof(u16) * 2) {
+      return cpu.GetGPR(GPR::R0) == 6;
+    }
+    cpu.Run(64);
+  }
+
+  return false;
+}
+
+static bool TestPrecompileProfile() {
+  auto memory = TestMemory{};
+  auto descriptor = CPU::Descriptor{memory};
+
+  std::memcpy(&memory.ram[0], kARMCode, sizeof(kARMCode));
+  std::memcpy(&memory.ram[kThumbBase - kCodeBase], kThumbCode, sizeof(kThumbCode));
+  descriptor.profile_blocks = true;
+
+  auto cpu = CreateCPU(descriptor);
+
+  if (!Check(RunProgram(*cpu), "precompile: the program did not finish")) {
+    return false;
+  }
+
+  auto profile = cpu->GetProfile();
+  bool has_arm_block = false;
+  bool has_thumb_block = false;
+
+  for (auto const& entry : profile) {
+    has_arm_block |= entry.address == kCodeBase;
+    has_thumb_block |= entry.address == (kThumbBase | 1);
+  }
+
+  if (!Check(has_arm_block && has_thumb_block, "precompile: the profile misses a block or the Thumb bit")) {
+    return false;
+  }
+
+  if (!Check(SaveProfile(kPath, profile), "precompile: the profile cannot be saved")) {
+    return false;
+  }
+
+  auto loaded_profile = LoadProfile(kPath);
+
+  if (!Check(Equal(loaded_profile, profile), "precompile: the profile changed")) {
+    return false;
+  }
+
+  descriptor.profile_blocks = false;
+  cpu = CreateCPU(descriptor);
+
+  auto precompiled_blocks = cpu->PrecompileProfile(loaded_profile);
+
+  if (!Check(precompiled_blocks == int(profile.size()), "precompile: not all blocks of the profile were compiled")) {
+    return false;
+  }
+
+  if (!Check(RunProgram(*cpu), "precompile: the precompiled program did not finish")) {
+    return false;
+  }
+
+  auto statistics = cpu->GetStatistics();
+
+  return Check(statistics.compiled_blocks == statistics.precompiled_blocks,
+    "precompile: blocks were compiled while running");
+}
+
+int main() {
+  int failures = 0;
+
+  for (auto test : {TestRoundTrip, TestMalformedLines, TestPrecompileProfile}) {
+    if (!test()) {
+      failures++;
+    }
+  }
+
+  std::remove(kPath);
+
+  if (failures != 0) {
+    fmt::print("{} failures\n", failures);
+    return 1;
+  }
+
+  fmt::print("all profile tests passed\n");
+  return 0;
+}